@@ -1,5 +1,6 @@
 ; boot.asm - OSのエントリーポイント
 global start
+global stack_top  ; BSPのスタックの上端（TSSのESP0に使う）
 extern kernel_main  ; C言語のカーネル関数
 
 ; startラベルを.textセクションの最初に配置
@@ -9,6 +10,10 @@ start:
     ; スタックポインタを設定
     mov esp, stack_top
 
+    ; マルチブート情報を引数として渡す（右の引数から順にpush）
+    push ebx ; マルチブート情報構造体のアドレス
+    push eax ; マジックナンバー
+
     ; カーネル関数を呼び出す
     call kernel_main
 
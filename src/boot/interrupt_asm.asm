@@ -1,64 +1,127 @@
 ; interrupt_asm.asm - 割り込みハンドラのアセンブリ部分
-global isr0, isr1, isr2, isr3, isr4, isr5, isr6, isr7
-global irq0, irq1
+; 256個すべてのベクタに入口を用意し、共通スタブでregisters_tを作ってCに渡す
+global interrupt_stub_table
 
-extern fault_handler
-extern irq_handler
+extern interrupt_dispatch
 
 ; 例外ハンドラのマクロ（エラーコードなし）
 %macro ISR_NOERRCODE 1
 isr%1:
-    cli
     push 0          ; ダミーのエラーコード
     push %1         ; 割り込み番号
-    jmp isr_common_stub
+    jmp interrupt_common_stub
+%endmacro
+
+; 例外ハンドラのマクロ（CPUがエラーコードを積む）
+%macro ISR_ERRCODE 1
+isr%1:
+    push %1         ; 割り込み番号
+    jmp interrupt_common_stub
 %endmacro
 
 ; IRQハンドラのマクロ
 %macro IRQ 2
 irq%1:
-    cli
     push 0          ; ダミーのエラーコード
     push %2         ; 割り込み番号
-    jmp irq_common_stub
+    jmp interrupt_common_stub
 %endmacro
 
-; 例外ハンドラ
-ISR_NOERRCODE 0
-ISR_NOERRCODE 1
-ISR_NOERRCODE 2
-ISR_NOERRCODE 3
-ISR_NOERRCODE 4
-ISR_NOERRCODE 5
-ISR_NOERRCODE 6
-ISR_NOERRCODE 7
+section .text
 
-; IRQハンドラ
-IRQ 0, 32
-IRQ 1, 33
+; 例外ハンドラ（0-31）
+ISR_NOERRCODE 0     ; #DE 除算エラー
+ISR_NOERRCODE 1     ; #DB デバッグ
+ISR_NOERRCODE 2     ; NMI
+ISR_NOERRCODE 3     ; #BP ブレークポイント
+ISR_NOERRCODE 4     ; #OF オーバーフロー
+ISR_NOERRCODE 5     ; #BR BOUND範囲外
+ISR_NOERRCODE 6     ; #UD 無効なオペコード
+ISR_NOERRCODE 7     ; #NM デバイス使用不可
+ISR_ERRCODE   8     ; #DF ダブルフォルト
+ISR_NOERRCODE 9     ; コプロセッサセグメントオーバーラン
+ISR_ERRCODE   10    ; #TS 無効なTSS
+ISR_ERRCODE   11    ; #NP セグメント不在
+ISR_ERRCODE   12    ; #SS スタックセグメントフォルト
+ISR_ERRCODE   13    ; #GP 一般保護例外
+ISR_ERRCODE   14    ; #PF ページフォルト
+ISR_NOERRCODE 15    ; 予約
+ISR_NOERRCODE 16    ; #MF x87浮動小数点例外
+ISR_ERRCODE   17    ; #AC アラインメントチェック
+ISR_NOERRCODE 18    ; #MC マシンチェック
+ISR_NOERRCODE 19    ; #XM SIMD浮動小数点例外
+ISR_NOERRCODE 20    ; #VE 仮想化例外
+ISR_ERRCODE   21    ; #CP 制御保護例外
+ISR_NOERRCODE 22    ; 予約
+ISR_NOERRCODE 23    ; 予約
+ISR_NOERRCODE 24    ; 予約
+ISR_NOERRCODE 25    ; 予約
+ISR_NOERRCODE 26    ; 予約
+ISR_NOERRCODE 27    ; 予約
+ISR_NOERRCODE 28    ; #HV ハイパーバイザインジェクション
+ISR_ERRCODE   29    ; #VC VMMコミュニケーション
+ISR_ERRCODE   30    ; #SX セキュリティ例外
+ISR_NOERRCODE 31    ; 予約
+
+; IRQハンドラ（PICでベクタ32-47に再マップ）
+IRQ 0, 32           ; タイマー
+IRQ 1, 33           ; キーボード
+IRQ 2, 34           ; スレーブPICへのカスケード
+IRQ 3, 35           ; COM2
+IRQ 4, 36           ; COM1
+IRQ 5, 37
+IRQ 6, 38           ; フロッピー
+IRQ 7, 39           ; LPT1（スプリアス）
+IRQ 8, 40           ; RTC
+IRQ 9, 41
+IRQ 10, 42
+IRQ 11, 43
+IRQ 12, 44          ; PS/2マウス
+IRQ 13, 45          ; FPU
+IRQ 14, 46          ; プライマリATA
+IRQ 15, 47          ; セカンダリATA（スプリアス）
+
+; その他のベクタ（48-255、APICやソフトウェア割り込み用）
+%assign i 48
+%rep 256 - 48
+isr%+i:
+    push 0          ; ダミーのエラーコード
+    push i          ; 割り込み番号
+    jmp interrupt_common_stub
+%assign i i + 1
+%endrep
 
-; 共通の例外ハンドラスタブ
-isr_common_stub:
+; 共通の割り込みハンドラスタブ
+; スタック: [pushaのレジスタ][割り込み番号][エラーコード][EIP][CS][EFLAGS] = registers_t
+interrupt_common_stub:
     pusha           ; すべてのレジスタを保存
-    
+    cld             ; Cの関数は方向フラグが0であることを前提にする
+
     ; Cの関数を呼び出し
-    push esp        ; スタックポインタを引数として渡す
-    call fault_handler
+    push esp        ; registers_tへのポインタを引数として渡す
+    call interrupt_dispatch
     add esp, 4      ; スタックを元に戻す
-    
+
     popa            ; すべてのレジスタを復元
-    add esp, 8      ; エラーコードと割り込み番号をスタックから削除
+    add esp, 8      ; 割り込み番号とエラーコードをスタックから削除
     iret            ; 割り込みから復帰
 
-; 共通のIRQハンドラスタブ
-irq_common_stub:
-    pusha           ; すべてのレジスタを保存
-    
-    ; Cの関数を呼び出し
-    push esp        ; スタックポインタを引数として渡す
-    call irq_handler
-    add esp, 4      ; スタックを元に戻す
-    
-    popa            ; すべてのレジスタを復元
-    add esp, 8      ; エラーコードと割り込み番号をスタックから削除
-    iret            ; 割り込みから復帰
\ No newline at end of file
+section .data
+
+; ベクタ番号から入口のアドレスを引く表（interrupt.cがIDTを埋めるのに使う）
+interrupt_stub_table:
+%assign i 0
+%rep 32
+    dd isr%+i
+%assign i i + 1
+%endrep
+%assign i 0
+%rep 16
+    dd irq%+i
+%assign i i + 1
+%endrep
+%assign i 48
+%rep 256 - 48
+    dd isr%+i
+%assign i i + 1
+%endrep
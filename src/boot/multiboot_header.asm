@@ -8,6 +8,15 @@ header_start:
     dd header_end - header_start ; ヘッダー長
     dd -(0xe85250d6 + 0 + (header_end - header_start))  ; チェックサム
 
+    ; フレームバッファタグ（任意: 設定できなければテキストモードのまま起動する）
+    align 8
+    dw 5    ; タイプ（フレームバッファ）
+    dw 1    ; フラグ（任意）
+    dd 20   ; サイズ
+    dd 1024 ; 幅
+    dd 768  ; 高さ
+    dd 32   ; 1ピクセルのビット数
+
     ; 終了タグ（必須）
     align 8
     dw 0    ; タイプ（終了）
@@ -0,0 +1,77 @@
+; smp_trampoline.asm - APの起動コード
+; BSPがSMP_TRAMPOLINE_ADDR（smp.h）にコピーし、SIPIでAPをリアルモードのままここから始めさせる。
+; 一時的なGDTでプロテクトモードに入り、BSPと同じCR3/CR4/CR0でページングを有効にして、
+; パラメータのスタックでCの入口（smp.cのsmp_ap_entry）を呼ぶ。
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+; コピー先のアドレス（smp.hのSMP_TRAMPOLINE_ADDRと同じ）
+%define TRAMPOLINE_ADDR 0x8000
+; このファイル内のラベルのコピー先でのアドレス
+%define REL(label) (TRAMPOLINE_ADDR + ((label) - smp_trampoline_start))
+
+section .text
+
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; 一時的なGDTを読み込んでプロテクトモードに入る
+    lgdt [REL(trampoline_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:REL(trampoline_32)
+
+bits 32
+trampoline_32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov fs, ax
+    mov gs, ax
+
+    ; BSPと同じページテーブルでページングを有効化（CR4のPSE/PGEを先に立てる）
+    mov eax, [REL(param_cr4)]
+    mov cr4, eax
+    mov eax, [REL(param_cr3)]
+    mov cr3, eax
+    mov eax, [REL(param_cr0)]
+    mov cr0, eax
+
+    ; パラメータのスタックに切り替えて、CPUの番号を引数にCの入口を呼ぶ
+    mov esp, [REL(param_stack)]
+    push dword [REL(param_cpu)]
+    mov eax, [REL(param_entry)]
+    call eax
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; 一時的なGDT（フラットなコードとデータ）
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF ; 0x08: コード
+    dq 0x00CF92000000FFFF ; 0x10: データ
+trampoline_gdt_ptr:
+    dw trampoline_gdt_ptr - trampoline_gdt - 1
+    dd REL(trampoline_gdt)
+
+; BSPが書き込むパラメータ（smp.cのsmp_trampoline_params_tと同じ並び）
+align 4
+smp_trampoline_params:
+param_cr0:   dd 0
+param_cr3:   dd 0
+param_cr4:   dd 0
+param_stack: dd 0 ; スタックの上端
+param_entry: dd 0 ; Cの入口
+param_cpu:   dd 0 ; CPUの番号
+smp_trampoline_end:
@@ -0,0 +1,25 @@
+; thread_asm.asm - スレッドのコンテキストスイッチ
+; 呼び出し規約でcallee-savedのレジスタ（EBX, ESI, EDI, EBP）だけを積み、スタックを入れ替える。
+; それ以外のレジスタは呼び出し側が保存済みで、EFLAGSは割り込み禁止で呼ばれる前提で保存しない。
+global thread_switch_context
+
+section .text
+bits 32
+
+; void thread_switch_context(uint32_t* prev_esp, uint32_t next_esp)
+thread_switch_context:
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov eax, [esp + 20] ; prev_esp
+    mov ecx, [esp + 24] ; next_esp
+    mov [eax], esp      ; 今のスタックを保存
+    mov esp, ecx        ; 次のスレッドのスタックに切り替え
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret                 ; 次のスレッドがthread_switch_contextを呼んだ場所（新しいスレッドはthread_entry）へ
@@ -1,88 +1,83 @@
 #include "../include/debug.h"
+#include "../include/kprintf.h"
+#include "../include/ring.h"
 #include "../include/screen.h"
+#include "../include/serial.h"
 #include "../include/string.h"
 
 // デバッグ行の最大数
 #define DEBUG_LINES 3
-// デバッグ表示開始行
-#define DEBUG_START_LINE (25 - DEBUG_LINES)
+// dmesgで一度に取り出すバイト数
+#define DEBUG_DUMP_CHUNK 128
+
+// ログの記録（どのCPUや割り込みハンドラからも書くのでMPSC、読むのはdmesgだけ）
+static uint8_t log_buffer[DEBUG_LOG_SIZE];
+static ring_t log_ring = { .buffer = log_buffer, .mask = DEBUG_LOG_SIZE - 1 };
+// リングが一杯で捨てたメッセージの数
+static volatile uint32_t log_dropped = 0;
+
+// メッセージをログのリングに記録（1行に入りきらなければ切り詰め、リングに入りきらなければ捨てる）
+static void debug_record(const char* message) {
+    // 改行まで1回で積み、他の生産者の行と混ざらないようにする
+    char line[DEBUG_DUMP_CHUNK];
+    size_t length = strlen(message);
+    if (length > sizeof(line) - 1) {
+        length = sizeof(line) - 1;
+    }
+    memcpy(line, message, length);
+    line[length] = '\n';
+
+    // 空きが足りなければ途中まで積まずに丸ごと捨てる
+    if (ring_mpsc_push_all(&log_ring, line, length + 1) != 0) {
+        __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+    }
+}
 
 // デバッグメッセージを表示
 void debug_log(const char* message) {
-    // 現在のカーソル位置を保存
-    int save_x, save_y;
-    screen_get_cursor(&save_x, &save_y);
-    
-    // デバッグ領域（画面下部）に移動
-    screen_set_cursor(0, DEBUG_START_LINE);
-    
-    // 既存のデバッグメッセージを上にスクロール
-    for (int i = DEBUG_START_LINE; i < DEBUG_START_LINE + DEBUG_LINES - 1; i++) {
-        for (int j = 0; j < 80; j++) {
-            uint16_t* vga_buffer = (uint16_t*)0xB8000;
-            vga_buffer[i * 80 + j] = vga_buffer[(i + 1) * 80 + j];
-        }
-    }
-    
-    // デバッグメッセージを表示
-    screen_set_cursor(0, DEBUG_START_LINE + DEBUG_LINES - 1);
-    screen_write(message, vga_entry_color(VGA_COLOR_BROWN, VGA_COLOR_BLACK));
-    
-    // カーソル位置を元に戻す
-    screen_set_cursor(save_x, save_y);
+    debug_record(message);
+
+    // デバッグ領域（画面下部）を1行上にずらし、最後の行に表示（カーソルは動かさない）
+    int height;
+    screen_get_size(NULL, &height);
+    screen_scroll_rows(height - DEBUG_LINES, DEBUG_LINES);
+    screen_write_at(0, height - 1, message, vga_entry_color(VGA_COLOR_BROWN, VGA_COLOR_BLACK));
 }
 
 // 数値付きデバッグメッセージを表示
 void debug_log_int(const char* message, int value) {
-    // 簡易的な数値変換
-    char buffer[16];
-    int i = 0;
-    int is_negative = 0;
-    
-    // 負の数処理
-    if (value < 0) {
-        is_negative = 1;
-        value = -value;
-    }
-    
-    // 数値を文字に変換
-    do {
-        buffer[i++] = '0' + (value % 10);
-        value /= 10;
-    } while (value > 0);
-    
-    if (is_negative) {
-        buffer[i++] = '-';
+    char full_message[DEBUG_DUMP_CHUNK];
+    ksnprintf(full_message, sizeof(full_message), "%s: %d", message, value);
+    debug_log(full_message);
+}
+
+// 書式化済みの出力をそのままログのリングに積む（kprintfの出力先、入りきらなければ捨てる）
+void debug_log_write(const char* data, size_t length) {
+    if (length == 0) {
+        return;
     }
-    buffer[i] = '\0';
-    
-    // 文字列を反転
-    for (int j = 0; j < i / 2; j++) {
-        char temp = buffer[j];
-        buffer[j] = buffer[i - j - 1];
-        buffer[i - j - 1] = temp;
+    if (ring_mpsc_push_all(&log_ring, data, length) != 0) {
+        __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
     }
-    
-    // メッセージと数値を表示
-    char full_message[80]; // 十分な長さを確保
-    int pos = 0;
-    
-    // メッセージをコピー
-    while (*message) {
-        full_message[pos++] = *message++;
+}
+
+// ログのリングを取り出して表示（to_serialなら画面ではなくCOM1に送る）
+void debug_dump(int to_serial) {
+    // まとめて取り出し、1回の書き込みで表示する
+    char chunk[DEBUG_DUMP_CHUNK];
+    uint32_t count;
+    while ((count = ring_pop_n(&log_ring, chunk, DEBUG_DUMP_CHUNK)) > 0) {
+        if (to_serial) {
+            serial_write_n(SERIAL_COM1, chunk, count);
+        } else {
+            screen_write_n(chunk, count, vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+        }
     }
-    
-    // 区切り
-    full_message[pos++] = ':';
-    full_message[pos++] = ' ';
-    
-    // 数値を追加
-    for (int j = 0; buffer[j]; j++) {
-        full_message[pos++] = buffer[j];
+
+    // ログ自身には書かない（取り出している最中のリングに積まない）
+    uint32_t dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        kprintf_to(to_serial ? KPRINTF_SERIAL : KPRINTF_SCREEN, "%C(dropped %u messages)\n",
+                   vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK), dropped);
     }
-    
-    full_message[pos] = '\0';
-    
-    // デバッグ表示
-    debug_log(full_message);
-}
\ No newline at end of file
+}
@@ -0,0 +1,227 @@
+// fbcon.c - リニアフレームバッファのコンソール
+// 文字と色属性の組ごとにフレームバッファのピクセル値へ展開したグリフをキャッシュしておき、描くときは
+// 1行（32ビット色なら32バイト、24ビットなら24、16ビットなら16）を書き込むだけにする。
+// 32ビット色ではSSEが使えれば16バイトずつ、それ以外は4バイトずつ書く。
+// フレームバッファはPATで書き込み結合にマップし、書くだけで読まない（スクロールは影から描き直す）。
+#include "../include/fbcon.h"
+#include "../include/cpu.h"
+#include "../include/font.h"
+#include "../include/fpu.h"
+#include "../include/paging.h"
+#include "../include/stddef.h"
+#include "../include/string.h"
+
+// キャッシュのエントリが有効な印（キーは文字と色属性の16ビット）
+#define GLYPH_VALID 0x10000
+// 1ピクセルの最大のバイト数（32ビット色）
+#define FB_MAX_BYTES_PER_PIXEL 4
+// 下線のカーソルの太さ（ドット）
+#define CURSOR_HEIGHT 2
+
+// 色を展開したグリフ（1行は先頭からfb_bytes * FONT_WIDTHバイト、16バイト境界に置きSSEでそのまま読む）
+typedef struct {
+    uint8_t pixels[FONT_HEIGHT][FONT_WIDTH * FB_MAX_BYTES_PER_PIXEL];
+    uint32_t key;
+} __attribute__((aligned(16))) glyph_t;
+
+// フレームバッファの先頭と1行のバイト数
+static uint8_t* fb_base = NULL;
+static uint32_t fb_pitch = 0;
+// 1ピクセルのバイト数（2、3、4）
+static uint32_t fb_bytes = 0;
+// 文字の桁数と行数
+static int columns = 0;
+static int rows = 0;
+// ライトコンバイニングでマップしたか
+static int write_combining = 0;
+// VGAの16色をこのフレームバッファのピクセル値にしたもの
+static uint32_t palette[16];
+// 描いたグリフのキャッシュ（直接マップ）
+static glyph_t glyph_cache[GLYPH_CACHE_SIZE];
+// キャッシュの統計
+static uint32_t cache_hits = 0;
+static uint32_t cache_misses = 0;
+
+// VGAの16色（RGB）
+static const uint32_t vga_rgb[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+// 8ビットの色成分をフレームバッファの位置と幅に合わせる
+static uint32_t color_field(uint32_t value, uint8_t position, uint8_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    if (size < 8) {
+        value >>= 8 - size;
+    }
+    return value << position;
+}
+
+// ピクセル値をfb_bytesバイトで書く（リトルエンディアン）
+static inline void write_pixel(volatile uint8_t* dest, uint32_t value) {
+    if (fb_bytes == 4) {
+        *(volatile uint32_t*)dest = value;
+    } else if (fb_bytes == 2) {
+        *(volatile uint16_t*)dest = value;
+    } else {
+        dest[0] = value;
+        dest[1] = value >> 8;
+        dest[2] = value >> 16;
+    }
+}
+
+// 文字と色属性のグリフを取り出す（キャッシュになければ描き起こす）
+static const glyph_t* glyph_lookup(uint16_t cell) {
+    uint8_t ch = cell & 0xFF;
+    uint8_t attr = cell >> 8;
+    glyph_t* glyph = &glyph_cache[(ch ^ (attr * 37)) & (GLYPH_CACHE_SIZE - 1)];
+    if (glyph->key == (GLYPH_VALID | cell)) {
+        cache_hits++;
+        return glyph;
+    }
+    cache_misses++;
+
+    // 収録していない文字は'?'で描く
+    const uint8_t* bits = font_8x16[ch < FONT_GLYPHS ? ch : '?'];
+    uint32_t fg = palette[attr & 0x0F];
+    uint32_t bg = palette[(attr >> 4) & 0x0F];
+    for (int y = 0; y < FONT_HEIGHT; y++) {
+        for (int x = 0; x < FONT_WIDTH; x++) {
+            write_pixel(&glyph->pixels[y][x * fb_bytes], (bits[y] & (0x80 >> x)) ? fg : bg);
+        }
+    }
+    glyph->key = GLYPH_VALID | cell;
+    return glyph;
+}
+
+// グリフを1つ書き込む（simdなら32ビット色の1行をXMMレジスタで2回の16バイト書き込みにする）
+static void glyph_blit(uint8_t* dest, const glyph_t* glyph, int simd) {
+    if (simd) {
+        // XMMレジスタはkernel_fpu_begin/endの区間でだけ使う（クロバーには書かない、string.cと同じ）
+        for (int y = 0; y < FONT_HEIGHT; y++) {
+            asm volatile("movdqa (%1), %%xmm0\n\t"
+                         "movdqa 16(%1), %%xmm1\n\t"
+                         "movdqu %%xmm0, (%0)\n\t"
+                         "movdqu %%xmm1, 16(%0)"
+                         :
+                         : "r" (dest), "r" (glyph->pixels[y])
+                         : "memory");
+            dest += fb_pitch;
+        }
+    } else {
+        uint32_t words = FONT_WIDTH * fb_bytes / 4;
+        for (int y = 0; y < FONT_HEIGHT; y++) {
+            volatile uint32_t* row = (volatile uint32_t*)dest;
+            const uint32_t* pixels = (const uint32_t*)glyph->pixels[y];
+            for (uint32_t i = 0; i < words; i++) {
+                row[i] = pixels[i];
+            }
+            dest += fb_pitch;
+        }
+    }
+}
+
+// セル(x, y)のフレームバッファ上の位置
+static inline uint8_t* cell_address(int x, int y) {
+    return fb_base + y * FONT_HEIGHT * fb_pitch + x * FONT_WIDTH * fb_bytes;
+}
+
+// フレームバッファを使えるようにする
+int fbcon_init(const multiboot_tag_framebuffer_t* info) {
+    // 15ビット色は16ビットに1ピクセルずつ置かれる
+    if (info == NULL || (info->bpp != 15 && info->bpp != 16 && info->bpp != 24 && info->bpp != 32) ||
+        (info->addr >> 32) != 0) {
+        return -1;
+    }
+
+    // PATを使えればライトコンバイニング、使えなければキャッシュしない
+    write_combining = cpu_pat_enabled();
+    uint32_t flags = write_combining ? PAGE_WC : (PAGE_PCD | PAGE_PWT);
+    uint32_t size = info->pitch * info->height;
+    void* base = paging_map_identity((uint32_t)info->addr, size, flags);
+    if (base == NULL) {
+        return -1;
+    }
+
+    fb_base = (uint8_t*)base;
+    fb_pitch = info->pitch;
+    fb_bytes = (info->bpp + 7) / 8;
+    columns = info->width / FONT_WIDTH;
+    rows = info->height / FONT_HEIGHT;
+
+    for (int i = 0; i < 16; i++) {
+        uint32_t rgb = vga_rgb[i];
+        palette[i] = color_field((rgb >> 16) & 0xFF, info->red_position, info->red_size) |
+                     color_field((rgb >> 8) & 0xFF, info->green_position, info->green_size) |
+                     color_field(rgb & 0xFF, info->blue_position, info->blue_size);
+    }
+    memset(glyph_cache, 0, sizeof(glyph_cache));
+    return 0;
+}
+
+// 文字の桁数
+int fbcon_columns(void) {
+    return columns;
+}
+
+// 文字の行数
+int fbcon_rows(void) {
+    return rows;
+}
+
+// ライトコンバイニングでマップしたか
+int fbcon_write_combining(void) {
+    return write_combining;
+}
+
+// first行目からcount行を描く
+void fbcon_draw_rows(int first, int count, const uint16_t* cells, int width, int stride) {
+    if (width > columns) {
+        width = columns;
+    }
+
+    // SIMDの区間は描く行全体で1回だけ開く（1行が32バイトになる32ビット色のときだけ）
+    int simd = fb_bytes == FB_MAX_BYTES_PER_PIXEL ? kernel_fpu_begin() : 0;
+    for (int y = first; y < first + count && y < rows; y++) {
+        uint8_t* dest = cell_address(0, y);
+        for (int x = 0; x < width; x++) {
+            glyph_blit(dest, glyph_lookup(cells[x]), simd);
+            dest += FONT_WIDTH * fb_bytes;
+        }
+        cells += stride;
+    }
+    if (simd) {
+        kernel_fpu_end();
+    }
+}
+
+// 1セルを描く
+void fbcon_draw_cell(int x, int y, uint16_t cell, int cursor) {
+    if (x < 0 || x >= columns || y < 0 || y >= rows) {
+        return;
+    }
+    uint8_t* dest = cell_address(x, y);
+    glyph_blit(dest, glyph_lookup(cell), 0);
+
+    if (cursor) {
+        uint32_t fg = palette[(cell >> 8) & 0x0F];
+        for (int line = FONT_HEIGHT - CURSOR_HEIGHT; line < FONT_HEIGHT; line++) {
+            uint8_t* row = dest + line * fb_pitch;
+            for (int i = 0; i < FONT_WIDTH; i++) {
+                write_pixel(row + i * fb_bytes, fg);
+            }
+        }
+    }
+}
+
+// キャッシュに当たった回数
+uint32_t fbcon_cache_hits(void) {
+    return cache_hits;
+}
+
+// キャッシュで描き起こした回数
+uint32_t fbcon_cache_misses(void) {
+    return cache_misses;
+}
@@ -1,16 +1,22 @@
 // keyboard.c - キーボードドライバの実装
 #include "../include/keyboard.h"
+#include "../include/interrupt.h"
 #include "../include/io.h"
+#include "../include/ring.h"
 #include "../include/screen.h"
+#include "../include/softirq.h"
 #include "../include/stddef.h"
+#include "../include/thread.h"
+#include "../include/trace.h"
+#include "../include/wait.h"
 
 
 
-// キーバッファ（キー入力を保存する）
+// キーバッファ（書くのはIRQ1とシリアルコンソールの割り込みなのでMPSC、読むのはシェルのスレッド）
 static char key_buffer[KEYBOARD_BUFFER_SIZE];
-// バッファの先頭と末尾のインデックス
-static size_t buffer_write = 0;
-static size_t buffer_read = 0;
+static ring_t key_ring;
+// キーが届くのを待つスレッド
+static wait_queue_t keyboard_wait = WAIT_QUEUE_INIT;
 
 // US/UKキーボードのスキャンコードからASCIIへのマッピング
 static const char scancode_to_ascii[] = {
@@ -22,8 +28,16 @@ static const char scancode_to_ascii[] = {
 	0, 0, 0, '+', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+// 画面に表示する文字のバッファ（割り込みで積み、タスクレットでまとめて表示する）
+static char echo_buffer[KEYBOARD_BUFFER_SIZE];
+static ring_t echo_ring;
+// エコー表示のタスクレット
+static tasklet_t echo_tasklet;
+
 // シフトキーが押されているか
 static uint8_t shift_pressed = 0;
+// Shift+PgUp/PgDnで溜まったスクロールバックの移動量（半画面単位、正なら古い方へ、タスクレットで反映）
+static volatile int scrollback_pending = 0;
 
 // US/UKキーボードのシフト時のスキャンコードからASCIIへのマッピング
 static const char scancode_to_ascii_shift[] = {
@@ -35,29 +49,45 @@ static const char scancode_to_ascii_shift[] = {
 	0, 0, 0, '+', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
-// キーバッファに文字を追加
+// キーバッファに文字を追加して、待っているスレッドを起こす（一杯なら捨てる）
 static void buffer_put(char c) {
-	// バッファがいっぱいの場合は何もしない
-	    if ((buffer_write + 1) % KEYBOARD_BUFFER_SIZE == buffer_read) {
-		    return;
-	    }
-
-	    // 文字をバッファに追加
-	    key_buffer[buffer_write] = c;
-	    buffer_write = (buffer_write + 1) % KEYBOARD_BUFFER_SIZE;
+	if (ring_mpsc_push(&key_ring, (uint8_t)c) == 0) {
+		wake_up(&keyboard_wait);
+	}
 }
 
-// キーバッファから文字を取得
-static char buffer_get() {
-	// バッファがからの場合はゼロを返す
-	if (buffer_read == buffer_write) {
+// キーバッファから文字を取得（空なら0）
+static char buffer_get(void) {
+	uint8_t c;
+	if (ring_pop(&key_ring, &c) != 0) {
 		return 0;
 	}
+	return (char)c;
+}
 
-	// バッファから文字を取得
-	char c = key_buffer[buffer_read];
-	buffer_read = (buffer_read + 1) % KEYBOARD_BUFFER_SIZE;
-	return c;
+// 溜まった文字を画面に表示し、スクロールバックの移動を反映（タスクレット、割り込みは許可された状態で動く）
+static void keyboard_echo(void* data) {
+	(void)data;
+	char chunk[32];
+	uint32_t count;
+	while ((count = ring_pop_n(&echo_ring, chunk, sizeof(chunk))) != 0) {
+		screen_write_n(chunk, count, vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+	}
+
+	// 画面の書き換えは割り込みの外で行う
+	int pages = __atomic_exchange_n(&scrollback_pending, 0, __ATOMIC_RELAXED);
+	if (pages != 0) {
+		int height;
+		screen_get_size(NULL, &height);
+		screen_scrollback(pages * (height / 2));
+	}
+}
+
+// 表示する文字を積んでタスクレットを予約
+static void echo_put(char c) {
+	if (ring_mpsc_push(&echo_ring, (uint8_t)c) == 0) {
+		tasklet_schedule(&echo_tasklet);
+	}
 }
 
 // キーボード割り込みハンドラ
@@ -81,6 +111,11 @@ void keyboard_handler(void) {
             shift_pressed = 1;
             // return を削除してPIC EOI送信を確実に行う
         }
+        // Shift+PgUp/PgDnでスクロールバックを半画面ずつ見返す
+        else if (shift_pressed && (scancode == KEY_PAGEUP || scancode == KEY_PAGEDOWN)) {
+            __atomic_fetch_add(&scrollback_pending, (scancode == KEY_PAGEUP) ? 1 : -1, __ATOMIC_RELAXED);
+            tasklet_schedule(&echo_tasklet);
+        }
         else {
             // スキャンコードをASCIIに変換
             char ascii;
@@ -92,23 +127,41 @@ void keyboard_handler(void) {
                 ascii = 0; // 不明なスキャンコード
             }
 
-            // ASCIIが有効な場合、バッファに追加し画面に表示
+            // ASCIIが有効な場合、画面への表示を後半処理に回してからバッファに追加
+            // （文字を読んだ側が後半処理を実行すれば、その文字までは必ず表示される）
             if (ascii) {
-                buffer_put(ascii);
-                if (ascii != '\b') {
-                    screen_put_char(ascii, vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-                }
+                keyboard_input(ascii);
             }
         }
     }
     
-    // PIC EOI送信は削除（irq_handlerで処理される）
+    // PIC EOI送信は削除（interrupt.cのIRQ処理で送られる）
+}
+
+// IRQ1のハンドラ
+static void keyboard_irq(registers_t* regs, void* ctx) {
+	(void)regs;
+	(void)ctx;
+	keyboard_handler();
 }
 
 // キーボードを初期化
 void keyboard_init(void) {
-	// 特に必要な初期化はないが、関数を用意しておく
-	// 実際のOSでは、ここで割り込みハンドラを設定する
+	ring_init(&key_ring, key_buffer, KEYBOARD_BUFFER_SIZE);
+	ring_init(&echo_ring, echo_buffer, KEYBOARD_BUFFER_SIZE);
+	tasklet_init(&echo_tasklet, keyboard_echo, NULL);
+
+	// IRQ1にハンドラを登録（キーは割り込みでバッファに入る）
+	register_irq_handler(1, keyboard_irq, NULL);
+}
+
+// キーボード以外から届いた文字をキー入力と同じように画面に表示してバッファに追加
+void keyboard_input(char c) {
+	TRACE_EVENT(TRACE_KEY_INPUT, (uint8_t)c);
+	if (c != '\b') {
+		echo_put(c);
+	}
+	buffer_put(c);
 }
 
 // キー入力を処理
@@ -119,18 +172,23 @@ void keyboard_process(void) {
 	}
 }
 
-// キー入力を松（次のキー入力があるまでブロック）
+// キー入力を待つ（次のキー入力があるまでスレッドを止める）
 char keyboard_get_char(void) {
 	char c;
-	// バッファが空の間は処理を繰り返す
-	while(!(c = buffer_get())) {
-		keyboard_process();
+	while (!(c = buffer_get())) {
+		// スケジューラが動く前はポーリングで読む
+		if (thread_current() == NULL) {
+			keyboard_process();
+			continue;
+		}
+		// IRQ1がwake_upするまで止まり、その間CPUはアイドルスレッドのHLTで休む
+		wait_event(keyboard_wait, keyboard_has_key());
 	}
 	return c;
 }
 
 // キーバッファに文字があるか確認
 uint8_t keyboard_has_key(void) {
-	return buffer_read != buffer_write;
+	return !ring_empty(&key_ring);
 }
 
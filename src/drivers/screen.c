@@ -1,23 +1,134 @@
-// screen.c - VGAテキストモードのドライバ実装
+// screen.c - コンソール（VGAテキストモード/フレームバッファ）のドライバ実装
+// 文字はRAM上の影のバッファに書き、変わった行だけをまとめて画面に写す。
+// 写すのは書き込みの呼び出しの終わり（screen_write/screen_write_n/改行など）で、
+// ハードウェアのカーソルは位置が変わったときだけ書き換える。
+// VGAのメモリ（32KB）は行のリングとして使い、スクロールはCRTCの表示開始アドレスを
+// 1行進めるだけにする。末尾に着いたときだけ画面の行を先頭にコピーして戻す。
+// フレームバッファのときは溜まったスクロールを1回のブロック転送にまとめ、空いた行だけを描く。
+// 画面から出た行はスクロールバックに残し、Shift+PgUp/PgDnで見返せる。
 #include "../include/screen.h"
+#include "../include/fbcon.h"
 #include "../include/io.h"
+#include "../include/multiboot.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
 #include "../include/stddef.h"
+#include "../include/string.h"
 
 // VGAテキストモードのバッファアドレス
 #define VGA_BUFFER 0xB8000
+// 影のバッファのセル数（VGAのメモリ0xB8000からの32KBと同じ）
+#define SHADOW_CELLS (0x8000 / 2)
+
+// 書き出し先
+#define OUTPUT_NONE 0 // まだないか描けない（ブートローダがグラフィックモードにして、フレームバッファを使う前）
+#define OUTPUT_VGA  1 // VGAテキストモード
+#define OUTPUT_FB   2 // フレームバッファ
+
+// screen_panicが画面のロックを待つ回数（この後は他のCPUを止めてロックを壊す）
+#define SCREEN_PANIC_SPINS 1000000
 
 
 // カーソル位置
 static int cursor_x = 0;
 static int cursor_y = 0;
+// 画面の桁数と行数
+static int columns = VGA_WIDTH;
+static int rows = VGA_HEIGHT;
+// 影のバッファに入る行の数（リングの大きさ）
+static int ring_rows = SHADOW_CELLS / VGA_WIDTH;
+// 書き出し先
+static int output = OUTPUT_VGA;
 // VGAバッファのポインタ
 static uint16_t* vga_buffer = (uint16_t*) VGA_BUFFER;
+// 画面の中身の影（行のリング、VGAのときはVGAのメモリと同じ並び）
+static uint16_t shadow[SHADOW_CELLS];
+// 画面の一番上の行がリングの何行目か
+static int top_row = 0;
+// まだ画面に写していない行（ビットiが画面の行i）
+static uint64_t dirty_rows = 0;
+// ハードウェアに最後に書いたカーソル位置（-1なら未設定）
+static int hw_cursor = -1;
+// ハードウェアに最後に書いた表示開始行（-1なら未設定）
+static int hw_top = -1;
+// フレームバッファにカーソルを描いた位置（yが-1なら描いていない）
+static int fb_cursor_x = 0;
+static int fb_cursor_y = -1;
+// スクロールバック（画面から出た行のリング）
+static uint16_t scrollback[SCREEN_SCROLLBACK_LINES][SCREEN_MAX_COLS];
+// 次に書くスクロールバックの行と、溜まっている行数
+static int scrollback_next = 0;
+static int scrollback_count = 0;
+// 見返している行数（0なら最新の画面）
+static int view_offset = 0;
+// フレームバッファに切り替えるときに、それまでのテキストの画面を退避する場所
+static uint16_t saved_screen[VGA_WIDTH * VGA_HEIGHT];
+// 画面の状態を守るロック（シェルとエコーのタスクレットなどが並んで書く）
+static spinlock_t screen_lock = SPINLOCK_INIT;
+
+// 空白のセル
+static inline uint16_t blank_cell(void) {
+	return vga_entry(' ', vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+}
+
+// 画面の全部の行の印
+static inline uint64_t all_rows(void) {
+	return rows >= 64 ? ~0ULL : (1ULL << rows) - 1;
+}
+
+// 画面の行rowの影の先頭
+static inline uint16_t* row_ptr(int row) {
+	return shadow + (top_row + row) * columns;
+}
+
+// 表示開始アドレスをハードウェアに更新する（変わっていなければ何もしない）
+static void update_start(void) {
+	if (top_row == hw_top) {
+		return;
+	}
+	hw_top = top_row;
+	uint16_t start = top_row * VGA_WIDTH;
+
+	// 開始アドレスの上位バイトと下位バイトを送信
+	outb(0x3D4, 0x0C);
+	outb(0x3D5, (uint8_t) ((start >> 8) & 0xFF));
+	outb(0x3D4, 0x0D);
+	outb(0x3D5, (uint8_t) (start & 0xFF));
+}
+
+// フレームバッファのカーソルを描き直す（redrawnは描き直した行、そこにあった古いカーソルは消えている）
+static void fb_update_cursor(uint64_t redrawn) {
+	int moved = cursor_x != fb_cursor_x || cursor_y != fb_cursor_y;
+	if (!moved && !(redrawn & (1ULL << cursor_y))) {
+		return;
+	}
+	if (moved && fb_cursor_y >= 0 && fb_cursor_y < rows && !(redrawn & (1ULL << fb_cursor_y))) {
+		fbcon_draw_cell(fb_cursor_x, fb_cursor_y, row_ptr(fb_cursor_y)[fb_cursor_x], 0);
+	}
+	fbcon_draw_cell(cursor_x, cursor_y, row_ptr(cursor_y)[cursor_x], 1);
+	fb_cursor_x = cursor_x;
+	fb_cursor_y = cursor_y;
+}
 
-// カーソル位置をハードウェアに更新する
+// カーソル位置をハードウェアに更新する（変わっていなければ何もしない）
 static void update_cursor() {
-	// カーソル位置を計算
-	uint16_t pos = cursor_y * VGA_WIDTH + cursor_x;
-	
+	if (output == OUTPUT_FB) {
+		if (view_offset == 0) {
+			fb_update_cursor(0);
+		}
+		return;
+	}
+	if (output != OUTPUT_VGA) {
+		return;
+	}
+
+	// カーソル位置を計算（VGAのメモリの先頭からの位置）
+	uint16_t pos = (top_row + cursor_y) * VGA_WIDTH + cursor_x;
+	if (pos == hw_cursor) {
+		return;
+	}
+	hw_cursor = pos;
+
 	// カーソル位置の下位バイトを送信
 	outb(0x3D4, 0x0F);
 	outb(0x3D5, (uint8_t) (pos & 0xFF));
@@ -27,55 +138,123 @@ static void update_cursor() {
 	outb(0x3D5, (uint8_t) ((pos >> 8) & 0xFF));
 }
 
-// 画面をスクロールする
-static void scroll() {
-	uint8_t blank_attr = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	uint16_t blank = vga_entry(' ', blank_attr);
+// フレームバッファに写す（変わった行を続きごとに描く）
+static void fb_flush_locked(void) {
+	uint64_t redrawn = dirty_rows;
+	dirty_rows = 0;
 
-	//一番上の行が画面から出る場合
-	if (cursor_y >= VGA_HEIGHT) {
-		// テキストを1行分上にコピー
-		for (int i = 0; i < (VGA_HEIGHT - 1) * VGA_WIDTH; i++) {
-			vga_buffer[i] = vga_buffer[i + VGA_WIDTH];
+	int row = 0;
+	while (row < rows) {
+		if ((redrawn & (1ULL << row)) == 0) {
+			row++;
+			continue;
 		}
-
-		// 最後の行をクリア
-		for (int i = (VGA_HEIGHT - 1) * VGA_WIDTH; i < VGA_HEIGHT * VGA_WIDTH; i++) {
-			vga_buffer[i] = blank;
+		int first = row;
+		while (row < rows && (redrawn & (1ULL << row)) != 0) {
+			row++;
 		}
-
-		// カーソル位置を調整
-		cursor_y = VGA_HEIGHT - 1;
+		fbcon_draw_rows(first, row - first, row_ptr(first), columns, columns);
 	}
+	fb_update_cursor(redrawn);
 }
 
-// 画面を初期化
-void screen_init(void) {
-	// 画面をクリア
-	screen_clear();
+// 変わった行を画面に写し、カーソルを合わせる（ロックを持って呼ぶ）
+static void flush_locked(void) {
+	// 見返している途中に書かれたら最新の画面に戻す
+	if (view_offset != 0) {
+		if (dirty_rows == 0) {
+			return;
+		}
+		view_offset = 0;
+		dirty_rows = all_rows();
+	}
+
+	if (output == OUTPUT_FB) {
+		fb_flush_locked();
+		return;
+	}
+	if (output != OUTPUT_VGA) {
+		// 写す先がまだない（フレームバッファを使い始めるときに全部描く）
+		dirty_rows = 0;
+		return;
+	}
 
-	// カーソルを更新
+	// 続いている変わった行はまとめて1回で写す
+	int row = 0;
+	while (dirty_rows != 0 && row < rows) {
+		if ((dirty_rows & (1ULL << row)) == 0) {
+			row++;
+			continue;
+		}
+		int first = row;
+		while (row < rows && (dirty_rows & (1ULL << row)) != 0) {
+			dirty_rows &= ~(1ULL << row);
+			row++;
+		}
+		memcpy(vga_buffer + (top_row + first) * VGA_WIDTH, row_ptr(first),
+		       (row - first) * VGA_WIDTH * sizeof(uint16_t));
+	}
+	update_start();
 	update_cursor();
 }
 
-// 画面をクリア
-void screen_clear(void) {
-	uint8_t blank_attr = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	uint16_t blank = vga_entry(' ', blank_attr);
+// 行を空白で埋める
+static void clear_rows(int first, int count) {
+	uint16_t blank = blank_cell();
 
-	// 全ての文字位置を空白で埋める
-	for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-		vga_buffer[i] = blank;
+	uint16_t* base = row_ptr(first);
+	for (int i = 0; i < count * columns; i++) {
+		base[i] = blank;
+	}
+	for (int row = first; row < first + count; row++) {
+		dirty_rows |= 1ULL << row;
 	}
+}
 
-	// カーソルを左上に戻す
-	cursor_x = 0;
-	cursor_y = 0;
-	update_cursor();
+// 画面をスクロールする
+static void scroll() {
+	//一番上の行が画面から出る場合
+	if (cursor_y >= rows) {
+		// 出ていく行をスクロールバックに残す（後で桁数が増えても困らないよう残りは空白）
+		uint16_t* line = scrollback[scrollback_next];
+		memcpy(line, row_ptr(0), columns * sizeof(uint16_t));
+		for (int i = columns; i < SCREEN_MAX_COLS; i++) {
+			line[i] = blank_cell();
+		}
+		scrollback_next = (scrollback_next + 1) % SCREEN_SCROLLBACK_LINES;
+		if (scrollback_count < SCREEN_SCROLLBACK_LINES) {
+			scrollback_count++;
+		}
+
+		dirty_rows >>= 1;
+		if (top_row + rows < ring_rows) {
+			// 表示開始を1行進めるだけ（画面に残る行はもう写してある）
+			top_row++;
+		} else {
+			// リングの末尾に着いたら、残る行を先頭にコピーして戻す
+			memmove(shadow, row_ptr(1), (rows - 1) * columns * sizeof(uint16_t));
+			top_row = 0;
+			// VGAのメモリは影と同じ並びなので写し直す
+			if (output == OUTPUT_VGA) {
+				dirty_rows = all_rows();
+			}
+		}
+		// フレームバッファは読むと遅い（書き込み結合かキャッシュなし）ので、ずらさずに影から全部描き直す
+		// 何行スクロールしても次に写すときの1回で済む
+		if (output == OUTPUT_FB) {
+			dirty_rows = all_rows();
+		}
+
+		// 最後の行をクリア
+		clear_rows(rows - 1, 1);
+
+		// カーソル位置を調整
+		cursor_y = rows - 1;
+	}
 }
 
-// 文字を指定した色で表示
-void screen_put_char(char c, uint8_t color) {
+// 文字を1つ影に書く（ロックを持って呼ぶ）
+static void put_char_locked(char c, uint8_t color) {
     // バックスペース処理
     if (c == '\b' && cursor_x > 0) {
         cursor_x--;
@@ -96,51 +275,233 @@ void screen_put_char(char c, uint8_t color) {
 	// 表示可能な文字の場合
 	else if (c >= ' ') {
 		// 文字と色属性を書き込む
-		vga_buffer[cursor_y * VGA_WIDTH + cursor_x] = vga_entry(c, color);
+		row_ptr(cursor_y)[cursor_x] = vga_entry(c, color);
+		dirty_rows |= 1ULL << cursor_y;
 		cursor_x++;
 	}
-	
+
 	// 行末まで来たら次の行へ
-	if (cursor_x >= VGA_WIDTH) {
+	if (cursor_x >= columns) {
 		cursor_x = 0;
 		cursor_y++;
 	}
 
 	// 必要に応じてスクロール
 	scroll();
+}
 
-	// カーソル位置を更新
-	update_cursor();
+// 画面を初期化
+void screen_init(void) {
+	// ブートローダがグラフィックモードにしていれば、フレームバッファを使えるまで書き出さない
+	// （0xB8000に書いても映らないので、テキストモードのときだけVGAに書く）
+	output = multiboot_text_mode() ? OUTPUT_VGA : OUTPUT_NONE;
+
+	// 画面をクリア（開始アドレスとカーソルも必ず書くように未設定に戻す）
+	hw_cursor = -1;
+	hw_top = -1;
+	screen_clear();
+}
+
+// フレームバッファのコンソールに切り替える
+int screen_init_framebuffer(void) {
+	const multiboot_tag_framebuffer_t* info = multiboot_framebuffer();
+	if (info == NULL) {
+		return -1;
+	}
+	if (fbcon_init(info) != 0 || fbcon_columns() < VGA_WIDTH || fbcon_rows() < VGA_HEIGHT) {
+		// 描けないグラフィックモードでは書き出さないまま（画面は影のバッファに残る）
+		return -1;
+	}
+
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+
+	// これまでの画面（80x25）を退避する
+	int old_columns = columns;
+	int old_rows = rows;
+	for (int row = 0; row < old_rows; row++) {
+		memcpy(saved_screen + row * old_columns, row_ptr(row), old_columns * sizeof(uint16_t));
+	}
+
+	// 桁数と行数を広げ、左上に置き直す
+	columns = fbcon_columns() < SCREEN_MAX_COLS ? fbcon_columns() : SCREEN_MAX_COLS;
+	rows = fbcon_rows() < SCREEN_MAX_ROWS ? fbcon_rows() : SCREEN_MAX_ROWS;
+	ring_rows = SHADOW_CELLS / columns;
+	top_row = 0;
+	clear_rows(0, rows);
+	for (int row = 0; row < old_rows; row++) {
+		memcpy(row_ptr(row), saved_screen + row * old_columns, old_columns * sizeof(uint16_t));
+	}
 
+	output = OUTPUT_FB;
+	view_offset = 0;
+	fb_cursor_y = -1;
+	dirty_rows = all_rows();
+	flush_locked();
+
+	spin_unlock_irqrestore(&screen_lock, flags);
+	return 0;
+}
+
+// 画面をクリア
+void screen_clear(void) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+
+	// 全ての文字位置を空白で埋める
+	clear_rows(0, rows);
+
+	// カーソルを左上に戻す
+	cursor_x = 0;
+	cursor_y = 0;
+	flush_locked();
+
+	spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+// 文字を指定した色で表示
+void screen_put_char(char c, uint8_t color) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+	put_char_locked(c, color);
+	flush_locked();
+	spin_unlock_irqrestore(&screen_lock, flags);
 }
 
 // 文字列を指定した色で表示
 void screen_write(const char* str, uint8_t color) {
-	for (size_t i = 0; str[i] != '\0'; i++) {
-		screen_put_char(str[i], color);
+	screen_write_n(str, strlen(str), color);
+}
+
+// 長さを指定して文字列を表示（終端の'\0'はいらない）
+void screen_write_n(const char* str, size_t length, uint8_t color) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+	for (size_t i = 0; i < length; i++) {
+		put_char_locked(str[i], color);
+	}
+	flush_locked();
+	spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+// 指定した位置に文字列を表示（カーソルは動かさない）
+void screen_write_at(int x, int y, const char* str, uint8_t color) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+	if (y < 0 || y >= rows) {
+		spin_unlock_irqrestore(&screen_lock, flags);
+		return;
+	}
+	for (size_t i = 0; str[i] != '\0' && x + (int)i < columns; i++) {
+		if (x + (int)i >= 0) {
+			row_ptr(y)[x + i] = vga_entry(str[i], color);
+		}
+	}
+	dirty_rows |= 1ULL << y;
+	flush_locked();
+	spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+// first行目からcount行を1行上にずらし、最後の行を空ける
+void screen_scroll_rows(int first, int count) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+	if (first < 0 || count <= 0 || first + count > rows) {
+		spin_unlock_irqrestore(&screen_lock, flags);
+		return;
 	}
+	memmove(row_ptr(first), row_ptr(first + 1),
+	        (count - 1) * columns * sizeof(uint16_t));
+	for (int row = first; row < first + count - 1; row++) {
+		dirty_rows |= 1ULL << row;
+	}
+	clear_rows(first + count - 1, 1);
+	flush_locked();
+	spin_unlock_irqrestore(&screen_lock, flags);
 }
 
 // 改行
 void screen_newline(void) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
 	cursor_x = 0;
 	cursor_y++;
 	scroll();
-	update_cursor();
+	flush_locked();
+	spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+// スクロールバックを見返す（linesが正なら古い方へ、負なら新しい方へ）
+void screen_scrollback(int lines) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+
+	int offset = view_offset + lines;
+	if (offset < 0) offset = 0;
+	if (offset > scrollback_count) offset = scrollback_count;
+	if (offset == view_offset || output == OUTPUT_NONE) {
+		spin_unlock_irqrestore(&screen_lock, flags);
+		return;
+	}
+	view_offset = offset;
+
+	if (view_offset == 0) {
+		// 最新の画面に戻す
+		dirty_rows = all_rows();
+		flush_locked();
+	} else {
+		// スクロールバックの後ろview_offset行と画面の上の行を並べて表示する（影は変えない）
+		int oldest = scrollback_next - scrollback_count + SCREEN_SCROLLBACK_LINES;
+		for (int row = 0; row < rows; row++) {
+			int line = scrollback_count - view_offset + row;
+			const uint16_t* source;
+			if (line < scrollback_count) {
+				source = scrollback[(oldest + line) % SCREEN_SCROLLBACK_LINES];
+			} else {
+				source = row_ptr(line - scrollback_count);
+			}
+			if (output == OUTPUT_FB) {
+				fbcon_draw_rows(row, 1, source, columns, columns);
+			} else {
+				memcpy(vga_buffer + (top_row + row) * VGA_WIDTH, source, VGA_WIDTH * sizeof(uint16_t));
+			}
+		}
+		// フレームバッファのカーソルは上書きされた
+		fb_cursor_y = -1;
+	}
+
+	spin_unlock_irqrestore(&screen_lock, flags);
+}
+
+// 例外で止まる前に画面のロックを壊す（このCPUが書いている途中で落ちても表示できるように）
+void screen_panic(void) {
+	// 他のCPUが書いている途中なら少しだけ書き終わるのを待ち、それから止める
+	for (uint32_t i = 0; i < SCREEN_PANIC_SPINS; i++) {
+		if (spin_trylock(&screen_lock)) {
+			break;
+		}
+		asm volatile("pause");
+	}
+	smp_stop_others();
+
+	// 止めたCPUかこのCPU自身が持ったままのロックでも、もう誰も放さないので壊してよい
+	spin_lock_init(&screen_lock);
+	view_offset = 0;
+}
+
+// まだ写していない変更を画面に写す
+void screen_flush(void) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
+	flush_locked();
+	spin_unlock_irqrestore(&screen_lock, flags);
 }
 
 // カーソル位置を設定
 void screen_set_cursor(int x, int y) {
+	uint32_t flags = spin_lock_irqsave(&screen_lock);
 	cursor_x = x;
 	cursor_y = y;
 
 	// 範囲を制限
 	if (cursor_x < 0) cursor_x = 0;
-	if (cursor_x >= VGA_WIDTH) cursor_x = VGA_WIDTH - 1;
+	if (cursor_x >= columns) cursor_x = columns - 1;
 	if (cursor_y < 0) cursor_y = 0;
-	if (cursor_y >= VGA_HEIGHT) cursor_y = VGA_HEIGHT - 1;
+	if (cursor_y >= rows) cursor_y = rows - 1;
 
 	update_cursor();
+	spin_unlock_irqrestore(&screen_lock, flags);
 }
 
 // カーソル位置を取得
@@ -148,3 +509,14 @@ void screen_get_cursor(int *x, int *y) {
 	if (x) *x = cursor_x;
 	if (y) *y = cursor_y;
 }
+
+// 画面の桁数と行数を取得
+void screen_get_size(int *width, int *height) {
+	if (width) *width = columns;
+	if (height) *height = rows;
+}
+
+// フレームバッファに描いているか
+int screen_is_framebuffer(void) {
+	return output == OUTPUT_FB;
+}
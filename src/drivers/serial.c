@@ -1,72 +1,382 @@
 // serial.c - シリアル通信ドライバの実装
+// 送信はMPSCのリングに積み、UARTのFIFOが空いていればその場で16バイトまで書き、
+// 残りはFIFOが空になったときのTHRE割り込みでまた16バイトずつ書く（書く側は待たない）。
+// 受信はRX割り込みでリングに積み、読むスレッドは届くまで止まる。
 #include "../include/serial.h"
 #include "../include/io.h"
+#include "../include/interrupt.h"
+#include "../include/ring.h"
+#include "../include/spinlock.h"
+#include "../include/stddef.h"
+#include "../include/string.h"
+#include "../include/thread.h"
+#include "../include/trace.h"
+#include "../include/wait.h"
+
+// 送信FIFOの大きさ（THREが立てばこれだけ続けて書ける）
+#define SERIAL_FIFO_SIZE 16
+// UARTの基準クロックを16で割った値（除数1のボーレート）
+#define SERIAL_BASE_BAUD 115200
+
+// レジスタ（ポートからのオフセット）
+#define UART_DATA 0 // 送受信データ（DLABが1なら除数の下位）
+#define UART_IER  1 // 割り込み許可（DLABが1なら除数の上位）
+#define UART_IIR  2 // 割り込みの要因（書くとFIFOの制御）
+#define UART_LCR  3 // ライン制御
+#define UART_MCR  4 // モデム制御
+#define UART_LSR  5 // ライン状態
+#define UART_MSR  6 // モデム状態
+
+// IERのビット
+#define IER_RX_DATA 0x01 // 受信データあり
+#define IER_THRE    0x02 // 送信FIFOが空いた
+#define IER_LINE    0x04 // 受信エラー
+
+// IIRの値
+#define IIR_NO_INTERRUPT 0x01
+#define IIR_ID_MASK      0x0E
+#define IIR_MODEM        0x00
+#define IIR_THRE         0x02
+#define IIR_RX_DATA      0x04
+#define IIR_LINE         0x06
+#define IIR_RX_TIMEOUT   0x0C
+
+// LSRのビット
+#define LSR_DATA_READY 0x01
+#define LSR_THRE       0x20
+
+// 1回の割り込みで処理する要因の上限（壊れたUARTで抜けられなくならないように）
+#define SERIAL_IRQ_LOOPS 16
+
+// ポートごとの状態
+typedef struct {
+    uint16_t port;                          // I/Oポート
+    uint8_t irq;                            // IRQ番号（COM1/COM3は4、COM2/COM4は3）
+    uint8_t initialized;                    // serial_initが成功したか
+    spinlock_t tx_lock;                     // リングからUARTに書くCPUを1つにする
+    ring_t tx_ring;                         // 送信待ちのバイト
+    uint8_t tx_buffer[SERIAL_TX_BUFFER_SIZE];
+    ring_t rx_ring;                         // 受信したバイト（書くのはRX割り込み、読むのはスレッド）
+    uint8_t rx_buffer[SERIAL_RX_BUFFER_SIZE];
+    wait_queue_t rx_wait;                   // 受信を待つスレッド
+    serial_input_t console;                 // コンソールにしていれば受信した文字を渡す先
+    volatile uint32_t rx_dropped;           // 受信リングが一杯で捨てたバイト数
+    volatile uint32_t claimed;              // serial_claimで1人が使っていれば1
+    volatile uint32_t writers;              // serial_sendの途中の書き手の数
+} serial_port_t;
+
+// COM1〜COM4
+static serial_port_t serial_ports[4] = {
+    { .port = SERIAL_COM1, .irq = 4 }, { .port = SERIAL_COM2, .irq = 3 },
+    { .port = SERIAL_COM3, .irq = 4 }, { .port = SERIAL_COM4, .irq = 3 },
+};
+
+// I/Oポートからポートの状態を引く（初期化されていなければNULL）
+static serial_port_t* serial_lookup(uint16_t port) {
+    for (uint32_t i = 0; i < 4; i++) {
+        if (serial_ports[i].port == port && serial_ports[i].initialized) {
+            return &serial_ports[i];
+        }
+    }
+    return NULL;
+}
+
+// 送信FIFOが空いていればリングから書き足す（他のCPUが書き足し中なら終わるのを待ってやり直す）
+// FIFOが埋まっていれば、空いたときのTHRE割り込みが続きを書くので待たない
+static void serial_kick(serial_port_t* sp) {
+    uint8_t chunk[SERIAL_FIFO_SIZE];
+    while (!ring_empty(&sp->tx_ring) && serial_is_transmit_empty(sp->port)) {
+        // ロックは16バイトを書く間だけ割り込みを止めて持つ（割り込みハンドラから書いても詰まらない）
+        uint32_t flags = irq_save();
+        if (!spin_trylock(&sp->tx_lock)) {
+            irq_restore(flags);
+            asm volatile("pause");
+            continue;
+        }
+        if (serial_is_transmit_empty(sp->port)) {
+            uint32_t count = ring_pop_n(&sp->tx_ring, chunk, SERIAL_FIFO_SIZE);
+            for (uint32_t i = 0; i < count; i++) {
+                outb(sp->port + UART_DATA, chunk[i]);
+            }
+        }
+        spin_unlock(&sp->tx_lock);
+        irq_restore(flags);
+    }
+}
+
+// 送信リングが空になるまでFIFOが空くのを待って書く（割り込みが来ないときだけ使う）
+static void serial_drain(serial_port_t* sp) {
+    while (!ring_empty(&sp->tx_ring)) {
+        while (serial_is_transmit_empty(sp->port) == 0) {
+            asm volatile("pause");
+        }
+        serial_kick(sp);
+    }
+}
+
+// countバイトを送信リングに積んで書き始める
+// リングが一杯のときだけ、空くまでFIFOに直接書いて待つ（割り込みが止まっていても進むように）
+static void serial_push(serial_port_t* sp, const char* data, uint32_t count) {
+    while (count > 0) {
+        uint32_t pushed = ring_mpsc_push_n(&sp->tx_ring, data, count);
+        data += pushed;
+        count -= pushed;
+        serial_kick(sp);
+        if (count > 0) {
+            while (serial_is_transmit_empty(sp->port) == 0) {
+                asm volatile("pause");
+            }
+        }
+    }
+}
+
+// 普通の書き手の送信（serial_claimで締め出されている間は捨てる）
+// 書き手の数を増やしてからclaimedを見るので、serial_claimが待ち終えた後に積む書き手はいない
+static void serial_send(serial_port_t* sp, const char* data, uint32_t count) {
+    __atomic_add_fetch(&sp->writers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&sp->claimed, __ATOMIC_SEQ_CST)) {
+        serial_push(sp, data, count);
+    }
+    __atomic_sub_fetch(&sp->writers, 1, __ATOMIC_RELEASE);
+}
+
+// 受信したバイトを読み取ってリングに積むか、コンソールに渡す
+static void serial_receive(serial_port_t* sp) {
+    int received = 0;
+    uint32_t bytes = 0;
+    while (inb(sp->port + UART_LSR) & LSR_DATA_READY) {
+        char c = inb(sp->port + UART_DATA);
+        bytes++;
+        if (sp->console != NULL) {
+            sp->console(c);
+        } else if (ring_push(&sp->rx_ring, (uint8_t)c) == 0) {
+            received = 1;
+        } else {
+            sp->rx_dropped++;
+        }
+    }
+    TRACE_EVENT(TRACE_SERIAL_RX, bytes);
+    if (received) {
+        wake_up(&sp->rx_wait);
+    }
+}
+
+// IRQ3/IRQ4のハンドラ（同じIRQを使う2つのポートをどちらも調べる）
+static void serial_irq(registers_t* regs, void* ctx) {
+    (void)regs;
+    uint8_t irq = (uint8_t)(uint32_t)ctx;
+    for (uint32_t i = 0; i < 4; i++) {
+        serial_port_t* sp = &serial_ports[i];
+        if (!sp->initialized || sp->irq != irq) {
+            continue;
+        }
+        for (int loop = 0; loop < SERIAL_IRQ_LOOPS; loop++) {
+            uint8_t iir = inb(sp->port + UART_IIR);
+            if (iir & IIR_NO_INTERRUPT) {
+                break;
+            }
+            switch (iir & IIR_ID_MASK) {
+            case IIR_RX_DATA:
+            case IIR_RX_TIMEOUT:
+                serial_receive(sp);
+                break;
+            case IIR_THRE:
+                // IIRを読んだのでTHREの要因は消えた。FIFOが空いた分を書き足す
+                serial_kick(sp);
+                break;
+            case IIR_LINE:
+                inb(sp->port + UART_LSR);
+                break;
+            case IIR_MODEM:
+                inb(sp->port + UART_MSR);
+                break;
+            }
+        }
+    }
+}
 
 // シリアルポートを初期化
-int serial_init(uint16_t port) {
+int serial_init(uint16_t port, uint32_t baud) {
+    // 除数で割り切れるボーレートだけ受け付ける（115200 / 除数）
+    if (baud == 0 || baud > SERIAL_BASE_BAUD || SERIAL_BASE_BAUD % baud != 0) {
+        return 1;
+    }
+    uint32_t divisor = SERIAL_BASE_BAUD / baud;
+
     // 割り込みを無効化
-    outb(port + 1, 0x00);
-    
+    outb(port + UART_IER, 0x00);
+
     // DLABを有効にしてボーレート設定
-    outb(port + 3, 0x80);
-    // 9600bpsに設定（115200 / 9600 = 12）
-    outb(port + 0, 0x0C);    // 除数の下位バイト
-    outb(port + 1, 0x00);    // 除数の上位バイト
-    
+    outb(port + UART_LCR, 0x80);
+    outb(port + UART_DATA, divisor & 0xFF);      // 除数の下位バイト
+    outb(port + UART_IER, (divisor >> 8) & 0xFF); // 除数の上位バイト
+
     // 8ビット、パリティなし、ストップビット1に設定
-    outb(port + 3, 0x03);
-    
+    outb(port + UART_LCR, 0x03);
+
     // FIFOを有効化（14バイト閾値）
-    outb(port + 2, 0xC7);
-    
+    outb(port + UART_IIR, 0xC7);
+
     // IRQ有効、RTS/DTR設定
-    outb(port + 4, 0x0B);
-    
+    outb(port + UART_MCR, 0x0B);
+
     // ループバックテストを行う
-    outb(port + 4, 0x1E);    // ループバック有効
-    outb(port + 0, 0xAE);    // テストバイト送信
-    
+    outb(port + UART_MCR, 0x1E);    // ループバック有効
+    outb(port + UART_DATA, 0xAE);   // テストバイト送信
+
     // 受信したバイトをチェック
-    if (inb(port + 0) != 0xAE) {
+    if (inb(port + UART_DATA) != 0xAE) {
         return 1; // 初期化失敗
     }
-    
-    // ループバック無効、正常モードに設定
-    outb(port + 4, 0x0F);
+
+    // ループバック無効、正常モードに設定（OUT2で割り込みを割り込みコントローラに出す）
+    outb(port + UART_MCR, 0x0F);
+
+    // 送受信のリングを用意してIRQに登録する
+    for (uint32_t i = 0; i < 4; i++) {
+        serial_port_t* sp = &serial_ports[i];
+        if (sp->port != port) {
+            continue;
+        }
+        spin_lock_init(&sp->tx_lock);
+        ring_init(&sp->tx_ring, sp->tx_buffer, SERIAL_TX_BUFFER_SIZE);
+        ring_init(&sp->rx_ring, sp->rx_buffer, SERIAL_RX_BUFFER_SIZE);
+        wait_queue_init(&sp->rx_wait);
+        sp->rx_dropped = 0;
+        sp->initialized = 1;
+
+        // 同じIRQのもう一方のポートが登録済みなら-1が返るが、ハンドラは両方を調べる
+        register_irq_handler(sp->irq, serial_irq, (void*)(uint32_t)sp->irq);
+
+        // 受信と送信FIFOが空いたときの割り込みを許可
+        while (inb(port + UART_LSR) & LSR_DATA_READY) {
+            inb(port + UART_DATA);
+        }
+        outb(port + UART_IER, IER_RX_DATA | IER_THRE | IER_LINE);
+    }
     return 0; // 初期化成功
 }
 
+// 受信した文字をinputに渡し、このポートをコンソールにする（NULLなら受信リングに戻す）
+void serial_set_console(uint16_t port, serial_input_t input) {
+    serial_port_t* sp = serial_lookup(port);
+    if (sp != NULL) {
+        __atomic_store_n(&sp->console, input, __ATOMIC_RELEASE);
+    }
+}
+
 // 送信が完了したかチェック
 int serial_is_transmit_empty(uint16_t port) {
-    return inb(port + 5) & 0x20;
+    return inb(port + UART_LSR) & LSR_THRE;
 }
 
 // 1文字を送信
 void serial_putchar(uint16_t port, char c) {
-    // 送信バッファが空になるまで待機
+    serial_port_t* sp = serial_lookup(port);
+    if (sp != NULL) {
+        serial_send(sp, &c, 1);
+        return;
+    }
+
+    // 初期化していないポートは直接書く
     while (serial_is_transmit_empty(port) == 0);
-    
-    // 文字を送信
     outb(port, c);
 }
 
 // 文字列を送信
 void serial_write(uint16_t port, const char* str) {
-    for (int i = 0; str[i] != '\0'; i++) {
-        serial_putchar(port, str[i]);
+    serial_write_n(port, str, strlen(str));
+}
+
+// 長さを指定して送信（終端の'\0'はいらない）
+void serial_write_n(uint16_t port, const char* data, size_t length) {
+    serial_port_t* sp = serial_lookup(port);
+    if (sp == NULL) {
+        for (size_t i = 0; i < length; i++) {
+            serial_putchar(port, data[i]);
+        }
+        return;
+    }
+
+    serial_send(sp, data, length);
+}
+
+// 他の書き手を締め出してポートを1人で使う
+void serial_claim(uint16_t port) {
+    serial_port_t* sp = serial_lookup(port);
+    if (sp == NULL) {
+        return;
+    }
+
+    while (__atomic_exchange_n(&sp->claimed, 1, __ATOMIC_SEQ_CST) != 0) {
+        thread_yield();
+    }
+    // 締め出す前に書き始めた書き手が積み終わるのを待つ（積んだ分は印より前に出る）
+    while (__atomic_load_n(&sp->writers, __ATOMIC_SEQ_CST) != 0) {
+        thread_yield();
+    }
+}
+
+// serial_claimした書き手の送信
+void serial_write_claimed(uint16_t port, const char* data, size_t length) {
+    serial_port_t* sp = serial_lookup(port);
+    if (sp == NULL) {
+        serial_write_n(port, data, length);
+        return;
+    }
+
+    serial_push(sp, data, length);
+}
+
+// serial_claimで締め出した書き手を戻す
+void serial_release(uint16_t port) {
+    serial_port_t* sp = serial_lookup(port);
+    if (sp != NULL) {
+        __atomic_store_n(&sp->claimed, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// 送信リングに残っているバイトを全部書き終えるまで待つ
+void serial_flush(uint16_t port) {
+    serial_port_t* sp = serial_lookup(port);
+    if (sp != NULL) {
+        serial_drain(sp);
     }
 }
 
 // 文字が利用可能かチェック
 int serial_received(uint16_t port) {
-    return inb(port + 5) & 1;
+    serial_port_t* sp = serial_lookup(port);
+    if (sp != NULL && !ring_empty(&sp->rx_ring)) {
+        return 1;
+    }
+    return inb(port + UART_LSR) & LSR_DATA_READY;
 }
 
-// 1文字を受信（ブロッキング）
+// 1文字を受信（届くまでスレッドを止める）
 char serial_getchar(uint16_t port) {
-    // データが受信されるまで待機
-    while (serial_received(port) == 0);
-    
-    // 文字を読み取り
-    return inb(port);
-}
\ No newline at end of file
+    serial_port_t* sp = serial_lookup(port);
+    while (1) {
+        uint8_t c;
+        if (sp != NULL && ring_pop(&sp->rx_ring, &c) == 0) {
+            return (char)c;
+        }
+
+        // 初期化していないポートやスケジューラが動く前はポーリングで読む
+        if (sp == NULL || thread_current() == NULL) {
+            if (inb(port + UART_LSR) & LSR_DATA_READY) {
+                return inb(port + UART_DATA);
+            }
+            continue;
+        }
+
+        // RX割り込みがwake_upするまで止まる
+        wait_event(sp->rx_wait, !ring_empty(&sp->rx_ring));
+    }
+}
+
+// 受信リングが一杯で捨てたバイト数
+uint32_t serial_rx_dropped(uint16_t port) {
+    serial_port_t* sp = serial_lookup(port);
+    return sp != NULL ? sp->rx_dropped : 0;
+}
@@ -1,6 +1,447 @@
+// string.c - メモリ操作と文字列操作の実装（起動時にCPUIDで実装を選択）
 #include "../include/string.h"
+#include "../include/cpu.h"
+#include "../include/fpu.h"
+#include "../include/stdint.h"
+
+// 1ワード（4バイト）単位の処理用の定数
+#define ONES  0x01010101u
+#define HIGHS 0x80808080u
+
+// ワード中に0のバイトがあれば非0
+#define HAS_ZERO_BYTE(w) (((w) - ONES) & ~(w) & HIGHS)
+
+// SSE2を使い始めるサイズ（これ未満は準備のコストの方が大きい）
+#define SSE2_THRESHOLD 128
+// 非テンポラルストアを使い始めるサイズ（キャッシュを汚さない）
+#define SSE2_NONTEMPORAL_THRESHOLD (256 * 1024)
+
+// 基本実装
+static void* memcpy_rep(void* dest, const void* src, size_t size);
+static void* memset_rep(void* ptr, int value, size_t size);
+static void* memmove_backward_rep(void* dest, const void* src, size_t size);
+static void* memchr_word(const void* ptr, int value, size_t size);
+static size_t strlen_word(const char* s);
+
+// 選択された実装（string_initまでは基本実装）
+static void* (*memcpy_impl)(void*, const void*, size_t) = memcpy_rep;
+static void* (*memset_impl)(void*, int, size_t) = memset_rep;
+static void* (*memmove_backward_impl)(void*, const void*, size_t) = memmove_backward_rep;
+static void* (*memchr_impl)(const void*, int, size_t) = memchr_word;
+static size_t (*strlen_impl)(const char*) = strlen_word;
+// 選択された実装の名前
+static const char* variant_name = "rep";
+
+// ---- 基本実装（rep movsd/stosd、ワード単位） ----
+
+// rep movsdで前方にコピー
+static void* memcpy_rep(void* dest, const void* src, size_t size) {
+	void* d = dest;
+	size_t dwords = size >> 2;
+	size_t bytes = size & 3;
+	asm volatile("rep movsl\n\t"
+	             "mov %3, %%ecx\n\t"
+	             "rep movsb"
+	             : "+D" (d), "+S" (src), "+c" (dwords)
+	             : "r" (bytes)
+	             : "memory");
+	return dest;
+}
+
+// rep stosdで埋める
+static void* memset_rep(void* ptr, int value, size_t size) {
+	void* d = ptr;
+	uint32_t pattern = (uint8_t)value * ONES;
+	size_t dwords = size >> 2;
+	size_t bytes = size & 3;
+	asm volatile("rep stosl\n\t"
+	             "mov %3, %%ecx\n\t"
+	             "rep stosb"
+	             : "+D" (d), "+c" (dwords)
+	             : "a" (pattern), "r" (bytes)
+	             : "memory");
+	return ptr;
+}
+
+// 後方からコピー（destがsrcより後ろで重なっている場合）
+static void* memmove_backward_rep(void* dest, const void* src, size_t size) {
+	uint8_t* d = (uint8_t*)dest + size;
+	const uint8_t* s = (const uint8_t*)src + size;
+
+	// 末尾の端数バイト
+	while (size & 3) {
+		*--d = *--s;
+		size--;
+	}
+
+	// 残りを4バイトずつ後ろから
+	size_t dwords = size >> 2;
+	if (dwords) {
+		d -= 4;
+		s -= 4;
+		asm volatile("std\n\t"
+		             "rep movsl\n\t"
+		             "cld"
+		             : "+D" (d), "+S" (s), "+c" (dwords)
+		             :
+		             : "memory");
+	}
+	return dest;
+}
+
+// ワード単位で文字を探す
+static void* memchr_word(const void* ptr, int value, size_t size) {
+	const uint8_t* p = (const uint8_t*)ptr;
+	uint8_t c = (uint8_t)value;
+
+	// 4バイト境界まで1バイトずつ
+	while (size && ((uint32_t)p & 3)) {
+		if (*p == c) {
+			return (void*)p;
+		}
+		p++;
+		size--;
+	}
+
+	// 4バイトずつ（一致したバイトは XOR で0になる）
+	uint32_t pattern = c * ONES;
+	while (size >= 4) {
+		uint32_t word = *(const uint32_t*)p ^ pattern;
+		if (HAS_ZERO_BYTE(word)) {
+			break;
+		}
+		p += 4;
+		size -= 4;
+	}
+
+	while (size--) {
+		if (*p == c) {
+			return (void*)p;
+		}
+		p++;
+	}
+	return NULL;
+}
+
+// ワード単位で長さを数える（境界に揃えた読み込みはページをまたがない）
+static size_t strlen_word(const char* s) {
+	const char* p = s;
+
+	while ((uint32_t)p & 3) {
+		if (*p == '\0') {
+			return p - s;
+		}
+		p++;
+	}
+
+	while (!HAS_ZERO_BYTE(*(const uint32_t*)p)) {
+		p += 4;
+	}
+	while (*p) {
+		p++;
+	}
+	return p - s;
+}
+
+// ---- SSE2実装 ----
+// カーネルは -msse なしでビルドされ、コンパイラ自身はXMMレジスタを使わない。
+// そのためXMMレジスタはここでのみ使い、インラインアセンブリのクロバーには書かない。
+// XMMレジスタはkernel_fpu_begin/endの区間でだけ触り、区間に入れなければ基本実装で処理する。
+
+// 64バイト単位でコピー（destは16バイト境界）
+static void sse2_copy_blocks(uint8_t* d, const uint8_t* s, size_t blocks, int nontemporal) {
+	if (nontemporal) {
+		asm volatile("1:\n\t"
+		             "movdqu (%1), %%xmm0\n\t"
+		             "movdqu 16(%1), %%xmm1\n\t"
+		             "movdqu 32(%1), %%xmm2\n\t"
+		             "movdqu 48(%1), %%xmm3\n\t"
+		             "movntdq %%xmm0, (%0)\n\t"
+		             "movntdq %%xmm1, 16(%0)\n\t"
+		             "movntdq %%xmm2, 32(%0)\n\t"
+		             "movntdq %%xmm3, 48(%0)\n\t"
+		             "add $64, %1\n\t"
+		             "add $64, %0\n\t"
+		             "dec %2\n\t"
+		             "jnz 1b\n\t"
+		             "sfence"
+		             : "+r" (d), "+r" (s), "+r" (blocks)
+		             :
+		             : "memory", "cc");
+	} else {
+		asm volatile("1:\n\t"
+		             "movdqu (%1), %%xmm0\n\t"
+		             "movdqu 16(%1), %%xmm1\n\t"
+		             "movdqu 32(%1), %%xmm2\n\t"
+		             "movdqu 48(%1), %%xmm3\n\t"
+		             "movdqa %%xmm0, (%0)\n\t"
+		             "movdqa %%xmm1, 16(%0)\n\t"
+		             "movdqa %%xmm2, 32(%0)\n\t"
+		             "movdqa %%xmm3, 48(%0)\n\t"
+		             "add $64, %1\n\t"
+		             "add $64, %0\n\t"
+		             "dec %2\n\t"
+		             "jnz 1b"
+		             : "+r" (d), "+r" (s), "+r" (blocks)
+		             :
+		             : "memory", "cc");
+	}
+}
+
+// SSE2で前方にコピー
+static void* memcpy_sse2(void* dest, const void* src, size_t size) {
+	if (size < SSE2_THRESHOLD) {
+		return memcpy_rep(dest, src, size);
+	}
+
+	if (!kernel_fpu_begin()) {
+		return memcpy_rep(dest, src, size);
+	}
+
+	uint8_t* d = (uint8_t*)dest;
+	const uint8_t* s = (const uint8_t*)src;
+	int nontemporal = size >= SSE2_NONTEMPORAL_THRESHOLD;
+
+	// コピー先を16バイト境界に揃える
+	size_t head = (16 - ((uint32_t)d & 15)) & 15;
+	memcpy_rep(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	size_t blocks = size >> 6;
+	sse2_copy_blocks(d, s, blocks, nontemporal);
+	kernel_fpu_end();
+
+	memcpy_rep(d + (blocks << 6), s + (blocks << 6), size & 63);
+	return dest;
+}
+
+// SSE2で埋める
+static void* memset_sse2(void* ptr, int value, size_t size) {
+	if (size < SSE2_THRESHOLD) {
+		return memset_rep(ptr, value, size);
+	}
+
+	if (!kernel_fpu_begin()) {
+		return memset_rep(ptr, value, size);
+	}
+
+	uint8_t* d = (uint8_t*)ptr;
+	uint32_t pattern = (uint8_t)value * ONES;
+
+	size_t head = (16 - ((uint32_t)d & 15)) & 15;
+	memset_rep(d, value, head);
+	d += head;
+	size -= head;
+
+	size_t blocks = size >> 6;
+	asm volatile("movd %2, %%xmm0\n\t"
+		             "pshufd $0, %%xmm0, %%xmm0\n\t"
+		             "1:\n\t"
+		             "movdqa %%xmm0, (%0)\n\t"
+		             "movdqa %%xmm0, 16(%0)\n\t"
+		             "movdqa %%xmm0, 32(%0)\n\t"
+		             "movdqa %%xmm0, 48(%0)\n\t"
+		             "add $64, %0\n\t"
+		             "dec %1\n\t"
+		             "jnz 1b"
+		             : "+r" (d), "+r" (blocks)
+		             : "r" (pattern)
+		             : "memory", "cc");
+	kernel_fpu_end();
+
+	memset_rep(d, value, size & 63);
+	return ptr;
+}
+
+// SSE2で後方からコピー（16バイト単位、読み込んでから書き込む）
+static void* memmove_backward_sse2(void* dest, const void* src, size_t size) {
+	if (size < SSE2_THRESHOLD) {
+		return memmove_backward_rep(dest, src, size);
+	}
+
+	if (!kernel_fpu_begin()) {
+		return memmove_backward_rep(dest, src, size);
+	}
+
+	uint8_t* d = (uint8_t*)dest + size;
+	const uint8_t* s = (const uint8_t*)src + size;
+	size_t blocks = size >> 6;
+	asm volatile("1:\n\t"
+		             "sub $64, %1\n\t"
+		             "sub $64, %0\n\t"
+		             "movdqu 48(%1), %%xmm3\n\t"
+		             "movdqu 32(%1), %%xmm2\n\t"
+		             "movdqu 16(%1), %%xmm1\n\t"
+		             "movdqu (%1), %%xmm0\n\t"
+		             "movdqu %%xmm3, 48(%0)\n\t"
+		             "movdqu %%xmm2, 32(%0)\n\t"
+		             "movdqu %%xmm1, 16(%0)\n\t"
+		             "movdqu %%xmm0, (%0)\n\t"
+		             "dec %2\n\t"
+		             "jnz 1b"
+		             : "+r" (d), "+r" (s), "+r" (blocks)
+		             :
+		             : "memory", "cc");
+	kernel_fpu_end();
+
+	// 先頭に残った端数
+	memmove_backward_rep(dest, src, size & 63);
+	return dest;
+}
+
+// 16バイトのうち値が一致するバイトのマスク
+static inline uint32_t sse2_match_mask(const uint8_t* p, uint32_t pattern) {
+	uint32_t mask;
+	asm volatile("movd %2, %%xmm0\n\t"
+	             "pshufd $0, %%xmm0, %%xmm0\n\t"
+	             "movdqa (%1), %%xmm1\n\t"
+	             "pcmpeqb %%xmm0, %%xmm1\n\t"
+	             "pmovmskb %%xmm1, %0"
+	             : "=r" (mask)
+	             : "r" (p), "r" (pattern)
+	             : "memory");
+	return mask;
+}
+
+// SSE2で文字を探す（16バイト境界に揃えて読む）
+static void* memchr_sse2(const void* ptr, int value, size_t size) {
+	if (size < SSE2_THRESHOLD || !kernel_fpu_begin()) {
+		return memchr_word(ptr, value, size);
+	}
+
+	const uint8_t* start = (const uint8_t*)ptr;
+	const uint8_t* end = start + size;
+	const uint8_t* p = (const uint8_t*)((uint32_t)start & ~15u);
+	uint32_t pattern = (uint8_t)value * ONES;
+	void* found = NULL;
+
+	// 最初のブロックは開始位置より前のバイトを除く
+	uint32_t mask = sse2_match_mask(p, pattern) >> (start - p) << (start - p);
+	while (mask == 0) {
+		p += 16;
+		if (p >= end) {
+			break;
+		}
+		mask = sse2_match_mask(p, pattern);
+	}
+	kernel_fpu_end();
+
+	if (mask != 0) {
+		const uint8_t* hit = p + __builtin_ctz(mask);
+		if (hit < end) {
+			found = (void*)hit;
+		}
+	}
+	return found;
+}
+
+// SSE2で長さを数える
+static size_t strlen_sse2(const char* s) {
+	// 短い文字列は最初の16バイトで見つかることが多いのでワード単位で調べる
+	const char* p = s;
+	const char* first_block = (const char*)(((uint32_t)s + 16) & ~15u);
+	while (p < first_block) {
+		if (*p == '\0') {
+			return p - s;
+		}
+		p++;
+	}
+
+	// SIMD区間の開始と終了にはCR0の書き換えが伴うので、長い文字列だけSSE2で調べる
+	const char* sse_start = p + SSE2_THRESHOLD;
+	while (p < sse_start) {
+		uint32_t w = *(const uint32_t*)p;
+		if (HAS_ZERO_BYTE(w)) {
+			while (*p) {
+				p++;
+			}
+			return p - s;
+		}
+		p += 4;
+	}
+	if (!kernel_fpu_begin()) {
+		return (p - s) + strlen_word(p);
+	}
+
+	uint32_t mask = sse2_match_mask((const uint8_t*)p, 0);
+	while (mask == 0) {
+		p += 16;
+		mask = sse2_match_mask((const uint8_t*)p, 0);
+	}
+	kernel_fpu_end();
+
+	return (p - s) + __builtin_ctz(mask);
+}
+
+// ---- 公開関数 ----
+
+// CPUの機能に応じて実装を選択
+void string_init(void) {
+	memcpy_impl = memcpy_rep;
+	memset_impl = memset_rep;
+	memmove_backward_impl = memmove_backward_rep;
+	memchr_impl = memchr_word;
+	strlen_impl = strlen_word;
+	variant_name = "rep";
+
+	if (cpu_has(CPU_FEATURE_SSE2) && cpu_sse_enabled()) {
+		memcpy_impl = memcpy_sse2;
+		memset_impl = memset_sse2;
+		memmove_backward_impl = memmove_backward_sse2;
+		memchr_impl = memchr_sse2;
+		strlen_impl = strlen_sse2;
+		variant_name = "sse2";
+	}
+}
+
+// 選択された実装の名前
+const char* string_variant(void) {
+	return variant_name;
+}
+
+// 指定アドレスからサイズ分のメモリを指定値で埋める
+void* memset(void* ptr, int value, size_t size) {
+	return memset_impl(ptr, value, size);
+}
+
+// メモリ間のコピー（領域が重なってはいけない）
+void* memcpy(void* dest, const void* src, size_t size) {
+	return memcpy_impl(dest, src, size);
+}
+
+// メモリ間のコピー（領域が重なってもよい）
+void* memmove(void* dest, const void* src, size_t size) {
+	// destが前にあるか重なっていなければ前方コピーで安全
+	if ((uint8_t*)dest <= (const uint8_t*)src || (uint8_t*)dest >= (const uint8_t*)src + size) {
+		return memcpy(dest, src, size);
+	}
+	return memmove_backward_impl(dest, src, size);
+}
+
+// メモリ中の文字を探す
+void* memchr(const void* ptr, int value, size_t size) {
+	return memchr_impl(ptr, value, size);
+}
 
 int strcmp(const char *s1, const char *s2) {
+	// 同じアラインメントなら4バイトずつ比較
+	if ((((uint32_t)s1 ^ (uint32_t)s2) & 3) == 0) {
+		while ((uint32_t)s1 & 3) {
+			if (*s1 == '\0' || *s1 != *s2) {
+				return *(const unsigned char*)s1 - *(const unsigned char*)s2;
+			}
+			s1++; s2++;
+		}
+		while (1) {
+			uint32_t w1 = *(const uint32_t*)s1;
+			if (w1 != *(const uint32_t*)s2 || HAS_ZERO_BYTE(w1)) {
+				break;
+			}
+			s1 += 4; s2 += 4;
+		}
+	}
 	while (*s1 && (*s1 == *s2)) {
 		s1++; s2++;
 	}
@@ -8,6 +449,22 @@ int strcmp(const char *s1, const char *s2) {
 }
 
 int strncmp(const char *s1, const char *s2, size_t n) {
+	// 同じアラインメントなら4バイトずつ比較
+	if ((((uint32_t)s1 ^ (uint32_t)s2) & 3) == 0) {
+		while (n && ((uint32_t)s1 & 3)) {
+			if (*s1 == '\0' || *s1 != *s2) {
+				return *(const unsigned char*)s1 - *(const unsigned char*)s2;
+			}
+			s1++; s2++; n--;
+		}
+		while (n >= 4) {
+			uint32_t w1 = *(const uint32_t*)s1;
+			if (w1 != *(const uint32_t*)s2 || HAS_ZERO_BYTE(w1)) {
+				break;
+			}
+			s1 += 4; s2 += 4; n -= 4;
+		}
+	}
 	while (n && *s1 && (*s1 == *s2)) {
 		s1++; s2++; n--;
 	}
@@ -18,24 +475,16 @@ int strncmp(const char *s1, const char *s2, size_t n) {
 }
 
 size_t strlen(const char *s) {
-	size_t len = 0;
-	while (s[len]){
-		len++;
-	}
-	return len;
+	return strlen_impl(s);
 }
 
 
 
 char *strcat(char *dest, const char *src) {
-	char *d = dest;
-	while (*d) {
-		d++;
-	} // destの末尾に移動
+	char *d = dest + strlen(dest); // destの末尾に移動
 	while (*src) {
 		*d++ = *src++; // srcの文字をコピー
 	}
 	*d = '\0'; // null終端
 	return dest;
 }
-
@@ -1,6 +1,15 @@
 // timer.c - PIT (Programmable Interval TImer) ドライバの実装
+// PITはワンショット（モード0）で使い、次のタイマーの期限にだけ割り込ませる。
+// 待つタイマーがなければPITを止めるので、アイドル中はタイマー割り込みが入らない。
+// 時刻はクロックソースがあればそこから、なければPITの経過カウントから求める。
 #include "../include/timer.h"
+#include "../include/clock.h"
+#include "../include/cpu.h"
+#include "../include/interrupt.h"
 #include "../include/io.h"
+#include "../include/softirq.h"
+#include "../include/spinlock.h"
+#include "../include/stddef.h"
 
 // PITの制御ポート
 #define PIT_COMMAND 0x43
@@ -9,46 +18,187 @@
 // PIT入力クロック（1.193182MHz）
 #define PIT_CLOCK 1193182
 
-// タイマーのティック（割り込み）カウント
+// 制御ワード 0x30 = 00110000b
+// - 00: チャンネル0を選択
+// - 11: 下位バイト、上位バイトの順に送信
+// - 000: モード0（カウントが0になったら割り込み、ワンショット）
+// - 0: 2進数カウント
+// 制御ワードだけを書くとカウントを書くまで止まる
+#define PIT_ONESHOT 0x30
+
+// リードバックコマンド 0xC2 = 11000010b（チャンネル0のカウントとステータスをラッチ）
+#define PIT_READBACK_CH0 0xC2
+
+// ステータスバイトのビット
+#define PIT_STATUS_OUT        0x80 // 出力（モード0ではカウントが0になると1）
+#define PIT_STATUS_NULL_COUNT 0x40 // 書いたカウントがまだ読み込まれていない
+
+// 1回にプログラムできる最大のカウント（約55ms）
+#define PIT_MAX_COUNT 0xFFFF
+
+// 1ティックのナノ秒
+#define NS_PER_TICK (1000000000u / TIMER_HZ)
+
+// タイマーのティック（TIMER_HZ）カウント
 static volatile uint32_t timer_ticks = 0;
+// ティックに満たないPITクロック数 × TIMER_HZ
+static uint32_t tick_remainder = 0;
+// PITにプログラムしたカウント（0なら停止中）
+static uint32_t pit_count = 0;
+// そのうち既にティックに加えたクロック数
+static uint32_t pit_accounted = 0;
+// タイマー割り込みの回数
+static uint32_t timer_irq_count = 0;
+// 期限を過ぎたタイマーを実行する後半処理
+static tasklet_t timer_tasklet;
+// ティックとPITのロック（タイマーホイールのロックの中で取る）
+static spinlock_t timer_lock = SPINLOCK_INIT;
+
+// プログラムしてから経過したPITクロック数
+static uint32_t pit_elapsed(void) {
+	outb(PIT_COMMAND, PIT_READBACK_CH0);
+	uint8_t status = inb(PIT_CHANNEL0);
+	uint32_t count = inb(PIT_CHANNEL0);
+	count |= (uint32_t)inb(PIT_CHANNEL0) << 8;
+
+	if (status & PIT_STATUS_NULL_COUNT) {
+		return 0;
+	}
+	// 0になった後もカウントは0xFFFFから減り続ける
+	if (status & PIT_STATUS_OUT) {
+		return pit_count + ((0x10000 - count) & 0xFFFF);
+	}
+	return pit_count - count;
+}
 
-// タイマーを初期化（周波数をHz単位で指定）
-void timer_init(uint32_t frequency) {
-	// 分周比を計算
-	uint32_t divisor = PIT_CLOCK / frequency;
-	// PITに制御ワードを送信
-	// 0x36 = 00110110b
-	// - 00: チャンネル0を選択
-	// - 11: 下位バイト、上位バイトの順に送信
-	// - 011: モード3（矩形波）
-	// - 0: 2進数カウント
-	outb(PIT_COMMAND, 0x36);
+// 経過した時間をティックに加える（timer_lockを持って呼ぶ）
+static void timer_account(void) {
+	// クロックソースがあればその時刻から求める（PITが止まっていても進む）
+	if (clock_available()) {
+		uint32_t rest_ns;
+		timer_ticks = (uint32_t)div64_u32(clock_ns(), NS_PER_TICK, &rest_ns);
+		tick_remainder = div64_32((uint64_t)rest_ns * PIT_CLOCK, NS_PER_TICK);
+		return;
+	}
 
-	// 分周比の下位バイトと上位バイトを送信
-	outb(PIT_CHANNEL0, divisor & 0xFF);		// 下位8ビット
-	outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);	// 上位8ビット
+	if (pit_count == 0) {
+		return;
+	}
+
+	uint32_t elapsed = pit_elapsed();
+	if (elapsed <= pit_accounted) {
+		return;
+	}
+	tick_remainder += (elapsed - pit_accounted) * TIMER_HZ;
+	pit_accounted = elapsed;
+	timer_ticks += tick_remainder / PIT_CLOCK;
+	tick_remainder %= PIT_CLOCK;
 }
 
-// タイマーの割り込みハンドラ
+// IRQ0のハンドラ
+static void timer_irq(registers_t* regs, void* ctx) {
+	(void)regs;
+	(void)ctx;
+	timer_handler();
+}
+
+// 期限を過ぎたタイマーの後半処理
+static void timer_softirq(void* data) {
+	(void)data;
+	timer_wheel_run();
+}
+
+// タイマーを初期化
+void timer_init(void) {
+	tasklet_init(&timer_tasklet, timer_softirq, NULL);
+
+	// タイマーが登録されるまではPITを止めておく
+	outb(PIT_COMMAND, PIT_ONESHOT);
+	pit_count = 0;
+
+	// IRQ0にハンドラを登録
+	register_irq_handler(0, timer_irq, NULL);
+}
+
+// タイマーの割り込みハンドラ（時刻を進めてタイマーの処理を後半処理に回す）
 void timer_handler(void) {
-	timer_ticks++;
+	timer_irq_count++;
+	spin_lock(&timer_lock);
+	timer_account();
+	spin_unlock(&timer_lock);
+	tasklet_schedule(&timer_tasklet);
+}
+
+// 次の割り込みを期限のティックにプログラムする
+void timer_program(uint32_t expires) {
+	spin_lock(&timer_lock);
+	timer_account();
+
+	// 期限のティックの境目までのPITクロック数（長ければ最大カウントで一度起きる）
+	int32_t delta = (int32_t)(expires - timer_ticks);
+	uint32_t count;
+	if (delta <= 0) {
+		count = 1;
+	} else if ((uint32_t)delta > PIT_MAX_COUNT * TIMER_HZ / PIT_CLOCK) {
+		count = PIT_MAX_COUNT;
+	} else {
+		count = ((uint32_t)delta * PIT_CLOCK - tick_remainder + TIMER_HZ - 1) / TIMER_HZ;
+		if (count > PIT_MAX_COUNT) {
+			count = PIT_MAX_COUNT;
+		}
+	}
+
+	outb(PIT_COMMAND, PIT_ONESHOT);
+	outb(PIT_CHANNEL0, count & 0xFF);		// 下位8ビット
+	outb(PIT_CHANNEL0, (count >> 8) & 0xFF);	// 上位8ビット
+	pit_count = count;
+	pit_accounted = 0;
+	spin_unlock(&timer_lock);
+}
+
+// PITを止める
+void timer_stop(void) {
+	spin_lock(&timer_lock);
+	timer_account();
+	outb(PIT_COMMAND, PIT_ONESHOT);
+	pit_count = 0;
+	spin_unlock(&timer_lock);
+}
+
+// timer_sleepの期限
+static void timer_sleep_expired(void* data) {
+	*(volatile int*)data = 1;
 }
 
 // 指定したミリ秒待機
 void timer_sleep(uint32_t ms) {
-	// ミリ秒からタイマーティック数に変換（100Hzを仮定）
-	uint32_t ticks = ms / 10;
-	uint32_t target_ticks = timer_ticks + ticks;
+	volatile int done = 0;
+	timer_list_t timer;
+	timer_setup(&timer, timer_sleep_expired, (void*)&done);
 
-	// 目標のティック数に達するまで待機
-	while (timer_ticks < target_ticks) {
-	// 割り込みがないシンプルなOSでは、ポーリングでタイマーを更新
-	timer_handler();
+	// 今のティックの残りが短くても指定した時間は待つよう1ティック足す
+	uint32_t flags = irq_save();
+	mod_timer(&timer, timer_get_ticks() + TIMER_MS_TO_TICKS(ms) + 1);
+
+	// 割り込みを許可してHLTで待ち、後半処理が禁止されていてもここで実行する
+	while (!done) {
+		asm volatile("sti; hlt" : : : "memory");
+		softirq_idle();
+		asm volatile("cli" : : : "memory");
 	}
+	irq_restore(flags);
 }
 
 // タイマーカウントを取得
 uint32_t timer_get_ticks(void) {
-	return timer_ticks;
+	uint32_t flags = spin_lock_irqsave(&timer_lock);
+	timer_account();
+	uint32_t ticks = timer_ticks;
+	spin_unlock_irqrestore(&timer_lock, flags);
+	return ticks;
 }
 
+// タイマー割り込みの回数
+uint32_t timer_interrupts(void) {
+	return timer_irq_count;
+}
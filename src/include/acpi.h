@@ -0,0 +1,68 @@
+// acpi.h - ACPIテーブル（RSDP/RSDT/XSDT/MADT）のインターフェース
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+// MADTから記録するCPUとI/O APICの最大数
+#define ACPI_MAX_CPUS    16
+#define ACPI_MAX_IOAPICS 4
+// ISA IRQの数
+#define ACPI_ISA_IRQS    16
+
+// 割り込みソースオーバーライドのフラグ（MPS INTIフラグ）
+#define ACPI_INTI_POLARITY_MASK 0x3
+#define ACPI_INTI_POLARITY_LOW  0x3
+#define ACPI_INTI_TRIGGER_MASK  0xC
+#define ACPI_INTI_TRIGGER_LEVEL 0xC
+
+// 全テーブル共通のヘッダ
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+// I/O APIC
+typedef struct {
+    uint8_t id;        // I/O APIC ID
+    uint32_t address;  // レジスタの物理アドレス
+    uint32_t gsi_base; // 最初の入力に対応するグローバルシステム割り込み番号
+} acpi_ioapic_t;
+
+// MADTから読み取った割り込みコントローラの構成
+typedef struct {
+    uint32_t lapic_address;                  // ローカルAPICの物理アドレス
+    int has_8259;                            // 8259 PICも実装されているか
+    uint32_t cpu_count;                      // 有効なCPUの数
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];     // 各CPUのローカルAPIC ID
+    uint32_t ioapic_count;                   // I/O APICの数
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    uint32_t isa_gsi[ACPI_ISA_IRQS];         // ISA IRQが接続されたGSI
+    uint16_t isa_flags[ACPI_ISA_IRQS];       // ISA IRQの極性とトリガモード
+    uint8_t nmi_lint;                        // NMIが接続されたLINT番号（0xFFならなし）
+} acpi_madt_info_t;
+
+// RSDPを探してMADTを読む（ACPIがなければ-1、2回目以降は最初の結果を返す）
+int acpi_init(void);
+
+// シグネチャでテーブルを探す（見つからなければNULL）
+const acpi_sdt_header_t* acpi_find_table(const char* signature);
+
+// MADTの内容（acpi_initが成功していなければNULL）
+const acpi_madt_info_t* acpi_madt(void);
+
+// FADTからACPI PMタイマーのI/Oポートを読む（なければ-1、ext32はカウンタが32ビットなら1）
+int acpi_pm_timer(uint16_t* port, int* ext32);
+
+// HPETテーブルからHPETのレジスタの物理アドレスを読む（なければ0）
+uint32_t acpi_hpet_address(void);
+
+#endif // ACPI_H
@@ -0,0 +1,69 @@
+// apic.h - ローカルAPICとI/O APICのインターフェース
+#ifndef APIC_H
+#define APIC_H
+
+#include "stdint.h"
+
+// ローカルAPICのレジスタ（ベースアドレスからのオフセット）
+#define LAPIC_ID          0x020
+#define LAPIC_VERSION     0x030
+#define LAPIC_TPR         0x080
+#define LAPIC_EOI         0x0B0
+#define LAPIC_SVR         0x0F0
+#define LAPIC_ESR         0x280
+#define LAPIC_ICR_LOW     0x300
+#define LAPIC_ICR_HIGH    0x310
+#define LAPIC_LVT_TIMER   0x320
+#define LAPIC_LVT_LINT0   0x350
+#define LAPIC_LVT_LINT1   0x360
+#define LAPIC_LVT_ERROR   0x370
+#define LAPIC_TIMER_INIT  0x380
+#define LAPIC_TIMER_COUNT 0x390
+#define LAPIC_TIMER_DIV   0x3E0
+
+// LVTのビット
+#define LAPIC_LVT_MASKED  (1u << 16)
+#define LAPIC_DELIVERY_NMI (4u << 8)
+
+// ICRの下位32ビット
+#define LAPIC_ICR_FIXED         (0u << 8)  // 配送モード: ベクタで割り込む
+#define LAPIC_ICR_INIT          (5u << 8)  // 配送モード: INIT
+#define LAPIC_ICR_STARTUP       (6u << 8)  // 配送モード: SIPI（ベクタは開始ページ番号）
+#define LAPIC_ICR_NMI           (4u << 8)  // 配送モード: NMI（ベクタは無視される）
+#define LAPIC_ICR_PENDING       (1u << 12) // 送信中
+#define LAPIC_ICR_ASSERT        (1u << 14) // レベル: アサート
+#define LAPIC_ICR_TRIGGER_LEVEL (1u << 15) // トリガ: レベル
+
+// スプリアス割り込みのベクタ（EOIを送ってはいけない）
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+// APICを検出して初期化し、ISA IRQの配送をI/O APICに切り替える（APICがなければ-1でPICのまま）
+int apic_init(void);
+
+// I/O APICで割り込みを配送しているか
+int apic_enabled(void);
+
+// ローカルAPICのレジスタを読み書き
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+
+// このCPUのローカルAPIC ID
+uint32_t lapic_id(void);
+
+// ローカルAPICにEOIを送る（MMIOへの書き込み1回）
+void lapic_eoi(void);
+
+// ローカルAPIC IDがapic_idのCPUにIPIを送る（icrはLAPIC_ICR_*とベクタ、送信が終わるまで待つ）
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+
+// APのローカルAPICを有効化（apic_initが成功した後にAPから呼ぶ）
+void apic_init_ap(void);
+
+// ISA IRQのリダイレクションエントリをマスク/マスク解除
+void ioapic_mask_irq(uint8_t irq);
+void ioapic_unmask_irq(uint8_t irq);
+
+// I/O APICの数
+uint32_t ioapic_count(void);
+
+#endif // APIC_H
@@ -0,0 +1,50 @@
+// arena.h - アリーナ（リージョン）アロケータのインターフェース
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+// チャンクサイズの既定値
+#define ARENA_DEFAULT_CHUNK 4096
+// arena_allocが返すアドレスのアライン
+#define ARENA_ALIGN 8
+
+typedef struct arena_chunk arena_chunk_t;
+
+// アリーナ（チャンクを連結し、ポインタを進めるだけで割り当てる）
+typedef struct arena {
+    arena_chunk_t* first;   // 最初のチャンク
+    arena_chunk_t* current; // 割り当て中のチャンク
+    size_t chunk_size;      // 新しいチャンクの既定の大きさ
+    size_t used;            // 割り当て済みのバイト数
+    size_t peak;            // usedの最大値
+    uint32_t chunk_count;   // 確保しているチャンク数
+} arena_t;
+
+// arena_resetで戻る位置
+typedef struct arena_mark {
+    arena_chunk_t* chunk;   // その時点のチャンク（NULLなら空の状態）
+    size_t offset;          // チャンク内の使用量
+    size_t used;            // その時点のused
+} arena_mark_t;
+
+// アリーナを作成（chunk_sizeが0なら既定値、失敗時はNULL）
+arena_t* arena_create(size_t chunk_size);
+
+// アリーナからsizeバイトを割り当てる（失敗時はNULL、個別の解放はできない）
+void* arena_alloc(arena_t* arena, size_t size);
+
+// 現在の位置を記録
+arena_mark_t arena_mark(arena_t* arena);
+
+// 記録した位置より後の割り当てをまとめて解放（初期化した位置なら全体）
+void arena_reset(arena_t* arena, arena_mark_t mark);
+
+// アリーナとすべてのチャンクを解放
+void arena_destroy(arena_t* arena);
+
+// 作業用アリーナ（シェルがコマンドごとにリセットする、memory_initの後に使える）
+arena_t* arena_scratch(void);
+
+#endif // ARENA_H
@@ -0,0 +1,30 @@
+// clock.h - クロックソース（TSC/HPET/ACPI PMタイマー）とナノ秒単位の単調時計のインターフェース
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "stdint.h"
+
+// TSCをPITで較正し、使えるクロックソースを選ぶ（timer_initの後に呼ぶ）
+// 不変TSC、HPET、ACPI PMタイマー、不変でないTSCの順に選ぶ
+void clock_init(void);
+
+// クロックソースが選ばれているか（0ならclock_nsはタイマーのティックから求める）
+int clock_available(void);
+
+// 起動してからのナノ秒（単調増加）
+uint64_t clock_ns(void);
+
+// TSCの値（TSCがなければ0）。短い区間の計測用で、差をclock_cycles_to_nsで換算する
+uint64_t clock_cycles(void);
+
+// TSCのサイクル数をナノ秒に換算（較正できていなければ0）
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+// 較正したTSCの周波数（kHz、TSCがなければ0）
+uint32_t clock_tsc_khz(void);
+
+// 選ばれたクロックソースの名前と周波数（kHz）
+const char* clock_source_name(void);
+uint32_t clock_source_khz(void);
+
+#endif // CLOCK_H
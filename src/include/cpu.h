@@ -0,0 +1,178 @@
+// cpu.h - CPUの機能判定と制御レジスタ操作のインターフェース
+#ifndef CPU_H
+#define CPU_H
+
+#include "stdint.h"
+
+// 機能ビットの番号（CPUIDのレジスタ番号 * 32 + ビット位置）
+#define CPU_WORD_1_EDX      0 // CPUID 1 EDX
+#define CPU_WORD_1_ECX      1 // CPUID 1 ECX
+#define CPU_WORD_EXT1_EDX   2 // CPUID 0x80000001 EDX
+#define CPU_WORD_EXT7_EDX   3 // CPUID 0x80000007 EDX
+#define CPU_WORDS           4
+
+#define CPU_FEATURE(word, bit) (((word) << 5) | (bit))
+
+#define CPU_FEATURE_FPU      CPU_FEATURE(CPU_WORD_1_EDX, 0)
+#define CPU_FEATURE_PSE      CPU_FEATURE(CPU_WORD_1_EDX, 3)
+#define CPU_FEATURE_TSC      CPU_FEATURE(CPU_WORD_1_EDX, 4)
+#define CPU_FEATURE_MSR      CPU_FEATURE(CPU_WORD_1_EDX, 5)
+#define CPU_FEATURE_APIC     CPU_FEATURE(CPU_WORD_1_EDX, 9)
+#define CPU_FEATURE_PGE      CPU_FEATURE(CPU_WORD_1_EDX, 13)
+#define CPU_FEATURE_PAT      CPU_FEATURE(CPU_WORD_1_EDX, 16)
+#define CPU_FEATURE_FXSR     CPU_FEATURE(CPU_WORD_1_EDX, 24)
+#define CPU_FEATURE_SSE      CPU_FEATURE(CPU_WORD_1_EDX, 25)
+#define CPU_FEATURE_SSE2     CPU_FEATURE(CPU_WORD_1_EDX, 26)
+#define CPU_FEATURE_SSE3     CPU_FEATURE(CPU_WORD_1_ECX, 0)
+#define CPU_FEATURE_SSSE3    CPU_FEATURE(CPU_WORD_1_ECX, 9)
+#define CPU_FEATURE_X2APIC   CPU_FEATURE(CPU_WORD_1_ECX, 21)
+#define CPU_FEATURE_INVARIANT_TSC CPU_FEATURE(CPU_WORD_EXT7_EDX, 8)
+
+// 制御レジスタのビット
+#define CR0_MP  (1u << 1)
+#define CR0_EM  (1u << 2)
+#define CR0_TS  (1u << 3)
+#define CR0_NE  (1u << 5)
+#define CR0_WP  (1u << 16)
+#define CR0_PG  (1u << 31)
+#define CR4_PSE (1u << 4)
+#define CR4_PGE (1u << 7)
+#define CR4_OSFXSR     (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+
+// PAT（ページ属性テーブル）のMSRと設定値
+// 電源投入時の値（WB, WT, UC-, UC の繰り返し）のうち、1番（PWTだけ）をWC（0x01）に変える
+#define MSR_IA32_PAT 0x277
+#define PAT_VALUE    0x0007040600070106ULL
+
+// 扱うCPUの最大数
+#define MAX_CPUS 16
+
+// CPUごとの領域（GSセグメントのベースが指す、gdt_initで設定する）
+typedef struct cpu_local {
+    struct cpu_local* self; // 自分自身のアドレス
+    uint32_t id;            // CPUの番号（0がBSP）
+} cpu_local_t;
+
+// 現在のCPUの番号（GSの指すCPUごとの領域から読む、メモリアクセス1回）
+static inline uint32_t cpu_current(void) {
+    uint32_t id;
+    asm volatile("movl %%gs:%c1, %0" : "=r" (id) : "i" (__builtin_offsetof(cpu_local_t, id)));
+    return id;
+}
+
+// 現在のCPUの領域
+static inline cpu_local_t* cpu_local(void) {
+    cpu_local_t* local;
+    asm volatile("movl %%gs:%c1, %0" : "=r" (local) : "i" (__builtin_offsetof(cpu_local_t, self)));
+    return local;
+}
+
+// CPUID命令
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d) : "a" (leaf), "c" (0));
+}
+
+// 制御レジスタの読み書き
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    asm volatile("mov %%cr0, %0" : "=r" (value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    asm volatile("mov %0, %%cr0" : : "r" (value) : "memory");
+}
+
+static inline uint32_t read_cr2(void) {
+    uint32_t value;
+    asm volatile("mov %%cr2, %0" : "=r" (value));
+    return value;
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t value;
+    asm volatile("mov %%cr3, %0" : "=r" (value));
+    return value;
+}
+
+static inline void write_cr3(uint32_t value) {
+    asm volatile("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    asm volatile("mov %%cr4, %0" : "=r" (value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    asm volatile("mov %0, %%cr4" : : "r" (value) : "memory");
+}
+
+// MSRの読み書き
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)) : "memory");
+}
+
+// タイムスタンプカウンタを読む
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// 64ビットを32ビットで割る（商が32ビットに収まらなければ0xFFFFFFFF、libgccを使わない）
+static inline uint32_t div64_32(uint64_t dividend, uint32_t divisor) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t quotient, remainder;
+    if (divisor == 0 || high >= divisor) {
+        return 0xFFFFFFFF;
+    }
+    asm("divl %4" : "=a" (quotient), "=d" (remainder) : "a" ((uint32_t)dividend), "d" (high), "rm" (divisor));
+    (void)remainder;
+    return quotient;
+}
+
+// 64ビットを32ビットで割る（商も64ビット、remainderがNULLでなければ余りも返す）
+static inline uint64_t div64_u32(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t quotient_high = high / divisor;
+    uint32_t quotient_low, rest;
+    asm("divl %4" : "=a" (quotient_low), "=d" (rest) : "a" ((uint32_t)dividend), "d" (high % divisor), "rm" (divisor));
+    if (remainder != 0) {
+        *remainder = rest;
+    }
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+}
+
+// 指定したアドレスのTLBエントリを無効化
+static inline void invlpg(uint32_t addr) {
+    asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+// CPUIDで機能を調べる
+void cpu_init(void);
+
+// APでFPUとSSEとPATを使えるようにする（機能はBSPのcpu_initで調べたものを使う）
+void cpu_init_ap(void);
+
+// 機能を持っているか
+int cpu_has(uint32_t feature);
+
+// SSEが有効化されているか（CR4.OSFXSR）
+int cpu_sse_enabled(void);
+
+// PATの1番をライトコンバイニングにしたか（PAGE_WCが使えるか）
+int cpu_pat_enabled(void);
+
+// ベンダー文字列（"GenuineIntel" など）
+const char* cpu_vendor(void);
+
+#endif // CPU_H
@@ -2,6 +2,10 @@
 #define DEBUG_H
 
 #include "stdint.h"
+#include "stddef.h"
+
+// ログを記録しておくリングの大きさ（2の冪）
+#define DEBUG_LOG_SIZE 4096
 
 // デバッグメッセージを表示
 void debug_log(const char* message);
@@ -9,4 +13,10 @@ void debug_log(const char* message);
 // 数値付きデバッグメッセージを表示
 void debug_log_int(const char* message, int value);
 
+// 書式化済みの出力をそのままログに積む（kprintfの出力先、改行は付けない）
+void debug_log_write(const char* data, size_t length);
+
+// 記録したログを取り出して表示（to_serialなら画面ではなくCOM1に送る、シェルから1つだけ呼ぶ）
+void debug_dump(int to_serial);
+
 #endif // DEBUG_H
\ No newline at end of file
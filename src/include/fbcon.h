@@ -0,0 +1,31 @@
+// fbcon.h - リニアフレームバッファに文字を描くコンソールのインターフェース
+#ifndef FBCON_H
+#define FBCON_H
+
+#include "stdint.h"
+#include "multiboot.h"
+
+// 描いた文字を覚えておくキャッシュのエントリ数（2の冪）
+#define GLYPH_CACHE_SIZE 256
+
+// フレームバッファを書き込み結合でマップして使えるようにする（15/16/24/32ビット色、失敗時は-1）
+int fbcon_init(const multiboot_tag_framebuffer_t* info);
+
+// 文字の桁数と行数
+int fbcon_columns(void);
+int fbcon_rows(void);
+
+// ライトコンバイニングでマップしたか
+int fbcon_write_combining(void);
+
+// first行目からcount行を描く（cellsはVGAと同じ文字と色属性の並び、1行widthセルでstrideセルずつ進む）
+void fbcon_draw_rows(int first, int count, const uint16_t* cells, int width, int stride);
+
+// 1セルを描く（cursorが0でなければ下端に下線のカーソルを重ねる）
+void fbcon_draw_cell(int x, int y, uint16_t cell, int cursor);
+
+// キャッシュに当たった回数と描き起こした回数
+uint32_t fbcon_cache_hits(void);
+uint32_t fbcon_cache_misses(void);
+
+#endif // FBCON_H
@@ -0,0 +1,15 @@
+// font.h - 組み込みのビットマップフォント
+#ifndef FONT_H
+#define FONT_H
+
+#include "stdint.h"
+
+// 文字の大きさ（ドット）と収録している文字数（ASCII）
+#define FONT_WIDTH  8
+#define FONT_HEIGHT 16
+#define FONT_GLYPHS 128
+
+// 文字ごとに1行1バイト（最上位ビットが左端）
+extern const uint8_t font_8x16[FONT_GLYPHS][FONT_HEIGHT];
+
+#endif // FONT_H
@@ -0,0 +1,46 @@
+// fpu.h - FPU/SSEの状態の遅延保存（#NM）とカーネル内でのSIMD利用のインターフェース
+#ifndef FPU_H
+#define FPU_H
+
+#include "stdint.h"
+
+// FXSAVEの保存領域の大きさ
+#define FPU_STATE_SIZE 512
+
+// コンテキストごとのFPU/SSEの状態（FXSAVEの形式、16バイト境界が必要）
+typedef struct {
+    uint8_t fxsave[FPU_STATE_SIZE]; // FXSAVEの保存領域
+    uint32_t used;                  // 一度でもFPUを使ったか（0なら初期状態を読み込む）
+} __attribute__((aligned(16))) fpu_state_t;
+
+// 遅延保存を有効化（#NMハンドラを登録し、起動時のコンテキストの状態を用意する）
+void fpu_init(void);
+
+// APの状態を初期化（BSPのfpu_initの後にAPから呼ぶ、最初のコンテキストはfpu_switchで設定する）
+void fpu_init_ap(void);
+
+// FPU/SSEの状態を遅延保存で管理しているか
+int fpu_lazy_enabled(void);
+
+// コンテキストの状態を初期化（まだFPUを使っていない状態）
+void fpu_state_init(fpu_state_t* state);
+
+// 実行するコンテキストを切り替える（レジスタの状態が別のコンテキストのものならCR0.TSを立てる）
+void fpu_switch(fpu_state_t* next);
+
+// コンテキストが終了するときに呼ぶ（レジスタの持ち主なら手放す）
+void fpu_release(fpu_state_t* state);
+
+// カーネル内でSIMDを使う区間を開始（使えれば1、使えなければ0を返す）
+// 0のときはXMMレジスタに触れずにスカラーの処理に切り替えること。
+// 区間の中では割り込みは許可されたままで、割り込みハンドラ内の区間は0を返す（入れ子にしない）
+int kernel_fpu_begin(void);
+
+// カーネル内でSIMDを使う区間を終了（kernel_fpu_beginが1を返したときだけ呼ぶ）
+void kernel_fpu_end(void);
+
+// #NMで状態を入れ替えた回数と、カーネル区間で状態を保存した回数
+uint32_t fpu_traps(void);
+uint32_t fpu_saves(void);
+
+#endif // FPU_H
@@ -0,0 +1,21 @@
+// gdt.h - CPUごとのGDTとTSSのインターフェース
+#ifndef GDT_H
+#define GDT_H
+
+#include "stdint.h"
+
+// セグメントセレクタ（IDTのゲートはGDT_KERNEL_CODEを使う）
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_PERCPU      0x18 // GSに入れる、ベースがCPUごとの領域を指す
+#define GDT_TSS         0x20
+
+// GDTのエントリ数
+#define GDT_ENTRIES 5
+
+// CPUのGDTとTSSを作って読み込み、GSがCPUごとの領域を指すようにする
+// BSPはkernel_mainの最初に呼ぶ（これより前はcpu_currentを使えない）
+// stack_topは特権レベルが変わる割り込みで使うスタック（TSSのESP0）
+void gdt_init(uint32_t cpu, uint32_t stack_top);
+
+#endif // GDT_H
@@ -19,15 +19,71 @@ typedef struct {
     uint32_t base;         // IDTのベースアドレス
 } __attribute__((packed)) idt_ptr_t;
 
+// IDTのエントリ数
+#define IDT_SIZE 256
+
+// CPU例外の数（ベクタ0-31）
+#define EXCEPTION_COUNT 32
+
+// PICのIRQを割り当てるベクタ（IRQ0-15 → 32-47）
+#define IRQ_BASE 32
+#define IRQ_COUNT 16
+#define IRQ_VECTOR(irq) (IRQ_BASE + (irq))
+
+// 割り込み時にスタックに積まれるレジスタ（interrupt_asm.asmの共通スタブが作る）
+typedef struct registers {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; // pushaで保存したレジスタ
+    uint32_t int_no;                                 // ベクタ番号
+    uint32_t err_code;                               // エラーコード（なければ0）
+    uint32_t eip, cs, eflags;                        // CPUが積んだ戻り先
+} registers_t;
+
+// 割り込みハンドラ（ctxは登録時に渡した値）
+typedef void (*interrupt_handler_t)(registers_t* regs, void* ctx);
+
 // 割り込み処理の初期化
 void interrupt_init(void);
 
+// APにBSPと同じIDTを読み込む
+void interrupt_init_ap(void);
+
+// ベクタにハンドラを登録（既に登録されていれば-1）
+int register_interrupt_handler(uint8_t vector, interrupt_handler_t fn, void* ctx);
+
+// IRQにハンドラを登録してそのIRQのマスクを外す（既に登録されていれば-1）
+int register_irq_handler(uint8_t irq, interrupt_handler_t fn, void* ctx);
+
+// IRQのハンドラを削除してマスクする
+void unregister_irq_handler(uint8_t irq);
+
+// IRQの配送をI/O APICに切り替える（apic_initから呼ばれる）
+void interrupt_switch_to_apic(void);
+
+// 割り込みの配送に使っているコントローラの名前（"APIC" または "8259 PIC"）
+const char* interrupt_controller(void);
+
+// IRQをマスク/マスク解除（PICのマスクのキャッシュを更新し、変わったポートだけ書き込む）
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+
 // 割り込みを有効化
 void interrupt_enable(void);
 
 // 割り込みを無効化
 void interrupt_disable(void);
 
+// 割り込みを無効化し、直前のEFLAGSを返す（割り込みコンテキストからも使える）
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+// irq_saveで保存したEFLAGSを戻す
+static inline void irq_restore(uint32_t flags) {
+    asm volatile("pushl %0; popfl" : : "r" (flags) : "memory", "cc");
+}
+
 // 特定の割り込みハンドラを設定
 void set_interrupt_handler(uint8_t n, uint32_t handler);
 
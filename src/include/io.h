@@ -26,4 +26,11 @@ static inline void outw(unsigned short port, unsigned short data) {
 	__asm__ volatile("outw %0, %1" : : "a" (data), "Nd" (port));
 }
 
+// ポートから4バイトのデータを読み取る
+static inline unsigned int inl(unsigned short port) {
+	unsigned int result;
+	__asm__ volatile("inl %1, %0" : "=a" (result) : "Nd" (port));
+	return result;
+}
+
 #endif // IO_H
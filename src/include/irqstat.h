@@ -0,0 +1,28 @@
+// irqstat.h - ベクタごとの割り込みの回数と処理時間の統計
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+#include "stdint.h"
+
+// 処理時間のヒストグラムのバケット数（log2(サイクル数)ごと）
+#define IRQSTAT_BUCKETS 32
+
+// 統計を初期化（TSCがあればサイクル数も記録する）
+void irqstat_init(void);
+
+// 割り込みの入口で呼ぶ（TSCの値、TSCがなければ0）
+uint64_t irqstat_begin(void);
+
+// 割り込みの出口で呼ぶ（入口の値から処理時間を求めて記録）
+void irqstat_end(uint32_t vector, uint64_t start);
+
+// 統計を画面に表示
+void irqstat_show(void);
+
+// 統計をCOM1に機械可読な形式で出力
+void irqstat_dump(void);
+
+// 統計をリセット
+void irqstat_reset(void);
+
+#endif // IRQSTAT_H
@@ -26,20 +26,22 @@
 #define KEY_F10         0x44
 #define KEY_NUMLOCK     0x45
 #define KEY_SCROLLLOCK  0x46
+#define KEY_PAGEUP      0x49
+#define KEY_PAGEDOWN    0x51
 
 // キーボードデータポート
 #define KEYBOARD_DATA_PORT 0x60
 
-// キーバッファのサイズ
+// キーバッファのサイズ（2の冪）
 #define KEYBOARD_BUFFER_SIZE 256
 
 // キーボードを初期化
 void keyboard_init(void);
 
-// キー入力を処理
+// キー入力をポーリングで処理（割り込みを使えないときだけ）
 void keyboard_process(void);
 
-// キー入力を待つ（次のキー入力があるまでブロック）
+// キー入力を待つ（次のキー入力があるまでスレッドを止める、割り込みを有効にして呼ぶ）
 char keyboard_get_char(void);
 
 // キーバッファに文字があるか確認
@@ -48,6 +50,9 @@ uint8_t keyboard_has_key(void);
 // キーボード割り込みハンドラ
 void keyboard_handler(void);
 
+// キーボード以外（シリアルコンソールなど）から届いた文字をキー入力として扱う（割り込みハンドラからも呼べる）
+void keyboard_input(char c);
+
 
 
 #endif // KEYBOARD_H
@@ -0,0 +1,44 @@
+// kprintf.h - 書式付きの出力（画面、シリアル、ログ）のインターフェース
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+#include "stdint.h"
+#include "stddef.h"
+#include "stdarg.h"
+
+// 出力先（ビットの組み合わせで指定する、登録順に1ビットずつ）
+#define KPRINTF_SCREEN 0x1 // 画面
+#define KPRINTF_SERIAL 0x2 // COM1
+#define KPRINTF_LOG    0x4 // ログのリング（dmesg）
+#define KPRINTF_ALL    0xFFFFFFFF
+
+// 登録できる出力先の最大数
+#define KPRINTF_MAX_SINKS 8
+// 1回の呼び出しで溜めておくバイト数（溢れたらその時点で書き出す）
+#define KPRINTF_BUFFER_SIZE 256
+// 1回の書き出しに入る色の切り替えの最大数
+#define KPRINTF_MAX_RUNS 16
+
+// 出力先の書き込み関数（色を使わない出力先はcolorを無視する）
+typedef void (*kprintf_write_t)(const char* data, size_t length, uint8_t color);
+
+// 出力先を登録（colored が0なら色ごとに分けず1回で受け取る、割り当てたビットを返し、満杯なら0）
+uint32_t kprintf_register_sink(kprintf_write_t write, int colored);
+
+// 書式:
+//   %d %i %u %x %X %c %s %p %%、長さ修飾子 z l ll（llは64ビット）
+//   フラグ '-'（左寄せ）と '0'（ゼロ埋め）、幅（数字か '*'）
+//   %C は色の切り替え（引数はvga_entry_colorの色属性、色を使わない出力先では何も出ない）
+
+// bufferに書式化する（最大size-1文字と終端、切り捨てずに書いたはずの文字数を返す）
+int ksnprintf(char* buffer, size_t size, const char* format, ...);
+int kvsnprintf(char* buffer, size_t size, const char* format, va_list args);
+
+// 画面に出力（書いた文字数を返す）
+int kprintf(const char* format, ...);
+
+// sinksで指定した出力先に出力（出力先ごとに溜めてまとめて書く）
+int kprintf_to(uint32_t sinks, const char* format, ...);
+int kvprintf_to(uint32_t sinks, const char* format, va_list args);
+
+#endif // KPRINTF_H
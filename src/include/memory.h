@@ -4,27 +4,36 @@
 
 #include "stdint.h"
 #include "stddef.h"
+#include "string.h"
 
 // メモリの初期化
 void memory_init(void);
 
+// キャッシュラインのサイズ
+#define CACHE_LINE_SIZE 64
+
 // メモリの割り当て
 void* kmalloc(size_t size);
 
+// アライン指定付きのメモリ割り当て（alignは2の冪、例: CACHE_LINE_SIZE）
+void* kmalloc_aligned(size_t size, size_t align);
+
 // メモリの解放
 void kfree(void* ptr);
 
-// 指定アドレスからサイズ分のメモリを0で埋める
-void memset(void* ptr, int value, size_t size);
-
-// メモリ間のコピー
-void memcpy(void* dest, const void* src, size_t size);
+// ヒープの高水位線を設定（これを超えた末尾の空きページはシステムに返す）
+void memory_set_high_watermark(size_t bytes);
 
 // メモリの統計情報を表示
 void memory_stats(void);
 
-void int_to_string(uint32_t value, char* buffer);
+// ヒーププロファイル（サイズ分布、ピーク、断片化、呼び出し元）を表示
+void heap_profile(void);
+
+// ヒーププロファイルをCOM1に機械可読な形式で出力
+void heap_profile_dump(void);
 
+// サイズを「1.50KB」のような形式に変換（bufferは16バイト以上）
 void print_size(size_t size, char* buffer);
 
 #endif // MEMORY_H
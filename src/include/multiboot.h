@@ -0,0 +1,106 @@
+// multiboot.h - マルチブート2情報構造体のインターフェース
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "stdint.h"
+
+// ブートローダがEAXに入れて渡すマジックナンバー
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+
+// タグの種類
+#define MULTIBOOT_TAG_TYPE_END           0
+#define MULTIBOOT_TAG_TYPE_CMDLINE       1
+#define MULTIBOOT_TAG_TYPE_BASIC_MEMINFO 4
+#define MULTIBOOT_TAG_TYPE_MMAP          6
+#define MULTIBOOT_TAG_TYPE_FRAMEBUFFER   8
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD      14
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW      15
+
+// フレームバッファの種類
+#define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED  0
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB      1
+#define MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT 2
+
+// メモリマップのエントリの種類
+#define MULTIBOOT_MEMORY_AVAILABLE        1
+#define MULTIBOOT_MEMORY_RESERVED         2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS              4
+#define MULTIBOOT_MEMORY_BADRAM           5
+
+// タグの共通ヘッダ（タグは8バイト境界に並ぶ）
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+} multiboot_tag_t;
+
+// 基本メモリ情報タグ（KB単位）
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+} multiboot_tag_basic_meminfo_t;
+
+// メモリマップのエントリ
+typedef struct {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+    uint32_t zero;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// メモリマップタグ
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+} multiboot_tag_mmap_t;
+
+// フレームバッファ情報タグ（RGBのときは後ろに色の並びが続く）
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint64_t addr;          // 物理アドレス
+    uint32_t pitch;         // 1行のバイト数
+    uint32_t width;         // 幅（ピクセル、テキストなら文字）
+    uint32_t height;        // 高さ
+    uint8_t bpp;            // 1ピクセルのビット数
+    uint8_t framebuffer_type;
+    uint16_t reserved;
+    // MULTIBOOT_FRAMEBUFFER_TYPE_RGBのときの色の位置と幅（ビット）
+    uint8_t red_position;
+    uint8_t red_size;
+    uint8_t green_position;
+    uint8_t green_size;
+    uint8_t blue_position;
+    uint8_t blue_size;
+} __attribute__((packed)) multiboot_tag_framebuffer_t;
+
+// マルチブート情報を登録（マジックが正しくなければ1を返す）
+int multiboot_init(uint32_t magic, uint32_t addr);
+
+// マルチブート情報が有効か
+int multiboot_valid(void);
+
+// マルチブート情報構造体の先頭アドレスとサイズ
+uint32_t multiboot_info_addr(void);
+uint32_t multiboot_info_size(void);
+
+// 指定した種類の最初のタグを探す（見つからなければNULL）
+const multiboot_tag_t* multiboot_find_tag(uint32_t type);
+
+// メモリマップのエントリ数
+uint32_t multiboot_mmap_count(void);
+
+// メモリマップのi番目のエントリ
+const multiboot_mmap_entry_t* multiboot_mmap_entry(uint32_t index);
+
+// RGBのフレームバッファ情報（ブートローダがグラフィックモードにしていなければNULL）
+const multiboot_tag_framebuffer_t* multiboot_framebuffer(void);
+
+// ブートローダが画面をテキストモードのままにしているか（フレームバッファのタグがないかEGAテキスト）
+int multiboot_text_mode(void);
+
+#endif // MULTIBOOT_H
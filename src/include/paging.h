@@ -0,0 +1,73 @@
+// paging.h - ページングと仮想メモリのインターフェース
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+// ページテーブルエントリのフラグ
+#define PAGE_PRESENT  0x001
+#define PAGE_WRITE    0x002
+#define PAGE_USER     0x004
+#define PAGE_PWT      0x008
+#define PAGE_PCD      0x010
+#define PAGE_ACCESSED 0x020
+#define PAGE_DIRTY    0x040
+#define PAGE_LARGE    0x080 // ページディレクトリエントリ: 4MBページ
+#define PAGE_GLOBAL   0x100
+
+// ライトコンバイニング（PATの1番、cpu_pat_enabledのときだけ。そうでなければライトスルー）
+#define PAGE_WC       PAGE_PWT
+
+// 4MBページのサイズ
+#define LARGE_PAGE_SIZE 0x400000
+
+// カーネルヒープの仮想領域（必要に応じて4KBページをマップして伸縮する）
+#define HEAP_VIRT_START 0xC0000000
+#define HEAP_VIRT_END   0xD0000000
+
+// 初回アクセス時にゼロページを割り当てる仮想領域
+#define VM_LAZY_START 0xD0000000
+#define VM_LAZY_END   0xE0000000
+
+// ページングの統計情報
+typedef struct {
+    uint32_t page_faults;        // ページフォルトの総数
+    uint32_t demand_zero_faults; // ゼロページを割り当てたフォルト数
+    uint32_t mapped_pages;       // 4KBでマップされているページ数
+    uint32_t large_pages;        // 4MBでマップされているページ数
+    uint32_t page_tables;        // 割り当てたページテーブル数
+    uint32_t lazy_reserved;      // 予約済みの遅延割り当て領域（バイト）
+} paging_stats_t;
+
+// ページングを初期化して有効化（物理メモリをアイデンティティマップ）
+void paging_init(void);
+
+// 4KBページをマップ
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags);
+
+// 物理アドレスの範囲を同じ仮想アドレスにマップ（MMIOやACPIテーブル用、失敗時はNULL）
+void* paging_map_identity(uint32_t phys, size_t size, uint32_t flags);
+
+// 4KBページのマップを解除（マップされていた物理アドレスを返す、なければ0）
+uint32_t paging_unmap(uint32_t virt);
+
+// 仮想アドレスに対応する物理アドレス（マップされていなければ0）
+uint32_t paging_virt_to_phys(uint32_t virt);
+
+// 初回アクセス時に物理メモリを割り当てる領域を予約（失敗時はNULL）
+void* vm_reserve(size_t size);
+
+// vm_reserveで予約した領域を解放（触ったページの物理メモリも返却）
+void vm_release(void* addr);
+
+// ページフォルトハンドラ（例外14のハンドラから呼ばれる）
+void page_fault_handler(uint32_t fault_addr, uint32_t err_code);
+
+// 統計情報を取得
+void paging_get_stats(paging_stats_t* stats);
+
+// 統計情報を表示
+void paging_stats(void);
+
+#endif // PAGING_H
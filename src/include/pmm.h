@@ -0,0 +1,40 @@
+// pmm.h - 物理ページフレームアロケータ（バディ方式）のインターフェース
+#ifndef PMM_H
+#define PMM_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+// ページサイズ
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+// 管理するブロックの次数（0: 4KB ... 10: 4MB）
+#define PMM_MAX_ORDER 11
+
+// 管理対象とする物理アドレスの範囲（1MB未満はBIOSやVGAが使うので除外）
+#define PMM_MIN_PHYS 0x100000
+#define PMM_MAX_PHYS 0xC0000000
+
+// マルチブートのメモリマップから物理ページアロケータを初期化
+void pmm_init(void);
+
+// 2^order ページの連続した物理ページを割り当てる（失敗時はNULL）
+void* alloc_pages(uint32_t order);
+
+// alloc_pagesで割り当てたページを解放
+void free_pages(void* addr, uint32_t order);
+
+// 指定した次数の空きブロック数
+uint32_t pmm_free_blocks(uint32_t order);
+
+// 空きページ数
+uint32_t pmm_free_page_count(void);
+
+// 管理しているページの総数
+uint32_t pmm_total_pages(void);
+
+// 管理している物理アドレスの上限
+uint32_t pmm_max_phys(void);
+
+#endif // PMM_H
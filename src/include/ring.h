@@ -0,0 +1,62 @@
+// ring.h - ロックなしのリングバッファ（SPSC/MPSC）のインターフェース
+#ifndef RING_H
+#define RING_H
+
+#include "stdint.h"
+#include "memory.h"
+
+// バイトのリングバッファ（大きさは2の冪、添字は一周させずに増やし続けてマスクで引く）
+// 生産者と消費者の添字は別のキャッシュラインに置き、互いの書き込みで無効化し合わないようにする
+typedef struct ring {
+    // 生産者側
+    volatile uint32_t head __attribute__((aligned(CACHE_LINE_SIZE))); // 消費者に見せた位置
+    volatile uint32_t reserve;      // MPSCで生産者が予約した位置
+    uint32_t tail_cache;            // 最後に読んだtail（SPSCの生産者だけが使う）
+    // 消費者側
+    volatile uint32_t tail __attribute__((aligned(CACHE_LINE_SIZE))); // 消費者が読んだ位置
+    uint32_t head_cache;            // 最後に読んだhead
+    // 変わらない値（両方が読む）
+    uint8_t* buffer __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint32_t mask;                  // 大きさ - 1
+} ring_t;
+
+// リングを初期化（sizeは2の冪、bufferはsizeバイト）
+void ring_init(ring_t* ring, void* buffer, uint32_t size);
+
+// 溜まっているバイト数と空きのバイト数（どちらの側からも呼べる、目安）
+uint32_t ring_count(const ring_t* ring);
+uint32_t ring_space(const ring_t* ring);
+
+// 空かどうか
+static inline int ring_empty(const ring_t* ring) {
+    return ring->head == ring->tail;
+}
+
+// ---- 生産者が1つ（SPSC） ----
+
+// 1バイト積む（一杯なら-1）
+int ring_push(ring_t* ring, uint8_t value);
+
+// 最大countバイト積む（積んだバイト数を返す）
+uint32_t ring_push_n(ring_t* ring, const void* data, uint32_t count);
+
+// ---- 生産者が複数（MPSC、割り込みハンドラや他のCPUからも呼べる） ----
+
+// 1バイト積む（一杯なら-1）
+int ring_mpsc_push(ring_t* ring, uint8_t value);
+
+// 最大countバイトをまとめて積む（積んだバイト数を返す、途中に他の生産者のバイトは挟まらない）
+uint32_t ring_mpsc_push_n(ring_t* ring, const void* data, uint32_t count);
+
+// countバイトを全部まとめて積む（空きが足りなければ何も積まずに-1、途中までは積まない）
+int ring_mpsc_push_all(ring_t* ring, const void* data, uint32_t count);
+
+// ---- 消費者（SPSC/MPSC共通、消費者は1つ） ----
+
+// 1バイト取り出す（空なら-1）
+int ring_pop(ring_t* ring, uint8_t* value);
+
+// 最大countバイト取り出す（取り出したバイト数を返す）
+uint32_t ring_pop_n(ring_t* ring, void* out, uint32_t count);
+
+#endif // RING_H
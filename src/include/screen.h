@@ -3,11 +3,19 @@
 #define SCREEN_H
 
 #include "stdint.h"
+#include "stddef.h"
 
 //  画面の幅と高さ
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 
+// フレームバッファで使う桁数と行数の上限
+#define SCREEN_MAX_COLS 160
+#define SCREEN_MAX_ROWS 64
+
+// スクロールバックに残す行数
+#define SCREEN_SCROLLBACK_LINES 256
+
 // VGAテキストモードの色定義
  #define VGA_COLOR_BLACK         0
  #define VGA_COLOR_BLUE          1
@@ -39,9 +47,12 @@ static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
 	return (uint16_t) uc | ((uint16_t) color << 8);
 }
 
-// 画面を初期化
+// 画面を初期化（multiboot_initの後に呼ぶ。グラフィックモードならフレームバッファを使うまで溜めておく）
 void screen_init(void);
 
+// ブートローダが用意したフレームバッファのコンソールに切り替える（paging_initの後、使えなければ-1）
+int screen_init_framebuffer(void);
+
 // 画面をクリア
 void screen_clear(void);
 
@@ -51,13 +62,37 @@ void screen_put_char(char c, uint8_t color);
 // 文字列を指定した色で表示
 void screen_write(const char* str, uint8_t color);
 
+// 長さを指定して文字列を表示（終端の'\0'はいらない）
+void screen_write_n(const char* str, size_t length, uint8_t color);
+
+// 指定した位置に文字列を表示（カーソルは動かさず、行末で切る）
+void screen_write_at(int x, int y, const char* str, uint8_t color);
+
+// first行目からcount行を1行上にずらし、最後の行を空ける
+void screen_scroll_rows(int first, int count);
+
+// スクロールバックを見返す（linesが正なら古い方へ、負なら新しい方へ。次に書くと最新に戻る）
+void screen_scrollback(int lines);
+
+// まだ写していない変更をVGAのメモリに写す（書き込みの関数は終わりに自分で写す）
+void screen_flush(void);
+
 // 改行
 void screen_newline(void);
 
+// 例外で止まる前に他のCPUを止め、画面のロックを壊す（この後はもう戻らないときだけ呼ぶ）
+void screen_panic(void);
+
 // カーソル位置を設定
 void screen_set_cursor(int x, int y);
 
 // カーソル位置を取得
 void screen_get_cursor(int *x, int *y);
 
+// 画面の桁数と行数を取得（テキストモードなら80x25）
+void screen_get_size(int *width, int *height);
+
+// フレームバッファに描いているか
+int screen_is_framebuffer(void);
+
 #endif // SCREEN_h
@@ -3,6 +3,7 @@
 #define SERIAL_H
 
 #include "stdint.h"
+#include "stddef.h"
 
 // シリアルポートの定義
 #define SERIAL_COM1 0x3F8
@@ -10,16 +11,41 @@
 #define SERIAL_COM3 0x3E8
 #define SERIAL_COM4 0x2E8
 
-// シリアルポートを初期化
-int serial_init(uint16_t port);
+// 送受信のリングの大きさ（2の冪）
+#define SERIAL_TX_BUFFER_SIZE 4096
+#define SERIAL_RX_BUFFER_SIZE 256
 
-// 1文字を送信
+// 既定のボーレート
+#define SERIAL_DEFAULT_BAUD 115200
+
+// コンソールにしたポートで受信した文字を受け取る関数（割り込みハンドラから呼ばれる）
+typedef void (*serial_input_t)(char c);
+
+// シリアルポートを初期化して送受信の割り込みを有効にする（baudは115200を割り切る値、失敗時は1）
+int serial_init(uint16_t port, uint32_t baud);
+
+// 受信した文字をリングに積まずinputに渡し、このポートをコンソールにする（NULLで戻す）
+void serial_set_console(uint16_t port, serial_input_t input);
+
+// 1文字を送信（送信リングに積み、FIFOが空いていればすぐ、残りはTHRE割り込みで書く）
 void serial_putchar(uint16_t port, char c);
 
-// 文字列を送信
+// 文字列を送信（送信リングが一杯のときだけ待つ）
 void serial_write(uint16_t port, const char* str);
 
-// 1文字を受信（ブロッキング）
+// 長さを指定して送信（終端の'\0'はいらない）
+void serial_write_n(uint16_t port, const char* data, size_t length);
+
+// 送信リングに残っているバイトを全部書き終えるまで待つ（割り込みを止めたまま止まる前に呼ぶ）
+void serial_flush(uint16_t port);
+
+// 他の書き手（コンソールのエコーやログ）を締め出し、ポートを1人で使う（スレッドから呼ぶ）
+// serial_releaseまでの間、serial_write_claimed以外で送ったバイトは捨てる
+void serial_claim(uint16_t port);
+void serial_write_claimed(uint16_t port, const char* data, size_t length);
+void serial_release(uint16_t port);
+
+// 1文字を受信（届くまでスレッドを止める、スケジューラが動く前はポーリング）
 char serial_getchar(uint16_t port);
 
 // 文字が利用可能かチェック
@@ -28,4 +54,7 @@ int serial_received(uint16_t port);
 // 送信が完了したかチェック
 int serial_is_transmit_empty(uint16_t port);
 
-#endif // SERIAL_H
\ No newline at end of file
+// 受信リングが一杯で捨てたバイト数
+uint32_t serial_rx_dropped(uint16_t port);
+
+#endif // SERIAL_H
@@ -0,0 +1,40 @@
+// smp.h - アプリケーションプロセッサ（AP）の起動とCPU間割り込みのインターフェース
+#ifndef SMP_H
+#define SMP_H
+
+#include "stdint.h"
+
+// APの起動コード（smp_trampoline.asm）をコピーする物理アドレス（1MB未満、4KB境界）
+#define SMP_TRAMPOLINE_ADDR 0x8000
+
+// CPU間割り込み（IPI）のベクタ
+#define IPI_RESCHEDULE_VECTOR 0xF0 // スケジューラを呼ばせる（処理は割り込みの出口で行う）
+#define IPI_TLB_VECTOR        0xF1 // TLBのエントリを無効化させる
+
+// MADTに載っているAPをINIT-SIPI-SIPIで起動する（APICが有効でなければ何もしない）
+// thread_initの後に呼ぶ。起動したAPはそれぞれのアイドルループに入る
+void smp_init(void);
+
+// オンラインのCPUの数と、そのビットマスク（ビットnがCPU n）
+uint32_t smp_cpu_count(void);
+uint32_t smp_online_mask(void);
+
+// CPUのローカルAPIC ID
+uint32_t smp_apic_id(uint32_t cpu);
+
+// 他のCPUにスケジューラを呼ばせる
+void smp_send_reschedule(uint32_t cpu);
+
+// 他のオンラインのCPUのTLBからvirtのエントリを消し、全CPUが済むまで待つ
+void smp_tlb_shootdown(uint32_t virt);
+
+// このCPUへのTLBの無効化要求があれば処理する（割り込み禁止のまま待つループから呼ぶ）
+void smp_tlb_poll(void);
+
+// 他のオンラインのCPUをNMIで止める（止まる前にだけ呼ぶ、既に別のCPUが止めていればこのCPUも止まる）
+void smp_stop_others(void);
+
+// smp_stop_othersで止められている途中か（NMIの例外ハンドラが止まるかどうかを決める）
+int smp_stopping(void);
+
+#endif // SMP_H
@@ -0,0 +1,47 @@
+// softirq.h - 割り込みの後半処理（タスクレット）のインターフェース
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include "stdint.h"
+
+// 1回の処理で実行するタスクレットの上限
+#define SOFTIRQ_BUDGET 16
+
+// タスクレット（IRQハンドラから予約し、割り込みを許可した状態で後から実行する）
+typedef struct tasklet {
+    struct tasklet* next;          // 予約キューのリンク
+    void (*fn)(void* data);        // 実行する関数
+    void* data;                    // 関数に渡す値
+    volatile uint32_t scheduled;   // 予約済みなら1（二重に積まない）
+} tasklet_t;
+
+// タスクレットを初期化
+void tasklet_init(tasklet_t* tasklet, void (*fn)(void* data), void* data);
+
+// タスクレットを現在のCPUのキューに予約（割り込みコンテキストから呼べる、ロックなし）
+void tasklet_schedule(tasklet_t* tasklet);
+
+// 予約されたタスクレットを最大budget個実行（実行した数を返す）
+uint32_t softirq_run(uint32_t budget);
+
+// 現在のCPUに予約されたタスクレットがあるか
+int softirq_pending(void);
+
+// 後半処理を禁止/許可（ネスト可能、許可に戻したときに溜まっていれば実行）
+void local_bh_disable(void);
+void local_bh_enable(void);
+
+// スレッドを切り替えるときに禁止のネスト数を入れ替える（前のスレッドの数を返す）
+uint32_t local_bh_switch(uint32_t count);
+
+// IRQの出口で呼ばれる（後半処理が許可されていれば割り込みを許可して実行）
+void softirq_irq_exit(void);
+
+// アイドルループから呼ぶ（local_bh_disable中でも実行する）
+void softirq_idle(void);
+
+// 実行したタスクレットの数と、予算を使い切った回数
+uint32_t softirq_processed(void);
+uint32_t softirq_exhausted(void);
+
+#endif // SOFTIRQ_H
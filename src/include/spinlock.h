@@ -0,0 +1,54 @@
+// spinlock.h - CPU間の排他に使うスピンロック
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "stdint.h"
+#include "interrupt.h"
+#include "smp.h"
+
+// スピンロック（0なら空き）
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+// ロックを初期化
+static inline void spin_lock_init(spinlock_t* lock) {
+    lock->locked = 0;
+}
+
+// ロックを取る（待つ間もTLBの無効化要求には応え、持ち主を待たせ合わないようにする）
+static inline void spin_lock(spinlock_t* lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+            asm volatile("pause");
+            smp_tlb_poll();
+        }
+    }
+}
+
+// 空いていればロックを取る（取れれば1）
+static inline int spin_trylock(spinlock_t* lock) {
+    return __atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+// ロックを放す
+static inline void spin_unlock(spinlock_t* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+// 割り込みを禁止してロックを取る（直前のEFLAGSを返す）
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+// ロックを放して割り込みの状態を戻す
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif // SPINLOCK_H
@@ -3,6 +3,24 @@
 
 #include "stddef.h"
 
+// CPUの機能に応じてメモリ/文字列操作の実装を選択（cpu_initの後に呼ぶ）
+void string_init(void);
+
+// 選択された実装の名前（"rep" または "sse2"）
+const char* string_variant(void);
+
+// 指定アドレスからサイズ分のメモリを指定値で埋める
+void* memset(void* ptr, int value, size_t size);
+
+// メモリ間のコピー（領域が重なってはいけない）
+void* memcpy(void* dest, const void* src, size_t size);
+
+// メモリ間のコピー（領域が重なってもよい）
+void* memmove(void* dest, const void* src, size_t size);
+
+// メモリ中の文字を探す（見つからなければNULL）
+void* memchr(const void* ptr, int value, size_t size);
+
 int strcmp(const char *s1, const char *s2);
 int strncmp(const char *s1, const char *s2, size_t n);
 size_t strlen(const char *s2);
@@ -0,0 +1,41 @@
+// task.h - ワークスティーリングのタスクプールのインターフェース
+#ifndef TASK_H
+#define TASK_H
+
+#include "stdint.h"
+
+// CPUごとのデック（両端キュー）に積めるタスクの数（2の冪）
+#define TASK_DEQUE_SIZE 256
+
+// タスク（呼び出し元が用意し、task_waitが戻るまで置いておく）
+typedef struct task {
+    void (*fn)(void* arg);      // 実行する関数
+    void* arg;                  // 関数に渡す値
+    volatile uint32_t done;     // 実行し終えたら1
+} task_t;
+
+// parallel_forに渡す関数（[start, end) を処理する）
+typedef void (*parallel_fn_t)(uint32_t start, uint32_t end, void* arg);
+
+// オンラインのCPUごとにワーカースレッドを作る（smp_initの後に呼ぶ）
+void task_init(void);
+
+// タスクを現在のCPUのデックに積み、休んでいるワーカーを1つ起こす（デックが一杯ならその場で実行する）
+void task_spawn(task_t* task, void (*fn)(void* arg), void* arg);
+
+// タスクの終了を待つ（待つ間も自分のデックや他のCPUから盗んだタスクを実行する）
+void task_wait(task_t* task);
+
+// [start, end) をgrain以下の区間になるまで半分に分けてfnを並列に呼び、全部終わるまで待つ
+void parallel_for(uint32_t start, uint32_t end, uint32_t grain, parallel_fn_t fn, void* arg);
+
+// タスクを実行するワーカーの数を制限する（CPU 0から数えてcount個、0なら全部）
+void task_set_workers(uint32_t count);
+
+// タスクを実行しているワーカーの数
+uint32_t task_workers(void);
+
+// CPUごとの実行/スティールの回数を表示
+void task_show(void);
+
+#endif // TASK_H
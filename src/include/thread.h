@@ -0,0 +1,92 @@
+// thread.h - カーネルスレッドとスケジューラのインターフェース
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "stdint.h"
+
+// 優先度の数（0が最も高い）
+#define THREAD_PRIORITIES 32
+#define THREAD_PRIORITY_HIGHEST 0
+#define THREAD_PRIORITY_DEFAULT 16
+#define THREAD_PRIORITY_LOWEST  (THREAD_PRIORITIES - 1)
+
+// スレッドごとのスタックの大きさ
+#define THREAD_STACK_SIZE 16384
+
+// スレッド名の最大長（終端を含む）
+#define THREAD_NAME_LEN 16
+
+// タイムスライスの既定値（ミリ秒）
+#define THREAD_TIMESLICE_MS 10
+
+// スレッドの状態
+typedef enum {
+    THREAD_READY,    // 実行可能（ランキューにある）
+    THREAD_RUNNING,  // 実行中
+    THREAD_SLEEPING, // thread_sleepで時間待ち
+    THREAD_BLOCKED,  // thread_joinなどで起こされるのを待っている
+    THREAD_DEAD      // 終了した（thread_joinで回収される）
+} thread_state_t;
+
+typedef struct thread thread_t;
+
+// 起動時のコンテキストをmainスレッドにし、アイドルスレッドを作る（memory_initとtimer_initの後に呼ぶ）
+void thread_init(void);
+
+// APの起動時のコンテキストをそのCPUのアイドルスレッドにする（APの上で呼ぶ、失敗すれば-1）
+int thread_init_ap(void);
+
+// このCPUのアイドルループに入る（戻らない）
+void thread_idle_loop(void) __attribute__((noreturn));
+
+// スレッドを作って実行可能にする（失敗時はNULL、priorityは0が最も高い）
+// スレッドの最も少ないオンラインのCPUに置き、以後そのCPUから移らない
+// fnから戻るとスレッドは終了する。終了したスレッドはthread_joinで回収する
+thread_t* thread_create(const char* name, void (*fn)(void* arg), void* arg, uint32_t priority);
+
+// 指定したCPUで実行するスレッドを作る（CPUがオンラインでなければNULL）
+thread_t* thread_create_on(uint32_t cpu, const char* name, void (*fn)(void* arg), void* arg, uint32_t priority);
+
+// 同じ優先度の次のスレッドにCPUを譲る
+void thread_yield(void);
+
+// 指定したミリ秒眠る（その間CPUは他のスレッドが使う）
+void thread_sleep(uint32_t ms);
+
+// スレッドの終了を待って回収する（thread_createが返したポインタは以後使えない）
+void thread_join(thread_t* thread);
+
+// 実行中のスレッドを終了する
+void thread_exit(void) __attribute__((noreturn));
+
+// 実行中のスレッド（thread_initの前はNULL）
+thread_t* thread_current(void);
+
+// 実行中のスレッドを止まる状態にする（この後で待つ条件を確かめ、満たされていなければthread_blockを呼ぶ）
+// 条件を確かめる前に状態を変えておくので、その間のthread_wakeを取りこぼさない
+void thread_prepare_block(void);
+
+// thread_prepare_blockの後にまだ起こされていなければ、起こされるまで止める
+void thread_block(void);
+
+// thread_prepare_blockの後、待つ条件が満たされていて止まらないときに呼ぶ（実行中に戻す）
+void thread_finish_block(void);
+
+// 眠っている/止まっているスレッドを実行可能にする（割り込みハンドラや他のCPUからも呼べる）
+void thread_wake(thread_t* thread);
+
+// タイムスライスの長さ（ミリ秒）を設定/取得
+void thread_set_timeslice(uint32_t ms);
+uint32_t thread_timeslice(void);
+
+// プリエンプションを禁止/許可（ネスト可能、禁止中はIRQの出口で切り替えない）
+void preempt_disable(void);
+void preempt_enable(void);
+
+// 最も外側のIRQの出口で呼ばれる（優先度の高いスレッドが起きたかタイムスライスが切れていれば切り替える）
+void thread_preempt(void);
+
+// スレッドの一覧（CPU時間とコンテキストスイッチの回数）を表示
+void thread_show(void);
+
+#endif // THREAD_H
@@ -1,19 +1,77 @@
-// timer.h - タイマー昨日のインターフェース
+// timer.h - タイマー機能のインターフェース
 #ifndef TIMER_H
 #define TIMER_H
 
 #include "stdint.h"
 
-// タイマーを初期化 (周波数をHz単位で指定）
-void timer_init(uint32_t frequency);
+// ティックの周波数（1ティック = 1ms）
+#define TIMER_HZ 1000
 
-// 指定したミリ秒待機
+// ミリ秒をティック数に変換（切り上げ）
+#define TIMER_MS_TO_TICKS(ms) (((ms) * TIMER_HZ + 999) / 1000)
+
+// タイマー（期限のティックを過ぎたら後半処理の中でfnを呼ぶ）
+typedef struct timer_list {
+    struct timer_list* next;    // スロットのリスト
+    struct timer_list** pprev;  // 前の要素のnext（NULLなら未登録）
+    uint32_t expires;           // 期限（ティック）
+    void (*fn)(void* data);     // 期限に呼ぶ関数
+    void* data;                 // 関数に渡す値
+} timer_list_t;
+
+// ティックの比較（32ビットで一周しても正しく比べる）
+static inline int time_after(uint32_t a, uint32_t b) {
+    return (int32_t)(b - a) < 0;
+}
+
+static inline int time_before(uint32_t a, uint32_t b) {
+    return time_after(b, a);
+}
+
+// タイマーを初期化（PITをワンショットモードにしてIRQ0を登録する）
+void timer_init(void);
+
+// 指定したミリ秒待機（割り込みを許可してHLTで待つ）
 void timer_sleep(uint32_t ms);
 
 // タイマー割り込みハンドラ
 void timer_handler(void);
 
-// タイマーカウントを取得
+// タイマーカウント（起動してからのティック、クロックソースがなければ待つタイマーがない間は進まない）
 uint32_t timer_get_ticks(void);
 
+// タイマー割り込みの回数
+uint32_t timer_interrupts(void);
+
+// タイマーを初期化（まだ登録しない）
+void timer_setup(timer_list_t* timer, void (*fn)(void* data), void* data);
+
+// timer->expiresを期限として登録（O(1)）
+void add_timer(timer_list_t* timer);
+
+// 登録を取り消す（登録されていたら1、O(1)）
+int del_timer(timer_list_t* timer);
+
+// 期限を変えて登録し直す（登録されていたら1、O(1)）
+int mod_timer(timer_list_t* timer, uint32_t expires);
+
+// 登録されているか
+static inline int timer_pending(const timer_list_t* timer) {
+    return timer->pprev != 0;
+}
+
+// 登録されているタイマーの数
+uint32_t timer_pending_count(void);
+
+// ---- タイマーホイールとPITドライバの間のインターフェース ----
+
+// 期限を過ぎたタイマーを実行して次の期限をプログラムする（タイマーの後半処理から呼ばれる）
+void timer_wheel_run(void);
+
+// 次の割り込みを期限のティックにプログラムする（割り込み禁止で呼ぶ）
+void timer_program(uint32_t expires);
+
+// 待つタイマーがないのでPITを止める（割り込み禁止で呼ぶ）
+void timer_stop(void);
+
 #endif // TIMER_H
@@ -0,0 +1,62 @@
+// trace.h - 静的トレースポイントとCPUごとのトレースバッファのインターフェース
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "stdint.h"
+
+// CPUごとのトレースバッファのレコード数（2の冪）
+#define TRACE_RECORDS 2048
+
+// トレースの出力の先頭と末尾に置く印
+#define TRACE_MAGIC "MYOSTRC1"
+#define TRACE_END_MAGIC "MYOSTRCE"
+
+// イベントの番号（名前と種類はtrace.cの表、出力の先頭にも書く）
+typedef enum {
+    TRACE_IRQ_ENTRY,        // 割り込みの入口（引数はベクタ）
+    TRACE_IRQ_EXIT,         // 割り込みの出口（引数はベクタ）
+    TRACE_TASKLET_ENTRY,    // タスクレットの実行開始（引数は関数のアドレス）
+    TRACE_TASKLET_EXIT,     // タスクレットの実行終了（引数は関数のアドレス）
+    TRACE_THREAD_SWITCH,    // スレッドの切り替え（引数は次のスレッド番号）
+    TRACE_KEY_INPUT,        // キー入力（引数は文字）
+    TRACE_SERIAL_RX,        // UARTの受信割り込み（引数は受信したバイト数）
+    TRACE_COMMAND_BEGIN,    // シェルのコマンドの実行開始（引数は引数の数）
+    TRACE_COMMAND_END,      // シェルのコマンドの実行終了
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+// 1件のレコード（出力でもこの16バイトをそのまま送る）
+typedef struct {
+    uint64_t timestamp;     // TSC（TSCがなければナノ秒）
+    uint32_t event;         // trace_event_t
+    uint32_t arg;           // イベントごとの値
+} trace_record_t;
+
+// 記録中なら0以外（TRACE_EVENTが見るのはこれだけ）
+extern volatile uint32_t trace_enabled;
+
+// レコードを現在のCPUのバッファに書く（TRACE_EVENTから呼ばれる）
+void trace_record(uint32_t event, uint32_t arg);
+
+// トレースポイント（止めている間は予測の当たる分岐1つだけ）
+#define TRACE_EVENT(event, arg)                                 \
+    do {                                                        \
+        if (__builtin_expect(trace_enabled != 0, 0)) {          \
+            trace_record((event), (uint32_t)(arg));             \
+        }                                                       \
+    } while (0)
+
+// バッファを空にして記録を始める（初回はバッファを確保する、失敗時は-1）
+int trace_start(void);
+
+// 記録を止める
+void trace_stop(void);
+
+// 記録を止め、バッファの中身をCOM1にバイナリで送る（形式はtrace.cの先頭、tools/trace2json.pyで変換する）
+void trace_dump(void);
+
+// 記録したレコード数と、上書きか記録の途中に割り込まれて失ったレコード数（全CPUの合計）
+uint32_t trace_count(void);
+uint32_t trace_lost(void);
+
+#endif // TRACE_H
@@ -0,0 +1,55 @@
+// wait.h - 待ち行列（条件が満たされるまでスレッドを止める）のインターフェース
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "stdint.h"
+#include "spinlock.h"
+#include "thread.h"
+
+// 待っているスレッド1つ分（待つ側のスタックに置く）
+typedef struct wait_entry {
+    struct wait_entry* next;    // 待ち行列のリンク
+    thread_t* thread;           // 待っているスレッド
+    uint32_t queued;            // 待ち行列に入っていれば1
+} wait_entry_t;
+
+// 待ち行列
+typedef struct {
+    spinlock_t lock;
+    wait_entry_t* head;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, 0 }
+
+// 待ち行列を初期化
+void wait_queue_init(wait_queue_t* queue);
+
+// 実行中のスレッドを待ち行列に入れて止まる状態にする（この後で条件を確かめる）
+void prepare_to_wait(wait_queue_t* queue, wait_entry_t* entry);
+
+// 待ち終わったら呼ぶ（実行中に戻し、待ち行列から外す）
+void finish_wait(wait_queue_t* queue, wait_entry_t* entry);
+
+// 待っているスレッドを全部起こす（割り込みハンドラからも呼べる）
+void wake_up(wait_queue_t* queue);
+
+// conditionが真になるまで止まる（スレッドから呼ぶ。条件を変えた側がwake_upを呼ぶ）
+// 止まる状態にしてから条件を確かめるので、その間のwake_upを取りこぼさない
+#define wait_event(queue, condition)                    \
+    do {                                                \
+        if (condition) {                                \
+            break;                                      \
+        }                                               \
+        wait_entry_t __entry;                           \
+        __entry.queued = 0;                             \
+        while (1) {                                     \
+            prepare_to_wait(&(queue), &__entry);        \
+            if (condition) {                            \
+                break;                                  \
+            }                                           \
+            thread_block();                             \
+        }                                               \
+        finish_wait(&(queue), &__entry);                \
+    } while (0)
+
+#endif // WAIT_H
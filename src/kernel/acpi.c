@@ -0,0 +1,375 @@
+// acpi.c - ACPIテーブルの探索とMADTの解析
+#include "../include/acpi.h"
+#include "../include/multiboot.h"
+#include "../include/paging.h"
+#include "../include/string.h"
+
+// RSDPを探すBIOS領域
+#define EBDA_SEGMENT_PTR 0x40E
+#define BIOS_ROM_START   0xE0000
+#define BIOS_ROM_END     0x100000
+
+// MADTのエントリの種類
+#define MADT_LOCAL_APIC          0
+#define MADT_IO_APIC             1
+#define MADT_INTERRUPT_OVERRIDE  2
+#define MADT_LOCAL_APIC_NMI      4
+#define MADT_LOCAL_APIC_OVERRIDE 5
+
+// FADTのフラグ: PMタイマーのカウンタが32ビット
+#define FADT_TMR_VAL_EXT (1u << 8)
+// GASのアドレス空間: システムメモリ
+#define GAS_SYSTEM_MEMORY 0
+
+// MADTのフラグ: 8259 PICも実装されている
+#define MADT_PCAT_COMPAT 0x1
+// ローカルAPICのフラグ: 有効
+#define MADT_LAPIC_ENABLED 0x1
+
+// RSDP（ACPI 2.0以降はXSDTのアドレスを含む）
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+// MADTの固定部分
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+// MADTのエントリ
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_local_apic_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_io_apic_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_interrupt_override_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t processor_id;
+    uint16_t flags;
+    uint8_t lint;
+} __attribute__((packed)) madt_local_apic_nmi_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed)) madt_local_apic_override_t;
+
+// FADT（PMタイマーまでの部分）
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t firmware_ctrl;
+    uint32_t dsdt;
+    uint8_t reserved;
+    uint8_t preferred_pm_profile;
+    uint16_t sci_int;
+    uint32_t smi_cmd;
+    uint8_t acpi_enable;
+    uint8_t acpi_disable;
+    uint8_t s4bios_req;
+    uint8_t pstate_cnt;
+    uint32_t pm1a_evt_blk;
+    uint32_t pm1b_evt_blk;
+    uint32_t pm1a_cnt_blk;
+    uint32_t pm1b_cnt_blk;
+    uint32_t pm2_cnt_blk;
+    uint32_t pm_tmr_blk;
+    uint32_t gpe0_blk;
+    uint32_t gpe1_blk;
+    uint8_t pm1_evt_len;
+    uint8_t pm1_cnt_len;
+    uint8_t pm2_cnt_len;
+    uint8_t pm_tmr_len;
+    uint8_t gpe0_blk_len;
+    uint8_t gpe1_blk_len;
+    uint8_t gpe1_base;
+    uint8_t cst_cnt;
+    uint16_t p_lvl2_lat;
+    uint16_t p_lvl3_lat;
+    uint16_t flush_size;
+    uint16_t flush_stride;
+    uint8_t duty_offset;
+    uint8_t duty_width;
+    uint8_t day_alrm;
+    uint8_t mon_alrm;
+    uint8_t century;
+    uint16_t iapc_boot_arch;
+    uint8_t reserved2;
+    uint32_t flags;
+} __attribute__((packed)) acpi_fadt_t;
+
+// HPETテーブル
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t event_timer_block_id;
+    uint8_t address_space_id;     // GAS: アドレス空間
+    uint8_t register_bit_width;
+    uint8_t register_bit_offset;
+    uint8_t access_size;
+    uint64_t address;             // GAS: アドレス
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+// RSDTまたはXSDT
+static const acpi_sdt_header_t* root_table = NULL;
+// ルートテーブルのエントリの大きさ（RSDTは4、XSDTは8）
+static uint32_t root_entry_size = 0;
+// MADTの内容
+static acpi_madt_info_t madt_info;
+static int madt_valid = 0;
+
+// バイト列の合計が0になるか
+static int acpi_checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// RSDPとして正しいか
+static const acpi_rsdp_t* acpi_check_rsdp(const void* ptr) {
+    const acpi_rsdp_t* rsdp = (const acpi_rsdp_t*)ptr;
+    if (strncmp(rsdp->signature, "RSD PTR ", 8) != 0 || !acpi_checksum_ok(rsdp, 20)) {
+        return NULL;
+    }
+    return rsdp;
+}
+
+// 16バイト境界ごとにRSDPを探す
+static const acpi_rsdp_t* acpi_scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        const acpi_rsdp_t* rsdp = acpi_check_rsdp((const void*)addr);
+        if (rsdp != NULL) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+// RSDPを探す（マルチブートのタグ、EBDA、BIOS ROM領域の順）
+static const acpi_rsdp_t* acpi_find_rsdp(void) {
+    const multiboot_tag_t* tag = multiboot_find_tag(MULTIBOOT_TAG_TYPE_ACPI_NEW);
+    if (tag == NULL) {
+        tag = multiboot_find_tag(MULTIBOOT_TAG_TYPE_ACPI_OLD);
+    }
+    if (tag != NULL) {
+        const acpi_rsdp_t* rsdp = acpi_check_rsdp(tag + 1);
+        if (rsdp != NULL) {
+            return rsdp;
+        }
+    }
+
+    // BIOSデータ領域にEBDAのセグメントがある（アドレス0付近の参照をGCCに警告させないため変数経由で読む）
+    const uint16_t* volatile segment = (const uint16_t*)EBDA_SEGMENT_PTR;
+    uint32_t ebda = (uint32_t)*segment << 4;
+    if (ebda != 0) {
+        const acpi_rsdp_t* rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+        if (rsdp != NULL) {
+            return rsdp;
+        }
+    }
+    return acpi_scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+}
+
+// テーブルをマップしてチェックサムを確かめる
+static const acpi_sdt_header_t* acpi_map_table(uint32_t phys) {
+    if (phys == 0 || paging_map_identity(phys, sizeof(acpi_sdt_header_t), 0) == NULL) {
+        return NULL;
+    }
+    const acpi_sdt_header_t* table = (const acpi_sdt_header_t*)phys;
+    if (table->length < sizeof(acpi_sdt_header_t) ||
+        paging_map_identity(phys, table->length, 0) == NULL ||
+        !acpi_checksum_ok(table, table->length)) {
+        return NULL;
+    }
+    return table;
+}
+
+// シグネチャでテーブルを探す
+const acpi_sdt_header_t* acpi_find_table(const char* signature) {
+    if (root_table == NULL) {
+        return NULL;
+    }
+
+    uint32_t count = (root_table->length - sizeof(acpi_sdt_header_t)) / root_entry_size;
+    const uint8_t* entries = (const uint8_t*)(root_table + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* entry = entries + i * root_entry_size;
+        // XSDTのエントリは64ビット（4GB以上のテーブルは扱えない）
+        if (root_entry_size == 8 && *(const uint32_t*)(entry + 4) != 0) {
+            continue;
+        }
+        const acpi_sdt_header_t* table = acpi_map_table(*(const uint32_t*)entry);
+        if (table != NULL && strncmp(table->signature, signature, 4) == 0) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+// MADTを解析
+static int acpi_parse_madt(void) {
+    const acpi_madt_t* madt = (const acpi_madt_t*)acpi_find_table("APIC");
+    if (madt == NULL) {
+        return -1;
+    }
+
+    memset(&madt_info, 0, sizeof(madt_info));
+    madt_info.lapic_address = madt->lapic_address;
+    madt_info.has_8259 = (madt->flags & MADT_PCAT_COMPAT) != 0;
+    madt_info.nmi_lint = 0xFF;
+
+    // オーバーライドがなければISA IRQはそのままの番号のGSI（エッジ、アクティブハイ）
+    for (uint32_t irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        madt_info.isa_gsi[irq] = irq;
+        madt_info.isa_flags[irq] = 0;
+    }
+
+    const uint8_t* ptr = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (ptr + sizeof(madt_entry_t) <= end) {
+        const madt_entry_t* entry = (const madt_entry_t*)ptr;
+        if (entry->length < sizeof(madt_entry_t) || ptr + entry->length > end) {
+            break;
+        }
+
+        switch (entry->type) {
+        case MADT_LOCAL_APIC: {
+            const madt_local_apic_t* lapic = (const madt_local_apic_t*)entry;
+            if ((lapic->flags & MADT_LAPIC_ENABLED) && madt_info.cpu_count < ACPI_MAX_CPUS) {
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = lapic->apic_id;
+            }
+            break;
+        }
+        case MADT_IO_APIC: {
+            const madt_io_apic_t* ioapic = (const madt_io_apic_t*)entry;
+            if (madt_info.ioapic_count < ACPI_MAX_IOAPICS) {
+                acpi_ioapic_t* info = &madt_info.ioapics[madt_info.ioapic_count++];
+                info->id = ioapic->id;
+                info->address = ioapic->address;
+                info->gsi_base = ioapic->gsi_base;
+            }
+            break;
+        }
+        case MADT_INTERRUPT_OVERRIDE: {
+            const madt_interrupt_override_t* over = (const madt_interrupt_override_t*)entry;
+            if (over->bus == 0 && over->source < ACPI_ISA_IRQS) {
+                madt_info.isa_gsi[over->source] = over->gsi;
+                madt_info.isa_flags[over->source] = over->flags;
+            }
+            break;
+        }
+        case MADT_LOCAL_APIC_NMI: {
+            const madt_local_apic_nmi_t* nmi = (const madt_local_apic_nmi_t*)entry;
+            madt_info.nmi_lint = nmi->lint;
+            break;
+        }
+        case MADT_LOCAL_APIC_OVERRIDE: {
+            const madt_local_apic_override_t* over = (const madt_local_apic_override_t*)entry;
+            if ((over->address >> 32) == 0) {
+                madt_info.lapic_address = (uint32_t)over->address;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        ptr += entry->length;
+    }
+
+    madt_valid = 1;
+    return 0;
+}
+
+// RSDPを探してMADTを読む
+int acpi_init(void) {
+    if (root_table != NULL) {
+        return madt_valid ? 0 : -1;
+    }
+
+    const acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (rsdp == NULL) {
+        return -1;
+    }
+
+    // ACPI 2.0以降で4GB未満にあればXSDT、そうでなければRSDTを使う
+    root_table = NULL;
+    if (rsdp->revision >= 2 && acpi_checksum_ok(rsdp, rsdp->length) &&
+        rsdp->xsdt_address != 0 && (rsdp->xsdt_address >> 32) == 0) {
+        root_table = acpi_map_table((uint32_t)rsdp->xsdt_address);
+        root_entry_size = 8;
+    }
+    if (root_table == NULL) {
+        root_table = acpi_map_table(rsdp->rsdt_address);
+        root_entry_size = 4;
+    }
+    if (root_table == NULL) {
+        return -1;
+    }
+
+    return acpi_parse_madt();
+}
+
+// MADTの内容
+const acpi_madt_info_t* acpi_madt(void) {
+    return madt_valid ? &madt_info : NULL;
+}
+
+// FADTからACPI PMタイマーのI/Oポートを読む
+int acpi_pm_timer(uint16_t* port, int* ext32) {
+    const acpi_fadt_t* fadt = (const acpi_fadt_t*)acpi_find_table("FACP");
+    if (fadt == NULL || fadt->header.length < sizeof(acpi_fadt_t) ||
+        fadt->pm_tmr_blk == 0 || fadt->pm_tmr_len < 4) {
+        return -1;
+    }
+    *port = (uint16_t)fadt->pm_tmr_blk;
+    *ext32 = (fadt->flags & FADT_TMR_VAL_EXT) != 0;
+    return 0;
+}
+
+// HPETテーブルからHPETのレジスタの物理アドレスを読む
+uint32_t acpi_hpet_address(void) {
+    const acpi_hpet_t* hpet = (const acpi_hpet_t*)acpi_find_table("HPET");
+    if (hpet == NULL || hpet->header.length < sizeof(acpi_hpet_t) ||
+        hpet->address_space_id != GAS_SYSTEM_MEMORY || (hpet->address >> 32) != 0) {
+        return 0;
+    }
+    return (uint32_t)hpet->address;
+}
@@ -0,0 +1,262 @@
+// apic.c - ローカルAPICとI/O APICの実装（MADTから構成を読み、なければ8259 PICのまま）
+#include "../include/apic.h"
+#include "../include/acpi.h"
+#include "../include/cpu.h"
+#include "../include/interrupt.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+
+// ローカルAPICのベースアドレスを持つMSR
+#define IA32_APIC_BASE_MSR 0x1B
+#define APIC_BASE_ENABLE   (1u << 11)
+
+// スプリアス割り込みベクタレジスタ: APICを有効化
+#define LAPIC_SVR_ENABLE 0x100
+
+// I/O APICのレジスタ（レジスタ選択とデータ窓）
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+// I/O APIC内部のレジスタ番号
+#define IOAPIC_REG_VERSION 0x01
+#define IOAPIC_REDTBL(n)   (0x10 + 2 * (n))
+
+// リダイレクションエントリのビット
+#define IOAPIC_ACTIVE_LOW (1u << 13)
+#define IOAPIC_LEVEL      (1u << 15)
+#define IOAPIC_MASKED     (1u << 16)
+
+// ISA IRQ2はスレーブPICへのカスケードなのでI/O APICでは使わない
+#define ISA_CASCADE_IRQ 2
+
+// I/O APIC
+typedef struct {
+    volatile uint32_t* base; // レジスタ（アンキャッシュでマップ）
+    uint32_t gsi_base;       // 最初の入力のGSI
+    uint32_t inputs;         // 入力の数
+} ioapic_t;
+
+// ローカルAPICのレジスタ（アンキャッシュでマップ）
+static volatile uint32_t* lapic_base = NULL;
+// I/O APICで割り込みを配送しているか
+static int apic_active = 0;
+// I/O APIC
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_total = 0;
+// ISA IRQごとのI/O APICと入力番号（NULLなら使わない）
+static ioapic_t* isa_ioapic[IRQ_COUNT];
+static uint8_t isa_pin[IRQ_COUNT];
+
+// I/O APICのレジスタを読み書き
+static uint32_t ioapic_read(ioapic_t* ioapic, uint32_t reg) {
+    ioapic->base[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t* ioapic, uint32_t reg, uint32_t value) {
+    ioapic->base[IOAPIC_REGSEL / 4] = reg;
+    ioapic->base[IOAPIC_WINDOW / 4] = value;
+}
+
+// ローカルAPICのレジスタを読む
+uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+// ローカルAPICのレジスタに書き込む
+void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+}
+
+// このCPUのローカルAPIC ID
+uint32_t lapic_id(void) {
+    return lapic_base != NULL ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+// ローカルAPICにEOIを送る
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+// ローカルAPIC IDがapic_idのCPUにIPIを送る
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    // ICRは上位、下位の順に書き、下位を書いた時点で送られる（途中で割り込まれないようにする）
+    uint32_t flags = irq_save();
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile("pause");
+    }
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile("pause");
+    }
+    irq_restore(flags);
+}
+
+// I/O APICで割り込みを配送しているか
+int apic_enabled(void) {
+    return apic_active;
+}
+
+// I/O APICの数
+uint32_t ioapic_count(void) {
+    return ioapic_total;
+}
+
+// GSIを受け持つI/O APICを探す
+static ioapic_t* ioapic_for_gsi(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_total; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].inputs) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+// ISA IRQのリダイレクションエントリのマスクビットを書き換える
+static void ioapic_set_masked(uint8_t irq, int masked) {
+    if (irq >= IRQ_COUNT || isa_ioapic[irq] == NULL) {
+        return;
+    }
+
+    ioapic_t* ioapic = isa_ioapic[irq];
+    uint32_t reg = IOAPIC_REDTBL(isa_pin[irq]);
+    uint32_t low = ioapic_read(ioapic, reg);
+    low = masked ? (low | IOAPIC_MASKED) : (low & ~IOAPIC_MASKED);
+    ioapic_write(ioapic, reg, low);
+}
+
+// ISA IRQをマスク
+void ioapic_mask_irq(uint8_t irq) {
+    ioapic_set_masked(irq, 1);
+}
+
+// ISA IRQのマスクを解除
+void ioapic_unmask_irq(uint8_t irq) {
+    ioapic_set_masked(irq, 0);
+}
+
+// ローカルAPICを有効化
+static void lapic_init(const acpi_madt_info_t* madt) {
+    // MSRでグローバルに有効化（ベースアドレスはそのまま）
+    wrmsr(IA32_APIC_BASE_MSR, rdmsr(IA32_APIC_BASE_MSR) | APIC_BASE_ENABLE);
+
+    // すべての割り込みを受け付ける
+    lapic_write(LAPIC_TPR, 0);
+
+    // ローカル割り込み: ISA IRQはI/O APIC経由なのでLINTはNMIの配線だけ残す
+    lapic_write(LAPIC_LVT_LINT0, madt->nmi_lint == 0 ? LAPIC_DELIVERY_NMI : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, madt->nmi_lint == 1 ? LAPIC_DELIVERY_NMI : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+    // エラー状態をクリア（書き込んでから読むと更新される）
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+
+    // スプリアスベクタを設定してソフトウェア的に有効化
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+    // 残っている割り込みがあれば受け付け済みにする
+    lapic_eoi();
+}
+
+// I/O APICをマップして全入力をマスク
+static int ioapic_init(const acpi_madt_info_t* madt) {
+    ioapic_total = 0;
+    for (uint32_t i = 0; i < madt->ioapic_count; i++) {
+        const acpi_ioapic_t* info = &madt->ioapics[i];
+        if (paging_map_identity(info->address, PAGE_SIZE, PAGE_PCD | PAGE_PWT) == NULL) {
+            continue;
+        }
+
+        ioapic_t* ioapic = &ioapics[ioapic_total++];
+        ioapic->base = (volatile uint32_t*)info->address;
+        ioapic->gsi_base = info->gsi_base;
+        ioapic->inputs = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+        for (uint32_t pin = 0; pin < ioapic->inputs; pin++) {
+            ioapic_write(ioapic, IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+            ioapic_write(ioapic, IOAPIC_REDTBL(pin) + 1, 0);
+        }
+    }
+    return ioapic_total > 0 ? 0 : -1;
+}
+
+// ISA IRQをPICと同じベクタ（32-47）でこのCPUに配送するよう設定（マスクしたまま）
+static void ioapic_route_isa(const acpi_madt_info_t* madt) {
+    uint32_t dest = lapic_id();
+
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        isa_ioapic[irq] = NULL;
+        if (irq == ISA_CASCADE_IRQ) {
+            continue;
+        }
+
+        // 他のIRQがオーバーライドでこのGSIを使っていれば、こちらは配線されていない
+        uint32_t gsi = madt->isa_gsi[irq];
+        int taken = 0;
+        for (uint32_t other = 0; other < IRQ_COUNT; other++) {
+            if (other != irq && madt->isa_gsi[other] == gsi && madt->isa_gsi[other] != other) {
+                taken = 1;
+            }
+        }
+        ioapic_t* ioapic = ioapic_for_gsi(gsi);
+        if (taken || ioapic == NULL) {
+            continue;
+        }
+
+        uint32_t low = IRQ_VECTOR(irq) | IOAPIC_MASKED;
+        uint16_t flags = madt->isa_flags[irq];
+        if ((flags & ACPI_INTI_POLARITY_MASK) == ACPI_INTI_POLARITY_LOW) {
+            low |= IOAPIC_ACTIVE_LOW;
+        }
+        if ((flags & ACPI_INTI_TRIGGER_MASK) == ACPI_INTI_TRIGGER_LEVEL) {
+            low |= IOAPIC_LEVEL;
+        }
+
+        isa_ioapic[irq] = ioapic;
+        isa_pin[irq] = gsi - ioapic->gsi_base;
+        ioapic_write(ioapic, IOAPIC_REDTBL(isa_pin[irq]) + 1, dest << 24);
+        ioapic_write(ioapic, IOAPIC_REDTBL(isa_pin[irq]), low);
+    }
+}
+
+// APのローカルAPICを有効化
+void apic_init_ap(void) {
+    if (apic_active) {
+        lapic_init(acpi_madt());
+    }
+}
+
+// APICを検出して初期化
+int apic_init(void) {
+    if (!cpu_has(CPU_FEATURE_APIC) || !cpu_has(CPU_FEATURE_MSR)) {
+        return -1;
+    }
+    if (acpi_init() != 0) {
+        return -1;
+    }
+    const acpi_madt_info_t* madt = acpi_madt();
+    if (madt == NULL || madt->ioapic_count == 0) {
+        return -1;
+    }
+
+    // ローカルAPICのレジスタをアンキャッシュでマップ
+    if (paging_map_identity(madt->lapic_address, PAGE_SIZE, PAGE_PCD | PAGE_PWT) == NULL) {
+        return -1;
+    }
+    if (ioapic_init(madt) != 0) {
+        return -1;
+    }
+    lapic_base = (volatile uint32_t*)madt->lapic_address;
+
+    uint32_t flags = irq_save();
+    lapic_init(madt);
+    ioapic_route_isa(madt);
+
+    // 登録済みのIRQをI/O APICに移し、8259はすべてマスクする
+    interrupt_switch_to_apic();
+    apic_active = 1;
+    irq_restore(flags);
+    return 0;
+}
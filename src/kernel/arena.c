@@ -0,0 +1,174 @@
+// arena.c - アリーナ（リージョン）アロケータの実装
+#include "../include/arena.h"
+#include "../include/interrupt.h"
+#include "../include/memory.h"
+
+// チャンク（ヘッダの直後から割り当てる）
+struct arena_chunk {
+    struct arena_chunk* next; // 次のチャンク
+    size_t size;              // 割り当てに使えるバイト数
+    size_t offset;            // 使用済みのバイト数
+    uint8_t data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+// 作業用アリーナ
+static arena_t* scratch_arena = NULL;
+
+// 値をARENA_ALIGNの境界に切り上げる
+static inline size_t arena_align(size_t value) {
+    return (value + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// 新しいチャンクを確保
+static arena_chunk_t* arena_chunk_new(arena_t* arena, size_t size) {
+    if (size < arena->chunk_size) {
+        size = arena->chunk_size;
+    }
+
+    arena_chunk_t* chunk = (arena_chunk_t*)kmalloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->offset = 0;
+    arena->chunk_count++;
+    return chunk;
+}
+
+// 現在のチャンクに収まらないとき、sizeバイト以上空いたチャンクに移る
+static arena_chunk_t* arena_next_chunk(arena_t* arena, size_t size) {
+    arena_chunk_t* current = arena->current;
+
+    // リセットで残しておいたチャンクに収まればそれを使う
+    if (current->next != NULL && current->next->size >= size) {
+        arena->current = current->next;
+        arena->current->offset = 0;
+        return arena->current;
+    }
+
+    // 新しいチャンクを現在のチャンクの直後に入れる
+    arena_chunk_t* chunk = arena_chunk_new(arena, size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = current->next;
+    current->next = chunk;
+    arena->current = chunk;
+    return chunk;
+}
+
+// アリーナを作成
+arena_t* arena_create(size_t chunk_size) {
+    arena_t* arena = (arena_t*)kmalloc(sizeof(arena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->chunk_size = arena_align(chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK);
+    arena->used = 0;
+    arena->peak = 0;
+    arena->chunk_count = 0;
+
+    // 最初のチャンクは作成時に確保しておく（arena->currentは常に有効）
+    arena->first = arena_chunk_new(arena, arena->chunk_size);
+    if (arena->first == NULL) {
+        kfree(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    return arena;
+}
+
+// アリーナからsizeバイトを割り当てる
+void* arena_alloc(arena_t* arena, size_t size) {
+    if (arena == NULL || size > (size_t)-1 - ARENA_ALIGN) {
+        return NULL;
+    }
+    size = arena_align(size ? size : 1);
+
+    uint32_t flags = irq_save();
+
+    arena_chunk_t* chunk = arena->current;
+    if (chunk->size - chunk->offset < size) {
+        chunk = arena_next_chunk(arena, size);
+        if (chunk == NULL) {
+            irq_restore(flags);
+            return NULL;
+        }
+    }
+
+    void* ptr = chunk->data + chunk->offset;
+    chunk->offset += size;
+    arena->used += size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+
+    irq_restore(flags);
+    return ptr;
+}
+
+// 現在の位置を記録
+arena_mark_t arena_mark(arena_t* arena) {
+    arena_mark_t mark;
+
+    uint32_t flags = irq_save();
+    mark.chunk = arena->current;
+    mark.offset = arena->current->offset;
+    mark.used = arena->used;
+    irq_restore(flags);
+    return mark;
+}
+
+// 記録した位置より後の割り当てをまとめて解放
+void arena_reset(arena_t* arena, arena_mark_t mark) {
+    uint32_t flags = irq_save();
+
+    arena_chunk_t* chunk = mark.chunk ? mark.chunk : arena->first;
+    chunk->offset = mark.chunk ? mark.offset : 0;
+    arena->current = chunk;
+    arena->used = mark.chunk ? mark.used : 0;
+
+    // 後ろのチャンクは既定サイズのものを1つだけ次回用に残し、残りは返却する
+    arena_chunk_t* next = chunk->next;
+    chunk->next = NULL;
+    while (next != NULL) {
+        arena_chunk_t* following = next->next;
+        if (chunk->next == NULL && next->size == arena->chunk_size) {
+            next->next = NULL;
+            chunk->next = next;
+        } else {
+            kfree(next);
+            arena->chunk_count--;
+        }
+        next = following;
+    }
+
+    irq_restore(flags);
+}
+
+// アリーナとすべてのチャンクを解放
+void arena_destroy(arena_t* arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    arena_chunk_t* chunk = arena->first;
+    while (chunk != NULL) {
+        arena_chunk_t* next = chunk->next;
+        kfree(chunk);
+        chunk = next;
+    }
+    kfree(arena);
+}
+
+// 作業用アリーナ（初回に作成）
+arena_t* arena_scratch(void) {
+    uint32_t flags = irq_save();
+    if (scratch_arena == NULL) {
+        scratch_arena = arena_create(ARENA_DEFAULT_CHUNK);
+    }
+    irq_restore(flags);
+    return scratch_arena;
+}
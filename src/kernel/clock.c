@@ -0,0 +1,300 @@
+// clock.c - クロックソースの選択と較正、ナノ秒単位の単調時計
+// カウンタの差分を ns = (差分 * mult) >> shift で換算する（割り算を使わない）。
+#include "../include/clock.h"
+#include "../include/acpi.h"
+#include "../include/cpu.h"
+#include "../include/interrupt.h"
+#include "../include/io.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/spinlock.h"
+#include "../include/stddef.h"
+#include "../include/timer.h"
+
+// 較正に使うPITチャンネル2（スピーカー用、割り込みを起こさない）
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND  0x43
+#define PIT_CLOCK    1193182
+// 制御ワード 0xB0 = 10110000b（チャンネル2、下位→上位バイト、モード0、2進数）
+#define PIT_CH2_ONESHOT 0xB0
+// ポート0x61: チャンネル2のゲート、スピーカー、出力
+#define PIT_GATE_PORT  0x61
+#define PIT_GATE2      0x01
+#define PIT_SPEAKER    0x02
+#define PIT_OUT2       0x20
+
+// 較正の長さ（PITクロック数、約10ms）と回数（最も短い結果を使う）
+#define CALIBRATE_COUNT  11932
+#define CALIBRATE_ROUNDS 3
+// PITが応答しないときに諦めるTSCのサイクル数
+#define CALIBRATE_TIMEOUT (1ull << 32)
+
+// HPETのレジスタ
+#define HPET_GCAP_ID        0x00
+#define HPET_GCAP_PERIOD    0x04 // カウンタの周期（フェムト秒）
+#define HPET_GEN_CONF       0x10
+#define HPET_MAIN_COUNTER   0xF0
+#define HPET_MAIN_COUNTER_HI 0xF4
+#define HPET_COUNT_SIZE_CAP (1u << 13)
+#define HPET_ENABLE_CNF     0x1
+// HPETの周期の上限（100ns、仕様）
+#define HPET_MAX_PERIOD 100000000u
+
+// ACPI PMタイマーの周波数
+#define PM_TIMER_HZ 3579545
+
+// 周波数の単位ごとの1秒のナノ秒
+#define NS_PER_HZ  1000000000u
+#define NS_PER_KHZ 1000000u
+
+// 選んだクロックソース
+typedef struct {
+    const char* name;          // 名前
+    uint64_t (*read)(void);    // カウンタを読む（一周するカウンタは64ビットに伸ばす）
+    uint32_t khz;              // 周波数（kHz）
+    uint32_t mult;             // 換算の係数
+    uint32_t shift;
+    uint64_t base_counter;     // 選んだときのカウンタ
+    uint64_t base_ns;          // そのときの時刻
+    uint32_t wrap_ms;          // カウンタが一周する時間の半分（0なら64ビットで一周しない）
+} clocksource_t;
+
+// 選んだクロックソース（readがNULLならない）
+static clocksource_t source;
+// TSCの周波数と換算の係数
+static uint32_t tsc_khz = 0;
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_shift = 0;
+// HPETのレジスタ
+static volatile uint32_t* hpet_base = NULL;
+// ACPI PMタイマーのポートとカウンタのマスク
+static uint16_t pm_port = 0;
+static uint32_t pm_mask = 0;
+// 一周するカウンタを64ビットに伸ばすための、前回の値と合計
+static uint32_t wrap_last = 0;
+static uint64_t wrap_total = 0;
+static uint32_t wrap_mask = 0;
+// wrap_lastとwrap_totalのロック（どのCPUからも読む）
+static spinlock_t wrap_lock = SPINLOCK_INIT;
+// 一周する前にカウンタを読むタイマー
+static timer_list_t keepalive_timer;
+
+// 1秒のナノ秒数scale、周波数freqから、ns = (cycles * mult) >> shift の係数を求める
+// （multが32ビットに収まる範囲でshiftを大きく取る）
+static void clock_calc_mult(uint32_t scale, uint32_t freq, uint32_t* mult, uint32_t* shift) {
+    uint32_t s = 32;
+    while (s > 0 && (scale >> (32 - s)) >= freq) {
+        s--;
+    }
+    *shift = s;
+    *mult = div64_32((uint64_t)scale << s, freq);
+}
+
+// (delta * mult) >> shift（96ビットの途中結果を64ビット2つに分けて計算、shiftは32以下）
+static inline uint64_t clock_mul_shift(uint64_t delta, uint32_t mult, uint32_t shift) {
+    uint64_t low = ((uint64_t)(uint32_t)delta * mult) >> shift;
+    uint64_t high = (uint64_t)(uint32_t)(delta >> 32) * mult;
+    return low + (high << (32 - shift));
+}
+
+// PITチャンネル2の約10msの間に進むTSCのサイクル数で較正する（失敗すれば0）
+static uint32_t clock_calibrate_tsc(void) {
+    uint64_t best = ~0ull;
+
+    for (int round = 0; round < CALIBRATE_ROUNDS; round++) {
+        uint32_t flags = irq_save();
+
+        // ゲートを開けてスピーカーを切り、ワンショットでカウントを書く
+        outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~PIT_SPEAKER) | PIT_GATE2);
+        outb(PIT_COMMAND, PIT_CH2_ONESHOT);
+        outb(PIT_CHANNEL2, CALIBRATE_COUNT & 0xFF);
+        outb(PIT_CHANNEL2, CALIBRATE_COUNT >> 8);
+
+        uint64_t start = rdtsc();
+        uint64_t end = start;
+        while (!(inb(PIT_GATE_PORT) & PIT_OUT2)) {
+            end = rdtsc();
+            if (end - start > CALIBRATE_TIMEOUT) {
+                break;
+            }
+        }
+        irq_restore(flags);
+
+        if (end - start <= CALIBRATE_TIMEOUT && end - start < best) {
+            best = end - start;
+        }
+    }
+
+    if (best == ~0ull) {
+        return 0;
+    }
+    // kHz = サイクル数 / (CALIBRATE_COUNT / PIT_CLOCK秒) / 1000
+    return div64_32(best * PIT_CLOCK, CALIBRATE_COUNT * 1000u);
+}
+
+// TSCを読む
+static uint64_t clock_read_tsc(void) {
+    return rdtsc();
+}
+
+// 一周するカウンタの値を64ビットに伸ばす（wrap_lockを持って呼ぶ）
+static uint64_t clock_extend(uint32_t value) {
+    wrap_total += (value - wrap_last) & wrap_mask;
+    wrap_last = value;
+    return wrap_total;
+}
+
+// HPETのカウンタを読む
+static uint64_t clock_read_hpet64(void) {
+    uint32_t high, low;
+    do {
+        high = hpet_base[HPET_MAIN_COUNTER_HI / 4];
+        low = hpet_base[HPET_MAIN_COUNTER / 4];
+    } while (high != hpet_base[HPET_MAIN_COUNTER_HI / 4]);
+    return ((uint64_t)high << 32) | low;
+}
+
+static uint64_t clock_read_hpet32(void) {
+    uint32_t flags = spin_lock_irqsave(&wrap_lock);
+    uint64_t value = clock_extend(hpet_base[HPET_MAIN_COUNTER / 4]);
+    spin_unlock_irqrestore(&wrap_lock, flags);
+    return value;
+}
+
+// ACPI PMタイマーを読む（24ビットまたは32ビット）
+static uint64_t clock_read_pm(void) {
+    uint32_t flags = spin_lock_irqsave(&wrap_lock);
+    uint64_t value = clock_extend(inl(pm_port) & pm_mask);
+    spin_unlock_irqrestore(&wrap_lock, flags);
+    return value;
+}
+
+// HPETを探して有効化（周波数をHzで返す、なければ0）
+static uint32_t clock_probe_hpet(void) {
+    uint32_t address = acpi_hpet_address();
+    if (address == 0 || paging_map_identity(address, PAGE_SIZE, PAGE_PCD | PAGE_PWT) == NULL) {
+        return 0;
+    }
+    hpet_base = (volatile uint32_t*)address;
+
+    uint32_t period = hpet_base[HPET_GCAP_PERIOD / 4];
+    if (period == 0 || period > HPET_MAX_PERIOD) {
+        return 0;
+    }
+    hpet_base[HPET_GEN_CONF / 4] |= HPET_ENABLE_CNF;
+    return div64_32(1000000000000000ull, period);
+}
+
+// カウンタが一周する前に読むタイマー
+static void clock_keepalive(void* data) {
+    (void)data;
+    clock_ns();
+    mod_timer(&keepalive_timer, timer_get_ticks() + TIMER_MS_TO_TICKS(source.wrap_ms));
+}
+
+// クロックソースを選ぶ（freqの単位はscaleで決まる。wrap_bitsは一周するカウンタのビット数でHz単位のソースだけが使う）
+static void clock_select(const char* name, uint64_t (*read)(void), uint32_t scale, uint32_t freq, uint32_t wrap_bits) {
+    clocksource_t next;
+    next.name = name;
+    next.read = read;
+    next.khz = scale == NS_PER_HZ ? freq / 1000 : freq;
+    clock_calc_mult(scale, freq, &next.mult, &next.shift);
+
+    // 一周するカウンタは半周ごとに読む（半周のミリ秒 = 2^bits * 500 / Hz）
+    next.wrap_ms = 0;
+    if (wrap_bits != 0) {
+        wrap_mask = wrap_bits == 32 ? 0xFFFFFFFF : (1u << wrap_bits) - 1;
+        next.wrap_ms = div64_32(((uint64_t)wrap_mask + 1) * 500, freq);
+        wrap_total = 0;
+        wrap_last = 0;
+    }
+
+    // 今のティックから続くように時刻の基準を取る
+    uint32_t flags = irq_save();
+    next.base_ns = (uint64_t)timer_get_ticks() * (NS_PER_HZ / TIMER_HZ);
+    next.base_counter = read();
+    source = next;
+    irq_restore(flags);
+
+    if (source.wrap_ms != 0) {
+        timer_setup(&keepalive_timer, clock_keepalive, NULL);
+        mod_timer(&keepalive_timer, timer_get_ticks() + TIMER_MS_TO_TICKS(source.wrap_ms));
+    }
+}
+
+// TSCを較正してクロックソースを選ぶ
+void clock_init(void) {
+    if (cpu_has(CPU_FEATURE_TSC)) {
+        tsc_khz = clock_calibrate_tsc();
+        if (tsc_khz != 0) {
+            clock_calc_mult(NS_PER_KHZ, tsc_khz, &tsc_mult, &tsc_shift);
+        }
+    }
+
+    // 不変TSC（周波数変更や省電力状態で止まらない）が最も安く読める
+    if (tsc_khz != 0 && cpu_has(CPU_FEATURE_INVARIANT_TSC)) {
+        clock_select("tsc", clock_read_tsc, NS_PER_KHZ, tsc_khz, 0);
+        return;
+    }
+
+    acpi_init();
+    uint32_t hpet_hz = clock_probe_hpet();
+    if (hpet_hz != 0) {
+        if (hpet_base[HPET_GCAP_ID / 4] & HPET_COUNT_SIZE_CAP) {
+            clock_select("hpet", clock_read_hpet64, NS_PER_HZ, hpet_hz, 0);
+        } else {
+            clock_select("hpet", clock_read_hpet32, NS_PER_HZ, hpet_hz, 32);
+        }
+        return;
+    }
+
+    int ext32;
+    if (acpi_pm_timer(&pm_port, &ext32) == 0) {
+        pm_mask = ext32 ? 0xFFFFFFFF : 0x00FFFFFF;
+        clock_select("acpi_pm", clock_read_pm, NS_PER_HZ, PM_TIMER_HZ, ext32 ? 32 : 24);
+        return;
+    }
+
+    // 不変でなくてもTSCしかなければ使う
+    if (tsc_khz != 0) {
+        clock_select("tsc (unstable)", clock_read_tsc, NS_PER_KHZ, tsc_khz, 0);
+    }
+}
+
+// クロックソースが選ばれているか
+int clock_available(void) {
+    return source.read != NULL;
+}
+
+// 起動してからのナノ秒
+uint64_t clock_ns(void) {
+    if (source.read == NULL) {
+        return (uint64_t)timer_get_ticks() * (NS_PER_HZ / TIMER_HZ);
+    }
+    return source.base_ns + clock_mul_shift(source.read() - source.base_counter, source.mult, source.shift);
+}
+
+// TSCの値
+uint64_t clock_cycles(void) {
+    return tsc_khz != 0 ? rdtsc() : 0;
+}
+
+// TSCのサイクル数をナノ秒に換算
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return tsc_khz != 0 ? clock_mul_shift(cycles, tsc_mult, tsc_shift) : 0;
+}
+
+// 較正したTSCの周波数
+uint32_t clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+// 選ばれたクロックソースの名前
+const char* clock_source_name(void) {
+    return source.read != NULL ? source.name : "ticks";
+}
+
+// 選ばれたクロックソースの周波数
+uint32_t clock_source_khz(void) {
+    return source.read != NULL ? source.khz : TIMER_HZ / 1000;
+}
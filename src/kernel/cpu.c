@@ -0,0 +1,101 @@
+// cpu.c - CPUIDによるCPU機能の判定
+#include "../include/cpu.h"
+
+// 機能ビット
+static uint32_t features[CPU_WORDS];
+// ベンダー文字列
+static char vendor[13];
+// SSEが有効化されているか
+static int sse_enabled = 0;
+// PATの1番をライトコンバイニングにしたか
+static int pat_enabled = 0;
+
+// FPUとSSEを使えるようにする
+static void enable_sse(void) {
+    // CR0: エミュレーションを無効化、WAIT/FWAITでTSを確認、FPU例外をネイティブに
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    asm volatile("fninit");
+
+    // CR4: FXSAVE/FXRSTORとSSE例外を有効化
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    sse_enabled = 1;
+}
+
+// PATの1番（PWTだけ立てたページ）をライトコンバイニングにする（他は電源投入時の値のまま）
+static void enable_pat(void) {
+    // キャッシュとTLBに古い属性が残らないよう、書き戻してから切り替える
+    asm volatile("wbinvd" : : : "memory");
+    wrmsr(MSR_IA32_PAT, PAT_VALUE);
+    write_cr3(read_cr3());
+    asm volatile("wbinvd" : : : "memory");
+    pat_enabled = 1;
+}
+
+// CPUIDで機能を調べる
+void cpu_init(void) {
+    uint32_t a, b, c, d;
+
+    // 基本リーフの最大値とベンダー文字列
+    cpuid(0, &a, &b, &c, &d);
+    uint32_t max_leaf = a;
+    *(uint32_t*)&vendor[0] = b;
+    *(uint32_t*)&vendor[4] = d;
+    *(uint32_t*)&vendor[8] = c;
+    vendor[12] = '\0';
+
+    if (max_leaf >= 1) {
+        cpuid(1, &a, &b, &c, &d);
+        features[CPU_WORD_1_EDX] = d;
+        features[CPU_WORD_1_ECX] = c;
+    }
+
+    // 拡張リーフ
+    cpuid(0x80000000, &a, &b, &c, &d);
+    uint32_t max_ext = a;
+    if (max_ext >= 0x80000001) {
+        cpuid(0x80000001, &a, &b, &c, &d);
+        features[CPU_WORD_EXT1_EDX] = d;
+    }
+    if (max_ext >= 0x80000007) {
+        cpuid(0x80000007, &a, &b, &c, &d);
+        features[CPU_WORD_EXT7_EDX] = d;
+    }
+
+    if (cpu_has(CPU_FEATURE_FXSR) && cpu_has(CPU_FEATURE_SSE)) {
+        enable_sse();
+    }
+    if (cpu_has(CPU_FEATURE_PAT) && cpu_has(CPU_FEATURE_MSR)) {
+        enable_pat();
+    }
+}
+
+// APでFPUとSSEとPATを使えるようにする
+void cpu_init_ap(void) {
+    if (sse_enabled) {
+        enable_sse();
+    }
+    // PATはCPUごとのMSRなので、全部のCPUで同じ値にする
+    if (pat_enabled) {
+        enable_pat();
+    }
+}
+
+// 機能を持っているか
+int cpu_has(uint32_t feature) {
+    return (features[feature >> 5] >> (feature & 31)) & 1;
+}
+
+// SSEが有効化されているか
+int cpu_sse_enabled(void) {
+    return sse_enabled;
+}
+
+// ライトコンバイニングのページ属性を使えるか
+int cpu_pat_enabled(void) {
+    return pat_enabled;
+}
+
+// ベンダー文字列
+const char* cpu_vendor(void) {
+    return vendor;
+}
@@ -0,0 +1,205 @@
+// fpu.c - FPU/SSEの状態の遅延保存とカーネル内でのSIMD利用
+// レジスタの状態は「持ち主」のコンテキストのものとしてCPUに置いたままにし、
+// 別のコンテキストが初めてFPU/SSE命令を実行したとき（CR0.TSによる#NM）にだけ入れ替える。
+// FPUを使わないコンテキストは保存も復元もしない。
+#include "../include/fpu.h"
+#include "../include/cpu.h"
+#include "../include/interrupt.h"
+#include "../include/memory.h"
+#include "../include/stddef.h"
+#include "../include/thread.h"
+
+// #NM（デバイス使用不可）のベクタ
+#define FPU_NM_VECTOR 7
+
+// CPUごとのFPUの状態（キャッシュラインを共有しないよう揃える）
+typedef struct {
+    fpu_state_t* owner;   // レジスタに状態が載っているコンテキスト（NULLなら誰のものでもない）
+    fpu_state_t* current; // 実行中のコンテキスト（fpu_initまではNULL）
+    uint32_t ts;          // CR0.TSを立てているか
+    uint32_t in_kernel;   // kernel_fpu_begin中なら1
+    uint32_t traps;       // #NMで状態を入れ替えた回数
+    uint32_t saves;       // カーネル区間で状態を保存した回数
+} __attribute__((aligned(CACHE_LINE_SIZE))) fpu_cpu_t;
+
+// CPUごとの状態
+static fpu_cpu_t fpu_cpus[MAX_CPUS];
+// 遅延保存を使っているか（FXSAVE/FXRSTORとSSEが有効なときだけ）
+static int lazy_enabled = 0;
+// FNINIT直後の状態（初めてFPUを使うコンテキストに読み込む）
+static fpu_state_t fpu_initial_state;
+// 起動時のコンテキスト（スレッドができるまではこれだけ）
+static fpu_state_t fpu_boot_state;
+
+// 現在のCPUの状態
+static inline fpu_cpu_t* this_cpu(void) {
+    return &fpu_cpus[cpu_current()];
+}
+
+static inline void fxsave(fpu_state_t* state) {
+    asm volatile("fxsave %0" : "=m" (state->fxsave));
+}
+
+static inline void fxrstor(const fpu_state_t* state) {
+    asm volatile("fxrstor %0" : : "m" (state->fxsave));
+}
+
+// CR0.TSを下ろす/立てる（変わるときだけ書き込む）
+static inline void fpu_clear_ts(fpu_cpu_t* cpu) {
+    if (cpu->ts) {
+        asm volatile("clts" : : : "memory");
+        cpu->ts = 0;
+    }
+}
+
+static inline void fpu_set_ts(fpu_cpu_t* cpu) {
+    if (!cpu->ts) {
+        write_cr0(read_cr0() | CR0_TS);
+        cpu->ts = 1;
+    }
+}
+
+// #NM: 実行中のコンテキストの状態をレジスタに載せる
+static void fpu_nm_handler(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    fpu_cpu_t* cpu = this_cpu();
+
+    fpu_clear_ts(cpu);
+    if (cpu->owner == cpu->current) {
+        return;
+    }
+
+    // 前の持ち主の状態を保存し、実行中のコンテキストの状態を読み込む
+    if (cpu->owner != NULL) {
+        fxsave(cpu->owner);
+    }
+    fpu_state_t* next = cpu->current;
+    fxrstor(next->used ? next : &fpu_initial_state);
+    next->used = 1;
+    cpu->owner = next;
+    cpu->traps++;
+}
+
+// 遅延保存を有効化
+void fpu_init(void) {
+    if (!cpu_sse_enabled()) {
+        return;
+    }
+
+    // cpu_initのFNINIT直後の状態（MXCSRは既定値）を初期状態として取っておく
+    asm volatile("fninit");
+    fxsave(&fpu_initial_state);
+
+    fpu_state_init(&fpu_boot_state);
+    fpu_cpu_t* cpu = this_cpu();
+    cpu->owner = NULL;
+    cpu->current = &fpu_boot_state;
+    cpu->ts = (read_cr0() & CR0_TS) != 0;
+    register_interrupt_handler(FPU_NM_VECTOR, fpu_nm_handler, NULL);
+    lazy_enabled = 1;
+
+    // 起動時のコンテキストも最初に使ったときに状態を読み込む
+    fpu_set_ts(cpu);
+}
+
+// APの状態を初期化
+void fpu_init_ap(void) {
+    if (!lazy_enabled) {
+        return;
+    }
+
+    fpu_cpu_t* cpu = this_cpu();
+    cpu->owner = NULL;
+    cpu->current = NULL;
+    cpu->ts = (read_cr0() & CR0_TS) != 0;
+    fpu_set_ts(cpu);
+}
+
+// FPU/SSEの状態を遅延保存で管理しているか
+int fpu_lazy_enabled(void) {
+    return lazy_enabled;
+}
+
+// コンテキストの状態を初期化
+void fpu_state_init(fpu_state_t* state) {
+    memset(state, 0, sizeof(*state));
+}
+
+// 実行するコンテキストを切り替える（スケジューラが割り込み禁止で呼ぶ）
+void fpu_switch(fpu_state_t* next) {
+    if (!lazy_enabled) {
+        return;
+    }
+
+    // レジスタに載っているのが次のコンテキストの状態なら#NMを起こさずに済む
+    fpu_cpu_t* cpu = this_cpu();
+    cpu->current = next;
+    if (cpu->owner == next) {
+        fpu_clear_ts(cpu);
+    } else {
+        fpu_set_ts(cpu);
+    }
+}
+
+// コンテキストが終了するときに呼ぶ
+void fpu_release(fpu_state_t* state) {
+    uint32_t flags = irq_save();
+    fpu_cpu_t* cpu = this_cpu();
+    if (cpu->owner == state) {
+        cpu->owner = NULL;
+    }
+    irq_restore(flags);
+}
+
+// カーネル内でSIMDを使う区間を開始
+int kernel_fpu_begin(void) {
+    if (!cpu_sse_enabled()) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+    fpu_cpu_t* cpu = this_cpu();
+    if (cpu->in_kernel) {
+        // 区間の途中で割り込まれた（割り込みハンドラはスカラーで処理する）
+        irq_restore(flags);
+        return 0;
+    }
+    cpu->in_kernel = 1;
+    // 区間の途中で別のスレッドに切り替わるとレジスタを上書きされる
+    preempt_disable();
+
+    // レジスタに載っているコンテキストの状態を保存する（後で#NMから読み直す）
+    fpu_clear_ts(cpu);
+    if (cpu->owner != NULL) {
+        fxsave(cpu->owner);
+        cpu->owner = NULL;
+        cpu->saves++;
+    }
+    irq_restore(flags);
+    return 1;
+}
+
+// カーネル内でSIMDを使う区間を終了
+void kernel_fpu_end(void) {
+    uint32_t flags = irq_save();
+    fpu_cpu_t* cpu = this_cpu();
+
+    // レジスタはもう誰の状態でもないので、次に使うコンテキストには#NMで読み込ませる
+    if (lazy_enabled) {
+        fpu_set_ts(cpu);
+    }
+    cpu->in_kernel = 0;
+    preempt_enable();
+    irq_restore(flags);
+}
+
+// #NMで状態を入れ替えた回数
+uint32_t fpu_traps(void) {
+    return this_cpu()->traps;
+}
+
+// カーネル区間で状態を保存した回数
+uint32_t fpu_saves(void) {
+    return this_cpu()->saves;
+}
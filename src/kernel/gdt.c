@@ -0,0 +1,94 @@
+// gdt.c - CPUごとのGDTとTSS
+// ブートローダのGDTは使わず、CPUごとにフラットなコード/データセグメントと、
+// ベースがそのCPUの領域（cpu_local_t）を指すGSセグメント、TSSを持つGDTを作る。
+#include "../include/gdt.h"
+#include "../include/cpu.h"
+#include "../include/memory.h"
+
+// アクセスバイト
+#define GDT_ACCESS_CODE 0x9A // 存在、DPL0、コード、実行/読み取り
+#define GDT_ACCESS_DATA 0x92 // 存在、DPL0、データ、読み書き
+#define GDT_ACCESS_TSS  0x89 // 存在、DPL0、32ビットTSS（非ビジー）
+
+// フラグ（上位4ビット）: 4KB単位、32ビット
+#define GDT_FLAGS_32BIT 0xC0
+#define GDT_FLAGS_BYTE  0x40
+
+// GDTのエントリ
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t flags_limit;    // 上位4ビットがフラグ、下位4ビットがリミットの上位
+    uint8_t base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+// LGDTに渡すポインタ
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_ptr_t;
+
+// 32ビットTSS（タスク切り替えは使わず、特権レベルが変わるときのスタックだけ使う）
+typedef struct {
+    uint32_t prev_task;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t unused[22];
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+// CPUごとのGDT、TSS、CPUごとの領域
+static gdt_entry_t gdts[MAX_CPUS][GDT_ENTRIES] __attribute__((aligned(CACHE_LINE_SIZE)));
+static tss_t tss[MAX_CPUS] __attribute__((aligned(CACHE_LINE_SIZE)));
+static cpu_local_t cpu_locals[MAX_CPUS] __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// エントリを設定（limitは20ビット、GDT_FLAGS_32BITなら4KB単位）
+static void gdt_set(gdt_entry_t* entry, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    entry->limit_low = limit & 0xFFFF;
+    entry->base_low = base & 0xFFFF;
+    entry->base_middle = (base >> 16) & 0xFF;
+    entry->access = access;
+    entry->flags_limit = flags | ((limit >> 16) & 0x0F);
+    entry->base_high = (base >> 24) & 0xFF;
+}
+
+// CPUのGDTとTSSを作って読み込む
+void gdt_init(uint32_t cpu, uint32_t stack_top) {
+    gdt_entry_t* gdt = gdts[cpu];
+    cpu_local_t* local = &cpu_locals[cpu];
+
+    local->self = local;
+    local->id = cpu;
+
+    memset(&tss[cpu], 0, sizeof(tss_t));
+    tss[cpu].esp0 = stack_top;
+    tss[cpu].ss0 = GDT_KERNEL_DATA;
+    tss[cpu].iomap_base = sizeof(tss_t); // I/O許可ビットマップなし
+
+    gdt_set(&gdt[0], 0, 0, 0, 0);
+    gdt_set(&gdt[GDT_KERNEL_CODE / 8], 0, 0xFFFFF, GDT_ACCESS_CODE, GDT_FLAGS_32BIT);
+    gdt_set(&gdt[GDT_KERNEL_DATA / 8], 0, 0xFFFFF, GDT_ACCESS_DATA, GDT_FLAGS_32BIT);
+    gdt_set(&gdt[GDT_PERCPU / 8], (uint32_t)local, sizeof(cpu_local_t) - 1, GDT_ACCESS_DATA, GDT_FLAGS_BYTE);
+    gdt_set(&gdt[GDT_TSS / 8], (uint32_t)&tss[cpu], sizeof(tss_t) - 1, GDT_ACCESS_TSS, 0);
+
+    gdt_ptr_t ptr;
+    ptr.limit = sizeof(gdts[cpu]) - 1;
+    ptr.base = (uint32_t)gdt;
+
+    // GDTを読み込み、CSは遠いジャンプで、他のセグメントレジスタは直接読み直す
+    asm volatile("lgdt %0\n\t"
+                 "ljmp %1, $1f\n"
+                 "1:\n\t"
+                 "mov %w2, %%ds\n\t"
+                 "mov %w2, %%es\n\t"
+                 "mov %w2, %%fs\n\t"
+                 "mov %w2, %%ss\n\t"
+                 "mov %w3, %%gs\n\t"
+                 "ltr %w4"
+                 : : "m" (ptr), "i" (GDT_KERNEL_CODE), "r" (GDT_KERNEL_DATA),
+                     "r" (GDT_PERCPU), "r" (GDT_TSS)
+                 : "memory");
+}
@@ -1,15 +1,19 @@
 // interrupt.c - 割り込み処理の実装
 #include "../include/interrupt.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
 #include "../include/io.h"
-#include "../include/keyboard.h"
-#include "../include/memory.h"
+#include "../include/irqstat.h"
+#include "../include/kprintf.h"
 #include "../include/screen.h"
-#include "../include/timer.h"
+#include "../include/serial.h"
+#include "../include/smp.h"
+#include "../include/softirq.h"
+#include "../include/string.h"
+#include "../include/thread.h"
+#include "../include/trace.h"
 
 
-// IDTのエントリ数
-#define IDT_SIZE 256
-
 // IDTテーブル
 static idt_entry_t idt[IDT_SIZE];
 // IDTポインタ
@@ -21,18 +25,51 @@ static idt_ptr_t idtp;
 #define PIC2_COMMAND 0xA0
 #define PIC2_DATA    0xA1
 
-// 外部で定義される割り込みハンドラ（アセンブリ）
-extern void isr0(void);
-extern void isr1(void);
-extern void isr2(void);
-extern void isr3(void);
-extern void isr4(void);
-extern void isr5(void);
-extern void isr6(void);
-extern void isr7(void);
+// PICのコマンド
+#define PIC_EOI      0x20
+#define PIC_READ_ISR 0x0B
+
+// スレーブPICがつながっているマスタのIRQ
+#define PIC_CASCADE_IRQ 2
+
+// カーネルのコードセグメントとゲートの種類（32ビット割り込みゲート、DPL0）
+#define KERNEL_CODE_SELECTOR 0x08
+#define IDT_INTERRUPT_GATE   0x8E
+
+// ハンドラの表のエントリ
+typedef struct {
+    interrupt_handler_t fn; // ハンドラ（NULLなら未登録）
+    void* ctx;              // ハンドラに渡す値
+} interrupt_entry_t;
+
+// 各ベクタの入口（interrupt_asm.asm）
+extern uint32_t interrupt_stub_table[IDT_SIZE];
 
-extern void irq0(void);
-extern void irq1(void);
+// ベクタごとのハンドラ
+static interrupt_entry_t handlers[IDT_SIZE];
+// PICのマスクのキャッシュ（ビットが1のIRQはマスク、下位8ビットがマスタ）
+static uint16_t pic_mask_cache = 0xFFFF;
+// スプリアスIRQの回数
+static uint32_t spurious_irqs = 0;
+// IRQをI/O APICで配送しているか（0なら8259 PIC）
+static int use_apic = 0;
+// NMIのベクタ
+#define NMI_VECTOR 2
+
+// CPUごとの割り込みのネストの深さ
+static uint32_t irq_depth[MAX_CPUS];
+
+// 例外の名前
+static const char* exception_names[EXCEPTION_COUNT] = {
+    "Divide Error", "Debug", "NMI", "Breakpoint",
+    "Overflow", "BOUND Range Exceeded", "Invalid Opcode", "Device Not Available",
+    "Double Fault", "Coprocessor Segment Overrun", "Invalid TSS", "Segment Not Present",
+    "Stack-Segment Fault", "General Protection", "Page Fault", "Reserved",
+    "x87 FPU Error", "Alignment Check", "Machine Check", "SIMD Floating-Point",
+    "Virtualization", "Control Protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor Injection", "VMM Communication", "Security", "Reserved"
+};
 
 // IDTエントリを設定
 static void idt_set_gate(uint8_t n, uint32_t handler, uint16_t sel, uint8_t flags) {
@@ -47,19 +84,96 @@ static void idt_set_gate(uint8_t n, uint32_t handler, uint16_t sel, uint8_t flag
 static void pic_remap(void) {
     // マスタPICの初期化
     outb(PIC1_COMMAND, 0x11);  // 初期化コマンド
-    outb(PIC1_DATA, 0x20);     // ベクタオフセット（IRQ0-7を0x20-0x27にマップ）
+    outb(PIC1_DATA, IRQ_BASE); // ベクタオフセット（IRQ0-7を0x20-0x27にマップ）
     outb(PIC1_DATA, 0x04);     // スレーブPICはIRQ2に接続
     outb(PIC1_DATA, 0x01);     // 8086モード
     
     // スレーブPICの初期化
-    outb(PIC2_COMMAND, 0x11);  // 初期化コマンド
-    outb(PIC2_DATA, 0x28);     // ベクタオフセット（IRQ8-15を0x28-0x2Fにマップ）
-    outb(PIC2_DATA, 0x02);     // マスタPICのIRQ2に接続
-    outb(PIC2_DATA, 0x01);     // 8086モード
+    outb(PIC2_COMMAND, 0x11);      // 初期化コマンド
+    outb(PIC2_DATA, IRQ_BASE + 8); // ベクタオフセット（IRQ8-15を0x28-0x2Fにマップ）
+    outb(PIC2_DATA, 0x02);         // マスタPICのIRQ2に接続
+    outb(PIC2_DATA, 0x01);         // 8086モード
     
     // 全ての割り込みをマスク（無効化）
+    pic_mask_cache = 0xFFFF;
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+// マスクのキャッシュを新しい値にして、変わった側のPICにだけ書き込む
+static void pic_set_mask(uint16_t mask) {
+    uint16_t changed = mask ^ pic_mask_cache;
+    pic_mask_cache = mask;
+    if (changed & 0x00FF) {
+        outb(PIC1_DATA, mask & 0xFF);
+    }
+    if (changed & 0xFF00) {
+        outb(PIC2_DATA, mask >> 8);
+    }
+}
+
+// IRQをマスク
+void irq_mask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    uint16_t mask = pic_mask_cache | (1u << irq);
+    // スレーブのIRQがすべてマスクされたらカスケードも閉じる
+    if ((mask & 0xFF00) == 0xFF00) {
+        mask |= 1u << PIC_CASCADE_IRQ;
+    }
+    if (use_apic) {
+        // APICモードではキャッシュはIRQごとの論理的なマスクとして使う
+        pic_mask_cache = mask;
+        ioapic_mask_irq(irq);
+    } else {
+        pic_set_mask(mask);
+    }
+    irq_restore(flags);
+}
+
+// IRQのマスクを解除
+void irq_unmask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    uint16_t mask = pic_mask_cache & ~(1u << irq);
+    // スレーブのIRQはカスケードも開いていないと届かない
+    if (irq >= 8) {
+        mask &= ~(1u << PIC_CASCADE_IRQ);
+    }
+    if (use_apic) {
+        pic_mask_cache = mask;
+        ioapic_unmask_irq(irq);
+    } else {
+        pic_set_mask(mask);
+    }
+    irq_restore(flags);
+}
+
+// IRQの配送をI/O APICに切り替える（マスクを外していたIRQを移し、8259はすべてマスク）
+void interrupt_switch_to_apic(void) {
+    uint32_t flags = irq_save();
+
     outb(PIC1_DATA, 0xFF);
     outb(PIC2_DATA, 0xFF);
+    use_apic = 1;
+
+    for (uint8_t irq = 0; irq < IRQ_COUNT; irq++) {
+        if (irq != PIC_CASCADE_IRQ && !(pic_mask_cache & (1u << irq))) {
+            ioapic_unmask_irq(irq);
+        }
+    }
+    irq_restore(flags);
+}
+
+// 割り込みの配送に使っているコントローラの名前
+const char* interrupt_controller(void) {
+    return use_apic ? "APIC" : "8259 PIC";
 }
 
 // 割り込み処理の初期化
@@ -68,32 +182,27 @@ void interrupt_init(void) {
     idtp.limit = (sizeof(idt_entry_t) * IDT_SIZE) - 1;
     idtp.base = (uint32_t)&idt;
     
-    // IDTをクリア
-    memset(&idt, 0, sizeof(idt_entry_t) * IDT_SIZE);
+    // ハンドラの表と統計をクリア
+    memset(handlers, 0, sizeof(handlers));
+    irqstat_init();
     
-    // PICを再マップ
+    // PICを再マップ（全IRQをマスクした状態になる）
     pic_remap();
     
-    // 例外ハンドラを設定（0-7）
-    idt_set_gate(0, (uint32_t)isr0, 0x08, 0x8E);
-    idt_set_gate(1, (uint32_t)isr1, 0x08, 0x8E);
-    idt_set_gate(2, (uint32_t)isr2, 0x08, 0x8E);
-    idt_set_gate(3, (uint32_t)isr3, 0x08, 0x8E);
-    idt_set_gate(4, (uint32_t)isr4, 0x08, 0x8E);
-    idt_set_gate(5, (uint32_t)isr5, 0x08, 0x8E);
-    idt_set_gate(6, (uint32_t)isr6, 0x08, 0x8E);
-    idt_set_gate(7, (uint32_t)isr7, 0x08, 0x8E);
-    
-    // IRQハンドラを設定
-    idt_set_gate(32, (uint32_t)irq0, 0x08, 0x8E); // タイマー
-    idt_set_gate(33, (uint32_t)irq1, 0x08, 0x8E); // キーボード
+    // すべてのベクタに入口を設定（例外0-31、IRQ 32-47、その他48-255）
+    for (uint32_t i = 0; i < IDT_SIZE; i++) {
+        idt_set_gate(i, interrupt_stub_table[i], KERNEL_CODE_SELECTOR, IDT_INTERRUPT_GATE);
+    }
     
     // IDTを読み込み
     asm volatile("lidt %0" : : "m" (idtp));
     
-    // タイマーとキーボード割り込みを有効化
-    // 0xFC → 0xFE に変更（キーボードのみ有効、タイマー無効）
-    outb(PIC1_DATA, 0xFE); // IRQ1（キーボード）のみ有効
+    // 各IRQはドライバがregister_irq_handlerで登録したときにマスクを外す
+}
+
+// APにBSPと同じIDTを読み込む
+void interrupt_init_ap(void) {
+    asm volatile("lidt %0" : : "m" (idtp));
 }
 
 // 割り込みを有効化
@@ -108,42 +217,150 @@ void interrupt_disable(void) {
 
 // 特定の割り込みハンドラを設定
 void set_interrupt_handler(uint8_t n, uint32_t handler) {
-    idt_set_gate(n, handler, 0x08, 0x8E);
+    idt_set_gate(n, handler, KERNEL_CODE_SELECTOR, IDT_INTERRUPT_GATE);
 }
 
-// 例外ハンドラ
-void fault_handler(uint32_t int_no, uint32_t err_code) {
-    screen_write("Exception occurred: ", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
-    
-    char buffer[32];
-    int_to_string(int_no, buffer);
-    screen_write(buffer, vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
-    
-    screen_write(" Error Code: ", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
-    int_to_string(err_code, buffer);
-    screen_write(buffer, vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
-    screen_newline();
-    
+// ベクタにハンドラを登録
+int register_interrupt_handler(uint8_t vector, interrupt_handler_t fn, void* ctx) {
+    uint32_t flags = irq_save();
+    if (handlers[vector].fn != NULL) {
+        irq_restore(flags);
+        return -1;
+    }
+    handlers[vector].ctx = ctx;
+    handlers[vector].fn = fn;
+    irq_restore(flags);
+    return 0;
+}
+
+// IRQにハンドラを登録してマスクを外す
+int register_irq_handler(uint8_t irq, interrupt_handler_t fn, void* ctx) {
+    if (irq >= IRQ_COUNT || register_interrupt_handler(IRQ_VECTOR(irq), fn, ctx) != 0) {
+        return -1;
+    }
+    irq_unmask(irq);
+    return 0;
+}
+
+// IRQのハンドラを削除してマスクする
+void unregister_irq_handler(uint8_t irq) {
+    if (irq >= IRQ_COUNT) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    irq_mask(irq);
+    handlers[IRQ_VECTOR(irq)].fn = NULL;
+    handlers[IRQ_VECTOR(irq)].ctx = NULL;
+    irq_restore(flags);
+}
+
+// 例外ハンドラ（登録されたハンドラのない例外の内容を表示して停止）
+static void fault_handler(registers_t* regs) {
+    // 落ちた別のCPUが送ったNMIなら、何も書かずにそのまま止まる
+    if (regs->int_no == NMI_VECTOR && smp_stopping()) {
+        while (1) {
+            asm volatile("cli; hlt");
+        }
+    }
+
+    // このCPUが画面に書いている途中で落ちたかもしれないので、ロックを壊してから書く
+    screen_panic();
+
+    // 画面だけでなくCOM1とログにも出し、画面が見えなくても残るようにする
+    const char* name = regs->int_no < EXCEPTION_COUNT ? exception_names[regs->int_no] : "unknown";
+    kprintf_to(KPRINTF_ALL,
+               "%CException occurred: %u (%s) Error Code: 0x%08X\n"
+               "  EIP=0x%08X CS=0x%08X EFLAGS=0x%08X\n"
+               "  EAX=0x%08X EBX=0x%08X ECX=0x%08X EDX=0x%08X\n"
+               "  ESI=0x%08X EDI=0x%08X EBP=0x%08X ESP=0x%08X\n",
+               vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK),
+               regs->int_no, name, regs->err_code,
+               regs->eip, regs->cs, regs->eflags,
+               regs->eax, regs->ebx, regs->ecx, regs->edx,
+               // pushaが保存したESPは割り込み直前ではなくEIP/CS/EFLAGSを積んだ後の値
+               regs->esi, regs->edi, regs->ebp, regs->esp + 20);
+
+    // 割り込みを止めたまま止まるので、送信リングに残った分はここで書き切る
+    serial_flush(SERIAL_COM1);
+
     // システムを停止
     while (1) {
-        asm volatile("hlt");
+        asm volatile("cli; hlt");
     }
 }
 
-// IRQハンドラ
-void irq_handler(uint32_t int_no) {
-    // IRQ0（タイマー）の処理
-    if (int_no == 32) {
-        timer_handler();
+// スプリアスIRQか調べる（IRQ7/15でPICのISRにビットが立っていなければスプリアス）
+static int irq_is_spurious(uint8_t irq) {
+    if (irq == 7) {
+        outb(PIC1_COMMAND, PIC_READ_ISR);
+        return !(inb(PIC1_COMMAND) & 0x80);
     }
-    // IRQ1（キーボード）の処理
-    else if (int_no == 33) {
-        keyboard_handler();
+    if (irq == 15) {
+        outb(PIC2_COMMAND, PIC_READ_ISR);
+        if (!(inb(PIC2_COMMAND) & 0x80)) {
+            // マスタはカスケードとして受け付けているのでEOIが必要
+            outb(PIC1_COMMAND, PIC_EOI);
+            return 1;
+        }
     }
-    
-    // EOI（End of Interrupt）シグナルをPICに送信
-    if (int_no >= 40) {
-        outb(PIC2_COMMAND, 0x20); // スレーブPICにEOI
+    return 0;
+}
+
+// IRQの処理（EOIを先に送ってからハンドラを呼ぶ。割り込みゲートなのでIFは0のまま）
+static void irq_dispatch(registers_t* regs) {
+    uint8_t irq = regs->int_no - IRQ_BASE;
+
+    if (use_apic) {
+        // ローカルAPICへのEOIはMMIOへの書き込み1回
+        lapic_eoi();
+    } else {
+        if (irq_is_spurious(irq)) {
+            spurious_irqs++;
+            return;
+        }
+
+        // EOI（End of Interrupt）シグナルをPICに送信
+        if (irq >= 8) {
+            outb(PIC2_COMMAND, PIC_EOI); // スレーブPICにEOI
+        }
+        outb(PIC1_COMMAND, PIC_EOI); // マスタPICにEOI
+    }
+
+    interrupt_entry_t* entry = &handlers[regs->int_no];
+    if (entry->fn != NULL) {
+        entry->fn(regs, entry->ctx);
     }
-    outb(PIC1_COMMAND, 0x20); // マスタPICにEOI
-}
\ No newline at end of file
+}
+
+// 割り込みの入口（interrupt_asm.asmの共通スタブから呼ばれる）
+void interrupt_dispatch(registers_t* regs) {
+    uint32_t cpu = cpu_current();
+    uint64_t start = irqstat_begin();
+    irq_depth[cpu]++;
+    TRACE_EVENT(TRACE_IRQ_ENTRY, regs->int_no);
+
+    if (regs->int_no >= IRQ_BASE && regs->int_no < IRQ_BASE + IRQ_COUNT) {
+        irq_dispatch(regs);
+    } else {
+        interrupt_entry_t* entry = &handlers[regs->int_no & (IDT_SIZE - 1)];
+        if (entry->fn != NULL) {
+            entry->fn(regs, entry->ctx);
+        } else if (regs->int_no < EXCEPTION_COUNT) {
+            fault_handler(regs);
+        }
+    }
+    TRACE_EVENT(TRACE_IRQ_EXIT, regs->int_no);
+    irqstat_end(regs->int_no, start);
+
+    // 例外以外の出口では、ハンドラが予約した後半処理を割り込みを許可して実行する
+    if (regs->int_no >= EXCEPTION_COUNT) {
+        softirq_irq_exit();
+    }
+
+    // 最も外側の出口では、必要なら割り込まれたスレッドを別のスレッドに切り替える
+    irq_depth[cpu]--;
+    if (regs->int_no >= EXCEPTION_COUNT && irq_depth[cpu] == 0) {
+        thread_preempt();
+    }
+}
@@ -0,0 +1,174 @@
+// irqstat.c - ベクタごとの割り込みの回数と処理時間（RDTSC）の統計
+#include "../include/irqstat.h"
+#include "../include/cpu.h"
+#include "../include/interrupt.h"
+#include "../include/kprintf.h"
+#include "../include/memory.h"
+#include "../include/screen.h"
+#include "../include/softirq.h"
+#include "../include/string.h"
+
+// ベクタごとの統計（割り込みゲートの中で更新するのでIFは0）
+typedef struct {
+    uint32_t count;                     // 回数
+    uint32_t min;                       // 最小サイクル数
+    uint32_t max;                       // 最大サイクル数
+    uint64_t total;                     // 合計サイクル数
+    uint32_t hist[IRQSTAT_BUCKETS];     // log2(サイクル数)ごとの回数
+} irqstat_entry_t;
+
+// CPUごとのベクタごとの統計（各CPUは自分の分だけを更新する、キャッシュラインを共有しないよう揃える）
+typedef struct {
+    irqstat_entry_t stats[IDT_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE))) irqstat_cpu_t;
+
+// CPUごとの統計
+static irqstat_cpu_t irqstat_cpus[MAX_CPUS];
+// TSCを使えるか
+static int tsc_available = 0;
+
+// 統計を初期化
+void irqstat_init(void) {
+    tsc_available = cpu_has(CPU_FEATURE_TSC);
+    irqstat_reset();
+}
+
+// 統計をリセット
+void irqstat_reset(void) {
+    uint32_t flags = irq_save();
+    memset(irqstat_cpus, 0, sizeof(irqstat_cpus));
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        for (uint32_t i = 0; i < IDT_SIZE; i++) {
+            irqstat_cpus[cpu].stats[i].min = 0xFFFFFFFF;
+        }
+    }
+    irq_restore(flags);
+}
+
+// 割り込みの入口で呼ぶ
+uint64_t irqstat_begin(void) {
+    return tsc_available ? rdtsc() : 0;
+}
+
+// 割り込みの出口で呼ぶ
+void irqstat_end(uint32_t vector, uint64_t start) {
+    irqstat_entry_t* entry = &irqstat_cpus[cpu_current()].stats[vector & (IDT_SIZE - 1)];
+    entry->count++;
+    if (!tsc_available) {
+        return;
+    }
+
+    // 1回の処理が2^32サイクルを超えることはないので32ビットで扱う
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    if (cycles < entry->min) {
+        entry->min = cycles;
+    }
+    if (cycles > entry->max) {
+        entry->max = cycles;
+    }
+    entry->total += cycles;
+    entry->hist[cycles ? 31 - __builtin_clz(cycles) : 0]++;
+}
+
+// ベクタの名前（IRQ番号か例外番号、bufferは16バイト）
+static void vector_name(uint32_t vector, char* buffer) {
+    if (vector < EXCEPTION_COUNT) {
+        ksnprintf(buffer, 16, "#%u", vector);
+    } else if (vector < IRQ_BASE + IRQ_COUNT) {
+        ksnprintf(buffer, 16, "IRQ%u", vector - IRQ_BASE);
+    } else {
+        ksnprintf(buffer, 16, "vec%u", vector);
+    }
+}
+
+// 全CPUの統計を合計する（他のCPUが更新中の値は目安、回数が0なら0を返す）
+static uint32_t irqstat_sum(uint32_t vector, irqstat_entry_t* out) {
+    memset(out, 0, sizeof(*out));
+    out->min = 0xFFFFFFFF;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        // 自分のCPUの分は表示中に更新されないよう割り込みを止めて写す
+        uint32_t flags = irq_save();
+        irqstat_entry_t copy = irqstat_cpus[cpu].stats[vector];
+        irq_restore(flags);
+        if (copy.count == 0) {
+            continue;
+        }
+        out->count += copy.count;
+        out->total += copy.total;
+        if (copy.min < out->min) {
+            out->min = copy.min;
+        }
+        if (copy.max > out->max) {
+            out->max = copy.max;
+        }
+        for (uint32_t i = 0; i < IRQSTAT_BUCKETS; i++) {
+            out->hist[i] += copy.hist[i];
+        }
+    }
+    return out->count;
+}
+
+// 統計を画面に表示
+void irqstat_show(void) {
+    char name[16];
+    uint8_t white = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    uint8_t grey = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+
+    kprintf("%CInterrupt Statistics (%s, %s):\n%C  vector     count       min       avg       max\n",
+            white, interrupt_controller(), tsc_available ? "cycles" : "no TSC", grey);
+
+    for (uint32_t vector = 0; vector < IDT_SIZE; vector++) {
+        irqstat_entry_t copy;
+        if (irqstat_sum(vector, &copy) == 0) {
+            continue;
+        }
+
+        vector_name(vector, name);
+        if (tsc_available) {
+            kprintf("%C  %-6s%C%10u%10u%10u%10u\n", grey, name, green, copy.count,
+                    copy.min, div64_32(copy.total, copy.count), copy.max);
+        } else {
+            kprintf("%C  %-6s%C%10u\n", grey, name, green, copy.count);
+        }
+
+        // ヒストグラム（空のバケットは省略、"2^k:回数"）
+        if (tsc_available) {
+            kprintf("%C        ", grey);
+            for (uint32_t i = 0; i < IRQSTAT_BUCKETS; i++) {
+                if (copy.hist[i] != 0) {
+                    kprintf("%C 2^%u:%C%u", grey, i, green, copy.hist[i]);
+                }
+            }
+            screen_newline();
+        }
+    }
+
+    kprintf("%C  Tasklets run: %C%u%C  Budget exhausted: %C%u\n",
+            grey, green, softirq_processed(), grey, green, softirq_exhausted());
+}
+
+// 統計をCOM1に機械可読な形式で出力
+// 形式: "irqstat begin" から "irqstat end" までの行。各行は空白区切り
+//   vec <ベクタ> <回数> <最小> <最大> <合計の上位32ビット> <合計の下位32ビット>
+//   hist <ベクタ> <log2(サイクル数)> <回数>
+void irqstat_dump(void) {
+    kprintf_to(KPRINTF_SERIAL, "irqstat begin\r\ntsc %u\r\n", tsc_available);
+
+    for (uint32_t vector = 0; vector < IDT_SIZE; vector++) {
+        irqstat_entry_t copy;
+        if (irqstat_sum(vector, &copy) == 0) {
+            continue;
+        }
+
+        kprintf_to(KPRINTF_SERIAL, "vec %u %u %u %u %u %u\r\n", vector, copy.count,
+                   tsc_available ? copy.min : 0, copy.max,
+                   (uint32_t)(copy.total >> 32), (uint32_t)copy.total);
+        for (uint32_t i = 0; i < IRQSTAT_BUCKETS; i++) {
+            if (copy.hist[i] != 0) {
+                kprintf_to(KPRINTF_SERIAL, "hist %u %u %u\r\n", vector, i, copy.hist[i]);
+            }
+        }
+    }
+    kprintf_to(KPRINTF_SERIAL, "irqstat end\r\n");
+}
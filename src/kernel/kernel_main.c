@@ -1,23 +1,221 @@
-// kernel_main.c - 完全ポーリング版
+// kernel_main.c - 割り込み駆動版
+#include "../include/apic.h"
+#include "../include/arena.h"
+#include "../include/clock.h"
+#include "../include/cpu.h"
+#include "../include/debug.h"
+#include "../include/fbcon.h"
+#include "../include/fpu.h"
+#include "../include/gdt.h"
+#include "../include/interrupt.h"
+#include "../include/irqstat.h"
 #include "../include/keyboard.h"
+#include "../include/kprintf.h"
 #include "../include/memory.h"
+#include "../include/multiboot.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
 #include "../include/screen.h"
 #include "../include/serial.h"
+#include "../include/smp.h"
+#include "../include/softirq.h"
 #include "../include/string.h"
+#include "../include/task.h"
+#include "../include/thread.h"
+#include "../include/timer.h"
+#include "../include/trace.h"
+
+// BSPのスタックの上端（boot.asmで定義）
+extern uint8_t stack_top[];
+
+// コマンドの最大引数数
+#define MAX_ARGS 16
+
+// コマンド行を空白で区切り、引数をアリーナに置く（引数の数を返す）
+static int parse_args(arena_t* arena, const char* line, char** argv) {
+    int argc = 0;
+
+    while (*line != '\0' && argc < MAX_ARGS) {
+        while (*line == ' ') {
+            line++;
+        }
+        if (*line == '\0') {
+            break;
+        }
+
+        const char* start = line;
+        while (*line != '\0' && *line != ' ') {
+            line++;
+        }
+
+        char* arg = (char*)arena_alloc(arena, line - start + 1);
+        if (arg == NULL) {
+            break;
+        }
+        memcpy(arg, start, line - start);
+        arg[line - start] = '\0';
+        argv[argc++] = arg;
+    }
+    return argc;
+}
+
+// parfillで埋める値
+#define PARFILL_PATTERN 0x5A
+// parfillのタスク1つが埋めるページ数（64KB）
+#define PARFILL_GRAIN 16
+
+// parfillの区間（ページ単位）を埋める
+static void parfill_range(uint32_t start, uint32_t end, void* arg) {
+    uint8_t* buffer = (uint8_t*)arg;
+    memset(buffer + start * PAGE_SIZE, PARFILL_PATTERN, (end - start) * PAGE_SIZE);
+}
+
+// バッファを1からNワーカーでparallel_forで埋め、時間と速度向上を表示する
+static void parfill_benchmark(uint32_t kb) {
+    uint8_t grey = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    uint32_t pages = (kb * 1024 + PAGE_SIZE - 1) / PAGE_SIZE;
+    // 物理メモリは初回に触ったときに割り当てるので、足りるかは先に空きページ数で確かめる
+    uint8_t* buffer = pmm_free_page_count() < pages ? NULL : (uint8_t*)vm_reserve(pages * PAGE_SIZE);
+    if (buffer == NULL) {
+        screen_write("parfill: out of memory\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+        return;
+    }
+
+    // 最初に一度触ってページ（ここで各ワーカーのフォルトでゼロのページが割り当たる）とキャッシュの状態を揃える
+    parallel_for(0, pages, PARFILL_GRAIN, parfill_range, buffer);
+
+    uint32_t base_us = 0;
+    for (uint32_t workers = 1; workers <= smp_cpu_count(); workers++) {
+        task_set_workers(workers);
+        uint64_t start = clock_ns();
+        parallel_for(0, pages, PARFILL_GRAIN, parfill_range, buffer);
+        uint32_t us = div64_32(clock_ns() - start, 1000);
+        if (us == 0) {
+            us = 1;
+        }
+        if (workers == 1) {
+            base_us = us;
+        }
+
+        kprintf("%C  %C%u%C workers: %C%u%C us, %C%u%C MB/s, speedup x%C%u.%u\n",
+                grey, green, workers, grey, green, us, grey, green, pages * PAGE_SIZE / us, grey,
+                green, base_us / us, base_us * 10 / us % 10);
+    }
+    task_set_workers(0);
+
+    // 最後に埋めた内容を確かめる
+    for (uint32_t i = 0; i < pages * PAGE_SIZE; i++) {
+        if (buffer[i] != PARFILL_PATTERN) {
+            screen_write("parfill: verify failed\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            break;
+        }
+    }
+    vm_release(buffer);
+}
+
+// 10進数の引数を読む（数字以外を含めば-1）
+static int parse_uint(const char* text, uint32_t* value) {
+    if (*text == '\0') {
+        return -1;
+    }
+    *value = 0;
+    for (; *text != '\0'; text++) {
+        if (*text < '0' || *text > '9') {
+            return -1;
+        }
+        *value = *value * 10 + (*text - '0');
+    }
+    return 0;
+}
+
+// COM1で受信した文字をシェルの入力にする（RX割り込みから呼ばれる）
+// 端末のCRは改行、DELはバックスペースとして扱い、打った文字は端末にも送り返す
+static void serial_console_input(char c) {
+    if (c == '\r') {
+        c = '\n';
+    } else if (c == 0x7F) {
+        c = '\b';
+    }
+
+    if (c == '\n') {
+        serial_write(SERIAL_COM1, "\r\n");
+    } else if (c == '\b') {
+        serial_write(SERIAL_COM1, "\b \b");
+    } else if (c >= ' ' && c <= '~') {
+        serial_putchar(SERIAL_COM1, c);
+    } else {
+        return;
+    }
+    keyboard_input(c);
+}
+
+// カーネルのメイン関数（boot.asmからマルチブート2のマジックと情報構造体のアドレスを受け取る）
+void kernel_main(uint32_t magic, uint32_t multiboot_addr) {
+    // BSPのGDT/TSSとCPUごとのデータ（GS）を設定する（cpu_currentはこの後から使える）
+    gdt_init(0, (uint32_t)stack_top);
+
+    // マルチブート情報を登録（画面はこれを見てテキストモードかフレームバッファかを決める）
+    int multiboot_error = multiboot_init(magic, multiboot_addr);
 
-// カーネルのメイン関数
-void kernel_main(void) {
     // 画面の初期化
     screen_init();
+    if (multiboot_error != 0) {
+        screen_write("Warning: not booted by a multiboot2 loader\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+    }
+
+    // CPUの機能を調べ、メモリ/文字列操作の実装を選ぶ
+    cpu_init();
+    string_init();
+
+    // 割り込み（例外）ハンドラの初期化
+    interrupt_init();
+
+    // FPU/SSEの状態を#NMで遅延保存する
+    fpu_init();
+
+    // 物理ページアロケータの初期化（メモリマップから）
+    pmm_init();
+
+    // ページングの有効化
+    paging_init();
+
+    // ブートローダがフレームバッファを用意していればそちらに描く（ライトコンバイニングでマップ）
+    screen_init_framebuffer();
     
     // メモリ管理の初期化
     memory_init();
+
+    // APICがあればIRQの配送をI/O APICに切り替える（なければ8259 PICのまま）
+    apic_init();
     
-    // キーボードの初期化（ポーリングのみ）
+    // キーボードの初期化（割り込みが有効になるまではポーリング）
     keyboard_init();
     
-    // シリアルポートの初期化
-    serial_init(SERIAL_COM1);
+    // シリアルポートの初期化（送受信は割り込みで行い、COM1は2つ目のコンソールにする）
+    if (serial_init(SERIAL_COM1, SERIAL_DEFAULT_BAUD) == 0) {
+        serial_set_console(SERIAL_COM1, serial_console_input);
+    }
+
+    // ブートローダが描けないグラフィックモードにしていれば画面には何も映らないので、COM1に知らせる
+    if (!multiboot_text_mode() && !screen_is_framebuffer()) {
+        kprintf_to(KPRINTF_SERIAL | KPRINTF_LOG, "Warning: unsupported framebuffer mode, screen output disabled\n");
+    }
+
+    // タイマーの初期化（PITはタイマーが登録されるまで止めておく）
+    timer_init();
+
+    // TSCを較正してクロックソースを選ぶ
+    clock_init();
+
+    // 起動時のコンテキストをmainスレッドにしてスケジューラを始める
+    thread_init();
+
+    // APを起動してそれぞれのアイドルループに入れる
+    smp_init();
+
+    // CPUごとにタスクプールのワーカーを作る
+    task_init();
     
     // ウェルカムメッセージ
     screen_write("Welcome to ", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
@@ -25,11 +223,11 @@ void kernel_main(void) {
     screen_write("OS", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
     screen_write(" v1.0!\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
     
-    screen_write("A minimal operating system with polling-based I/O.\n", 
+    screen_write("A minimal operating system with interrupt-driven I/O.\n", 
                 vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
     
     // シリアルにもメッセージを送信
-    serial_write(SERIAL_COM1, "MyOS v1.0 - Polling mode active\r\n");
+    serial_write(SERIAL_COM1, "MyOS v1.0 - Interrupt mode active\r\n");
     
     // シンプルなコマンドライン
     screen_newline();
@@ -37,6 +235,19 @@ void kernel_main(void) {
     
     char command[256];
     int cmd_pos = 0;
+
+    // コマンドごとの一時的な割り当てに使うアリーナ（コマンドの実行後にまとめて解放）
+    arena_t* shell_arena = arena_scratch();
+    arena_mark_t shell_mark;
+    if (shell_arena != NULL) {
+        shell_mark = arena_mark(shell_arena);
+    }
+
+    // シェルは画面を直接使うので、後半処理は入力待ちの間にだけ実行する
+    local_bh_disable();
+
+    // 割り込みを有効にする（キー入力はIRQ1で受け、待つ間はスレッドを止める）
+    interrupt_enable();
     
     while (1) {
         // コマンドプロンプトを表示
@@ -50,71 +261,83 @@ void kernel_main(void) {
         screen_get_cursor(&prompt_x, &prompt_y);
 
         while (1) {
-            // ポーリングでキーボード入力を処理
-            keyboard_process();
+            // キーが届くまで止まる（IRQ1が起こし、その間CPUはHLTで休む）
+            char c = keyboard_get_char();
 
-            // キーボード入力を処理
-            if (keyboard_has_key()) {
-                char c = keyboard_get_char();
-                
-                // Enterキーで入力終了
-                if (c == '\n') {
-                    command[cmd_pos] = '\0';
-                    screen_newline();
-                    break;
-                }
-                // バックスペースで文字削除
-                else if (c == '\b') {
-                    if (cmd_pos > 0) {
-                        cmd_pos--;
-                        // カーソル位置を取得
-                        int cursor_x, cursor_y;
-                        screen_get_cursor(&cursor_x, &cursor_y);
-
-                        // カーソル位置がプロンプトの位置より下の場合
-                        if (cursor_x == 0 && cursor_y > prompt_y) {
-                            cursor_y--;
-                            cursor_x = VGA_WIDTH - 1;
-                            screen_set_cursor(cursor_x, cursor_y);
-                            screen_put_char(' ', vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-                            screen_set_cursor(cursor_x, cursor_y);
-                        }
-                        else if (cursor_x > 1 || cursor_y > prompt_y) {
-                            // 通常のバックスペース処理
-                            cursor_x--;
-                            screen_set_cursor(cursor_x, cursor_y);
-                            screen_put_char(' ', vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-                            screen_set_cursor(cursor_x, cursor_y);
-                        }
+            // この文字までのエコー表示を済ませる
+            softirq_idle();
+            
+            // Enterキーで入力終了
+            if (c == '\n') {
+                command[cmd_pos] = '\0';
+                screen_newline();
+                break;
+            }
+            // バックスペースで文字削除
+            else if (c == '\b') {
+                if (cmd_pos > 0) {
+                    cmd_pos--;
+                    // カーソル位置を取得
+                    int cursor_x, cursor_y;
+                    screen_get_cursor(&cursor_x, &cursor_y);
+
+                    // カーソル位置がプロンプトの位置より下の場合
+                    if (cursor_x == 0 && cursor_y > prompt_y) {
+                        cursor_y--;
+                        screen_get_size(&cursor_x, NULL);
+                        cursor_x--;
+                        screen_set_cursor(cursor_x, cursor_y);
+                        screen_put_char(' ', vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+                        screen_set_cursor(cursor_x, cursor_y);
+                    }
+                    else if (cursor_x > 1 || cursor_y > prompt_y) {
+                        // 通常のバックスペース処理
+                        cursor_x--;
+                        screen_set_cursor(cursor_x, cursor_y);
+                        screen_put_char(' ', vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+                        screen_set_cursor(cursor_x, cursor_y);
                     }
-                }
-                // 通常の文字入力
-                else if (cmd_pos < 255 && c >= ' ' && c <= '~') {
-                    command[cmd_pos++] = c;
                 }
             }
-            
-            // CPUを少し休ませる（ポーリング間隔調整）
-            for (int i = 0; i < 10000; i++) {
-                asm volatile("nop");
+            // 通常の文字入力
+            else if (cmd_pos < 255 && c >= ' ' && c <= '~') {
+                command[cmd_pos++] = c;
             }
         }
         
+        // コマンドを引数に分ける
+        char* argv[MAX_ARGS];
+        int argc = 0;
+        if (shell_arena != NULL) {
+            argc = parse_args(shell_arena, command, argv);
+        }
+
         // コマンドを解釈して実行（既存のコマンド処理をそのまま維持）
-        if (cmd_pos > 0) {
+        TRACE_EVENT(TRACE_COMMAND_BEGIN, argc);
+        if (argc > 0) {
             // helpコマンド
-            if (strcmp(command, "help") == 0) {
+            if (strcmp(argv[0], "help") == 0) {
                 screen_write("Available commands:\n", vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
                 screen_write("  help - Display this help message\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  clear - Clear the screen\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  echo [text] - Display text\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  info - System information\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  memory - Memory statistics\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  vmstat - Paging statistics\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  heapprof [serial] - Heap profile (or dump it to COM1)\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  irqstat [serial|reset] - Interrupt counts and latency\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  test - Memory allocation test\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  serial [text] - Send text via serial port\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  sleep <ms> - Wait on a timer\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  ps - List threads with CPU time and context switches\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  timeslice [ms] - Show or set the scheduler timeslice\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  dmesg [serial] - Show logged debug messages (or send them to COM1)\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  trace start|stop|dump - Record tracepoints (dump sends them to COM1)\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  tasks - Task pool steal/execute counters per CPU\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  parfill [KB] - Parallel fill benchmark with 1..N workers\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
             }
             // clearコマンド
-            else if (strcmp(command, "clear") == 0) {
+            else if (strcmp(argv[0], "clear") == 0) {
                 screen_clear();
             }
             // echoコマンド
@@ -123,23 +346,74 @@ void kernel_main(void) {
                 screen_newline();
             }
             // infoコマンド
-            else if (strcmp(command, "info") == 0) {
+            else if (strcmp(argv[0], "info") == 0) {
                 screen_write("MyOS - A minimal OS for learning\n", vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
                 screen_write("Version: 1.0\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("Features:\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  - Dynamic memory management\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  - Interrupt handling\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  - Keyboard support\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-                screen_write("  - VGA text mode output\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-                screen_write("  - Timer (PIT @ 100Hz)\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                if (screen_is_framebuffer()) {
+                    int width, height;
+                    screen_get_size(&width, &height);
+                    kprintf("%C  - Framebuffer console: %dx%d (%s, glyph cache %u hits / %u misses)\n",
+                            vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK), width, height,
+                            fbcon_write_combining() ? "write-combining" : "uncached",
+                            fbcon_cache_hits(), fbcon_cache_misses());
+                } else {
+                    screen_write("  - VGA text mode output\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                }
+                screen_write("  - Timer (one-shot PIT, timer wheel)\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
                 screen_write("  - Serial communication\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  - Preemptive kernel threads (O(1) priority run queue)\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                screen_write("  - Work-stealing task pool (Chase-Lev deques)\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                kprintf("%C  - CPUs online: %u\n"
+                        "  - Clocksource: %s (%u kHz), TSC: %u kHz\n"
+                        "  - Interrupt controller: %s\n"
+                        "  - Memory/string ops: %s\n",
+                        vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK), smp_cpu_count(),
+                        clock_source_name(), clock_source_khz(), clock_tsc_khz(),
+                        interrupt_controller(), string_variant());
+                screen_write("  - FPU/SSE state: ", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                if (fpu_lazy_enabled()) {
+                    kprintf("%Clazy FXSAVE (#NM traps: %u, kernel saves: %u)",
+                            vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK), fpu_traps(), fpu_saves());
+                } else {
+                    screen_write("not managed", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+                }
+                screen_newline();
             }
             // memoryコマンド
-            else if (strcmp(command, "memory") == 0) {
+            else if (strcmp(argv[0], "memory") == 0) {
                 memory_stats();
             }
+            // heapprofコマンド
+            else if (strcmp(argv[0], "heapprof") == 0) {
+                if (argc > 1 && strcmp(argv[1], "serial") == 0) {
+                    heap_profile_dump();
+                    screen_write("Heap profile sent via serial port\n", vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
+                } else {
+                    heap_profile();
+                }
+            }
+            // irqstatコマンド
+            else if (strcmp(argv[0], "irqstat") == 0) {
+                if (argc > 1 && strcmp(argv[1], "serial") == 0) {
+                    irqstat_dump();
+                    screen_write("Interrupt statistics sent via serial port\n", vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
+                } else if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+                    irqstat_reset();
+                    screen_write("Interrupt statistics cleared\n", vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
+                } else {
+                    irqstat_show();
+                }
+            }
+            // vmstatコマンド
+            else if (strcmp(argv[0], "vmstat") == 0) {
+                paging_stats();
+            }
             // testコマンド
-            else if (strcmp(command, "test") == 0) {
+            else if (strcmp(argv[0], "test") == 0) {
                 screen_write("Memory allocation test:\n", vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
                 void* ptr1 = kmalloc(100);
                 void* ptr2 = kmalloc(200);
@@ -170,6 +444,80 @@ void kernel_main(void) {
                 serial_write(SERIAL_COM1, "\r\n");
                 screen_write("Message sent via serial port\n", vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
             }
+            // sleepコマンド
+            else if (strcmp(argv[0], "sleep") == 0) {
+                uint32_t ms;
+                if (argc < 2 || parse_uint(argv[1], &ms) != 0) {
+                    screen_write("Usage: sleep <ms>\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+                } else {
+                    uint32_t start = timer_get_ticks();
+                    uint64_t start_ns = clock_ns();
+                    uint32_t irqs = timer_interrupts();
+                    thread_sleep(ms);
+
+                    kprintf("%CSlept %C%u%C ticks (%C%u%C us), timer interrupts: %C%u\n",
+                            vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK),
+                            vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK), timer_get_ticks() - start,
+                            vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK),
+                            vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK), div64_32(clock_ns() - start_ns, 1000),
+                            vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK),
+                            vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK), timer_interrupts() - irqs);
+                }
+            }
+            // psコマンド
+            else if (strcmp(argv[0], "ps") == 0) {
+                thread_show();
+            }
+            // timesliceコマンド
+            else if (strcmp(argv[0], "timeslice") == 0) {
+                uint32_t ms;
+                if (argc >= 2 && parse_uint(argv[1], &ms) == 0 && ms != 0) {
+                    thread_set_timeslice(ms);
+                } else if (argc >= 2) {
+                    screen_write("Usage: timeslice [ms]\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+                }
+                kprintf("%CTimeslice: %C%u%C ms\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK),
+                        vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK), thread_timeslice(),
+                        vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+            }
+            // dmesgコマンド
+            else if (strcmp(argv[0], "dmesg") == 0) {
+                debug_dump(argc > 1 && strcmp(argv[1], "serial") == 0);
+            }
+            // traceコマンド
+            else if (strcmp(argv[0], "trace") == 0) {
+                uint8_t grey = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+                uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+                if (argc > 1 && strcmp(argv[1], "start") == 0) {
+                    if (trace_start() == 0) {
+                        kprintf("%CTracing started (%u records per CPU)\n", green, TRACE_RECORDS);
+                    } else {
+                        kprintf("%CFailed to allocate trace buffers\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+                    }
+                } else if (argc > 1 && strcmp(argv[1], "stop") == 0) {
+                    trace_stop();
+                    kprintf("%CTracing stopped: %C%u%C records, %C%u%C overwritten\n",
+                            grey, green, trace_count(), grey, green, trace_lost(), grey);
+                } else if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+                    trace_dump();
+                    kprintf("%CTrace sent via serial port (%u records)\n", green, trace_count());
+                } else {
+                    kprintf("%CUsage: trace start|stop|dump\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+                }
+            }
+            // tasksコマンド
+            else if (strcmp(argv[0], "tasks") == 0) {
+                task_show();
+            }
+            // parfillコマンド
+            else if (strcmp(argv[0], "parfill") == 0) {
+                uint32_t kb = 4096;
+                if (argc >= 2 && (parse_uint(argv[1], &kb) != 0 || kb == 0)) {
+                    screen_write("Usage: parfill [KB]\n", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+                } else {
+                    parfill_benchmark(kb);
+                }
+            }
             // 不明なコマンド
             else {
                 screen_write("Unknown command: ", vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
@@ -177,5 +525,11 @@ void kernel_main(void) {
                 screen_newline();
             }
         }
+        TRACE_EVENT(TRACE_COMMAND_END, argc);
+
+        // このコマンドで使った一時領域をまとめて解放
+        if (shell_arena != NULL) {
+            arena_reset(shell_arena, shell_mark);
+        }
     }
 }
\ No newline at end of file
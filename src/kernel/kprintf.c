@@ -0,0 +1,357 @@
+// kprintf.c - 書式付きの出力の実装
+// 書式は1回なぞるだけで、文字は呼び出し側のスタックの溜め場所に積む。
+// 溜め場所が一杯になるか呼び出しの終わりに、出力先ごとにまとめて1回で書く
+// （色を使う出力先には色の切り替えごとの区切りで書く）。
+#include "../include/kprintf.h"
+#include "../include/cpu.h"
+#include "../include/debug.h"
+#include "../include/screen.h"
+#include "../include/serial.h"
+
+// 既定の色
+#define KPRINTF_DEFAULT_COLOR 0x07 // VGA_COLOR_LIGHT_GREY / VGA_COLOR_BLACK
+
+// 出力先
+typedef struct {
+    kprintf_write_t write;
+    int colored;
+} kprintf_sink_t;
+
+// 書式化の出力先（文字列かkprintfの溜め場所）
+typedef struct {
+    char* buffer;
+    size_t capacity;     // 文字列ならsize-1、溜め場所なら大きさ
+    size_t length;       // bufferに積んだ文字数
+    size_t total;        // 書いたはずの文字数（切り捨てた分も数える）
+    uint32_t sinks;      // 0なら文字列に書く（溢れたら切り捨て）
+    uint8_t color;       // 今の色
+    uint32_t run_count;  // 色の区切りの数
+    size_t run_start[KPRINTF_MAX_RUNS];
+    uint8_t run_color[KPRINTF_MAX_RUNS];
+} kout_t;
+
+// 画面に書く
+static void screen_sink(const char* data, size_t length, uint8_t color) {
+    screen_write_n(data, length, color);
+}
+
+// COM1に書く
+static void serial_sink(const char* data, size_t length, uint8_t color) {
+    (void)color;
+    serial_write_n(SERIAL_COM1, data, length);
+}
+
+// ログのリングに書く
+static void log_sink(const char* data, size_t length, uint8_t color) {
+    (void)color;
+    debug_log_write(data, length);
+}
+
+// 登録された出力先（ビットiがsinks[i]）
+static kprintf_sink_t sinks[KPRINTF_MAX_SINKS] = {
+    { screen_sink, 1 },
+    { serial_sink, 0 },
+    { log_sink, 0 },
+};
+static uint32_t sink_count = 3;
+
+// 出力先を登録
+uint32_t kprintf_register_sink(kprintf_write_t write, int colored) {
+    uint32_t index = __atomic_load_n(&sink_count, __ATOMIC_RELAXED);
+    do {
+        if (index >= KPRINTF_MAX_SINKS) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&sink_count, &index, index + 1, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    sinks[index].colored = colored;
+    __atomic_store_n(&sinks[index].write, write, __ATOMIC_RELEASE);
+    return 1u << index;
+}
+
+// 溜め場所を出力先に書き出して空にする
+static void kout_flush(kout_t* out) {
+    if (out->length == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < KPRINTF_MAX_SINKS; i++) {
+        kprintf_write_t write = __atomic_load_n(&sinks[i].write, __ATOMIC_ACQUIRE);
+        if (!(out->sinks & (1u << i)) || write == NULL) {
+            continue;
+        }
+        if (!sinks[i].colored) {
+            write(out->buffer, out->length, out->color);
+            continue;
+        }
+        // 色の区切りごとに書く
+        for (uint32_t run = 0; run < out->run_count; run++) {
+            size_t start = out->run_start[run];
+            size_t end = run + 1 < out->run_count ? out->run_start[run + 1] : out->length;
+            if (end > start) {
+                write(out->buffer + start, end - start, out->run_color[run]);
+            }
+        }
+    }
+    out->length = 0;
+    out->run_count = 1;
+    out->run_start[0] = 0;
+    out->run_color[0] = out->color;
+}
+
+// 1文字出す
+static void kout_putc(kout_t* out, char c) {
+    out->total++;
+    if (out->length >= out->capacity) {
+        if (out->sinks == 0) {
+            return;
+        }
+        kout_flush(out);
+    }
+    out->buffer[out->length++] = c;
+}
+
+// 同じ文字をcount個出す
+static void kout_repeat(kout_t* out, char c, int count) {
+    for (int i = 0; i < count; i++) {
+        kout_putc(out, c);
+    }
+}
+
+// 色を切り替える
+static void kout_color(kout_t* out, uint8_t color) {
+    if (out->sinks == 0 || color == out->color) {
+        return;
+    }
+    out->color = color;
+    if (out->run_start[out->run_count - 1] == out->length) {
+        // まだ何も書いていない区切りは色だけ変える
+        out->run_color[out->run_count - 1] = color;
+        return;
+    }
+    if (out->run_count == KPRINTF_MAX_RUNS) {
+        kout_flush(out);
+        out->run_color[0] = color;
+        return;
+    }
+    out->run_start[out->run_count] = out->length;
+    out->run_color[out->run_count] = color;
+    out->run_count++;
+}
+
+// 文字列を幅に合わせて出す
+static void kout_string(kout_t* out, const char* s, int width, int left) {
+    if (s == NULL) {
+        s = "(null)";
+    }
+    int length = 0;
+    while (s[length] != '\0') {
+        length++;
+    }
+    if (!left && width > length) {
+        kout_repeat(out, ' ', width - length);
+    }
+    for (int i = 0; i < length; i++) {
+        kout_putc(out, s[i]);
+    }
+    if (left && width > length) {
+        kout_repeat(out, ' ', width - length);
+    }
+}
+
+// 数を幅に合わせて出す（baseは10か16）
+static void kout_number(kout_t* out, uint64_t value, int negative, uint32_t base, int upper,
+                        int width, int left, int zero) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char temp[24];
+    int count = 0;
+
+    // 下の桁から作る（64ビットの割り算はlibgccを使わずに行う）
+    do {
+        uint32_t digit;
+        if (base == 16) {
+            digit = (uint32_t)value & 0xF;
+            value >>= 4;
+        } else if ((value >> 32) == 0) {
+            digit = (uint32_t)value % 10;
+            value = (uint32_t)value / 10;
+        } else {
+            value = div64_u32(value, 10, &digit);
+        }
+        temp[count++] = digits[digit];
+    } while (value != 0);
+
+    int length = count + (negative ? 1 : 0);
+    int pad = width > length ? width - length : 0;
+    if (!left && !zero) {
+        kout_repeat(out, ' ', pad);
+    }
+    if (negative) {
+        kout_putc(out, '-');
+    }
+    if (!left && zero) {
+        kout_repeat(out, '0', pad);
+    }
+    while (count > 0) {
+        kout_putc(out, temp[--count]);
+    }
+    if (left) {
+        kout_repeat(out, ' ', pad);
+    }
+}
+
+// 書式をなぞって出す
+static void kout_format(kout_t* out, const char* format, va_list args) {
+    for (const char* p = format; *p != '\0'; p++) {
+        if (*p != '%') {
+            kout_putc(out, *p);
+            continue;
+        }
+        p++;
+
+        // フラグ
+        int left = 0;
+        int zero = 0;
+        for (;; p++) {
+            if (*p == '-') {
+                left = 1;
+            } else if (*p == '0') {
+                zero = 1;
+            } else {
+                break;
+            }
+        }
+
+        // 幅
+        int width = 0;
+        if (*p == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                left = 1;
+                width = -width;
+            }
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                width = width * 10 + (*p - '0');
+                p++;
+            }
+        }
+
+        // 長さ修飾子（zとlは32ビットなのでintと同じ）
+        int wide = 0;
+        if (*p == 'z') {
+            p++;
+        } else if (*p == 'l') {
+            p++;
+            if (*p == 'l') {
+                wide = 1;
+                p++;
+            }
+        }
+
+        switch (*p) {
+        case 'd':
+        case 'i': {
+            int64_t value = wide ? va_arg(args, int64_t) : va_arg(args, int32_t);
+            uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+            kout_number(out, magnitude, value < 0, 10, 0, width, left, zero);
+            break;
+        }
+        case 'u':
+            kout_number(out, wide ? va_arg(args, uint64_t) : va_arg(args, uint32_t), 0, 10, 0, width, left, zero);
+            break;
+        case 'x':
+        case 'X':
+            kout_number(out, wide ? va_arg(args, uint64_t) : va_arg(args, uint32_t), 0, 16, *p == 'X', width, left, zero);
+            break;
+        case 'p':
+            kout_putc(out, '0');
+            kout_putc(out, 'x');
+            kout_number(out, (uint32_t)va_arg(args, void*), 0, 16, 0, 8, 0, 1);
+            break;
+        case 'c':
+            kout_putc(out, (char)va_arg(args, int));
+            break;
+        case 's':
+            kout_string(out, va_arg(args, const char*), width, left);
+            break;
+        case 'C':
+            kout_color(out, (uint8_t)va_arg(args, int));
+            break;
+        case '%':
+            kout_putc(out, '%');
+            break;
+        case '\0':
+            // 書式の最後が'%'で終わっている
+            return;
+        default:
+            kout_putc(out, '%');
+            kout_putc(out, *p);
+            break;
+        }
+    }
+}
+
+// bufferに書式化する
+int kvsnprintf(char* buffer, size_t size, const char* format, va_list args) {
+    kout_t out;
+    out.buffer = buffer;
+    out.capacity = size > 0 ? size - 1 : 0;
+    out.length = 0;
+    out.total = 0;
+    out.sinks = 0;
+    out.color = KPRINTF_DEFAULT_COLOR;
+    out.run_count = 1;
+    out.run_start[0] = 0;
+    out.run_color[0] = out.color;
+
+    kout_format(&out, format, args);
+    if (size > 0) {
+        buffer[out.length] = '\0';
+    }
+    return (int)out.total;
+}
+
+int ksnprintf(char* buffer, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = kvsnprintf(buffer, size, format, args);
+    va_end(args);
+    return result;
+}
+
+// 出力先に出力
+int kvprintf_to(uint32_t sinks, const char* format, va_list args) {
+    char buffer[KPRINTF_BUFFER_SIZE];
+    kout_t out;
+    out.buffer = buffer;
+    out.capacity = sizeof(buffer);
+    out.length = 0;
+    out.total = 0;
+    out.sinks = sinks;
+    out.color = KPRINTF_DEFAULT_COLOR;
+    out.run_count = 1;
+    out.run_start[0] = 0;
+    out.run_color[0] = out.color;
+
+    kout_format(&out, format, args);
+    kout_flush(&out);
+    return (int)out.total;
+}
+
+int kprintf_to(uint32_t sinks, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = kvprintf_to(sinks, format, args);
+    va_end(args);
+    return result;
+}
+
+// 画面に出力
+int kprintf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = kvprintf_to(KPRINTF_SCREEN, format, args);
+    va_end(args);
+    return result;
+}
@@ -1,89 +1,713 @@
-// memory.c - シンプルなメモリ管理の実装
+// memory.c - スラブ＋境界タグ方式のメモリ管理の実装
 
 #include "../include/memory.h"
+#include "../include/arena.h"
+#include "../include/interrupt.h"
+#include "../include/kprintf.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
 #include "../include/screen.h"
+#include "../include/serial.h"
+#include "../include/spinlock.h"
+#include "../include/string.h"
 
-// メモリプールの開始アドレス
-#define MEMORY_START 0x100000
-// メモリプールのサイズ(1MB)
-#define MEMORY_SIZE 0x100000
-// メモリブロックの最小サイズ
-#define MIN_BLOCK_SIZE 16
+// ヒープの初期サイズ(1MB)
+#define HEAP_INITIAL_SIZE (PAGE_SIZE << 8)
+// ヒープの最大サイズ（仮想領域全体）
+#define HEAP_MAX_SIZE (HEAP_VIRT_END - HEAP_VIRT_START)
+// 一度に伸ばす/縮める最小サイズ（伸縮の繰り返しを防ぐ）
+#define HEAP_GROW_MIN (64 * 1024)
+// 高水位線の既定値（これを超えた末尾の空きページをシステムに返す）
+#define HEAP_DEFAULT_WATERMARK (4 * 1024 * 1024)
 
-// メモリブロックの状態
-#define BLOCK_FREE 0
+// ---- 大きなオブジェクト用（境界タグ方式） ----
+
+// ブロックサイズの粒度
+#define BLOCK_ALIGN 8
+// ブロックヘッダのサイズ
+#define BLOCK_HEADER_SIZE 8
+// ブロックフッタのサイズ
+#define BLOCK_FOOTER_SIZE 4
+// ブロックの最小サイズ（ヘッダ＋フリーリストのリンク＋フッタ）
+#define MIN_BLOCK_SIZE 24
+// フリーリストのビン数（log2(サイズ)ごと）
+#define BIN_COUNT 32
+
+// サイズ欄の下位ビットに置くフラグ
 #define BLOCK_USED 1
+#define BLOCK_FLAGS_MASK (BLOCK_ALIGN - 1)
+// 使用中ブロックのタグ（上位16ビットはkfreeでの簡易チェック用のマジック、下位8ビットは呼び出し元の番号）
+#define BLOCK_TAG_MAGIC      0xB10C0000
+#define BLOCK_TAG_MAGIC_MASK 0xFFFF0000
+#define BLOCK_TAG_SITE_MASK  0x000000FF
 
-// メモリブロックのヘッダ構造体
+// メモリブロックのヘッダ構造体（フッタにはサイズ欄のコピーを置く）
 typedef struct block_header {
-    size_t size; // ブロックのサイズ
-    uint8_t status;  // ブロックの状態 (使用中/未使用)
-    struct block_header* next; // 次のブロックへのポインタ
+    uint32_t size_flags; // ブロック全体のサイズ | フラグ
+    uint32_t tag;        // 使用中ならBLOCK_TAG_MAGIC | 呼び出し元の番号
 } block_header_t;
 
-// メモリプールの開始アドレス
-static void* memory_pool = (void*)MEMORY_START;
-// 最初のブロックヘッダへのポインタ
-static block_header_t* first_block = NULL;
+// フリーブロック（ヘッダの直後にフリーリストのリンクを置く）
+typedef struct free_block {
+    block_header_t header;
+    struct free_block* next;
+    struct free_block* prev;
+} free_block_t;
+
+// ---- 小さなオブジェクト用（サイズクラス別スラブ） ----
+
+// サイズクラス数（16, 32, ..., 2048）
+#define SLAB_CLASS_COUNT 8
+// スラブで扱う最小・最大サイズ
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE 2048
+// スラブ先頭のヘッダ領域の単位（オブジェクトをキャッシュライン境界から並べる）
+#define SLAB_HEADER_ALIGN CACHE_LINE_SIZE
+// 1スラブあたりの最低オブジェクト数
+#define SLAB_MIN_OBJECTS 8
+
+// スラブ（スラブサイズ境界にアラインされ、先頭にこのヘッダと
+// オブジェクトごとの呼び出し元番号の配列を置く）
+typedef struct slab {
+    struct slab* next;      // 部分使用スラブのリスト
+    struct slab* prev;
+    void* free_list;        // 空きオブジェクトのリスト
+    uint16_t in_use;        // 使用中のオブジェクト数
+    uint16_t capacity;      // オブジェクト数
+    uint32_t class_index;   // サイズクラス
+} slab_t;
+
+// サイズクラス
+typedef struct slab_class {
+    slab_t* partial;        // 空きのあるスラブのリスト
+    uint32_t partial_count; // 空きのあるスラブの数
+    uint32_t slab_count;    // スラブの総数
+    uint32_t object_size;   // オブジェクトサイズ
+    uint32_t object_shift;  // log2(オブジェクトサイズ)
+    uint32_t slab_bytes;    // 1スラブのバイト数（2の冪）
+    uint32_t header_size;   // ヘッダ領域のバイト数（キャッシュラインの倍数）
+    uint32_t capacity;      // 1スラブあたりのオブジェクト数
+} slab_class_t;
+
+// ---- ヒーププロファイル ----
+
+// 呼び出し元の表の大きさ（0番は表に入りきらなかった呼び出し元）
+#define HEAP_SITE_COUNT 64
+// heapprofで表示する呼び出し元の数
+#define HEAP_TOP_SITES 8
+// サイズのヒストグラムのバケット数（log2(要求サイズ)ごと）
+#define HEAP_HIST_BUCKETS 32
+
+// 割り当ての呼び出し元
+typedef struct heap_site {
+    uint32_t addr;       // 戻りアドレス
+    uint32_t allocs;     // 割り当て回数
+    uint32_t live_count; // 解放されていない数
+    uint32_t live_bytes; // 解放されていないバイト数
+} heap_site_t;
+
+// メモリプールの開始アドレス（HEAP_VIRT_STARTから必要な分だけマップする）
+static uint8_t* memory_pool = NULL;
+// 現在マップされているヒープのサイズ
+static uint32_t heap_size = 0;
+// ヒープサイズの最大値
+static uint32_t heap_peak_size = 0;
+// この大きさを超えた末尾の空きページは返却する
+static uint32_t heap_high_watermark = HEAP_DEFAULT_WATERMARK;
+// ヒープを伸ばした/縮めた回数
+static uint32_t heap_grow_count = 0;
+static uint32_t heap_shrink_count = 0;
+// ヒープのロック（この中でpaging→pmmの順にロックを取る）
+static spinlock_t heap_lock = SPINLOCK_INIT;
+// サイズ別フリーリスト
+static free_block_t* bins[BIN_COUNT];
+// 空でないビンのビットマップ
+static uint32_t bin_bitmap = 0;
+// サイズクラス
+static slab_class_t slab_classes[SLAB_CLASS_COUNT];
+// ページごとのスラブ所属（0 = スラブではない、それ以外はクラス番号 + 1）
+static uint8_t slab_page_map[HEAP_MAX_SIZE / PAGE_SIZE];
 // 割り当てられたメモリの合計サイズ
 static size_t allocated_memory = 0;
-// 利用可能なメモリの合計サイズ
+// 利用可能なメモリの合計サイズ（フリーブロックの合計）
 static size_t free_memory = 0;
+// 割り当て済みメモリの最大値
+static size_t peak_memory = 0;
+// 割り当て/解放/失敗の回数
+static uint32_t alloc_count = 0;
+static uint32_t free_count = 0;
+static uint32_t failed_count = 0;
+// 要求サイズのヒストグラム
+static uint32_t size_histogram[HEAP_HIST_BUCKETS];
+// 呼び出し元の表（アドレスのハッシュで開番地法）
+static heap_site_t heap_sites[HEAP_SITE_COUNT];
+
+// 値を2の冪の境界に切り上げる
+static inline uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// サイズからビン番号を求める（floor(log2(size))）
+static inline uint32_t bin_index(uint32_t size) {
+    return 31 - __builtin_clz(size);
+}
+
+// ブロックのサイズを取得
+static inline uint32_t block_size(const block_header_t* block) {
+    return block->size_flags & ~BLOCK_FLAGS_MASK;
+}
+
+// ヘッダとフッタを書き込む
+static void block_set(block_header_t* block, uint32_t size, uint32_t flags) {
+    block->size_flags = size | flags;
+    *(uint32_t*)((uint8_t*)block + size - BLOCK_FOOTER_SIZE) = size | flags;
+}
+
+// フリーリストにブロックを追加
+static void free_list_insert(free_block_t* block) {
+    uint32_t index = bin_index(block_size(&block->header));
+
+    block->header.tag = 0;
+    block->prev = NULL;
+    block->next = bins[index];
+    if (bins[index] != NULL) {
+        bins[index]->prev = block;
+    }
+    bins[index] = block;
+    bin_bitmap |= 1u << index;
+}
+
+// フリーリストからブロックを取り除く
+static void free_list_remove(free_block_t* block) {
+    uint32_t index = bin_index(block_size(&block->header));
+
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        bins[index] = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    if (bins[index] == NULL) {
+        bin_bitmap &= ~(1u << index);
+    }
+}
+
+// size以上のフリーブロックを探す
+static free_block_t* free_list_find(uint32_t size) {
+    uint32_t index = bin_index(size);
+
+    // 2の冪でなければ1つ上のビンから探す（そこにあれば必ず収まる）
+    uint32_t first = ((size & (size - 1)) == 0) ? index : index + 1;
+    uint32_t mask = (first < BIN_COUNT) ? (bin_bitmap & (~0u << first)) : 0;
+    if (mask != 0) {
+        return bins[__builtin_ctz(mask)];
+    }
+
+    // 同じビンの中から収まるものを探す
+    for (free_block_t* block = bins[index]; block != NULL; block = block->next) {
+        if (block_size(&block->header) >= size) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+// フリーブロックを境界タグで前後のフリーブロックと結合し、フリーリストに入れる
+static void block_release(block_header_t* block, uint32_t size) {
+    // 後ろのブロックと結合
+    block_header_t* next = (block_header_t*)((uint8_t*)block + size);
+    if (!(next->size_flags & BLOCK_USED)) {
+        free_list_remove((free_block_t*)next);
+        size += block_size(next);
+    }
+
+    // 前のブロックと結合（直前のフッタを見る）
+    uint32_t prev_footer = *(uint32_t*)((uint8_t*)block - BLOCK_FOOTER_SIZE);
+    if (!(prev_footer & BLOCK_USED)) {
+        block_header_t* prev = (block_header_t*)((uint8_t*)block - (prev_footer & ~BLOCK_FLAGS_MASK));
+        free_list_remove((free_block_t*)prev);
+        size += block_size(prev);
+        block = prev;
+    }
+
+    block_set(block, size, 0);
+    free_list_insert((free_block_t*)block);
+}
+
+// ヒープの末尾に番兵ヘッダを置く
+static void heap_set_sentinel(void) {
+    block_header_t* sentinel = (block_header_t*)(memory_pool + heap_size - BLOCK_HEADER_SIZE);
+    sentinel->size_flags = BLOCK_USED;
+    sentinel->tag = 0;
+}
+
+// [start, end) のページのマップを解除して物理ページを返却
+static void heap_unmap_pages(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        uint32_t phys = paging_unmap(addr);
+        if (phys != 0) {
+            free_pages((void*)phys, 0);
+        }
+    }
+}
+
+// [start, end) に物理ページをマップ（途中で失敗したらマップした分を戻して-1）
+static int heap_map_pages(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        void* page = alloc_pages(0);
+        if (page == NULL) {
+            heap_unmap_pages(start, addr);
+            return -1;
+        }
+        if (paging_map(addr, (uint32_t)page, PAGE_WRITE) != 0) {
+            free_pages(page, 0);
+            heap_unmap_pages(start, addr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// ヒープを伸ばし、少なくともneedバイトのフリーブロックを末尾に作る
+static int heap_grow(uint32_t need) {
+    if (memory_pool == NULL) {
+        return -1;
+    }
+
+    uint32_t grow = align_up(need, PAGE_SIZE);
+    if (grow < HEAP_GROW_MIN) {
+        grow = HEAP_GROW_MIN;
+    }
+    if (grow > HEAP_MAX_SIZE - heap_size) {
+        if (need > HEAP_MAX_SIZE - heap_size) {
+            return -1;
+        }
+        grow = HEAP_MAX_SIZE - heap_size;
+    }
+
+    uint32_t old_end = (uint32_t)memory_pool + heap_size;
+    if (heap_map_pages(old_end, old_end + grow) != 0) {
+        return -1;
+    }
+    heap_size += grow;
+    heap_set_sentinel();
+
+    // 古い番兵の位置から新しい番兵の手前までをフリーブロックにする
+    // （末尾のフリーブロックがあれば結合される）
+    block_release((block_header_t*)(old_end - BLOCK_HEADER_SIZE), grow);
+    free_memory += grow;
+
+    heap_grow_count++;
+    if (heap_size > heap_peak_size) {
+        heap_peak_size = heap_size;
+    }
+    return 0;
+}
+
+// 末尾のフリーブロックのうち高水位線を超えるページをシステムに返す
+static void heap_trim(void) {
+    if (memory_pool == NULL || heap_size <= heap_high_watermark) {
+        return;
+    }
+
+    uint32_t end = (uint32_t)memory_pool + heap_size;
+    uint32_t footer = *(uint32_t*)(end - BLOCK_HEADER_SIZE - BLOCK_FOOTER_SIZE);
+    if (footer & BLOCK_USED) {
+        return;
+    }
+    block_header_t* last = (block_header_t*)(end - BLOCK_HEADER_SIZE - (footer & ~BLOCK_FLAGS_MASK));
+
+    // 残すブロックの最小サイズと新しい番兵の場所を確保し、高水位線より下は縮めない
+    uint32_t new_end = align_up((uint32_t)last + MIN_BLOCK_SIZE + BLOCK_HEADER_SIZE, PAGE_SIZE);
+    if (new_end < (uint32_t)memory_pool + heap_high_watermark) {
+        new_end = (uint32_t)memory_pool + heap_high_watermark;
+    }
+    if (new_end >= end || end - new_end < HEAP_GROW_MIN) {
+        return;
+    }
+
+    uint32_t released = end - new_end;
+    free_list_remove((free_block_t*)last);
+    block_set(last, new_end - BLOCK_HEADER_SIZE - (uint32_t)last, 0);
+    free_list_insert((free_block_t*)last);
+
+    heap_size -= released;
+    heap_set_sentinel();
+    heap_unmap_pages(new_end, end);
+    free_memory -= released;
+    heap_shrink_count++;
+}
+
+// 大きなオブジェクトを割り当てる（alignは2の冪）
+static void* large_alloc(size_t size, uint32_t align) {
+    if (size > HEAP_MAX_SIZE) {
+        return NULL;
+    }
+
+    uint32_t need = align_up(size + BLOCK_HEADER_SIZE + BLOCK_FOOTER_SIZE, BLOCK_ALIGN);
+    if (need < MIN_BLOCK_SIZE) {
+        need = MIN_BLOCK_SIZE;
+    }
+
+    // アラインが必要な場合は前方を切り出せるだけ余分に探す
+    uint32_t search = need;
+    if (align > BLOCK_ALIGN) {
+        search += align + MIN_BLOCK_SIZE;
+    }
+
+    // 足りなければヒープを伸ばす
+    free_block_t* block = free_list_find(search);
+    if (block == NULL) {
+        if (heap_grow(search) != 0) {
+            return NULL;
+        }
+        block = free_list_find(search);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    free_list_remove(block);
+
+    uint8_t* start = (uint8_t*)block;
+    uint32_t total = block_size(&block->header);
+    free_memory -= total;
+
+    // 前方の余りをフリーブロックとして切り出す
+    if (align > BLOCK_ALIGN) {
+        uint32_t payload = (uint32_t)start + BLOCK_HEADER_SIZE;
+        uint32_t aligned = align_up(payload, align);
+        if (aligned != payload) {
+            while (aligned - payload < MIN_BLOCK_SIZE) {
+                aligned += align;
+            }
+            uint32_t front = aligned - payload;
+            block_set((block_header_t*)start, front, 0);
+            free_list_insert((free_block_t*)start);
+            free_memory += front;
+            start += front;
+            total -= front;
+        }
+    }
+
+    // 後方の余りをフリーブロックとして切り出す
+    if (total - need >= MIN_BLOCK_SIZE) {
+        block_set((block_header_t*)(start + need), total - need, 0);
+        free_list_insert((free_block_t*)(start + need));
+        free_memory += total - need;
+        total = need;
+    }
+
+    block_header_t* header = (block_header_t*)start;
+    block_set(header, total, BLOCK_USED);
+    header->tag = BLOCK_TAG_MAGIC;
+
+    return start + BLOCK_HEADER_SIZE;
+}
+
+// 大きなオブジェクトの利用可能サイズ
+static inline uint32_t large_usable_size(const void* ptr) {
+    const block_header_t* block = (const block_header_t*)((const uint8_t*)ptr - BLOCK_HEADER_SIZE);
+    return block_size(block) - BLOCK_HEADER_SIZE - BLOCK_FOOTER_SIZE;
+}
+
+// 大きなオブジェクトを解放し、境界タグで前後のフリーブロックと結合する
+// 末尾が大きく空いたらヒープを縮める。戻り値は解放した利用可能サイズ（不正なポインタなら0）
+static uint32_t large_free(void* ptr) {
+    block_header_t* block = (block_header_t*)((uint8_t*)ptr - BLOCK_HEADER_SIZE);
+    if ((block->tag & BLOCK_TAG_MAGIC_MASK) != BLOCK_TAG_MAGIC || !(block->size_flags & BLOCK_USED)) {
+        return 0; // 不正なポインタか二重解放
+    }
+
+    uint32_t size = block_size(block);
+    uint32_t usable = size - BLOCK_HEADER_SIZE - BLOCK_FOOTER_SIZE;
+    free_memory += size;
+    block->tag = 0;
+
+    block_release(block, size);
+    heap_trim();
+    return usable;
+}
+
+// サイズからサイズクラスを求める
+static inline uint32_t slab_class_index(size_t size) {
+    if (size <= SLAB_MIN_SIZE) {
+        return 0;
+    }
+    return (32 - __builtin_clz(size - 1)) - 4;
+}
+
+// スラブのページをページマップに登録/解除
+static void slab_mark_pages(slab_t* slab, uint32_t bytes, uint8_t value) {
+    uint32_t first = ((uint32_t)slab - (uint32_t)memory_pool) / PAGE_SIZE;
+    for (uint32_t i = 0; i < bytes / PAGE_SIZE; i++) {
+        slab_page_map[first + i] = value;
+    }
+}
+
+// 部分使用リストにスラブを追加
+static void slab_partial_push(slab_class_t* cls, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = cls->partial;
+    if (cls->partial != NULL) {
+        cls->partial->prev = slab;
+    }
+    cls->partial = slab;
+    cls->partial_count++;
+}
+
+// 部分使用リストからスラブを取り除く
+static void slab_partial_remove(slab_class_t* cls, slab_t* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        cls->partial = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = slab->prev = NULL;
+    cls->partial_count--;
+}
+
+// 新しいスラブを作成
+static slab_t* slab_create(uint32_t index) {
+    slab_class_t* cls = &slab_classes[index];
+
+    // スラブサイズ境界にアラインして確保（解放時にアドレスからヘッダを引ける）
+    slab_t* slab = (slab_t*)large_alloc(cls->slab_bytes, cls->slab_bytes);
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->in_use = 0;
+    slab->capacity = cls->capacity;
+    slab->class_index = index;
+
+    // 空きオブジェクトのリストを作る
+    uint8_t* object = (uint8_t*)slab + cls->header_size;
+    slab->free_list = object;
+    for (uint32_t i = 0; i + 1 < slab->capacity; i++) {
+        *(void**)object = object + cls->object_size;
+        object += cls->object_size;
+    }
+    *(void**)object = NULL;
+
+    slab_mark_pages(slab, cls->slab_bytes, (uint8_t)(index + 1));
+    slab_partial_push(cls, slab);
+    cls->slab_count++;
+    return slab;
+}
+
+// オブジェクトごとの呼び出し元番号の配列（ヘッダの直後）
+static inline uint8_t* slab_sites(slab_t* slab) {
+    return (uint8_t*)(slab + 1);
+}
+
+// スラブ内のオブジェクトの番号
+static inline uint32_t slab_object_index(const slab_class_t* cls, const slab_t* slab, const void* ptr) {
+    return ((uint32_t)ptr - (uint32_t)slab - cls->header_size) >> cls->object_shift;
+}
+
+// スラブからオブジェクトを割り当てる
+static void* slab_alloc(uint32_t index, uint8_t site) {
+    slab_class_t* cls = &slab_classes[index];
+
+    slab_t* slab = cls->partial;
+    if (slab == NULL) {
+        slab = slab_create(index);
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+
+    void* object = slab->free_list;
+    slab->free_list = *(void**)object;
+    slab->in_use++;
+
+    // 満杯になったら部分使用リストから外す
+    if (slab->in_use == slab->capacity) {
+        slab_partial_remove(cls, slab);
+    }
+
+    slab_sites(slab)[slab_object_index(cls, slab, object)] = site;
+    return object;
+}
+
+// オブジェクトをスラブに返す（割り当てた呼び出し元の番号を返す）
+static uint8_t slab_free(uint32_t index, void* ptr) {
+    slab_class_t* cls = &slab_classes[index];
+    slab_t* slab = (slab_t*)((uint32_t)ptr & ~(cls->slab_bytes - 1));
+    uint8_t site = slab_sites(slab)[slab_object_index(cls, slab, ptr)];
+
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+
+    // 満杯だったスラブは再び部分使用リストへ
+    if (slab->in_use == slab->capacity) {
+        slab_partial_push(cls, slab);
+    }
+    slab->in_use--;
+
+    // 空になったスラブは、他に空きのあるスラブがあるか、ヒープが高水位線を超えていれば返却する
+    if (slab->in_use == 0 && (cls->partial_count > 1 || heap_size > heap_high_watermark)) {
+        slab_partial_remove(cls, slab);
+        slab_mark_pages(slab, cls->slab_bytes, 0);
+        cls->slab_count--;
+        large_free(slab);
+    }
+    return site;
+}
+
+// 呼び出し元の番号を求める（表がいっぱいなら0）
+static uint8_t heap_site_lookup(uint32_t addr) {
+    uint32_t hash = ((addr >> 2) * 2654435761u) >> 26;
+
+    for (uint32_t probe = 0; probe < HEAP_SITE_COUNT; probe++) {
+        uint32_t i = (hash + probe) & (HEAP_SITE_COUNT - 1);
+        if (i == 0) {
+            continue;
+        }
+        if (heap_sites[i].addr == addr) {
+            return (uint8_t)i;
+        }
+        if (heap_sites[i].addr == 0) {
+            heap_sites[i].addr = addr;
+            return (uint8_t)i;
+        }
+    }
+    return 0;
+}
+
+// 割り当てを記録
+static void heap_record_alloc(uint8_t site, size_t requested, uint32_t usable) {
+    size_histogram[bin_index(requested ? requested : 1)]++;
+    heap_sites[site].allocs++;
+    heap_sites[site].live_count++;
+    heap_sites[site].live_bytes += usable;
+
+    alloc_count++;
+    allocated_memory += usable;
+    if (allocated_memory > peak_memory) {
+        peak_memory = allocated_memory;
+    }
+}
+
+// 解放を記録
+static void heap_record_free(uint8_t site, uint32_t usable) {
+    heap_sites[site].live_count--;
+    heap_sites[site].live_bytes -= usable;
+
+    free_count++;
+    allocated_memory -= usable;
+}
+
+// 割り当ての本体（alignは2の冪、callerは呼び出し元の戻りアドレス）
+static void* heap_alloc(size_t size, size_t align, uint32_t caller) {
+    void* ptr;
+    uint32_t usable;
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    uint8_t site = heap_site_lookup(caller);
+
+    // スラブのオブジェクトは min(オブジェクトサイズ, キャッシュライン) 境界に並んでいる
+    if (align <= CACHE_LINE_SIZE && size <= SLAB_MAX_SIZE) {
+        uint32_t index = slab_class_index(size < align ? align : size);
+        ptr = slab_alloc(index, site);
+        usable = slab_classes[index].object_size;
+    } else {
+        ptr = large_alloc(size, align);
+        if (ptr != NULL) {
+            block_header_t* header = (block_header_t*)((uint8_t*)ptr - BLOCK_HEADER_SIZE);
+            header->tag |= site;
+            usable = large_usable_size(ptr);
+        }
+    }
+
+    if (ptr != NULL) {
+        heap_record_alloc(site, size, usable);
+    } else {
+        failed_count++;
+    }
+
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
 
 // メモリの初期化
 void memory_init(void) {
-    // 最初のブロックを設定
-    first_block = (block_header_t*)memory_pool;
-    first_block->size = MEMORY_SIZE - sizeof(block_header_t);
-    first_block->status = BLOCK_FREE;
-    first_block->next = NULL;
-
-    free_memory = MEMORY_SIZE - sizeof(block_header_t);
+    memset(bins, 0, sizeof(bins));
+    memset(slab_page_map, 0, sizeof(slab_page_map));
+    bin_bitmap = 0;
     allocated_memory = 0;
+    free_memory = 0;
+
+    // サイズクラスを設定
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        slab_class_t* cls = &slab_classes[i];
+        cls->partial = NULL;
+        cls->partial_count = 0;
+        cls->slab_count = 0;
+        cls->object_size = SLAB_MIN_SIZE << i;
+        cls->object_shift = __builtin_ctz(cls->object_size);
+        cls->slab_bytes = PAGE_SIZE;
+        while (cls->slab_bytes < cls->object_size * SLAB_MIN_OBJECTS) {
+            cls->slab_bytes <<= 1;
+        }
+
+        // ヘッダと呼び出し元番号の配列が収まるまでヘッダ領域を広げる
+        cls->header_size = SLAB_HEADER_ALIGN;
+        while (1) {
+            cls->capacity = (cls->slab_bytes - cls->header_size) / cls->object_size;
+            uint32_t need = align_up(sizeof(slab_t) + cls->capacity, SLAB_HEADER_ALIGN);
+            if (need <= cls->header_size) {
+                break;
+            }
+            cls->header_size = need;
+        }
+    }
+
+    // プロファイルをリセット
+    memset(size_histogram, 0, sizeof(size_histogram));
+    memset(heap_sites, 0, sizeof(heap_sites));
+    peak_memory = 0;
+    alloc_count = free_count = failed_count = 0;
+
+    // ヒープの仮想領域の先頭に初期サイズ分の物理ページをマップする
+    memory_pool = NULL;
+    heap_size = heap_peak_size = 0;
+    heap_grow_count = heap_shrink_count = 0;
+    if (heap_map_pages(HEAP_VIRT_START, HEAP_VIRT_START + HEAP_INITIAL_SIZE) != 0) {
+        return;
+    }
+    memory_pool = (uint8_t*)HEAP_VIRT_START;
+    heap_size = heap_peak_size = HEAP_INITIAL_SIZE;
+
+    // 先頭に使用中のフッタ、末尾に使用中の番兵ヘッダを置き、結合が範囲外に出ないようにする
+    *(uint32_t*)(memory_pool + 4) = BLOCK_USED;
+    heap_set_sentinel();
+
+    // 残り全体を1つのフリーブロックにする
+    uint32_t size = heap_size - 2 * BLOCK_HEADER_SIZE;
+    block_set((block_header_t*)(memory_pool + BLOCK_HEADER_SIZE), size, 0);
+    free_list_insert((free_block_t*)(memory_pool + BLOCK_HEADER_SIZE));
+    free_memory = size;
 }
 
-// メモリの割り当て（単純なファーストフィット方式）
+// メモリの割り当て（2048バイト以下はスラブ、それ以上は境界タグ方式）
 void* kmalloc(size_t size) {
-    // サイズを最小ブロックサイズにアライン
-    if (size < MIN_BLOCK_SIZE) {
-        size = MIN_BLOCK_SIZE;
-    }
-    
-    // 4バイト境界にアライン
-    size = (size + 3) & ~3;
-    
-    block_header_t* current = first_block;
-    
-    // 利用可能なブロックを探す
-    while (current != NULL) {
-        if (current->status == BLOCK_FREE && current->size >= size) {
-            // 十分な大きさのフリーブロックを発見
-            
-            // ブロックを分割するかどうか決定
-            if (current->size > size + sizeof(block_header_t) + MIN_BLOCK_SIZE) {
-                // ブロックを分割
-                block_header_t* new_block = (block_header_t*)((char*)current + sizeof(block_header_t) + size);
-                new_block->size = current->size - size - sizeof(block_header_t);
-                new_block->status = BLOCK_FREE;
-                new_block->next = current->next;
-                
-                current->size = size;
-                current->next = new_block;
-            }
-            
-            // ブロックを使用中に設定
-            current->status = BLOCK_USED;
-            allocated_memory += current->size;
-            free_memory -= current->size;
-            
-            // データ部分のポインタを返す
-            return (void*)((char*)current + sizeof(block_header_t));
-        }
-        current = current->next;
-    }
-    
-    // 利用可能なブロックが見つからない
-    return NULL;
+    return heap_alloc(size, BLOCK_ALIGN, (uint32_t)__builtin_return_address(0));
+}
+
+// アライン指定付きのメモリ割り当て（alignは2の冪）
+void* kmalloc_aligned(size_t size, size_t align) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+    if (align < BLOCK_ALIGN) {
+        align = BLOCK_ALIGN;
+    }
+    return heap_alloc(size, align, (uint32_t)__builtin_return_address(0));
 }
 
 // メモリの解放
@@ -91,120 +715,259 @@ void kfree(void* ptr) {
     if (ptr == NULL) {
         return;
     }
-    
-    // ブロックヘッダを取得
-    block_header_t* block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
-    
-    // ブロックをフリーに設定
-    block->status = BLOCK_FREE;
-    allocated_memory -= block->size;
-    free_memory += block->size;
-    
-    // 隣接するフリーブロックと結合
-    block_header_t* current = first_block;
-    while (current != NULL) {
-        if (current->status == BLOCK_FREE && current->next != NULL && current->next->status == BLOCK_FREE) {
-            // 隣接するフリーブロックを結合
-            block_header_t* next_block = current->next;
-            current->size += sizeof(block_header_t) + next_block->size;
-            current->next = next_block->next;
-        } else {
-            current = current->next;
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
+    // スラブのページならサイズクラスに返す
+    uint32_t offset = (uint32_t)ptr - (uint32_t)memory_pool;
+    if (memory_pool != NULL && offset < heap_size && slab_page_map[offset / PAGE_SIZE] != 0) {
+        uint32_t index = slab_page_map[offset / PAGE_SIZE] - 1;
+        uint8_t site = slab_free(index, ptr);
+        heap_record_free(site, slab_classes[index].object_size);
+    } else {
+        block_header_t* header = (block_header_t*)((uint8_t*)ptr - BLOCK_HEADER_SIZE);
+        uint8_t site = header->tag & BLOCK_TAG_SITE_MASK;
+        uint32_t usable = large_free(ptr);
+        if (usable != 0) {
+            heap_record_free(site, usable);
         }
     }
-}
 
-// 指定アドレスからサイズ分のメモリを指定値で埋める
-void memset(void* ptr, int value, size_t size) {
-    unsigned char* p = (unsigned char*)ptr;
-    for (size_t i = 0; i < size; i++) {
-        p[i] = (unsigned char)value;
-    }
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
-// メモリ間のコピー
-void memcpy(void* dest, const void* src, size_t size) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
-    for (size_t i = 0; i < size; i++) {
-        d[i] = s[i];
+// ヒープの高水位線を設定（初期サイズ未満にはしない）
+void memory_set_high_watermark(size_t bytes) {
+    if (bytes < HEAP_INITIAL_SIZE) {
+        bytes = HEAP_INITIAL_SIZE;
     }
+    if (bytes > HEAP_MAX_SIZE) {
+        bytes = HEAP_MAX_SIZE;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    heap_high_watermark = align_up(bytes, PAGE_SIZE);
+    heap_trim();
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 // メモリの統計情報を表示
 void memory_stats(void) {
-    screen_write("Memory Statistics:\n", vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-    
-    // 文字列表示用の関数が必要なので、簡易的な実装
-    char buffer[32];
-    
-    // 割り当て済みメモリを表示
-    screen_write("  Allocated: ", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-    print_size(allocated_memory, buffer);
-    screen_write(buffer, vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
-    screen_write(" bytes\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-    
-    // フリーメモリを表示
-    screen_write("  Free: ", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-    print_size(free_memory, buffer);
-    screen_write(buffer, vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
-    screen_write(" bytes\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-    
-    // 総メモリ容量を表示
-    screen_write("  Total: ", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-    print_size(MEMORY_SIZE, buffer);
-    screen_write(buffer, vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
-    screen_write(" bytes\n", vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-}
-
-// 整数を文字列に変換する簡易関数
-void int_to_string(uint32_t value, char* buffer) {
-    if (value == 0) {
-        buffer[0] = '0';
-        buffer[1] = '\0';
-        return;
+    uint8_t white = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    uint8_t grey = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    char size[4][16];
+
+    kprintf("%CMemory Statistics:\n", white);
+
+    // 割り当て済み・フリー・総メモリ容量（現在マップされているヒープ）を表示
+    print_size(allocated_memory, size[0]);
+    print_size(free_memory, size[1]);
+    kprintf("%C  Allocated: %C%s%C bytes\n  Free: %C%s%C bytes\n",
+            grey, green, size[0], grey, green, size[1], grey);
+    print_size(heap_size, size[0]);
+    print_size(heap_peak_size, size[1]);
+    print_size(heap_high_watermark, size[2]);
+    kprintf("%C  Total: %C%s%C bytes (peak %C%s%C, watermark %C%s%C)\n",
+            grey, green, size[0], grey, green, size[1], grey, green, size[2], grey);
+
+    // ヒープを伸ばした/縮めた回数を表示
+    kprintf("%C  Grows: %C%u%C  Shrinks: %C%u\n",
+            grey, green, heap_grow_count, grey, green, heap_shrink_count);
+
+    // 使用中のサイズクラスごとのスラブ数を表示
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        if (slab_classes[i].slab_count == 0) {
+            continue;
+        }
+        kprintf("%C  Slab %u: %C%u%C slabs\n",
+                grey, slab_classes[i].object_size, green, slab_classes[i].slab_count, grey);
     }
-    
-    char temp[32];
-    int index = 0;
-    
-    while (value > 0) {
-        temp[index++] = '0' + (value % 10);
-        value /= 10;
+
+    // 作業用アリーナの使用状況を表示
+    arena_t* scratch = arena_scratch();
+    if (scratch != NULL) {
+        print_size(scratch->used, size[0]);
+        print_size(scratch->peak, size[1]);
+        kprintf("%C  Scratch arena: %C%s%C used, peak %C%s%C, %C%u%C chunks\n",
+                grey, green, size[0], grey, green, size[1], grey, green, scratch->chunk_count, grey);
+    }
+
+    // 物理ページの空き状況を表示
+    print_size((size_t)pmm_total_pages() * PAGE_SIZE, size[0]);
+    kprintf("%CPhysical pages: %C%u%C free of %C%u%C (%C%s%C)\n",
+            white, green, pmm_free_page_count(), grey, green, pmm_total_pages(), grey, green, size[0], grey);
+
+    // 次数ごとの空きブロック数を表示
+    kprintf("%C  Free blocks by order:", grey);
+    for (uint32_t order = 0; order < PMM_MAX_ORDER; order++) {
+        kprintf(" %C%u", green, pmm_free_blocks(order));
+    }
+    screen_newline();
+}
+
+// 最大のフリーブロックの利用可能サイズ
+static uint32_t largest_free_extent(void) {
+    if (bin_bitmap == 0) {
+        return 0;
+    }
+
+    // 最も大きいビンの中だけを調べればよい
+    uint32_t largest = 0;
+    for (free_block_t* block = bins[bin_index(bin_bitmap)]; block != NULL; block = block->next) {
+        if (block_size(&block->header) > largest) {
+            largest = block_size(&block->header);
+        }
+    }
+    return largest - BLOCK_HEADER_SIZE - BLOCK_FOOTER_SIZE;
+}
+
+// 外部断片化率（パーミル）: 1 - 最大のフリーブロック / フリーメモリの合計
+static uint32_t fragmentation_permille(uint32_t largest) {
+    uint32_t per_mille = free_memory / 1000;
+    if (per_mille == 0) {
+        return 0;
+    }
+    uint32_t ratio = largest / per_mille;
+    return ratio >= 1000 ? 0 : 1000 - ratio;
+}
+
+// ライブバイト数の多い順に呼び出し元を選ぶ（countは最大HEAP_TOP_SITES）
+static uint32_t top_heap_sites(uint8_t* out, uint32_t count) {
+    uint8_t used[HEAP_SITE_COUNT];
+    uint32_t found = 0;
+
+    memset(used, 0, sizeof(used));
+    while (found < count) {
+        uint32_t best = HEAP_SITE_COUNT;
+        for (uint32_t i = 0; i < HEAP_SITE_COUNT; i++) {
+            if (used[i] || heap_sites[i].allocs == 0) {
+                continue;
+            }
+            if (best == HEAP_SITE_COUNT || heap_sites[i].live_bytes > heap_sites[best].live_bytes) {
+                best = i;
+            }
+        }
+        if (best == HEAP_SITE_COUNT) {
+            break;
+        }
+        used[best] = 1;
+        out[found++] = (uint8_t)best;
     }
-    
-    // 文字列を逆順にしてbufferにコピー
-    for (int i = 0; i < index; i++) {
-        buffer[i] = temp[index - 1 - i];
+    return found;
+}
+
+// ヒーププロファイルを表示
+void heap_profile(void) {
+    char size[3][16];
+    uint8_t grey = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    uint32_t largest = largest_free_extent();
+    uint32_t frag = fragmentation_permille(largest);
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    kprintf("%CHeap Profile:\n", vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+
+    print_size(allocated_memory, size[0]);
+    print_size(peak_memory, size[1]);
+    print_size(free_memory, size[2]);
+    kprintf("%C  In use: %C%s%C  Peak: %C%s%C  Free: %C%s\n",
+            grey, green, size[0], grey, green, size[1], grey, green, size[2]);
+
+    print_size(largest, size[0]);
+    kprintf("%C  Largest free: %C%s%C  Fragmentation: %C%u.%u%%\n",
+            grey, green, size[0], grey, green, frag / 10, frag % 10);
+
+    kprintf("%C  Allocs: %C%u%C  Frees: %C%u%C  Failed: %C%u\n",
+            grey, green, alloc_count, grey, green, free_count, grey,
+            failed_count ? vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK) : green, failed_count);
+
+    // 要求サイズのヒストグラム（空のバケットは省略）
+    kprintf("%C  Sizes:", grey);
+    for (uint32_t i = 0; i < HEAP_HIST_BUCKETS; i++) {
+        if (size_histogram[i] == 0) {
+            continue;
+        }
+        print_size((size_t)1 << i, size[0]);
+        kprintf("%C %s+:%C%u", grey, size[0], green, size_histogram[i]);
+    }
+    screen_newline();
+
+    // ライブバイト数の多い呼び出し元
+    uint8_t top[HEAP_TOP_SITES];
+    uint32_t count = top_heap_sites(top, HEAP_TOP_SITES);
+    kprintf("%C  Top call sites (live):\n", grey);
+    for (uint32_t i = 0; i < count; i++) {
+        heap_site_t* site = &heap_sites[top[i]];
+        print_size(site->live_bytes, size[0]);
+        if (top[i] == 0) {
+            kprintf("%C    (other)   ", grey);
+        } else {
+            kprintf("%C    0x%08X", grey, site->addr);
+        }
+        kprintf("%C %C%s%C in %C%u%C blocks, %C%u%C allocs\n",
+                grey, green, size[0], grey, green, site->live_count, grey, green, site->allocs, grey);
     }
-    buffer[index] = '\0';
 }
 
-// サイズを人間が読みやすい形式に変換する関数
+// ヒーププロファイルをCOM1に機械可読な形式で出力
+// 形式: "heapprof begin" から "heapprof end" までの行。各行は空白区切り
+//   <キー> <値>
+//   hist <log2(サイズ)> <回数>
+//   site <0x戻りアドレス> <割り当て回数> <ライブ数> <ライブバイト数>
+void heap_profile_dump(void) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    uint32_t largest = largest_free_extent();
+    uint32_t frag = fragmentation_permille(largest);
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    kprintf_to(KPRINTF_SERIAL,
+               "heapprof begin\r\n"
+               "in_use %u\r\npeak %u\r\nfree %u\r\nheap_size %u\r\n"
+               "heap_grows %u\r\nheap_shrinks %u\r\nlargest_free %u\r\nfrag_permille %u\r\n"
+               "allocs %u\r\nfrees %u\r\nfailed %u\r\n",
+               allocated_memory, peak_memory, free_memory, heap_size,
+               heap_grow_count, heap_shrink_count, largest, frag,
+               alloc_count, free_count, failed_count);
+
+    for (uint32_t i = 0; i < HEAP_HIST_BUCKETS; i++) {
+        if (size_histogram[i] == 0) {
+            continue;
+        }
+        kprintf_to(KPRINTF_SERIAL, "hist %u %u\r\n", i, size_histogram[i]);
+    }
+
+    for (uint32_t i = 0; i < HEAP_SITE_COUNT; i++) {
+        heap_site_t* site = &heap_sites[i];
+        if (site->allocs == 0) {
+            continue;
+        }
+        kprintf_to(KPRINTF_SERIAL, "site 0x%08X %u %u %u\r\n",
+                   site->addr, site->allocs, site->live_count, site->live_bytes);
+    }
+    kprintf_to(KPRINTF_SERIAL, "heapprof end\r\n");
+}
+
+// サイズを人間が読みやすい形式に変換する関数（bufferは16バイト以上）
 void print_size(size_t size, char* buffer) {
-    const char* suffixes[] = {"B", "KB", "MB", "GB", "TB"};
+    static const char* const suffixes[] = {"B", "KB", "MB", "GB"};
     int index = 0;
-    
-    while (size >= 1024 && index < 4) {
-        size /= 1024;
+    size_t unit = 1;
+
+    while (size / unit >= 1024 && index < 3) {
+        unit *= 1024;
         index++;
     }
-    
-    // 整数部分と小数部分を分ける
-    size_t integer_part = size;
-    size_t decimal_part = (size - integer_part) * 100;
-    
-    // 整数部分を文字列に変換
-    int_to_string(integer_part, buffer);
-    
-    // 小数部分を文字列に追加
+
+    // 整数部分と小数部分（小数点以下2桁、切り捨て）を分け、1回の書式化で組み立てる
+    size_t integer_part = size / unit;
+    size_t remainder = size % unit;
+    size_t decimal_part = (index > 0) ? (remainder / (unit / 1024)) * 100 / 1024 : 0;
     if (decimal_part > 0) {
-        char decimal_buffer[8];
-        int_to_string(decimal_part, decimal_buffer);
-        strcat(buffer, ".");
-        strcat(buffer, decimal_buffer);
-    }
-    
-    // 単位を追加
-    strcat(buffer, suffixes[index]);
-}
\ No newline at end of file
+        ksnprintf(buffer, 16, "%zu.%02zu%s", integer_part, decimal_part, suffixes[index]);
+    } else {
+        ksnprintf(buffer, 16, "%zu%s", integer_part, suffixes[index]);
+    }
+}
@@ -0,0 +1,97 @@
+// multiboot.c - マルチブート2情報構造体の解析
+#include "../include/multiboot.h"
+#include "../include/stddef.h"
+
+// マルチブート情報構造体の先頭（固定部分: total_size, reserved）
+static uint32_t info_addr = 0;
+// マルチブート情報構造体の全体サイズ
+static uint32_t info_size = 0;
+// メモリマップタグ（キャッシュ）
+static const multiboot_tag_mmap_t* mmap_tag = NULL;
+
+// マルチブート情報を登録
+int multiboot_init(uint32_t magic, uint32_t addr) {
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC || addr == 0) {
+        info_addr = 0;
+        info_size = 0;
+        return 1;
+    }
+
+    info_addr = addr;
+    info_size = *(const uint32_t*)addr;
+    mmap_tag = (const multiboot_tag_mmap_t*)multiboot_find_tag(MULTIBOOT_TAG_TYPE_MMAP);
+    return 0;
+}
+
+// マルチブート情報が有効か
+int multiboot_valid(void) {
+    return info_addr != 0;
+}
+
+// マルチブート情報構造体の先頭アドレス
+uint32_t multiboot_info_addr(void) {
+    return info_addr;
+}
+
+// マルチブート情報構造体のサイズ
+uint32_t multiboot_info_size(void) {
+    return info_size;
+}
+
+// 指定した種類の最初のタグを探す
+const multiboot_tag_t* multiboot_find_tag(uint32_t type) {
+    if (info_addr == 0) {
+        return NULL;
+    }
+
+    // 固定部分（8バイト）の直後からタグが並ぶ
+    uint32_t pos = info_addr + 8;
+    uint32_t end = info_addr + info_size;
+
+    while (pos + sizeof(multiboot_tag_t) <= end) {
+        const multiboot_tag_t* tag = (const multiboot_tag_t*)pos;
+        if (tag->type == MULTIBOOT_TAG_TYPE_END) {
+            break;
+        }
+        if (tag->type == type) {
+            return tag;
+        }
+        // 次のタグは8バイト境界
+        pos += (tag->size + 7) & ~7;
+    }
+    return NULL;
+}
+
+// メモリマップのエントリ数
+uint32_t multiboot_mmap_count(void) {
+    if (mmap_tag == NULL || mmap_tag->entry_size == 0) {
+        return 0;
+    }
+    return (mmap_tag->size - sizeof(multiboot_tag_mmap_t)) / mmap_tag->entry_size;
+}
+
+// メモリマップのi番目のエントリ
+const multiboot_mmap_entry_t* multiboot_mmap_entry(uint32_t index) {
+    if (index >= multiboot_mmap_count()) {
+        return NULL;
+    }
+    uint32_t pos = (uint32_t)mmap_tag + sizeof(multiboot_tag_mmap_t) + index * mmap_tag->entry_size;
+    return (const multiboot_mmap_entry_t*)pos;
+}
+
+// RGBのフレームバッファ情報
+const multiboot_tag_framebuffer_t* multiboot_framebuffer(void) {
+    const multiboot_tag_framebuffer_t* tag =
+        (const multiboot_tag_framebuffer_t*)multiboot_find_tag(MULTIBOOT_TAG_TYPE_FRAMEBUFFER);
+    if (tag == NULL || tag->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB) {
+        return NULL;
+    }
+    return tag;
+}
+
+// ブートローダが画面をテキストモードのままにしているか
+int multiboot_text_mode(void) {
+    const multiboot_tag_framebuffer_t* tag =
+        (const multiboot_tag_framebuffer_t*)multiboot_find_tag(MULTIBOOT_TAG_TYPE_FRAMEBUFFER);
+    return tag == NULL || tag->framebuffer_type == MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT;
+}
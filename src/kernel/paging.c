@@ -0,0 +1,382 @@
+// paging.c - ページングの実装（4MBページでのアイデンティティマップと遅延ゼロページ）
+#include "../include/paging.h"
+#include "../include/cpu.h"
+#include "../include/interrupt.h"
+#include "../include/kprintf.h"
+#include "../include/memory.h"
+#include "../include/pmm.h"
+#include "../include/screen.h"
+#include "../include/serial.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+
+// ページディレクトリ/ページテーブルのエントリ数
+#define PAGE_ENTRIES 1024
+// エントリ中の物理アドレス部分
+#define PAGE_FRAME_MASK 0xFFFFF000
+// 仮想アドレスからインデックスを求める
+#define PDE_INDEX(virt) ((virt) >> 22)
+#define PTE_INDEX(virt) (((virt) >> PAGE_SHIFT) & (PAGE_ENTRIES - 1))
+
+// 少なくともアイデンティティマップする範囲（16MB）
+#define IDENTITY_MIN 0x1000000
+
+// 遅延割り当て領域の最大数
+#define VM_MAX_REGIONS 32
+
+// ページフォルトのエラーコード
+#define PF_PRESENT 0x1 // 保護違反（0ならページが存在しない）
+#define PF_WRITE   0x2 // 書き込みアクセス
+
+// 遅延割り当て領域 [start, end)
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} vm_region_t;
+
+// カーネルのページディレクトリ
+static uint32_t page_directory[PAGE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+// カーネルのマッピングに付けるグローバルビット（PGE対応時のみ）
+static uint32_t global_flag = 0;
+// アイデンティティマップの上限
+static uint32_t identity_limit = 0;
+// 遅延割り当て領域（開始アドレス順）
+static vm_region_t vm_regions[VM_MAX_REGIONS];
+static uint32_t vm_region_count = 0;
+// 統計情報
+static paging_stats_t stats;
+// ページテーブルと仮想領域のロック（この中でpmmのロックを取る）
+static spinlock_t paging_lock = SPINLOCK_INIT;
+
+// 仮想アドレスを含むページテーブルを取得（必要なら作成）
+static uint32_t* get_page_table(uint32_t virt, int create) {
+    uint32_t pde = page_directory[PDE_INDEX(virt)];
+
+    if (pde & PAGE_PRESENT) {
+        // 4MBページの中には4KBページを作れない
+        if (pde & PAGE_LARGE) {
+            return NULL;
+        }
+        return (uint32_t*)(pde & PAGE_FRAME_MASK);
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    // ページテーブルは物理ページをそのまま使う（アイデンティティマップ内にある）
+    uint32_t* table = (uint32_t*)alloc_pages(0);
+    if (table == NULL) {
+        return NULL;
+    }
+    memset(table, 0, PAGE_SIZE);
+    page_directory[PDE_INDEX(virt)] = (uint32_t)table | PAGE_PRESENT | PAGE_WRITE;
+    stats.page_tables++;
+    return table;
+}
+
+// 例外14（ページフォルト）のハンドラ
+static void page_fault_isr(registers_t* regs, void* ctx) {
+    (void)ctx;
+    page_fault_handler(read_cr2(), regs->err_code);
+}
+
+// ページングを初期化して有効化
+void paging_init(void) {
+    memset(page_directory, 0, sizeof(page_directory));
+    memset(&stats, 0, sizeof(stats));
+    vm_region_count = 0;
+
+    int use_pse = cpu_has(CPU_FEATURE_PSE);
+    global_flag = cpu_has(CPU_FEATURE_PGE) ? PAGE_GLOBAL : 0;
+
+    // 物理メモリ全体（4MB単位に切り上げ）をアイデンティティマップする
+    identity_limit = pmm_max_phys();
+    if (identity_limit < IDENTITY_MIN) {
+        identity_limit = IDENTITY_MIN;
+    }
+    identity_limit = (identity_limit + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+
+    for (uint32_t addr = 0; addr < identity_limit; addr += LARGE_PAGE_SIZE) {
+        if (use_pse) {
+            // 4MBページ1つでページテーブル1枚分を覆い、TLBミスを減らす
+            page_directory[PDE_INDEX(addr)] = addr | PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE | global_flag;
+            stats.large_pages++;
+        } else {
+            uint32_t* table = get_page_table(addr, 1);
+            if (table == NULL) {
+                break;
+            }
+            for (uint32_t i = 0; i < PAGE_ENTRIES; i++) {
+                table[i] = (addr + i * PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITE | global_flag;
+            }
+            stats.mapped_pages += PAGE_ENTRIES;
+        }
+    }
+
+    // PSEとグローバルページを有効化
+    uint32_t cr4 = read_cr4();
+    if (use_pse) {
+        cr4 |= CR4_PSE;
+    }
+    if (global_flag) {
+        cr4 |= CR4_PGE;
+    }
+    write_cr4(cr4);
+
+    // ページフォルトのハンドラを登録
+    register_interrupt_handler(14, page_fault_isr, NULL);
+
+    // ページディレクトリを読み込んでページングを有効化
+    write_cr3((uint32_t)page_directory);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+}
+
+// 4KBページをマップ
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags) {
+    uint32_t irq_flags = spin_lock_irqsave(&paging_lock);
+
+    uint32_t* table = get_page_table(virt, 1);
+    if (table == NULL) {
+        spin_unlock_irqrestore(&paging_lock, irq_flags);
+        return -1;
+    }
+
+    uint32_t* entry = &table[PTE_INDEX(virt)];
+    if (!(*entry & PAGE_PRESENT)) {
+        stats.mapped_pages++;
+    }
+    *entry = (phys & PAGE_FRAME_MASK) | flags | PAGE_PRESENT;
+    invlpg(virt);
+
+    spin_unlock_irqrestore(&paging_lock, irq_flags);
+    return 0;
+}
+
+// 物理アドレスの範囲を同じ仮想アドレスにマップ（既にマップされているページはそのまま）
+void* paging_map_identity(uint32_t phys, size_t size, uint32_t flags) {
+    uint32_t start = phys & PAGE_FRAME_MASK;
+    uint32_t end = phys + size;
+
+    for (uint32_t page = start; page < end && page >= start; page += PAGE_SIZE) {
+        uint32_t pde = page_directory[PDE_INDEX(page)];
+        if ((pde & PAGE_PRESENT) && (pde & PAGE_LARGE)) {
+            continue; // アイデンティティマップの4MBページ内
+        }
+        uint32_t* table = get_page_table(page, 0);
+        if (table != NULL && (table[PTE_INDEX(page)] & PAGE_PRESENT)) {
+            continue;
+        }
+        if (paging_map(page, page, flags | PAGE_WRITE | global_flag) != 0) {
+            return NULL;
+        }
+    }
+    return (void*)phys;
+}
+
+// 4KBページのマップを解除（paging_lockを持って呼ぶ、他のCPUのTLBからも消す）
+static uint32_t paging_unmap_locked(uint32_t virt) {
+    uint32_t* table = get_page_table(virt, 0);
+    uint32_t phys = 0;
+    if (table != NULL && (table[PTE_INDEX(virt)] & PAGE_PRESENT)) {
+        phys = table[PTE_INDEX(virt)] & PAGE_FRAME_MASK;
+        table[PTE_INDEX(virt)] = 0;
+        stats.mapped_pages--;
+        invlpg(virt);
+        smp_tlb_shootdown(virt);
+    }
+    return phys;
+}
+
+// 4KBページのマップを解除
+uint32_t paging_unmap(uint32_t virt) {
+    uint32_t irq_flags = spin_lock_irqsave(&paging_lock);
+    uint32_t phys = paging_unmap_locked(virt);
+    spin_unlock_irqrestore(&paging_lock, irq_flags);
+    return phys;
+}
+
+// 仮想アドレスに対応する物理アドレス
+uint32_t paging_virt_to_phys(uint32_t virt) {
+    uint32_t pde = page_directory[PDE_INDEX(virt)];
+    if (!(pde & PAGE_PRESENT)) {
+        return 0;
+    }
+    if (pde & PAGE_LARGE) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+    }
+
+    uint32_t pte = ((uint32_t*)(pde & PAGE_FRAME_MASK))[PTE_INDEX(virt)];
+    if (!(pte & PAGE_PRESENT)) {
+        return 0;
+    }
+    return (pte & PAGE_FRAME_MASK) | (virt & (PAGE_SIZE - 1));
+}
+
+// アドレスを含む遅延割り当て領域を探す
+static vm_region_t* vm_region_find(uint32_t addr) {
+    for (uint32_t i = 0; i < vm_region_count; i++) {
+        if (addr >= vm_regions[i].start && addr < vm_regions[i].end) {
+            return &vm_regions[i];
+        }
+    }
+    return NULL;
+}
+
+// 初回アクセス時に物理メモリを割り当てる領域を予約
+void* vm_reserve(size_t size) {
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (size == 0 || size > VM_LAZY_END - VM_LAZY_START) {
+        return NULL;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+
+    // 領域の間の隙間を先頭から探す（領域の後ろには1ページのガードを空ける）
+    uint32_t start = VM_LAZY_START;
+    uint32_t index = 0;
+    while (index < vm_region_count && vm_regions[index].start - start < size) {
+        start = vm_regions[index].end + PAGE_SIZE;
+        index++;
+    }
+    if (vm_region_count == VM_MAX_REGIONS || start >= VM_LAZY_END || VM_LAZY_END - start < size) {
+        spin_unlock_irqrestore(&paging_lock, flags);
+        return NULL;
+    }
+
+    // 開始アドレス順を保って挿入
+    for (uint32_t i = vm_region_count; i > index; i--) {
+        vm_regions[i] = vm_regions[i - 1];
+    }
+    vm_regions[index].start = start;
+    vm_regions[index].end = start + size;
+    vm_region_count++;
+    stats.lazy_reserved += size;
+
+    spin_unlock_irqrestore(&paging_lock, flags);
+    return (void*)start;
+}
+
+// vm_reserveで予約した領域を解放
+void vm_release(void* addr) {
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+
+    uint32_t index = 0;
+    while (index < vm_region_count && vm_regions[index].start != (uint32_t)addr) {
+        index++;
+    }
+    if (index == vm_region_count) {
+        spin_unlock_irqrestore(&paging_lock, flags);
+        return;
+    }
+
+    // 触られたページだけ物理メモリを返却（ページテーブルのない4MBは飛ばす）
+    uint32_t virt = vm_regions[index].start;
+    while (virt < vm_regions[index].end) {
+        if (get_page_table(virt, 0) == NULL) {
+            virt = (virt + LARGE_PAGE_SIZE) & ~(LARGE_PAGE_SIZE - 1);
+            continue;
+        }
+        uint32_t phys = paging_unmap_locked(virt);
+        if (phys != 0) {
+            free_pages((void*)phys, 0);
+        }
+        virt += PAGE_SIZE;
+    }
+
+    stats.lazy_reserved -= vm_regions[index].end - vm_regions[index].start;
+    for (uint32_t i = index; i + 1 < vm_region_count; i++) {
+        vm_regions[i] = vm_regions[i + 1];
+    }
+    vm_region_count--;
+
+    spin_unlock_irqrestore(&paging_lock, flags);
+}
+
+// 遅延割り当て領域のページにゼロで埋めたページを割り当てる（マップできたか、既にマップ済みなら0）
+static int demand_zero(uint32_t virt) {
+    // 領域でなさそうなら確保しない（ロックなしで見るので目安、確定はロックの中で調べ直す）
+    if (vm_region_find(virt) == NULL) {
+        return -1;
+    }
+
+    // ゼロで埋めるのはロックの外で行う
+    void* frame = alloc_pages(0);
+    if (frame == NULL) {
+        return -1;
+    }
+    memset(frame, 0, PAGE_SIZE);
+
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+    if (vm_region_find(virt) == NULL) {
+        spin_unlock_irqrestore(&paging_lock, flags);
+        free_pages(frame, 0);
+        return -1;
+    }
+    uint32_t* table = get_page_table(virt, 1);
+    if (table == NULL) {
+        spin_unlock_irqrestore(&paging_lock, flags);
+        free_pages(frame, 0);
+        return -1;
+    }
+
+    // 同じページで同時にフォルトした他のCPUが先にマップしていれば、そのページを使う
+    uint32_t* entry = &table[PTE_INDEX(virt)];
+    if (*entry & PAGE_PRESENT) {
+        spin_unlock_irqrestore(&paging_lock, flags);
+        free_pages(frame, 0);
+        invlpg(virt);
+        return 0;
+    }
+    *entry = (uint32_t)frame | PAGE_WRITE | global_flag | PAGE_PRESENT;
+    stats.mapped_pages++;
+    stats.demand_zero_faults++;
+    invlpg(virt);
+    spin_unlock_irqrestore(&paging_lock, flags);
+    return 0;
+}
+
+// ページフォルトハンドラ
+void page_fault_handler(uint32_t fault_addr, uint32_t err_code) {
+    // 他のCPUのフォルトと同時に数えるので原子的に足す（他の統計はpaging_lockの中で更新する）
+    __atomic_fetch_add(&stats.page_faults, 1, __ATOMIC_RELAXED);
+
+    // 遅延割り当て領域の未マップページなら、ゼロで埋めたページを割り当てる
+    if (!(err_code & PF_PRESENT) && demand_zero(fault_addr & PAGE_FRAME_MASK) == 0) {
+        return;
+    }
+
+    // 回復できないフォルト（fault_handlerと同じく画面・COM1・ログのすべてに出す）
+    screen_panic();
+    kprintf_to(KPRINTF_ALL, "%CPage fault at 0x%08X Error Code: %u\n",
+               vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK), fault_addr, err_code);
+    serial_flush(SERIAL_COM1);
+
+    // システムを停止
+    while (1) {
+        asm volatile("cli; hlt");
+    }
+}
+
+// 統計情報を取得
+void paging_get_stats(paging_stats_t* out) {
+    *out = stats;
+}
+
+// 統計情報を表示
+void paging_stats(void) {
+    char identity[16];
+    char reserved[16];
+    uint8_t grey = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+
+    print_size(identity_limit, identity);
+    print_size(stats.lazy_reserved, reserved);
+    kprintf("%CVirtual Memory:\n", vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    kprintf("%C  Page faults: %C%u%C (demand-zero: %C%u%C)\n",
+            grey, green, stats.page_faults, grey, green, stats.demand_zero_faults, grey);
+    kprintf("%C  Identity mapped: %C%s%C%s\n", grey, green, identity, grey, global_flag ? " (global)" : "");
+    kprintf("%C  4MB pages: %C%u%C  4KB pages: %C%u%C  Page tables: %C%u\n",
+            grey, green, stats.large_pages, grey, green, stats.mapped_pages, grey, green, stats.page_tables);
+    kprintf("%C  Lazy reserved: %C%s%C in %C%u%C regions\n",
+            grey, green, reserved, grey, green, vm_region_count, grey);
+}
@@ -0,0 +1,302 @@
+// pmm.c - 物理ページフレームアロケータ（バディ方式）の実装
+#include "../include/pmm.h"
+#include "../include/interrupt.h"
+#include "../include/memory.h"
+#include "../include/multiboot.h"
+#include "../include/spinlock.h"
+
+// カーネルイメージの先頭と末尾（linker.ldで定義）
+extern uint8_t kernel_start[];
+extern uint8_t kernel_end[];
+
+// フレーム情報: 空きブロックの先頭フレームにはフラグと次数を置く
+#define FRAME_FREE_HEAD  0x80
+#define FRAME_ORDER_MASK 0x0F
+
+// 予約領域の最大数
+#define MAX_RESERVED 4
+
+// 空きブロックのリンク（空きページ自身の先頭に置く）
+typedef struct pmm_block {
+    struct pmm_block* next;
+    struct pmm_block* prev;
+} pmm_block_t;
+
+// 次数ごとの空きリスト
+typedef struct {
+    pmm_block_t* head;
+    uint32_t count;
+} free_area_t;
+
+// 予約された物理アドレス範囲 [start, end)
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} phys_range_t;
+
+// 次数ごとの空きリスト
+static free_area_t free_areas[PMM_MAX_ORDER];
+// フレームごとの情報（1フレーム1バイト）
+static uint8_t* frame_info = NULL;
+// 管理するフレーム番号の上限
+static uint32_t max_pfn = 0;
+// 管理しているページの総数
+static uint32_t total_pages = 0;
+// 空きページ数
+static uint32_t free_page_count = 0;
+// 予約領域（カーネルイメージ、ブート情報、フレーム情報）
+static phys_range_t reserved[MAX_RESERVED];
+static uint32_t reserved_count = 0;
+// フリーリストのロック
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+// 値を2の冪の境界に切り上げる
+static inline uint32_t page_align_up(uint32_t value) {
+    return (value + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+// 予約領域を追加
+static void reserve_range(uint32_t start, uint32_t end) {
+    if (reserved_count < MAX_RESERVED && start < end) {
+        reserved[reserved_count].start = start & ~(PAGE_SIZE - 1);
+        reserved[reserved_count].end = page_align_up(end);
+        reserved_count++;
+    }
+}
+
+// [start, end) が予約領域と重なる場合、重なった予約領域の末尾を返す（重ならなければ0）
+static uint32_t reserved_overlap(uint32_t start, uint32_t end) {
+    for (uint32_t i = 0; i < reserved_count; i++) {
+        if (start < reserved[i].end && reserved[i].start < end) {
+            return reserved[i].end;
+        }
+    }
+    return 0;
+}
+
+// i番目の利用可能な物理メモリ領域を取得（ページ境界に丸め、管理範囲に切り詰める）
+static int usable_region(uint32_t index, uint32_t* start, uint32_t* end) {
+    uint64_t base;
+    uint64_t limit;
+
+    if (multiboot_mmap_count() > 0) {
+        const multiboot_mmap_entry_t* entry = multiboot_mmap_entry(index);
+        if (entry == NULL) {
+            return 0;
+        }
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) {
+            *start = *end = 0;
+            return 1;
+        }
+        base = entry->addr;
+        limit = entry->addr + entry->len;
+    } else {
+        // メモリマップがない場合は基本メモリ情報（1MBから上のKB数）を使う
+        const multiboot_tag_basic_meminfo_t* meminfo =
+            (const multiboot_tag_basic_meminfo_t*)multiboot_find_tag(MULTIBOOT_TAG_TYPE_BASIC_MEMINFO);
+        if (meminfo == NULL || index > 0) {
+            return 0;
+        }
+        base = 0x100000;
+        limit = base + (uint64_t)meminfo->mem_upper * 1024;
+    }
+
+    if (base < PMM_MIN_PHYS) {
+        base = PMM_MIN_PHYS;
+    }
+    if (limit > PMM_MAX_PHYS) {
+        limit = PMM_MAX_PHYS;
+    }
+    if (base >= limit) {
+        *start = *end = 0;
+        return 1;
+    }
+
+    *start = page_align_up((uint32_t)base);
+    *end = (uint32_t)limit & ~(PAGE_SIZE - 1);
+    if (*start > *end) {
+        *end = *start;
+    }
+    return 1;
+}
+
+// 空きリストにブロックを追加
+static void free_area_push(uint32_t pfn, uint32_t order) {
+    pmm_block_t* block = (pmm_block_t*)(pfn << PAGE_SHIFT);
+    free_area_t* area = &free_areas[order];
+
+    block->prev = NULL;
+    block->next = area->head;
+    if (area->head != NULL) {
+        area->head->prev = block;
+    }
+    area->head = block;
+    area->count++;
+    frame_info[pfn] = FRAME_FREE_HEAD | order;
+}
+
+// 空きリストからブロックを取り除く
+static void free_area_remove(pmm_block_t* block, uint32_t order) {
+    free_area_t* area = &free_areas[order];
+
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        area->head = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    area->count--;
+    frame_info[(uint32_t)block >> PAGE_SHIFT] = 0;
+}
+
+// マルチブートのメモリマップから物理ページアロケータを初期化
+void pmm_init(void) {
+    uint32_t start;
+    uint32_t end;
+
+    memset(free_areas, 0, sizeof(free_areas));
+    reserved_count = 0;
+    total_pages = 0;
+    free_page_count = 0;
+    max_pfn = 0;
+
+    // 管理するフレーム番号の上限を求める
+    for (uint32_t i = 0; usable_region(i, &start, &end); i++) {
+        if (start < end && (end >> PAGE_SHIFT) > max_pfn) {
+            max_pfn = end >> PAGE_SHIFT;
+        }
+    }
+    if (max_pfn == 0) {
+        return;
+    }
+
+    // カーネルイメージとブート情報を予約
+    reserve_range((uint32_t)kernel_start, (uint32_t)kernel_end);
+    reserve_range(multiboot_info_addr(), multiboot_info_addr() + multiboot_info_size());
+
+    // フレーム情報の置き場所を予約領域を避けて探す
+    uint32_t info_bytes = page_align_up(max_pfn);
+    for (uint32_t i = 0; frame_info == NULL && usable_region(i, &start, &end); i++) {
+        uint32_t skip;
+        while (start + info_bytes <= end && (skip = reserved_overlap(start, start + info_bytes)) != 0) {
+            start = skip;
+        }
+        if (start < end && start + info_bytes <= end) {
+            frame_info = (uint8_t*)start;
+        }
+    }
+    if (frame_info == NULL) {
+        max_pfn = 0;
+        return;
+    }
+    reserve_range((uint32_t)frame_info, (uint32_t)frame_info + info_bytes);
+    memset(frame_info, 0, info_bytes);
+
+    // 予約領域を除いたフレームを、できるだけ大きな整列済みブロックとして空きリストに入れる
+    for (uint32_t i = 0; usable_region(i, &start, &end); i++) {
+        uint32_t pfn = start >> PAGE_SHIFT;
+        uint32_t end_pfn = end >> PAGE_SHIFT;
+
+        while (pfn < end_pfn) {
+            uint32_t skip = reserved_overlap(pfn << PAGE_SHIFT, (pfn + 1) << PAGE_SHIFT);
+            if (skip != 0) {
+                pfn = skip >> PAGE_SHIFT;
+                continue;
+            }
+
+            uint32_t order = 0;
+            while (order + 1 < PMM_MAX_ORDER) {
+                uint32_t pages = 1u << (order + 1);
+                if ((pfn & (pages - 1)) != 0 || pfn + pages > end_pfn ||
+                    reserved_overlap(pfn << PAGE_SHIFT, (pfn + pages) << PAGE_SHIFT) != 0) {
+                    break;
+                }
+                order++;
+            }
+
+            free_area_push(pfn, order);
+            total_pages += 1u << order;
+            free_page_count += 1u << order;
+            pfn += 1u << order;
+        }
+    }
+}
+
+// 2^order ページの連続した物理ページを割り当てる
+void* alloc_pages(uint32_t order) {
+    if (order >= PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+
+    // 空きのある最小の次数を探す
+    uint32_t current = order;
+    while (current < PMM_MAX_ORDER && free_areas[current].head == NULL) {
+        current++;
+    }
+    if (current == PMM_MAX_ORDER) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return NULL;
+    }
+
+    pmm_block_t* block = free_areas[current].head;
+    free_area_remove(block, current);
+
+    // 大きなブロックを半分ずつに分割し、後半を空きリストに戻す
+    uint32_t pfn = (uint32_t)block >> PAGE_SHIFT;
+    while (current > order) {
+        current--;
+        free_area_push(pfn + (1u << current), current);
+    }
+
+    free_page_count -= 1u << order;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return block;
+}
+
+// alloc_pagesで割り当てたページを解放（バディが空いていれば結合する）
+void free_pages(void* addr, uint32_t order) {
+    uint32_t pfn = (uint32_t)addr >> PAGE_SHIFT;
+    if (addr == NULL || order >= PMM_MAX_ORDER || pfn + (1u << order) > max_pfn) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+
+    free_page_count += 1u << order;
+    while (order + 1 < PMM_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (buddy >= max_pfn || frame_info[buddy] != (FRAME_FREE_HEAD | order)) {
+            break;
+        }
+        free_area_remove((pmm_block_t*)(buddy << PAGE_SHIFT), order);
+        pfn &= ~(1u << order);
+        order++;
+    }
+    free_area_push(pfn, order);
+
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// 指定した次数の空きブロック数
+uint32_t pmm_free_blocks(uint32_t order) {
+    return order < PMM_MAX_ORDER ? free_areas[order].count : 0;
+}
+
+// 空きページ数
+uint32_t pmm_free_page_count(void) {
+    return free_page_count;
+}
+
+// 管理しているページの総数
+uint32_t pmm_total_pages(void) {
+    return total_pages;
+}
+
+// 管理している物理アドレスの上限
+uint32_t pmm_max_phys(void) {
+    return max_pfn << PAGE_SHIFT;
+}
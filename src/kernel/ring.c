@@ -0,0 +1,160 @@
+// ring.c - ロックなしのリングバッファの実装
+// 生産者はデータを書いてからheadをreleaseで進め、消費者はheadをacquireで読んでからデータを読む。
+// 消費者は読み終えてからtailをreleaseで進め、生産者はtailをacquireで読んで空きを求める。
+// MPSCの生産者はreserveをCASで進めて場所を取り、書き終えたら予約の順にheadを進める。
+#include "../include/ring.h"
+#include "../include/interrupt.h"
+#include "../include/string.h"
+
+// リングを初期化
+void ring_init(ring_t* ring, void* buffer, uint32_t size) {
+    ring->head = 0;
+    ring->reserve = 0;
+    ring->tail_cache = 0;
+    ring->tail = 0;
+    ring->head_cache = 0;
+    ring->buffer = (uint8_t*)buffer;
+    ring->mask = size - 1;
+}
+
+// 溜まっているバイト数
+uint32_t ring_count(const ring_t* ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+// 空きのバイト数
+uint32_t ring_space(const ring_t* ring) {
+    return ring->mask + 1 - ring_count(ring);
+}
+
+// positionからcountバイトを書く（端で折り返す）
+static void ring_copy_in(ring_t* ring, uint32_t position, const uint8_t* data, uint32_t count) {
+    uint32_t offset = position & ring->mask;
+    uint32_t first = ring->mask + 1 - offset;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(ring->buffer + offset, data, first);
+    memcpy(ring->buffer, data + first, count - first);
+}
+
+// positionからcountバイトを読む（端で折り返す）
+static void ring_copy_out(const ring_t* ring, uint32_t position, uint8_t* out, uint32_t count) {
+    uint32_t offset = position & ring->mask;
+    uint32_t first = ring->mask + 1 - offset;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(out, ring->buffer + offset, first);
+    memcpy(out + first, ring->buffer, count - first);
+}
+
+// 1バイト積む（SPSC）
+int ring_push(ring_t* ring, uint8_t value) {
+    uint32_t head = ring->head;
+    if (head - ring->tail_cache > ring->mask) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->tail_cache > ring->mask) {
+            return -1;
+        }
+    }
+    ring->buffer[head & ring->mask] = value;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 最大countバイト積む（SPSC）
+uint32_t ring_push_n(ring_t* ring, const void* data, uint32_t count) {
+    uint32_t head = ring->head;
+    uint32_t space = ring->mask + 1 - (head - ring->tail_cache);
+    if (space < count) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        space = ring->mask + 1 - (head - ring->tail_cache);
+        if (space < count) {
+            count = space;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    ring_copy_in(ring, head, (const uint8_t*)data, count);
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+// 最大countバイトをまとめて積む（MPSC、allなら全部入るときだけ積み、入らなければ何も積まない）
+static uint32_t ring_mpsc_publish(ring_t* ring, const void* data, uint32_t count, int all) {
+    // 予約から公開までに同じCPUの割り込みが割り込むと、先の生産者を待ち続けるので禁止する
+    uint32_t flags = irq_save();
+
+    uint32_t start = __atomic_load_n(&ring->reserve, __ATOMIC_RELAXED);
+    uint32_t take;
+    do {
+        uint32_t space = ring->mask + 1 - (start - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+        take = count < space ? count : space;
+        if (take == 0 || (all && take < count)) {
+            irq_restore(flags);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->reserve, &start, start + take, 0,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    ring_copy_in(ring, start, (const uint8_t*)data, take);
+
+    // 先に予約した生産者が公開し終えるのを待ってから、予約の順にheadを進める
+    while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != start) {
+        asm volatile("pause");
+    }
+    __atomic_store_n(&ring->head, start + take, __ATOMIC_RELEASE);
+
+    irq_restore(flags);
+    return take;
+}
+
+// 最大countバイトをまとめて積む（MPSC）
+uint32_t ring_mpsc_push_n(ring_t* ring, const void* data, uint32_t count) {
+    return ring_mpsc_publish(ring, data, count, 0);
+}
+
+// countバイトを全部まとめて積む（MPSC）
+int ring_mpsc_push_all(ring_t* ring, const void* data, uint32_t count) {
+    return ring_mpsc_publish(ring, data, count, 1) == count ? 0 : -1;
+}
+
+// 1バイト積む（MPSC）
+int ring_mpsc_push(ring_t* ring, uint8_t value) {
+    return ring_mpsc_push_n(ring, &value, 1) == 1 ? 0 : -1;
+}
+
+// 1バイト取り出す
+int ring_pop(ring_t* ring, uint8_t* value) {
+    uint32_t tail = ring->tail;
+    if (tail == ring->head_cache) {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == ring->head_cache) {
+            return -1;
+        }
+    }
+    *value = ring->buffer[tail & ring->mask];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 最大countバイト取り出す
+uint32_t ring_pop_n(ring_t* ring, void* out, uint32_t count) {
+    uint32_t tail = ring->tail;
+    uint32_t available = ring->head_cache - tail;
+    if (available < count) {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        available = ring->head_cache - tail;
+        if (available < count) {
+            count = available;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    ring_copy_out(ring, tail, (uint8_t*)out, count);
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
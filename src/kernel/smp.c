@@ -0,0 +1,251 @@
+// smp.c - アプリケーションプロセッサ（AP）の起動とCPU間割り込み
+// MADTに載っているAPを1つずつINIT-SIPI-SIPIで起動し、オンラインになるのを待ってから次に進む。
+// APは1MB未満にコピーした起動コードからページングを有効にしてsmp_ap_entryに入り、
+// CPUごとのGDT/TSS、IDT、ローカルAPIC、FPUを設定してアイドルスレッドになる。
+#include "../include/smp.h"
+#include "../include/acpi.h"
+#include "../include/apic.h"
+#include "../include/clock.h"
+#include "../include/cpu.h"
+#include "../include/fpu.h"
+#include "../include/gdt.h"
+#include "../include/interrupt.h"
+#include "../include/io.h"
+#include "../include/memory.h"
+#include "../include/multiboot.h"
+#include "../include/spinlock.h"
+#include "../include/string.h"
+#include "../include/thread.h"
+
+// APのスタックの大きさ（そのままAPのアイドルスレッドのスタックになる）
+#define SMP_AP_STACK_SIZE 16384
+
+// INIT後とSIPI後の待ち時間（マイクロ秒）と、APがオンラインになるのを待つ上限
+#define SMP_INIT_DELAY_US    10000
+#define SMP_SIPI_DELAY_US    200
+#define SMP_ONLINE_TIMEOUT_US 100000
+
+// 起動コードのパラメータ（smp_trampoline.asmと同じ並び）
+typedef struct {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;     // スタックの上端
+    uint32_t entry;     // Cの入口
+    uint32_t cpu;       // CPUの番号
+} __attribute__((packed)) smp_trampoline_params_t;
+
+// 起動コード（smp_trampoline.asm）
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_params[];
+
+// オンラインのCPUのビットマスク（BSPは最初からオンライン）
+static volatile uint32_t online_mask = 1;
+// オンラインのCPUの数
+static uint32_t cpu_total = 1;
+// CPUごとのローカルAPIC ID
+static uint32_t cpu_apic_ids[MAX_CPUS];
+// APごとのスタックの上端
+static uint32_t ap_stack_tops[MAX_CPUS];
+// TLBの無効化要求（一度に1つ、tlb_lockを持つCPUが出す）
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static volatile uint32_t tlb_pending = 0; // まだ無効化していないCPUのビット
+static volatile uint32_t tlb_address = 0; // 無効化するアドレス
+
+// smp_stop_othersを呼んだCPUがあれば1
+static volatile uint32_t stopping = 0;
+
+// マイクロ秒単位で待つ（クロックソースがなければポート0x80への書き込み1回を約1マイクロ秒とする）
+static void smp_udelay(uint32_t us) {
+    if (clock_available()) {
+        uint64_t end = clock_ns() + (uint64_t)us * 1000;
+        while (clock_ns() < end) {
+            asm volatile("pause");
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < us; i++) {
+        outb(0x80, 0);
+    }
+}
+
+// スケジューラを呼ばせるIPI（切り替えは割り込みの出口のthread_preemptで行う）
+static void smp_reschedule_ipi(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    lapic_eoi();
+}
+
+// TLBの無効化を求めるIPI
+static void smp_tlb_ipi(registers_t* regs, void* ctx) {
+    (void)regs;
+    (void)ctx;
+    smp_tlb_poll();
+    lapic_eoi();
+}
+
+// APのCの入口（起動コードからBSPと同じページテーブルで呼ばれる、戻らない）
+static void smp_ap_entry(uint32_t cpu) {
+    gdt_init(cpu, ap_stack_tops[cpu]);
+    cpu_init_ap();
+    interrupt_init_ap();
+    apic_init_ap();
+    fpu_init_ap();
+
+    // アイドルスレッドができてからオンラインにする（それまではスレッドが置かれない）
+    if (thread_init_ap() == 0) {
+        __atomic_or_fetch(&online_mask, 1u << cpu, __ATOMIC_RELEASE);
+    }
+    thread_idle_loop();
+}
+
+// APを1つ起動してオンラインになるのを待つ（失敗すれば-1）
+static int smp_boot_ap(uint32_t cpu, uint32_t apic_id) {
+    uint8_t* stack = (uint8_t*)kmalloc_aligned(SMP_AP_STACK_SIZE, 16);
+    if (stack == NULL) {
+        return -1;
+    }
+    ap_stack_tops[cpu] = (uint32_t)stack + SMP_AP_STACK_SIZE;
+    cpu_apic_ids[cpu] = apic_id;
+
+    smp_trampoline_params_t* params = (smp_trampoline_params_t*)
+        (SMP_TRAMPOLINE_ADDR + (smp_trampoline_params - smp_trampoline_start));
+    params->cr0 = read_cr0() & ~CR0_TS;
+    params->cr3 = read_cr3();
+    params->cr4 = read_cr4();
+    params->stack = ap_stack_tops[cpu];
+    params->entry = (uint32_t)smp_ap_entry;
+    params->cpu = cpu;
+
+    // INIT（アサートしてからデアサート）、10ms待ってSIPIを最大2回
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_TRIGGER_LEVEL);
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_TRIGGER_LEVEL);
+    smp_udelay(SMP_INIT_DELAY_US);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        smp_udelay(SMP_SIPI_DELAY_US);
+        if (online_mask & (1u << cpu)) {
+            return 0;
+        }
+    }
+
+    for (uint32_t waited = 0; waited < SMP_ONLINE_TIMEOUT_US; waited += 100) {
+        if (online_mask & (1u << cpu)) {
+            return 0;
+        }
+        smp_udelay(100);
+    }
+
+    // 起動しなかったAPのスタックは、遅れて動き出しても壊れないよう返さない
+    return -1;
+}
+
+// MADTに載っているAPを起動する
+void smp_init(void) {
+    cpu_apic_ids[0] = lapic_id();
+
+    register_interrupt_handler(IPI_RESCHEDULE_VECTOR, smp_reschedule_ipi, NULL);
+    register_interrupt_handler(IPI_TLB_VECTOR, smp_tlb_ipi, NULL);
+
+    const acpi_madt_info_t* madt = acpi_madt();
+    if (!apic_enabled() || madt == NULL || thread_current() == NULL) {
+        return;
+    }
+
+    // 起動コードの置き場所がマルチブート情報と重なっていれば起動しない
+    uint32_t size = smp_trampoline_end - smp_trampoline_start;
+    uint32_t info = multiboot_info_addr();
+    if (info < SMP_TRAMPOLINE_ADDR + size && info + multiboot_info_size() > SMP_TRAMPOLINE_ADDR) {
+        return;
+    }
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, smp_trampoline_start, size);
+
+    for (uint32_t i = 0; i < madt->cpu_count && cpu_total < MAX_CPUS; i++) {
+        uint32_t apic_id = madt->cpu_apic_ids[i];
+        if (apic_id == cpu_apic_ids[0]) {
+            continue;
+        }
+        if (smp_boot_ap(cpu_total, apic_id) == 0) {
+            cpu_total++;
+        }
+    }
+}
+
+// オンラインのCPUの数
+uint32_t smp_cpu_count(void) {
+    return cpu_total;
+}
+
+// オンラインのCPUのビットマスク
+uint32_t smp_online_mask(void) {
+    return online_mask;
+}
+
+// CPUのローカルAPIC ID
+uint32_t smp_apic_id(uint32_t cpu) {
+    return cpu_apic_ids[cpu];
+}
+
+// 他のCPUにスケジューラを呼ばせる
+void smp_send_reschedule(uint32_t cpu) {
+    if (cpu != cpu_current() && (online_mask & (1u << cpu))) {
+        lapic_send_ipi(cpu_apic_ids[cpu], LAPIC_ICR_FIXED | IPI_RESCHEDULE_VECTOR);
+    }
+}
+
+// 他のオンラインのCPUのTLBからvirtのエントリを消す
+void smp_tlb_shootdown(uint32_t virt) {
+    uint32_t others = online_mask & ~(1u << cpu_current());
+    if (others == 0) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&tlb_lock);
+    tlb_address = virt;
+    __atomic_store_n(&tlb_pending, others, __ATOMIC_RELEASE);
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (others & (1u << cpu)) {
+            lapic_send_ipi(cpu_apic_ids[cpu], LAPIC_ICR_FIXED | IPI_TLB_VECTOR);
+        }
+    }
+
+    // 割り込み禁止で待っているCPUもスピンロックやスケジューラの中で応える
+    while (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) != 0) {
+        asm volatile("pause");
+    }
+    spin_unlock_irqrestore(&tlb_lock, flags);
+}
+
+// このCPUへのTLBの無効化要求があれば処理する
+void smp_tlb_poll(void) {
+    uint32_t bit = 1u << cpu_current();
+    if (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) & bit) {
+        invlpg(tlb_address);
+        __atomic_and_fetch(&tlb_pending, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+// 他のオンラインのCPUをNMIで止める
+void smp_stop_others(void) {
+    // 2つのCPUが同時に落ちたときは、先に止め始めた方だけが画面とCOM1を使う
+    if (__atomic_exchange_n(&stopping, 1, __ATOMIC_ACQ_REL) != 0) {
+        while (1) {
+            asm volatile("cli; hlt");
+        }
+    }
+
+    // NMIは割り込み禁止でスピンロックを待っているCPUにも届く
+    uint32_t others = online_mask & ~(1u << cpu_current());
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (others & (1u << cpu)) {
+            lapic_send_ipi(cpu_apic_ids[cpu], LAPIC_ICR_NMI);
+        }
+    }
+}
+
+// smp_stop_othersで止められている途中か
+int smp_stopping(void) {
+    return __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+}
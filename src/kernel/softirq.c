@@ -0,0 +1,165 @@
+// softirq.c - 割り込みの後半処理（タスクレット）の実装
+#include "../include/softirq.h"
+#include "../include/cpu.h"
+#include "../include/interrupt.h"
+#include "../include/memory.h"
+#include "../include/stddef.h"
+#include "../include/thread.h"
+#include "../include/trace.h"
+
+// CPUごとの後半処理の状態（キャッシュラインを共有しないよう揃える）
+typedef struct {
+    tasklet_t* volatile head; // 予約キュー（LIFO、CASで積む）
+    tasklet_t* local;         // 取り出し済みで未実行のタスクレット（予約順）
+    uint32_t bh_count;        // local_bh_disableのネスト数
+    uint32_t running;         // 実行中なら1（入れ子で実行しない）
+    uint32_t processed;       // 実行したタスクレットの数
+    uint32_t exhausted;       // 予算を使い切った回数
+} __attribute__((aligned(CACHE_LINE_SIZE))) softirq_cpu_t;
+
+// CPUごとの状態
+static softirq_cpu_t softirq_cpus[MAX_CPUS];
+
+// 現在のCPUの状態
+static inline softirq_cpu_t* this_cpu(void) {
+    return &softirq_cpus[cpu_current()];
+}
+
+// タスクレットを初期化
+void tasklet_init(tasklet_t* tasklet, void (*fn)(void* data), void* data) {
+    tasklet->next = NULL;
+    tasklet->fn = fn;
+    tasklet->data = data;
+    tasklet->scheduled = 0;
+}
+
+// タスクレットを現在のCPUのキューに予約
+void tasklet_schedule(tasklet_t* tasklet) {
+    // 既に予約済みなら何もしない（実行前にもう一度積まない）
+    if (__atomic_exchange_n(&tasklet->scheduled, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    // 先頭にCASで積む（他のCPUや割り込みと競合しても再試行するだけ）
+    softirq_cpu_t* cpu = this_cpu();
+    tasklet_t* head = cpu->head;
+    do {
+        tasklet->next = head;
+    } while (!__atomic_compare_exchange_n(&cpu->head, &head, tasklet, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// 予約キューをまとめて取り出し、予約順に並べ替えてlocalに置く（localが空のときだけ呼ぶ）
+static void softirq_collect(softirq_cpu_t* cpu) {
+    tasklet_t* list = __atomic_exchange_n(&cpu->head, NULL, __ATOMIC_ACQUIRE);
+    tasklet_t* reversed = NULL;
+
+    while (list != NULL) {
+        tasklet_t* next = list->next;
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+    cpu->local = reversed;
+}
+
+// 予約されたタスクレットを最大budget個実行
+uint32_t softirq_run(uint32_t budget) {
+    softirq_cpu_t* cpu = this_cpu();
+    uint32_t done = 0;
+
+    // 実行中に割り込みの出口から再び呼ばれても入れ子にしない
+    uint32_t flags = irq_save();
+    if (cpu->running) {
+        irq_restore(flags);
+        return 0;
+    }
+    cpu->running = 1;
+    // スレッドから呼ばれたときに途中で切り替えられると、runningが立ったままこのCPUの後半処理が止まる
+    preempt_disable();
+    irq_restore(flags);
+
+    while (done < budget) {
+        if (cpu->local == NULL) {
+            softirq_collect(cpu);
+            if (cpu->local == NULL) {
+                break;
+            }
+        }
+
+        // localはrunningを立てたCPU自身しか触らない
+        tasklet_t* tasklet = cpu->local;
+        cpu->local = tasklet->next;
+
+        // 実行前に予約を解除し、関数の中から自分を再予約できるようにする
+        tasklet->next = NULL;
+        __atomic_store_n(&tasklet->scheduled, 0, __ATOMIC_RELEASE);
+        TRACE_EVENT(TRACE_TASKLET_ENTRY, tasklet->fn);
+        tasklet->fn(tasklet->data);
+        TRACE_EVENT(TRACE_TASKLET_EXIT, tasklet->fn);
+        done++;
+    }
+
+    cpu->processed += done;
+    if (done == budget && softirq_pending()) {
+        cpu->exhausted++;
+    }
+    cpu->running = 0;
+    preempt_enable();
+    return done;
+}
+
+// 現在のCPUに予約されたタスクレットがあるか
+int softirq_pending(void) {
+    softirq_cpu_t* cpu = this_cpu();
+    return cpu->local != NULL || cpu->head != NULL;
+}
+
+// 後半処理を禁止
+void local_bh_disable(void) {
+    this_cpu()->bh_count++;
+}
+
+// 後半処理を許可（溜まっていれば実行）
+void local_bh_enable(void) {
+    softirq_cpu_t* cpu = this_cpu();
+    if (--cpu->bh_count == 0 && softirq_pending()) {
+        softirq_run(SOFTIRQ_BUDGET);
+    }
+}
+
+// 禁止のネスト数を入れ替える（スケジューラが割り込み禁止で呼ぶ）
+uint32_t local_bh_switch(uint32_t count) {
+    softirq_cpu_t* cpu = this_cpu();
+    uint32_t previous = cpu->bh_count;
+    cpu->bh_count = count;
+    return previous;
+}
+
+// IRQの出口で呼ばれる（割り込みゲートの中なのでIFは0）
+void softirq_irq_exit(void) {
+    softirq_cpu_t* cpu = this_cpu();
+    if (cpu->bh_count != 0 || cpu->running || !softirq_pending()) {
+        return;
+    }
+
+    // 割り込みを許可して実行し、割り込みを止めて出口に戻る
+    asm volatile("sti" : : : "memory");
+    softirq_run(SOFTIRQ_BUDGET);
+    asm volatile("cli" : : : "memory");
+}
+
+// アイドルループから呼ぶ（アイドル中は何も触っていないので禁止中でも実行してよい）
+void softirq_idle(void) {
+    softirq_run(SOFTIRQ_BUDGET);
+}
+
+// 実行したタスクレットの数
+uint32_t softirq_processed(void) {
+    return this_cpu()->processed;
+}
+
+// 予算を使い切った回数
+uint32_t softirq_exhausted(void) {
+    return this_cpu()->exhausted;
+}
@@ -0,0 +1,349 @@
+// task.c - ワークスティーリングのタスクプールの実装
+// CPUごとにChase-Levのデックとワーカースレッドを持つ。積んだCPUは末尾（bottom）から
+// LIFOで取り出し、他のCPUは先頭（top）からCASで盗むので、グローバルなロックはない。
+// 同じCPUの複数のスレッドが所有者側を触るのはpreempt_disableの区間に限って直列にする。
+// 仕事のないワーカーはスレッドを止め、CPUはアイドルスレッドのHLTで休む。
+#include "../include/task.h"
+#include "../include/cpu.h"
+#include "../include/kprintf.h"
+#include "../include/memory.h"
+#include "../include/screen.h"
+#include "../include/smp.h"
+#include "../include/thread.h"
+
+// デックの添字のマスク
+#define TASK_DEQUE_MASK (TASK_DEQUE_SIZE - 1)
+
+// CPUごとのデックと統計（キャッシュラインを共有しないよう揃える）
+typedef struct {
+    volatile int32_t top;                   // 盗む側が取る位置
+    volatile int32_t bottom;                // 所有者が積む/取る位置
+    task_t* volatile slots[TASK_DEQUE_SIZE]; // 環状の配列
+    thread_t* worker;                       // このCPUのワーカースレッド
+    uint32_t seed;                          // 盗む相手を選ぶ乱数の状態
+    uint32_t spawned;                       // 積んだタスクの数
+    uint32_t executed;                      // 実行したタスクの数
+    uint32_t stolen;                        // 他のCPUから盗んだ数
+    uint32_t steal_failed;                  // 盗もうとして見つからなかった回数
+    uint32_t parks;                         // ワーカーが休んだ回数
+    uint32_t overflows;                     // デックが一杯でその場で実行した数
+} __attribute__((aligned(CACHE_LINE_SIZE))) task_cpu_t;
+
+// parallel_forの区間
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint32_t grain;
+    parallel_fn_t fn;
+    void* arg;
+} parallel_range_t;
+
+// CPUごとの状態
+static task_cpu_t task_cpus[MAX_CPUS];
+// 休んでいるワーカーのCPUのビット
+static volatile uint32_t parked_mask = 0;
+// タスクを実行するワーカーの数（0なら全部）
+static volatile uint32_t worker_limit = 0;
+
+// xorshift32
+static uint32_t task_random(task_cpu_t* tc) {
+    uint32_t x = tc->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tc->seed = x;
+    return x;
+}
+
+// タスクを実行するCPUのビットマスク
+static uint32_t task_active_mask(void) {
+    uint32_t online = smp_online_mask();
+    uint32_t limit = worker_limit;
+    if (limit != 0 && limit < MAX_CPUS) {
+        online &= (1u << limit) - 1;
+    }
+    return online;
+}
+
+// 末尾に積む（所有者だけが呼ぶ、一杯なら-1）
+static int deque_push(task_cpu_t* tc, task_t* task) {
+    int32_t bottom = tc->bottom;
+    int32_t top = __atomic_load_n(&tc->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= TASK_DEQUE_SIZE) {
+        return -1;
+    }
+    tc->slots[bottom & TASK_DEQUE_MASK] = task;
+    __atomic_store_n(&tc->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 末尾から取り出す（所有者だけが呼ぶ、最後の1つは盗む側とCASで取り合う）
+static task_t* deque_pop(task_cpu_t* tc) {
+    int32_t bottom = tc->bottom - 1;
+    tc->bottom = bottom;
+    // bottomの書き込みをtopの読み込みより先に見せる（x86でもストアとロードの順は入れ替わる）
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t top = tc->top;
+
+    if (top > bottom) {
+        tc->bottom = bottom + 1;
+        return NULL;
+    }
+    task_t* task = tc->slots[bottom & TASK_DEQUE_MASK];
+    if (top == bottom) {
+        if (!__atomic_compare_exchange_n(&tc->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        tc->bottom = bottom + 1;
+    }
+    return task;
+}
+
+// 先頭から盗む（どのCPUからも呼べる、空か取り合いに負ければNULL）
+static task_t* deque_steal(task_cpu_t* tc) {
+    int32_t top = __atomic_load_n(&tc->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t bottom = __atomic_load_n(&tc->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return NULL;
+    }
+    task_t* task = tc->slots[top & TASK_DEQUE_MASK];
+    if (!__atomic_compare_exchange_n(&tc->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return task;
+}
+
+// 乱数で選んだCPUから順に、他のCPUのデックを1周して盗む
+static task_t* task_steal(uint32_t cpu, task_cpu_t* tc) {
+    uint32_t online = smp_online_mask();
+    uint32_t start = task_random(tc) % MAX_CPUS;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        uint32_t victim = (start + i) % MAX_CPUS;
+        if (victim == cpu || !(online & (1u << victim))) {
+            continue;
+        }
+        task_t* task = deque_steal(&task_cpus[victim]);
+        if (task != NULL) {
+            tc->stolen++;
+            return task;
+        }
+    }
+    tc->steal_failed++;
+    return NULL;
+}
+
+// 実行するタスクを探す（自分のデック、なければ他のCPUから）
+static task_t* task_find(void) {
+    preempt_disable();
+    uint32_t cpu = cpu_current();
+    task_cpu_t* tc = &task_cpus[cpu];
+    task_t* task = deque_pop(tc);
+    if (task == NULL) {
+        task = task_steal(cpu, tc);
+    }
+    if (task != NULL) {
+        tc->executed++;
+    }
+    preempt_enable();
+    return task;
+}
+
+// タスクを実行する（doneを立てた後は待っている側が片付けるので触らない）
+static void task_run(task_t* task) {
+    task->fn(task->arg);
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+}
+
+// 実行するCPUのデックにタスクが残っているか
+static int task_available(void) {
+    uint32_t online = smp_online_mask();
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if ((online & (1u << cpu)) && task_cpus[cpu].top < task_cpus[cpu].bottom) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 休んでいるワーカーを1つ起こす（なるべく他のCPUのもの）
+static void task_wake_worker(void) {
+    // 積んだタスクを見せてから休んでいるワーカーのビットを読む
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t parked = parked_mask & task_active_mask();
+    if (parked == 0) {
+        return;
+    }
+    uint32_t others = parked & ~(1u << cpu_current());
+    uint32_t cpu = __builtin_ctz(others != 0 ? others : parked);
+    uint32_t bit = 1u << cpu;
+    if ((__atomic_fetch_and(&parked_mask, ~bit, __ATOMIC_SEQ_CST) & bit) && task_cpus[cpu].worker != NULL) {
+        thread_wake(task_cpus[cpu].worker);
+    }
+}
+
+// ワーカースレッド（タスクがなければ止まり、task_spawnかtask_set_workersで起こされる）
+static void task_worker(void* arg) {
+    uint32_t cpu = (uint32_t)arg;
+    uint32_t bit = 1u << cpu;
+    task_cpu_t* tc = &task_cpus[cpu];
+
+    while (1) {
+        if (task_active_mask() & bit) {
+            task_t* task = task_find();
+            if (task != NULL) {
+                task_run(task);
+                continue;
+            }
+        }
+
+        // 止まる状態にしてからビットを立て、その間に積まれたタスクを取りこぼさないよう確かめ直す
+        thread_prepare_block();
+        __atomic_or_fetch(&parked_mask, bit, __ATOMIC_SEQ_CST);
+        if ((task_active_mask() & bit) && task_available()) {
+            __atomic_and_fetch(&parked_mask, ~bit, __ATOMIC_SEQ_CST);
+            thread_finish_block();
+            continue;
+        }
+        tc->parks++;
+        thread_block();
+        __atomic_and_fetch(&parked_mask, ~bit, __ATOMIC_SEQ_CST);
+    }
+}
+
+// オンラインのCPUごとにワーカースレッドを作る
+void task_init(void) {
+    uint32_t online = smp_online_mask();
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        task_cpus[cpu].seed = 0x9E3779B9u * (cpu + 1);
+        if (!(online & (1u << cpu))) {
+            continue;
+        }
+
+        char name[THREAD_NAME_LEN];
+        ksnprintf(name, sizeof(name), "task/%u", cpu);
+        task_cpus[cpu].worker = thread_create_on(cpu, name, task_worker, (void*)cpu, THREAD_PRIORITY_DEFAULT);
+    }
+}
+
+// タスクを現在のCPUのデックに積む
+void task_spawn(task_t* task, void (*fn)(void* arg), void* arg) {
+    task->fn = fn;
+    task->arg = arg;
+    task->done = 0;
+
+    preempt_disable();
+    task_cpu_t* tc = &task_cpus[cpu_current()];
+    int pushed = deque_push(tc, task) == 0;
+    if (pushed) {
+        tc->spawned++;
+    } else {
+        tc->overflows++;
+    }
+    preempt_enable();
+
+    if (!pushed) {
+        task_run(task);
+        return;
+    }
+    task_wake_worker();
+}
+
+// タスクの終了を待つ
+void task_wait(task_t* task) {
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        task_t* other = task_find();
+        if (other != NULL) {
+            task_run(other);
+        } else {
+            // 他のCPUが実行中（同じCPUのワーカーが持っていればCPUを譲る）
+            asm volatile("pause");
+            thread_yield();
+        }
+    }
+}
+
+// parallel_forの後半の区間を実行するタスク
+static void parallel_for_task(void* arg);
+
+// 区間を半分に分け、後半をタスクに積んで前半を自分で処理する
+static void parallel_for_split(const parallel_range_t* range) {
+    if (range->end - range->start <= range->grain) {
+        range->fn(range->start, range->end, range->arg);
+        return;
+    }
+
+    uint32_t middle = range->start + (range->end - range->start) / 2;
+    parallel_range_t upper = *range;
+    parallel_range_t lower = *range;
+    upper.start = middle;
+    lower.end = middle;
+
+    task_t task;
+    task_spawn(&task, parallel_for_task, &upper);
+    parallel_for_split(&lower);
+    task_wait(&task);
+}
+
+static void parallel_for_task(void* arg) {
+    parallel_for_split((const parallel_range_t*)arg);
+}
+
+// [start, end) を並列に処理する
+void parallel_for(uint32_t start, uint32_t end, uint32_t grain, parallel_fn_t fn, void* arg) {
+    if (start >= end) {
+        return;
+    }
+    parallel_range_t range;
+    range.start = start;
+    range.end = end;
+    range.grain = grain != 0 ? grain : 1;
+    range.fn = fn;
+    range.arg = arg;
+    parallel_for_split(&range);
+}
+
+// タスクを実行するワーカーの数を制限する
+void task_set_workers(uint32_t count) {
+    worker_limit = count < MAX_CPUS ? count : 0;
+
+    // 新しく加わったCPUで休んでいるワーカーを起こす
+    uint32_t wake = __atomic_fetch_and(&parked_mask, ~task_active_mask(), __ATOMIC_SEQ_CST) & task_active_mask();
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if ((wake & (1u << cpu)) && task_cpus[cpu].worker != NULL) {
+            thread_wake(task_cpus[cpu].worker);
+        }
+    }
+}
+
+// タスクを実行しているワーカーの数
+uint32_t task_workers(void) {
+    // __builtin_popcountはlibgccを呼ぶので、立っているビットを1つずつ落として数える
+    uint32_t mask = task_active_mask();
+    uint32_t count = 0;
+    while (mask != 0) {
+        mask &= mask - 1;
+        count++;
+    }
+    return count;
+}
+
+// CPUごとの実行/スティールの回数を表示
+void task_show(void) {
+    uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    uint32_t online = smp_online_mask();
+
+    kprintf("%CTask pool (%u of %u workers active):\n"
+            "%C  cpu  spawned executed   stolen   failed    parks overflow\n",
+            vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), task_workers(), smp_cpu_count(),
+            vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!(online & (1u << cpu))) {
+            continue;
+        }
+        task_cpu_t* tc = &task_cpus[cpu];
+        kprintf("%C%5u%9u%9u%9u%9u%9u%9u\n", green, cpu, tc->spawned, tc->executed,
+                tc->stolen, tc->steal_failed, tc->parks, tc->overflows);
+    }
+}
@@ -0,0 +1,668 @@
+// thread.c - カーネルスレッドとO(1)スケジューラの実装
+// 優先度ごとのFIFOキューと、空でないキューを示すビットマップで次のスレッドをO(1)で選ぶ。
+// 切り替えはthread_switch_context（thread_asm.asm）がcallee-savedレジスタだけを保存して行い、
+// FPU/SSEの状態はfpu_switchで#NMまで遅延させる。
+// 同じ優先度に待っているスレッドがあるときだけタイムスライスのタイマーを張る。
+// ランキューはCPUごとにあり、スレッドは作られたCPUから移らない。ランキューのロックは
+// schedule()の呼び出し元で取り、切り替え先がschedule_tail()で放す。
+#include "../include/thread.h"
+#include "../include/clock.h"
+#include "../include/cpu.h"
+#include "../include/fpu.h"
+#include "../include/interrupt.h"
+#include "../include/kprintf.h"
+#include "../include/memory.h"
+#include "../include/screen.h"
+#include "../include/smp.h"
+#include "../include/softirq.h"
+#include "../include/spinlock.h"
+#include "../include/stddef.h"
+#include "../include/timer.h"
+#include "../include/trace.h"
+
+// スレッド
+struct thread {
+    uint32_t esp;                  // 切り替えたときのスタックポインタ
+    uint32_t id;                   // スレッド番号
+    char name[THREAD_NAME_LEN];    // 名前
+    uint32_t priority;             // 優先度（0が最も高い）
+    volatile thread_state_t state; // 状態
+    struct thread* run_next;       // ランキューのリンク
+    struct thread* all_next;       // 全スレッドのリストのリンク
+    void (*fn)(void* arg);         // 実行する関数
+    void* arg;                     // 関数に渡す値
+    void* stack;                   // スタック（mainスレッドは起動時のスタックなのでNULL）
+    struct thread* joiner;         // thread_joinで終了を待っているスレッド
+    timer_list_t sleep_timer;      // thread_sleepのタイマー
+    uint32_t bh_count;             // 切り替えた時点の後半処理の禁止数
+    uint64_t runtime_ns;           // 実行したCPU時間
+    uint32_t switches;             // 自分からCPUを手放した回数
+    uint32_t preempts;             // 割り込みで切り替えられた回数
+    uint32_t cpu;                  // 実行するCPU
+    volatile uint32_t on_cpu;      // スタックを使っている間は1（回収はこれが0になるのを待つ）
+    fpu_state_t fpu;               // FPU/SSEの状態
+};
+
+// CPUごとのスケジューラの状態（キャッシュラインを共有しないよう揃える）
+typedef struct {
+    spinlock_t lock;                        // ランキューとスレッドの状態のロック
+    uint32_t id;                            // CPUの番号
+    thread_t* current;                      // 実行中のスレッド
+    thread_t* idle;                         // アイドルスレッド
+    uint32_t bitmap;                        // 空でないキューのビット（ビットnが優先度n）
+    thread_t* head[THREAD_PRIORITIES];      // 優先度ごとのキューの先頭
+    thread_t* tail[THREAD_PRIORITIES];      // 末尾
+    uint32_t need_resched;                  // IRQの出口で切り替えるなら1
+    uint32_t preempt_count;                 // preempt_disableのネスト数
+    timer_list_t slice_timer;               // タイムスライスの終わりに割り込みを起こすタイマー
+    uint32_t slice_active;                  // slice_timerを張っているか
+    uint32_t slice_end;                     // タイムスライスが終わるティック
+    uint64_t switch_ns;                     // currentに切り替えた時刻
+    uint32_t switches;                      // コンテキストスイッチの回数
+    uint32_t nr_threads;                    // このCPUのスレッドの数（アイドルスレッドを除く）
+    thread_t* prev;                         // 切り替える前のスレッド（schedule_tailで使う）
+} __attribute__((aligned(CACHE_LINE_SIZE))) thread_cpu_t;
+
+// スタックの切り替え（thread_asm.asm、callee-savedレジスタを積んでespを入れ替える）
+extern void thread_switch_context(uint32_t* prev_esp, uint32_t next_esp);
+
+// CPUごとの状態
+static thread_cpu_t thread_cpus[MAX_CPUS];
+// 全スレッドのリスト（psと回収に使う）
+static thread_t* thread_list = NULL;
+// thread_listとスレッドの終了（joinerとDEAD）のロック（ランキューのロックより先に取る）
+static spinlock_t thread_list_lock = SPINLOCK_INIT;
+// 次に割り当てるスレッド番号
+static uint32_t next_thread_id = 0;
+// タイムスライス（ミリ秒）
+static uint32_t timeslice_ms = THREAD_TIMESLICE_MS;
+
+// 現在のCPUの状態
+static inline thread_cpu_t* this_cpu(void) {
+    return &thread_cpus[cpu_current()];
+}
+
+// ランキューの末尾に積む（割り込み禁止で呼ぶ）
+static void runqueue_push(thread_cpu_t* cpu, thread_t* thread) {
+    uint32_t priority = thread->priority;
+    thread->run_next = NULL;
+    if (cpu->tail[priority] != NULL) {
+        cpu->tail[priority]->run_next = thread;
+    } else {
+        cpu->head[priority] = thread;
+        cpu->bitmap |= 1u << priority;
+    }
+    cpu->tail[priority] = thread;
+}
+
+// 最も優先度の高いキューの先頭を取り出す（空ならNULL、割り込み禁止で呼ぶ）
+static thread_t* runqueue_pop(thread_cpu_t* cpu) {
+    if (cpu->bitmap == 0) {
+        return NULL;
+    }
+    uint32_t priority = __builtin_ctz(cpu->bitmap);
+    thread_t* thread = cpu->head[priority];
+    cpu->head[priority] = thread->run_next;
+    if (cpu->head[priority] == NULL) {
+        cpu->tail[priority] = NULL;
+        cpu->bitmap &= ~(1u << priority);
+    }
+    thread->run_next = NULL;
+    return thread;
+}
+
+// タイムスライスの終わり
+static void thread_slice_expired(void* data) {
+    thread_cpu_t* cpu = (thread_cpu_t*)data;
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    int expired = cpu->slice_active;
+    if (expired) {
+        cpu->need_resched = 1;
+    }
+    spin_unlock_irqrestore(&cpu->lock, flags);
+
+    // タイマーはBSPで実行されるので、他のCPUにはIPIで切り替えさせる
+    if (expired) {
+        smp_send_reschedule(cpu->id);
+    }
+}
+
+// 同じ優先度で待っているスレッドがあればタイムスライスを張り、なければ外す（ランキューのロックを持って呼ぶ）
+static void thread_update_slice(thread_cpu_t* cpu) {
+    thread_t* current = cpu->current;
+    if (current != cpu->idle && (cpu->bitmap & (1u << current->priority))) {
+        if (!cpu->slice_active) {
+            cpu->slice_end = timer_get_ticks() + TIMER_MS_TO_TICKS(timeslice_ms);
+            cpu->slice_active = 1;
+            mod_timer(&cpu->slice_timer, cpu->slice_end);
+        }
+    } else if (cpu->slice_active) {
+        cpu->slice_active = 0;
+        del_timer(&cpu->slice_timer);
+    }
+}
+
+// 切り替えた後に新しいスレッドの側で呼ぶ（ランキューのロックを放し、前のスレッドのスタックを手放す）
+static void schedule_tail(void) {
+    thread_cpu_t* cpu = this_cpu();
+    __atomic_store_n(&cpu->prev->on_cpu, 0, __ATOMIC_RELEASE);
+    spin_unlock(&cpu->lock);
+}
+
+// 次のスレッドに切り替える（割り込み禁止でランキューのロックを持って呼び、戻るときには放している）
+// currentが実行中のままならランキューに戻す
+static void schedule(thread_cpu_t* cpu, int preempted) {
+    smp_tlb_poll();
+
+    thread_t* prev = cpu->current;
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        if (prev != cpu->idle) {
+            runqueue_push(cpu, prev);
+        }
+    }
+
+    thread_t* next = runqueue_pop(cpu);
+    if (next == NULL) {
+        next = cpu->idle;
+    }
+    cpu->need_resched = 0;
+    next->state = THREAD_RUNNING;
+    if (next == prev) {
+        thread_update_slice(cpu);
+        spin_unlock(&cpu->lock);
+        return;
+    }
+
+    // 前のスレッドのCPU時間を締める
+    uint64_t now = clock_ns();
+    prev->runtime_ns += now - cpu->switch_ns;
+    cpu->switch_ns = now;
+    if (preempted) {
+        prev->preempts++;
+    } else {
+        prev->switches++;
+    }
+    cpu->switches++;
+
+    // 新しいスレッドのタイムスライスを張り直す
+    cpu->current = next;
+    if (cpu->slice_active) {
+        cpu->slice_active = 0;
+        del_timer(&cpu->slice_timer);
+    }
+    thread_update_slice(cpu);
+
+    // 後半処理の禁止数とFPUの状態はスレッドごとに持つ
+    prev->bh_count = local_bh_switch(next->bh_count);
+    fpu_switch(&next->fpu);
+    next->on_cpu = 1;
+    cpu->prev = prev;
+    TRACE_EVENT(TRACE_THREAD_SWITCH, next->id);
+    thread_switch_context(&prev->esp, next->esp);
+    schedule_tail();
+}
+
+// スレッドの構造体を確保して初期化（スタックは確保しない）
+static thread_t* thread_alloc(const char* name, uint32_t priority) {
+    thread_t* thread = (thread_t*)kmalloc_aligned(sizeof(thread_t), 16);
+    if (thread == NULL) {
+        return NULL;
+    }
+    memset(thread, 0, sizeof(*thread));
+
+    uint32_t length = strlen(name);
+    if (length >= THREAD_NAME_LEN) {
+        length = THREAD_NAME_LEN - 1;
+    }
+    memcpy(thread->name, name, length);
+    thread->priority = priority < THREAD_PRIORITIES ? priority : THREAD_PRIORITY_LOWEST;
+    thread->state = THREAD_READY;
+    fpu_state_init(&thread->fpu);
+
+    uint32_t flags = spin_lock_irqsave(&thread_list_lock);
+    thread->id = next_thread_id++;
+    thread->all_next = thread_list;
+    thread_list = thread;
+    spin_unlock_irqrestore(&thread_list_lock, flags);
+    return thread;
+}
+
+// 新しいスレッドの最初の命令（thread_switch_contextのretで入ってくる）
+static void thread_entry(void) {
+    schedule_tail();
+    thread_t* self = this_cpu()->current;
+    asm volatile("sti" : : : "memory");
+    self->fn(self->arg);
+    thread_exit();
+}
+
+// スタックを確保し、thread_switch_contextで切り替えるとthread_entryから始まるように積む
+static int thread_setup_stack(thread_t* thread) {
+    thread->stack = kmalloc_aligned(THREAD_STACK_SIZE, 16);
+    if (thread->stack == NULL) {
+        return -1;
+    }
+
+    uint32_t* sp = (uint32_t*)((uint8_t*)thread->stack + THREAD_STACK_SIZE);
+    *--sp = 0;                          // thread_entryの戻りアドレス（戻らない）
+    *--sp = (uint32_t)thread_entry;     // thread_switch_contextの戻りアドレス
+    *--sp = 0;                          // ebp
+    *--sp = 0;                          // ebx
+    *--sp = 0;                          // esi
+    *--sp = 0;                          // edi
+    thread->esp = (uint32_t)sp;
+    return 0;
+}
+
+// アイドルスレッド（実行できるスレッドがなければ後半処理を済ませてHLTで待つ）
+// 他のCPUがスレッドを積んだときはIPIで起こされる
+static void __attribute__((noreturn)) thread_idle(void* arg) {
+    thread_cpu_t* cpu = (thread_cpu_t*)arg;
+    while (1) {
+        softirq_idle();
+
+        asm volatile("cli" : : : "memory");
+        spin_lock(&cpu->lock);
+        if (cpu->bitmap != 0) {
+            schedule(cpu, 0);
+        } else {
+            spin_unlock(&cpu->lock);
+            if (!softirq_pending()) {
+                asm volatile("sti; hlt; cli" : : : "memory");
+            }
+        }
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+// 眠っていたスレッドの期限
+static void thread_sleep_expired(void* data) {
+    thread_wake((thread_t*)data);
+}
+
+// 起動時のコンテキストをmainスレッドにし、アイドルスレッドを作る
+void thread_init(void) {
+    thread_cpu_t* cpu = this_cpu();
+    cpu->id = cpu_current();
+    timer_setup(&cpu->slice_timer, thread_slice_expired, cpu);
+
+    thread_t* main = thread_alloc("main", THREAD_PRIORITY_DEFAULT);
+    thread_t* idle = thread_alloc("idle", THREAD_PRIORITY_LOWEST);
+    if (main == NULL || idle == NULL) {
+        return;
+    }
+    idle->fn = thread_idle;
+    idle->arg = cpu;
+    if (thread_setup_stack(idle) != 0) {
+        return;
+    }
+    timer_setup(&main->sleep_timer, thread_sleep_expired, main);
+
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    main->state = THREAD_RUNNING;
+    main->bh_count = 0;
+    main->on_cpu = 1;
+    cpu->idle = idle;
+    cpu->current = main;
+    cpu->nr_threads = 1;
+    cpu->switch_ns = clock_ns();
+    fpu_switch(&main->fpu);
+    spin_unlock_irqrestore(&cpu->lock, flags);
+}
+
+// APの起動時のコンテキストをそのCPUのアイドルスレッドにする（失敗すれば-1）
+int thread_init_ap(void) {
+    thread_cpu_t* cpu = this_cpu();
+    cpu->id = cpu_current();
+    timer_setup(&cpu->slice_timer, thread_slice_expired, cpu);
+
+    thread_t* idle = thread_alloc("idle", THREAD_PRIORITY_LOWEST);
+    if (idle == NULL) {
+        return -1;
+    }
+    idle->cpu = cpu->id;
+
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    idle->state = THREAD_RUNNING;
+    idle->on_cpu = 1;
+    cpu->idle = idle;
+    cpu->current = idle;
+    cpu->switch_ns = clock_ns();
+    fpu_switch(&idle->fpu);
+    spin_unlock_irqrestore(&cpu->lock, flags);
+    return 0;
+}
+
+// このCPUのアイドルループに入る
+void thread_idle_loop(void) {
+    thread_cpu_t* cpu = this_cpu();
+    if (cpu->idle == NULL) {
+        while (1) {
+            asm volatile("cli; hlt");
+        }
+    }
+    thread_idle(cpu);
+}
+
+// スレッドの最も少ないオンラインのCPUを選ぶ
+static uint32_t thread_pick_cpu(void) {
+    uint32_t online = smp_online_mask();
+    uint32_t best = cpu_current();
+    for (uint32_t id = 0; id < MAX_CPUS; id++) {
+        if ((online & (1u << id)) && thread_cpus[id].nr_threads < thread_cpus[best].nr_threads) {
+            best = id;
+        }
+    }
+    return best;
+}
+
+// スレッドを作って実行可能にする
+thread_t* thread_create(const char* name, void (*fn)(void* arg), void* arg, uint32_t priority) {
+    return thread_create_on(thread_pick_cpu(), name, fn, arg, priority);
+}
+
+// 指定したCPUで実行するスレッドを作る
+thread_t* thread_create_on(uint32_t cpu, const char* name, void (*fn)(void* arg), void* arg, uint32_t priority) {
+    if (this_cpu()->current == NULL || cpu >= MAX_CPUS || !(smp_online_mask() & (1u << cpu))) {
+        return NULL;
+    }
+
+    thread_t* thread = thread_alloc(name, priority);
+    if (thread == NULL) {
+        return NULL;
+    }
+    thread->fn = fn;
+    thread->arg = arg;
+    thread->cpu = cpu;
+    timer_setup(&thread->sleep_timer, thread_sleep_expired, thread);
+    if (thread_setup_stack(thread) != 0) {
+        // 一覧から外して返す
+        thread->state = THREAD_DEAD;
+        thread_join(thread);
+        return NULL;
+    }
+
+    __atomic_add_fetch(&thread_cpus[thread->cpu].nr_threads, 1, __ATOMIC_RELAXED);
+    thread->state = THREAD_BLOCKED;
+    thread_wake(thread);
+    return thread;
+}
+
+// 同じ優先度の次のスレッドにCPUを譲る
+void thread_yield(void) {
+    thread_cpu_t* cpu = this_cpu();
+    if (cpu->current == NULL) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    schedule(cpu, 0);
+    irq_restore(flags);
+}
+
+// 指定したミリ秒眠る
+void thread_sleep(uint32_t ms) {
+    thread_cpu_t* cpu = this_cpu();
+    if (cpu->current == NULL || cpu->current == cpu->idle) {
+        timer_sleep(ms);
+        return;
+    }
+
+    // 今のティックの残りが短くても指定した時間は眠るよう1ティック足す
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    thread_t* self = cpu->current;
+    self->state = THREAD_SLEEPING;
+    mod_timer(&self->sleep_timer, timer_get_ticks() + TIMER_MS_TO_TICKS(ms) + 1);
+    schedule(cpu, 0);
+    irq_restore(flags);
+}
+
+// スレッドの終了を待って回収する
+void thread_join(thread_t* thread) {
+    thread_cpu_t* cpu = this_cpu();
+    if (thread == NULL || thread == cpu->current || thread == cpu->idle) {
+        return;
+    }
+
+    // joinerの設定とDEADの確認はthread_exitとthread_list_lockで排他する
+    uint32_t flags = spin_lock_irqsave(&thread_list_lock);
+    while (thread->state != THREAD_DEAD) {
+        thread->joiner = cpu->current;
+        thread_prepare_block();
+        spin_unlock(&thread_list_lock);
+        thread_block();
+        spin_lock(&thread_list_lock);
+    }
+
+    // 全スレッドのリストから外す
+    thread_t** link = &thread_list;
+    while (*link != NULL && *link != thread) {
+        link = &(*link)->all_next;
+    }
+    if (*link != NULL) {
+        *link = thread->all_next;
+    }
+    spin_unlock_irqrestore(&thread_list_lock, flags);
+
+    // 他のCPUで終了したスレッドがまだ自分のスタックの上にいれば切り替え終わるのを待つ
+    while (__atomic_load_n(&thread->on_cpu, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+    kfree(thread->stack);
+    kfree(thread);
+}
+
+// 実行中のスレッドを終了する
+void thread_exit(void) {
+    thread_cpu_t* cpu = this_cpu();
+    asm volatile("cli" : : : "memory");
+
+    thread_t* self = cpu->current;
+    fpu_release(&self->fpu);
+    __atomic_sub_fetch(&cpu->nr_threads, 1, __ATOMIC_RELAXED);
+
+    spin_lock(&thread_list_lock);
+    self->state = THREAD_DEAD;
+    thread_t* joiner = self->joiner;
+    spin_unlock(&thread_list_lock);
+    if (joiner != NULL) {
+        thread_wake(joiner);
+    }
+
+    spin_lock(&cpu->lock);
+    schedule(cpu, 0);
+
+    // DEADのスレッドには戻ってこない
+    while (1) {
+        asm volatile("hlt");
+    }
+}
+
+// 実行中のスレッド
+thread_t* thread_current(void) {
+    return this_cpu()->current;
+}
+
+// 実行中のスレッドを止まる状態にする（この後で待つ条件を確かめ、まだならthread_blockを呼ぶ）
+void thread_prepare_block(void) {
+    thread_cpu_t* cpu = this_cpu();
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    cpu->current->state = THREAD_BLOCKED;
+    spin_unlock_irqrestore(&cpu->lock, flags);
+}
+
+// thread_prepare_blockの後に起こされていなければ起こされるまで止める
+void thread_block(void) {
+    thread_cpu_t* cpu = this_cpu();
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    if (cpu->current->state == THREAD_BLOCKED) {
+        schedule(cpu, 0);
+    } else {
+        spin_unlock(&cpu->lock);
+    }
+    irq_restore(flags);
+}
+
+// thread_prepare_blockの後、待つ条件が満たされていて止まらないときに呼ぶ
+void thread_finish_block(void) {
+    thread_cpu_t* cpu = this_cpu();
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    if (cpu->current->state == THREAD_BLOCKED) {
+        cpu->current->state = THREAD_RUNNING;
+    }
+    spin_unlock_irqrestore(&cpu->lock, flags);
+}
+
+// 眠っている/止まっているスレッドを実行可能にする
+void thread_wake(thread_t* thread) {
+    thread_cpu_t* cpu = &thread_cpus[thread->cpu];
+    int kick = 0;
+
+    uint32_t flags = spin_lock_irqsave(&cpu->lock);
+    if (thread->state == THREAD_SLEEPING || thread->state == THREAD_BLOCKED) {
+        del_timer(&thread->sleep_timer);
+        thread_t* current = cpu->current;
+        if (thread == current) {
+            // thread_prepare_blockの後、thread_blockで止まる前に起こされた
+            thread->state = THREAD_RUNNING;
+        } else {
+            thread->state = THREAD_READY;
+            runqueue_push(cpu, thread);
+
+            // 優先度が高ければすぐに、同じならタイムスライスが切れたら切り替える
+            if (current == cpu->idle || thread->priority < current->priority) {
+                cpu->need_resched = 1;
+                kick = 1;
+            } else {
+                thread_update_slice(cpu);
+            }
+        }
+    }
+    spin_unlock(&cpu->lock);
+
+    // 他のCPUのスレッドならIPIで切り替えさせる
+    if (kick) {
+        smp_send_reschedule(cpu->id);
+    }
+    irq_restore(flags);
+}
+
+// タイムスライスの長さ（ミリ秒）を設定
+void thread_set_timeslice(uint32_t ms) {
+    timeslice_ms = ms != 0 ? ms : 1;
+}
+
+// タイムスライスの長さ（ミリ秒）
+uint32_t thread_timeslice(void) {
+    return timeslice_ms;
+}
+
+// プリエンプションを禁止
+void preempt_disable(void) {
+    this_cpu()->preempt_count++;
+}
+
+// プリエンプションを許可（切り替えは次のIRQの出口かthread_yieldで行う）
+void preempt_enable(void) {
+    this_cpu()->preempt_count--;
+}
+
+// 最も外側のIRQの出口で呼ばれる（割り込みゲートの中なのでIFは0）
+void thread_preempt(void) {
+    thread_cpu_t* cpu = this_cpu();
+    if (cpu->current == NULL || cpu->preempt_count != 0) {
+        return;
+    }
+
+    // 後半処理が禁止されていてスライスのタイマーが実行されていなくても期限で判断する
+    spin_lock(&cpu->lock);
+    if (cpu->slice_active && !time_before(timer_get_ticks(), cpu->slice_end)) {
+        cpu->need_resched = 1;
+    }
+    if (cpu->need_resched) {
+        schedule(cpu, 1);
+    } else {
+        spin_unlock(&cpu->lock);
+    }
+}
+
+// 状態の表示名
+static const char* thread_state_name(thread_state_t state) {
+    switch (state) {
+    case THREAD_READY:    return "ready";
+    case THREAD_RUNNING:  return "running";
+    case THREAD_SLEEPING: return "sleeping";
+    case THREAD_BLOCKED:  return "blocked";
+    default:              return "dead";
+    }
+}
+
+// thread_showが1回に表示するスレッドの数（スタックに写しを置く）
+#define THREAD_SHOW_MAX 32
+
+// thread_showがロックを持つ間に写しておくスレッドの情報
+typedef struct {
+    uint32_t id;
+    uint32_t cpu;
+    char name[THREAD_NAME_LEN];
+    uint32_t priority;
+    thread_state_t state;
+    uint32_t runtime_ms;
+    uint32_t switches;
+    uint32_t preempts;
+} thread_snapshot_t;
+
+// スレッドの一覧を表示
+void thread_show(void) {
+    uint8_t grey = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    uint8_t green = vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+
+    uint32_t switches = 0;
+    for (uint32_t id = 0; id < MAX_CPUS; id++) {
+        switches += thread_cpus[id].switches;
+    }
+
+    // 表示は画面のロックと描き直しを待つので、ロックを持つ間は写すだけにする
+    thread_snapshot_t snapshots[THREAD_SHOW_MAX];
+    uint32_t count = 0;
+    uint32_t total = 0;
+    uint32_t flags = spin_lock_irqsave(&thread_list_lock);
+    for (thread_t* thread = thread_list; thread != NULL; thread = thread->all_next, total++) {
+        if (count == THREAD_SHOW_MAX) {
+            continue;
+        }
+
+        // 実行中のスレッドは今のスライスの分も足す
+        thread_cpu_t* cpu = &thread_cpus[thread->cpu];
+        uint64_t runtime = thread->runtime_ns;
+        if (thread == cpu->current) {
+            runtime += clock_ns() - cpu->switch_ns;
+        }
+
+        thread_snapshot_t* snapshot = &snapshots[count++];
+        snapshot->id = thread->id;
+        snapshot->cpu = thread->cpu;
+        memcpy(snapshot->name, thread->name, THREAD_NAME_LEN);
+        snapshot->priority = thread->priority;
+        snapshot->state = thread->state;
+        snapshot->runtime_ms = div64_32(runtime, 1000000);
+        snapshot->switches = thread->switches;
+        snapshot->preempts = thread->preempts;
+    }
+    spin_unlock_irqrestore(&thread_list_lock, flags);
+
+    kprintf("%CThreads (timeslice %u ms, context switches %u):\n"
+            "%C   id cpu name             pri state     cpu(ms)  yields preempts\n",
+            vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), timeslice_ms, switches, grey);
+    for (uint32_t i = 0; i < count; i++) {
+        thread_snapshot_t* snapshot = &snapshots[i];
+        kprintf("%C%5u%C%4u %-*s%3u %-8s%C%9u%8u%9u\n",
+                green, snapshot->id, grey, snapshot->cpu, THREAD_NAME_LEN + 1, snapshot->name,
+                snapshot->priority, thread_state_name(snapshot->state),
+                green, snapshot->runtime_ms, snapshot->switches, snapshot->preempts);
+    }
+    if (total > count) {
+        kprintf("%C  (%u more threads)\n", grey, total - count);
+    }
+}
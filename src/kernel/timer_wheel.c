@@ -0,0 +1,301 @@
+// timer_wheel.c - 階層タイマーホイール
+// 近い期限（256ティック以内）は1ティック単位のルートに置き、遠い期限は64スロットずつの外側の段に置く。
+// 外側の段のスロットはルートが一周するたびに1つずつ内側に下ろす（カスケード）。
+// 登録・削除はリストの付け替えだけでO(1)、次の期限は各段の占有ビットマップから求める。
+#include "../include/timer.h"
+#include "../include/interrupt.h"
+#include "../include/spinlock.h"
+#include "../include/stddef.h"
+
+// ルート（1ティック単位、256スロット）
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_ROOT_SIZE (1u << WHEEL_ROOT_BITS)
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+// 外側の段（64スロットずつ、4段で32ビットのティックを覆う）
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVEL_SIZE (1u << WHEEL_LEVEL_BITS)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+// 外側の段のスロット1つが覆うティック数の対数
+#define WHEEL_LEVEL_SHIFT(level) (WHEEL_ROOT_BITS + (level) * WHEEL_LEVEL_BITS)
+
+// スロットの先頭と、空でないスロットのビットマップ
+static timer_list_t* wheel_root[WHEEL_ROOT_SIZE];
+static uint32_t wheel_root_map[WHEEL_ROOT_SIZE / 32];
+static timer_list_t* wheel_levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+static uint32_t wheel_level_map[WHEEL_LEVELS][WHEEL_LEVEL_SIZE / 32];
+// 次に処理するティック（これより前の期限のタイマーは実行済み）
+static uint32_t wheel_clock = 0;
+// 登録されているタイマーの数
+static uint32_t wheel_count = 0;
+// PITにプログラムしている期限（armedが0なら止まっている）
+static int wheel_armed = 0;
+static uint32_t wheel_armed_expires = 0;
+// ホイールのロック（コールバックを呼ぶ間は放す、この中でtimer.cのロックを取る）
+static spinlock_t wheel_lock = SPINLOCK_INIT;
+
+// ビットマップのstart以上end未満で最初に立っているビット（なければ-1）
+static int bitmap_find(const uint32_t* map, uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t word = map[start >> 5] >> (start & 31);
+        if (word != 0) {
+            uint32_t bit = start + __builtin_ctz(word);
+            return bit < end ? (int)bit : -1;
+        }
+        start = (start | 31) + 1;
+    }
+    return -1;
+}
+
+// タイマーをスロットに入れる
+static void wheel_enqueue(timer_list_t* timer) {
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel_clock;
+    timer_list_t** slot;
+    uint32_t* map;
+    uint32_t index;
+
+    // 既に期限を過ぎていれば今のスロットで実行する
+    if ((int32_t)delta < 0) {
+        expires = wheel_clock;
+        delta = 0;
+    }
+
+    if (delta < WHEEL_ROOT_SIZE) {
+        index = expires & WHEEL_ROOT_MASK;
+        slot = &wheel_root[index];
+        map = wheel_root_map;
+    } else {
+        uint32_t level = 0;
+        while (level < WHEEL_LEVELS - 1 && (delta >> WHEEL_LEVEL_SHIFT(level + 1)) != 0) {
+            level++;
+        }
+        index = (expires >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_LEVEL_MASK;
+        slot = &wheel_levels[level][index];
+        map = wheel_level_map[level];
+    }
+
+    timer->next = *slot;
+    if (timer->next != NULL) {
+        timer->next->pprev = &timer->next;
+    }
+    *slot = timer;
+    timer->pprev = slot;
+    map[index >> 5] |= 1u << (index & 31);
+}
+
+// タイマーをスロットから外す（スロットが空になればビットを下ろす）
+static void wheel_dequeue(timer_list_t* timer) {
+    timer_list_t** pprev = timer->pprev;
+    *pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = pprev;
+    } else if (pprev >= wheel_root && pprev < wheel_root + WHEEL_ROOT_SIZE) {
+        // スロットの先頭にいた最後のタイマーが外れて空になった
+        uint32_t index = pprev - wheel_root;
+        wheel_root_map[index >> 5] &= ~(1u << (index & 31));
+    } else if (pprev >= &wheel_levels[0][0] && pprev < &wheel_levels[0][0] + WHEEL_LEVELS * WHEEL_LEVEL_SIZE) {
+        uint32_t n = pprev - &wheel_levels[0][0];
+        uint32_t level = n / WHEEL_LEVEL_SIZE;
+        uint32_t index = n % WHEEL_LEVEL_SIZE;
+        wheel_level_map[level][index >> 5] &= ~(1u << (index & 31));
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// 外側の段のスロットを内側に下ろす
+static void wheel_cascade(uint32_t level, uint32_t index) {
+    timer_list_t* list = wheel_levels[level][index];
+    wheel_levels[level][index] = NULL;
+    wheel_level_map[level][index >> 5] &= ~(1u << (index & 31));
+
+    while (list != NULL) {
+        timer_list_t* next = list->next;
+        wheel_enqueue(list);
+        list = next;
+    }
+}
+
+// 次に処理が必要なティック（ルートは正確な期限、外側の段はカスケードする時刻）
+static int wheel_next_event(uint32_t* next) {
+    if (wheel_count == 0) {
+        return 0;
+    }
+
+    // ちょうど境目でまだ下ろしていないスロットがあれば、今すぐ処理が必要
+    uint32_t index = wheel_clock & WHEEL_ROOT_MASK;
+    if (index == 0) {
+        for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+            uint32_t slot = (wheel_clock >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_LEVEL_MASK;
+            if (wheel_level_map[level][slot >> 5] & (1u << (slot & 31))) {
+                *next = wheel_clock;
+                return 1;
+            }
+            if (slot != 0) {
+                break;
+            }
+        }
+    }
+
+    // ルートの今の位置から後ろは今周の期限
+    int found = bitmap_find(wheel_root_map, index, WHEEL_ROOT_SIZE);
+    if (found >= 0) {
+        *next = wheel_clock + (found - index);
+        return 1;
+    }
+
+    // ルートの前半は次の周の期限（カスケードより後にはならない）
+    uint32_t best = wheel_clock + (WHEEL_ROOT_SIZE - index);
+    int have = 0;
+    found = bitmap_find(wheel_root_map, 0, index);
+    if (found >= 0) {
+        best += found;
+        have = 1;
+    }
+
+    // 外側の段: 空でない最初のスロットをカスケードする時刻（今のスロットは一周後）
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        uint32_t shift = WHEEL_LEVEL_SHIFT(level);
+        uint32_t current = (wheel_clock >> shift) & WHEEL_LEVEL_MASK;
+        const uint32_t* map = wheel_level_map[level];
+        found = bitmap_find(map, current + 1, WHEEL_LEVEL_SIZE);
+        if (found < 0) {
+            found = bitmap_find(map, 0, current + 1);
+        }
+        if (found < 0) {
+            continue;
+        }
+
+        uint32_t distance = ((uint32_t)found - current) & WHEEL_LEVEL_MASK;
+        if (distance == 0) {
+            distance = WHEEL_LEVEL_SIZE;
+        }
+        uint32_t when = ((wheel_clock >> shift) + distance) << shift;
+        if (!have || time_before(when, best)) {
+            best = when;
+            have = 1;
+        }
+    }
+
+    *next = best;
+    return have;
+}
+
+// 次の期限でPITをプログラムする（なければ止める）
+static void wheel_rearm(void) {
+    uint32_t next;
+    if (wheel_next_event(&next)) {
+        wheel_armed = 1;
+        wheel_armed_expires = next;
+        timer_program(next);
+    } else if (wheel_armed) {
+        wheel_armed = 0;
+        timer_stop();
+    }
+}
+
+// タイマーを初期化
+void timer_setup(timer_list_t* timer, void (*fn)(void* data), void* data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->data = data;
+}
+
+// 割り込み禁止で登録し、プログラム済みの期限より早ければPITをプログラムし直す
+static void wheel_add(timer_list_t* timer) {
+    wheel_enqueue(timer);
+    wheel_count++;
+    if (!wheel_armed || time_before(timer->expires, wheel_armed_expires)) {
+        wheel_armed = 1;
+        wheel_armed_expires = timer->expires;
+        timer_program(timer->expires);
+    }
+}
+
+// タイマーを登録
+void add_timer(timer_list_t* timer) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    if (!timer_pending(timer)) {
+        wheel_add(timer);
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+// 登録を取り消す（PITはそのままにし、空振りの割り込みで次の期限に直す）
+int del_timer(timer_list_t* timer) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    int pending = timer_pending(timer);
+    if (pending) {
+        wheel_dequeue(timer);
+        wheel_count--;
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    return pending;
+}
+
+// 期限を変えて登録し直す
+int mod_timer(timer_list_t* timer, uint32_t expires) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    int pending = timer_pending(timer);
+    if (pending) {
+        wheel_dequeue(timer);
+        wheel_count--;
+    }
+    timer->expires = expires;
+    wheel_add(timer);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    return pending;
+}
+
+// 登録されているタイマーの数
+uint32_t timer_pending_count(void) {
+    return wheel_count;
+}
+
+// 期限を過ぎたタイマーを実行して次の期限をプログラムする
+void timer_wheel_run(void) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    uint32_t now = timer_get_ticks();
+
+    while (!time_after(wheel_clock, now)) {
+        uint32_t index = wheel_clock & WHEEL_ROOT_MASK;
+
+        // ルートが一周したら外側の段を1スロットずつ下ろす
+        if (index == 0) {
+            for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+                uint32_t slot = (wheel_clock >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_LEVEL_MASK;
+                wheel_cascade(level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+
+        // このティックのタイマーを割り込みを戻して実行（関数の中から登録し直してよい）
+        while (wheel_root[index] != NULL) {
+            timer_list_t* timer = wheel_root[index];
+            wheel_dequeue(timer);
+            wheel_count--;
+
+            spin_unlock_irqrestore(&wheel_lock, flags);
+            timer->fn(timer->data);
+            flags = spin_lock_irqsave(&wheel_lock);
+        }
+
+        // 空のスロットは飛ばす（次のタイマーかルートの一周の境目、ただし今のティックまで）
+        int found = bitmap_find(wheel_root_map, index + 1, WHEEL_ROOT_SIZE);
+        uint32_t step = found >= 0 ? (uint32_t)found - index : WHEEL_ROOT_SIZE - index;
+        if (time_after(wheel_clock + step, now + 1)) {
+            wheel_clock = now + 1;
+        } else {
+            wheel_clock += step;
+        }
+    }
+
+    wheel_rearm();
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
@@ -0,0 +1,214 @@
+// trace.c - 静的トレースポイントとCPUごとのトレースバッファの実装
+// バッファはCPUごとのレコードの配列で、書くのはそのCPU（とそのCPUの割り込み）だけなのでロックはいらない。
+// 一杯になれば古いレコードから上書きし、最後のTRACE_RECORDS件を残す（フライトレコーダー）。
+// バッファはvm_reserveで予約し、物理メモリは書いたページの分だけ初回のページフォルトで割り当てる。
+//
+// trace_dumpの出力（リトルエンディアン）:
+//   "MYOSTRC1"                  印（8バイト）
+//   uint32 ticks_per_ms         タイムスタンプの1ミリ秒あたりの値
+//   uint32 cpu_count            CPUの数
+//   uint32 event_count          イベントの種類の数
+//   event_count回: uint8 phase, uint8 name_length, name[name_length]
+//                               phaseはChromeのトレースの種類（'B'開始、'E'終了、'i'瞬間）
+//   cpu_count回:   uint32 cpu, uint32 count, uint32 lost, trace_record_t[count]（古い順）
+//   "MYOSTRCE"                  終わりの印（8バイト）
+//   uint32 length               始めの印の後から終わりの印の前までのバイト数
+//   uint32 checksum             同じ範囲のFNV-1a（32ビット）
+// 送っている間はCOM1の他の書き手（コンソールのエコーやログ）を締め出し、バイト列に混ざらないようにする。
+#include "../include/trace.h"
+#include "../include/clock.h"
+#include "../include/cpu.h"
+#include "../include/memory.h"
+#include "../include/paging.h"
+#include "../include/serial.h"
+#include "../include/smp.h"
+#include "../include/string.h"
+
+// CPUごとのバッファ（キャッシュラインを共有しないよう揃える）
+typedef struct {
+    trace_record_t* records;    // TRACE_RECORDS件
+    volatile uint32_t head;     // 次に書くレコードの番号（一周させずに増やし続けてマスクで引く）
+    volatile uint32_t busy;     // trace_recordの途中なら1
+    volatile uint32_t dropped;  // trace_recordの途中に割り込まれて捨てたレコード数
+} __attribute__((aligned(CACHE_LINE_SIZE))) trace_cpu_t;
+
+// イベントの名前と種類
+typedef struct {
+    const char* name;
+    char phase;
+} trace_event_info_t;
+
+// イベントの表（trace_event_tの順）
+static const trace_event_info_t trace_events[TRACE_EVENT_COUNT] = {
+    [TRACE_IRQ_ENTRY]     = { "irq", 'B' },
+    [TRACE_IRQ_EXIT]      = { "irq", 'E' },
+    [TRACE_TASKLET_ENTRY] = { "tasklet", 'B' },
+    [TRACE_TASKLET_EXIT]  = { "tasklet", 'E' },
+    [TRACE_THREAD_SWITCH] = { "thread_switch", 'i' },
+    [TRACE_KEY_INPUT]     = { "key", 'i' },
+    [TRACE_SERIAL_RX]     = { "serial_rx", 'i' },
+    [TRACE_COMMAND_BEGIN] = { "command", 'B' },
+    [TRACE_COMMAND_END]   = { "command", 'E' },
+};
+
+// 記録中なら0以外
+volatile uint32_t trace_enabled = 0;
+// CPUごとのバッファ
+static trace_cpu_t trace_cpus[MAX_CPUS];
+// バッファを用意したCPUの数
+static uint32_t trace_cpu_count = 0;
+// タイムスタンプにTSCを使うか（使えなければclock_nsのナノ秒）
+static int trace_use_tsc = 0;
+
+// レコードを現在のCPUのバッファに書く
+void trace_record(uint32_t event, uint32_t arg) {
+    uint32_t cpu = cpu_current();
+    if (cpu >= trace_cpu_count) {
+        return;
+    }
+    trace_cpu_t* tc = &trace_cpus[cpu];
+
+    // まだ触っていないページに書くとページフォルトになり、その入口のトレースポイントがまた
+    // 同じページに書いてフォルトし続けるので、書いている途中に入ってきたレコードは捨てる
+    if (tc->busy) {
+        tc->dropped++;
+        return;
+    }
+    tc->busy = 1;
+    asm volatile("" : : : "memory");
+
+    // 割り込めるのは同じCPUの割り込みだけなので、lockなしのxaddで番号を取れば重ならない
+    uint32_t index = 1;
+    asm volatile("xaddl %0, %1" : "+r" (index), "+m" (tc->head) : : "memory");
+
+    trace_record_t* record = &tc->records[index & (TRACE_RECORDS - 1)];
+    record->timestamp = trace_use_tsc ? rdtsc() : clock_ns();
+    record->event = event;
+    record->arg = arg;
+
+    asm volatile("" : : : "memory");
+    tc->busy = 0;
+}
+
+// バッファを空にして記録を始める
+int trace_start(void) {
+    trace_enabled = 0;
+
+    // 初回だけ、起動しているCPUの数だけバッファを確保する
+    if (trace_cpu_count == 0) {
+        uint32_t count = smp_cpu_count();
+        if (count == 0) {
+            count = 1;
+        }
+        if (count > MAX_CPUS) {
+            count = MAX_CPUS;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            trace_cpus[i].records = (trace_record_t*)vm_reserve(TRACE_RECORDS * sizeof(trace_record_t));
+            if (trace_cpus[i].records == NULL) {
+                for (uint32_t j = 0; j < i; j++) {
+                    vm_release(trace_cpus[j].records);
+                    trace_cpus[j].records = NULL;
+                }
+                return -1;
+            }
+        }
+        trace_cpu_count = count;
+    }
+
+    for (uint32_t i = 0; i < trace_cpu_count; i++) {
+        trace_cpus[i].head = 0;
+        trace_cpus[i].dropped = 0;
+    }
+    trace_use_tsc = clock_tsc_khz() != 0;
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 記録を止める
+void trace_stop(void) {
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+// FNV-1aの初期値と素数
+#define TRACE_FNV_OFFSET 2166136261u
+#define TRACE_FNV_PRIME  16777619u
+
+// 送ったバイト数とチェックサム（trace_dumpの間だけ使う）
+static uint32_t trace_dump_length;
+static uint32_t trace_dump_checksum;
+
+// バイト列を送り、長さとチェックサムに足す
+static void trace_send(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (uint32_t i = 0; i < length; i++) {
+        trace_dump_checksum = (trace_dump_checksum ^ bytes[i]) * TRACE_FNV_PRIME;
+    }
+    trace_dump_length += length;
+    serial_write_claimed(SERIAL_COM1, (const char*)data, length);
+}
+
+// 32ビットの値をリトルエンディアンで送る
+static void trace_send_u32(uint32_t value) {
+    trace_send(&value, sizeof(value));
+}
+
+// 記録を止め、バッファの中身をCOM1に送る
+void trace_dump(void) {
+    trace_stop();
+
+    serial_claim(SERIAL_COM1);
+    serial_write_claimed(SERIAL_COM1, TRACE_MAGIC, 8);
+    trace_dump_length = 0;
+    trace_dump_checksum = TRACE_FNV_OFFSET;
+    trace_send_u32(trace_use_tsc ? clock_tsc_khz() : 1000000);
+    trace_send_u32(trace_cpu_count);
+    trace_send_u32(TRACE_EVENT_COUNT);
+    for (uint32_t i = 0; i < TRACE_EVENT_COUNT; i++) {
+        uint8_t header[2] = { (uint8_t)trace_events[i].phase, (uint8_t)strlen(trace_events[i].name) };
+        trace_send(header, sizeof(header));
+        trace_send(trace_events[i].name, header[1]);
+    }
+
+    // 一周していれば古い方（headの位置）から、していなければ先頭から送る
+    for (uint32_t cpu = 0; cpu < trace_cpu_count; cpu++) {
+        trace_cpu_t* tc = &trace_cpus[cpu];
+        uint32_t head = tc->head;
+        uint32_t count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+        uint32_t first = head < TRACE_RECORDS ? 0 : head & (TRACE_RECORDS - 1);
+
+        trace_send_u32(cpu);
+        trace_send_u32(count);
+        trace_send_u32(head - count + tc->dropped);
+        uint32_t tail = TRACE_RECORDS - first < count ? TRACE_RECORDS - first : count;
+        trace_send(&tc->records[first], tail * sizeof(trace_record_t));
+        trace_send(tc->records, (count - tail) * sizeof(trace_record_t));
+    }
+
+    // 終わりの印と長さ、チェックサム（長さとチェックサム自身は含めない）
+    uint32_t trailer[2] = { trace_dump_length, trace_dump_checksum };
+    serial_write_claimed(SERIAL_COM1, TRACE_END_MAGIC, 8);
+    serial_write_claimed(SERIAL_COM1, (const char*)trailer, sizeof(trailer));
+    serial_flush(SERIAL_COM1);
+    serial_release(SERIAL_COM1);
+}
+
+// 記録したレコード数
+uint32_t trace_count(void) {
+    uint32_t total = 0;
+    for (uint32_t cpu = 0; cpu < trace_cpu_count; cpu++) {
+        uint32_t head = trace_cpus[cpu].head;
+        total += head < TRACE_RECORDS ? head : TRACE_RECORDS;
+    }
+    return total;
+}
+
+// 上書きと、書いている途中に割り込まれて失ったレコード数
+uint32_t trace_lost(void) {
+    uint32_t total = 0;
+    for (uint32_t cpu = 0; cpu < trace_cpu_count; cpu++) {
+        uint32_t head = trace_cpus[cpu].head;
+        total += (head < TRACE_RECORDS ? 0 : head - TRACE_RECORDS) + trace_cpus[cpu].dropped;
+    }
+    return total;
+}
@@ -0,0 +1,57 @@
+// wait.c - 待ち行列の実装
+// wake_upは待っているスレッドを行列から外してから起こす。起こされたスレッドは条件を確かめ直し、
+// まだならprepare_to_waitで入り直す。ロックは待ち行列→ランキューの順に取る。
+#include "../include/wait.h"
+#include "../include/stddef.h"
+
+// 待ち行列を初期化
+void wait_queue_init(wait_queue_t* queue) {
+    spin_lock_init(&queue->lock);
+    queue->head = NULL;
+}
+
+// 実行中のスレッドを待ち行列に入れて止まる状態にする
+void prepare_to_wait(wait_queue_t* queue, wait_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    if (!entry->queued) {
+        entry->thread = thread_current();
+        entry->next = queue->head;
+        entry->queued = 1;
+        queue->head = entry;
+    }
+    thread_prepare_block();
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+// 待ち終わったら呼ぶ
+void finish_wait(wait_queue_t* queue, wait_entry_t* entry) {
+    thread_finish_block();
+
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    if (entry->queued) {
+        wait_entry_t** link = &queue->head;
+        while (*link != NULL && *link != entry) {
+            link = &(*link)->next;
+        }
+        if (*link != NULL) {
+            *link = entry->next;
+        }
+        entry->queued = 0;
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+// 待っているスレッドを全部起こす
+void wake_up(wait_queue_t* queue) {
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    wait_entry_t* entry = queue->head;
+    queue->head = NULL;
+    while (entry != NULL) {
+        // 待つ側はfinish_waitでこのロックを取るまでentryを手放さない
+        wait_entry_t* next = entry->next;
+        entry->queued = 0;
+        thread_wake(entry->thread);
+        entry = next;
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+# trace2json.py - `trace dump`がCOM1に送ったトレースをChromeのトレースJSONに変換する
+#
+# 使い方:
+#   qemu-system-i386 ... -serial file:com1.log   # シェルで trace start → ... → trace dump
+#   python3 tools/trace2json.py com1.log > trace.json
+#   chrome://tracing か https://ui.perfetto.dev で trace.json を開く
+#
+# 入力の形式はsrc/kernel/trace.cの先頭を参照。入力のうち印より前（起動時の文字など）は読み飛ばす。
+# 終わりの印と長さ、チェックサムが合わなければ（途中で他の出力が混ざった、欠けたなど）変換せずに失敗する。
+
+import json
+import struct
+import sys
+
+MAGIC = b"MYOSTRC1"
+END_MAGIC = b"MYOSTRCE"
+RECORD = struct.Struct("<QII")  # timestamp, event, arg
+
+
+class Reader:
+    """バイト列を先頭から読む"""
+
+    def __init__(self, data, offset):
+        self.data = data
+        self.offset = offset
+
+    def take(self, size):
+        if self.offset + size > len(self.data):
+            raise ValueError("trace is truncated")
+        chunk = self.data[self.offset:self.offset + size]
+        self.offset += size
+        return chunk
+
+    def u8(self):
+        return self.take(1)[0]
+
+    def u32(self):
+        return struct.unpack("<I", self.take(4))[0]
+
+
+def fnv1a(data):
+    """FNV-1a（32ビット）"""
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def check_trailer(reader, start):
+    """終わりの印と長さ、チェックサムを確かめる"""
+    payload = reader.data[start:reader.offset]
+    if reader.take(len(END_MAGIC)) != END_MAGIC:
+        raise ValueError("trace is corrupted (missing %r after the records)" % END_MAGIC.decode())
+    length = reader.u32()
+    checksum = reader.u32()
+    if length != len(payload):
+        raise ValueError("trace is corrupted (length %d, expected %d)" % (len(payload), length))
+    if checksum != fnv1a(payload):
+        raise ValueError("trace is corrupted (checksum 0x%08x, expected 0x%08x)" % (fnv1a(payload), checksum))
+
+
+def decode(data):
+    """最後のトレースを読み、ChromeのトレースJSONのオブジェクトを返す"""
+    start = data.rfind(MAGIC)
+    if start < 0:
+        raise ValueError("no trace found (missing %r)" % MAGIC.decode())
+    start += len(MAGIC)
+    reader = Reader(data, start)
+
+    ticks_per_ms = reader.u32()
+    cpu_count = reader.u32()
+    event_count = reader.u32()
+    events = []
+    for _ in range(event_count):
+        phase = chr(reader.u8())
+        name = reader.take(reader.u8()).decode("ascii", "replace")
+        events.append((name, phase))
+
+    records = []
+    metadata = []
+    for _ in range(cpu_count):
+        cpu = reader.u32()
+        count = reader.u32()
+        lost = reader.u32()
+        for _ in range(count):
+            records.append((cpu,) + RECORD.unpack(reader.take(RECORD.size)))
+        metadata.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": cpu,
+                         "args": {"name": "CPU %d (%d lost)" % (cpu, lost) if lost else "CPU %d" % cpu}})
+    check_trailer(reader, start)
+
+    # 時刻は全CPUで最も古いレコードを0としたマイクロ秒
+    base = min((r[1] for r in records), default=0)
+    trace_events = list(metadata)
+    for cpu, timestamp, event, arg in sorted(records, key=lambda r: r[1]):
+        if event < len(events):
+            name, phase = events[event]
+        else:
+            name, phase = "event%d" % event, "i"
+        entry = {
+            "name": name,
+            "ph": phase,
+            "ts": (timestamp - base) * 1000.0 / ticks_per_ms,
+            "pid": 0,
+            "tid": cpu,
+            "args": {"arg": arg},
+        }
+        if phase == "i":
+            entry["s"] = "t"
+        trace_events.append(entry)
+
+    return {"traceEvents": trace_events, "displayTimeUnit": "ns"}
+
+
+def main(argv):
+    if len(argv) > 2:
+        sys.stderr.write("usage: %s [capture]\n" % argv[0])
+        return 2
+    if len(argv) == 2:
+        with open(argv[1], "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    try:
+        trace = decode(data)
+    except ValueError as e:
+        sys.stderr.write("%s: %s\n" % (argv[0], e))
+        return 1
+    json.dump(trace, sys.stdout)
+    sys.stdout.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))